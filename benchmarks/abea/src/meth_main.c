@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include "logsum.h"
+#include "roi.h"
 
 /* Input/processing/output interleave framework :
 unless IO_PROC_NO_INTERLEAVE is set input, processing and output are interleaved
@@ -681,9 +682,17 @@ int meth_main(int argc, char* argv[], int8_t mode) {
         core->align_time,core->extra_load_cpu);
     #endif
 
+    roi_result_str("kernel", "abea");
+    roi_result_str("input", fastqfile);
+    roi_result_num("threads", opt.num_thread);
+    // Loading overlaps processing unless IO_PROC_NO_INTERLEAVE is defined.
+    roi_result_num("io_seconds", core->load_db_time);
+    roi_result_throughput("reads", core->total_reads);
+
     //free the core data structure
     free_core(core,opt);
 
+    roi_finalize();
 
     return 0;
 }
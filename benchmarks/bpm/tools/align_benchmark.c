@@ -22,26 +22,7 @@
  * DESCRIPTION: Wavefront Alignments Algorithms Benchmark
  */
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-  #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-  #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-  #if defined(__x86_64__) || defined(_M_X64)
-    #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-    #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-  #else
-    #error invalid TARGET
-  #endif
-#endif
+#include "roi.h"
 
 #include "utils/commons.h"
 #include "system/profiler_timer.h"
@@ -109,25 +90,8 @@ void align_benchmark(const alg_algorithm_type alg_algorithm) {
   // Init
   timer_reset(&(parameters.timer_global));
 
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-#endif
-#if PWR
-  // 1. Initialize Power API
-  PWR_Cntxt pwr_cntxt = NULL;
-  PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-  // 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-  PWR_Obj pwr_obj = NULL;
-  PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-
-  double energy0 = 0.0;
-#endif
+  roi_phase_t roi_kernel = roi_phase("benchmark_edit_bpm");
+  roi_phase_t roi_align_pairs = roi_phase("align_pairs");
 
   FILE *input_file = fopen(parameters.input, "r");
   if (input_file == NULL) {
@@ -143,6 +107,8 @@ void align_benchmark(const alg_algorithm_type alg_algorithm) {
   char more_seqs = 1;
   int seqs_read = 0;
   int seqs_processed = 0;
+  double io_start = roi_wtime();
+  double io_seconds = 0.0;
   #pragma omp parallel num_threads(parameters.threads)
   {
     align_input_t align_input;
@@ -202,43 +168,18 @@ void align_benchmark(const alg_algorithm_type alg_algorithm) {
       }
     }
 
-#if PERF_ANALYSIS
-	  const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd;
-#endif
-
     #pragma omp barrier
     #pragma omp master
     {
+      io_seconds = roi_wtime() - io_start;
       timer_start(&(parameters.timer_global));
-#if RAPL_STOPWATCH
-	    rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-      PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-      perf_pipe_fd = open(perf_pipe, O_WRONLY);
-      if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-      }
-      write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-      __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-      fapp_start("benchmark_edit_bpm", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-      __DR_START_TRACE();
-#endif
+      roi_begin(roi_kernel);
     }
+    // Open the ROI before any thread starts aligning.
+    #pragma omp barrier
 
     // Process the sequences.
+    roi_thread_begin(roi_align_pairs);
 
     it = head;
     while(it != NULL) {
@@ -293,46 +234,12 @@ void align_benchmark(const alg_algorithm_type alg_algorithm) {
 
       it = it->next;
     }
+    roi_thread_end(roi_align_pairs);
 
     #pragma omp barrier
     #pragma omp master
     {
-#if DYNAMORIO_ANALYSIS
-      __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-      write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-      close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-      __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-      fapp_stop("benchmark_edit_bpm", 1, 0);
-#endif
-#if PWR
-      // 3. Get electric energy at the end.
-      double energy1 = 0.0;
-      PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-      // 4. Terminate processing of Power API
-      PWR_CntxtDestroy(pwr_cntxt);
-
-      fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-      rapl_stopwatch_pause(&rapl_sw);
-
-      uint64_t count = 0;
-      err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-      if (err) {
-        fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-      }
-
-      fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-      rapl_stopwatch_destroy(&rapl_sw);
-      rapl_stopwatch_api_destroy();
-#endif
+      roi_end(roi_kernel);
       timer_stop(&(parameters.timer_global));
     }
 
@@ -364,6 +271,12 @@ void align_benchmark(const alg_algorithm_type alg_algorithm) {
   timer_print(stderr,&parameters.timer_global,NULL);
   // fprintf(stderr,"  => Time.Alignment    ");
   // timer_print(stderr,&align_timer, &parameters.timer_global);
+  roi_result_str("kernel", "bpm");
+  roi_result_str("algorithm", parameters.algorithm);
+  roi_result_str("input", parameters.input);
+  roi_result_num("threads", parameters.threads);
+  roi_result_num("io_seconds", io_seconds);
+  roi_result_throughput("pairs", seqs_read);
   // Free
   fclose(input_file);
   if (output_file != NULL) fclose(output_file);
@@ -455,4 +368,5 @@ int main(int argc,char* argv[]) {
     fprintf(stderr,"Algorithm '%s' not recognized\n",parameters.algorithm);
     exit(1);
   }
+  roi_finalize();
 }
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""
+Convert a text pair file of bsw to the binary format of src/pair_file.h.
+
+Usage: pairs2bin.py [--2bit] PAIRS.txt PAIRS.bin
+
+bsw detects the format of -pairs by its magic number, and maps binary files
+instead of parsing them. With --2bit, the bases are packed four per byte.
+"""
+
+import argparse
+import re
+import struct
+import sys
+from array import array
+
+PAIR_FILE_MAGIC = 0x3152494150575342
+PAIR_FILE_VERSION = 1
+PAIR_FILE_2BIT = 0x1
+ALIGN = 64
+
+# The text format stores the base codes 0-4 as digits.
+DECODE = bytes((c - 48) & 0xff for c in range(256))
+AMBIG = 4
+
+
+def read_pairs(f):
+    """h0, reference and query of every pair, as loadPairs reads them."""
+    while True:
+        h0_line = f.readline()
+        ref = f.readline()
+        qer = f.readline()
+        if not qer.endswith(b'\n'):
+            return
+        h0 = re.match(rb'\s*([-+]?\d+)', h0_line[:9])
+        yield (int(h0.group(1)) if h0 else 0), ref[:-1], qer[:-1]
+
+
+def pack2bit(seq):
+    """Bases of seq (codes 0-3) packed four per byte, the first one lowest."""
+    seq = seq + bytes(-len(seq) % 4)
+    # Every byte is at most 3, so the shifted streams never carry into the
+    # next byte.
+    packed = 0
+    for i in range(4):
+        packed |= int.from_bytes(seq[i::4], 'little') << (2 * i)
+    return packed.to_bytes(len(seq) // 4, 'little')
+
+
+def pad(out, size):
+    out.write(bytes(-size % ALIGN))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('pairs', help='text pair file')
+    parser.add_argument('output', help='binary pair file to write')
+    parser.add_argument('--2bit', dest='packed', action='store_true',
+                        help='pack the bases four per byte')
+    args = parser.parse_args()
+
+    ref_off, qer_off, h0s = array('Q', [0]), array('Q', [0]), array('i')
+    ref, qer = bytearray(), bytearray()
+    with open(args.pairs, 'rb') as f:
+        for i, (h0, r, q) in enumerate(read_pairs(f)):
+            if not r or not q:
+                sys.exit(f'{args.pairs}: pair {i} has an empty sequence')
+            h0s.append(h0)
+            ref += r.translate(DECODE)
+            qer += q.translate(DECODE)
+            ref_off.append(len(ref))
+            qer_off.append(len(qer))
+    if max(ref, default=0) > AMBIG or max(qer, default=0) > AMBIG:
+        sys.exit(f'{args.pairs}: bases must be 0-4')
+
+    flags = 0
+    ambig = array('Q')
+    if args.packed:
+        flags |= PAIR_FILE_2BIT
+        for base, seq in ((0, ref), (len(ref), qer)):
+            ambig.extend(base + m.start() for m in re.finditer(b'\x04', seq))
+        ref = pack2bit(bytes(ref).replace(b'\x04', b'\x00'))
+        qer = pack2bit(bytes(qer).replace(b'\x04', b'\x00'))
+
+    num_pairs, ref_bases, qer_bases = len(h0s), ref_off[-1], qer_off[-1]
+    header = struct.pack('<QIIQQQQ', PAIR_FILE_MAGIC, PAIR_FILE_VERSION, flags,
+                         num_pairs, ref_bases, qer_bases, len(ambig))
+    if sys.byteorder != 'little':
+        for a in (ref_off, qer_off, h0s, ambig):
+            a.byteswap()
+    with open(args.output, 'wb') as out:
+        for section in (header, ref_off, qer_off, h0s, ref, qer):
+            section = bytes(section)
+            out.write(section)
+            pad(out, len(section))
+        out.write(bytes(ambig))
+    print(f'{num_pairs} pairs, {ref_bases} reference and {qer_bases} query '
+          'bases', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
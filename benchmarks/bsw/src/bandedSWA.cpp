@@ -27,6 +27,7 @@
 Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@intel.com>;
 *****************************************************************************************/
 
+#include <string.h>
 #include "omp.h" 
 #include "bandedSWA.h"
 
@@ -43,6 +44,7 @@ extern uint64_t prof[10][112];
 #define DUMMY1 99
 #define DUMMY2 100
 
+#ifndef BSW_SIMD    // kernel independent code, see the Makefile
 //-----------------------------------------------------------------------------------
 // constructor
 BandedPairWiseSW::BandedPairWiseSW(const int o_del, const int e_del, const int o_ins,
@@ -66,6 +68,8 @@ BandedPairWiseSW::BandedPairWiseSW(const int o_del, const int e_del, const int o
     this->w_ambig    = DEFAULT_AMBIG;
     this->swTicks = 0;
     this->SW_cells = 0;
+    numPairs8 = numPairs8Overflow = numPairs16 = numPairsIntra = numPairsScalar = 0;
+    laneCells = vectorCells = 0;
     setupTicks = 0;
     sort1Ticks = 0;
     swTicks = 0;
@@ -79,14 +83,14 @@ BandedPairWiseSW::BandedPairWiseSW(const int o_del, const int e_del, const int o
     this->F16_ = this->H16_  = this->H16__ = NULL;
     
     F8_ = H8_ = H8__ = NULL;
-    F8_ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8 * numThreads * sizeof(int8_t), 64);
-    H8_ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8 * numThreads * sizeof(int8_t), 64);
-    H8__ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8 * numThreads * sizeof(int8_t), 64);
+    F8_ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8_MAX * numThreads * sizeof(int8_t), 64);
+    H8_ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8_MAX * numThreads * sizeof(int8_t), 64);
+    H8__ = (int8_t *)_mm_malloc(MAX_SEQ_LEN8 * SIMD_WIDTH8_MAX * numThreads * sizeof(int8_t), 64);
 
     F16_ = H16_ = H16__ = NULL;
-    F16_ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16 * numThreads * sizeof(int16_t), 64);
-    H16_ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16 * numThreads * sizeof(int16_t), 64);
-    H16__ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16 * numThreads * sizeof(int16_t), 64);
+    F16_ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16_MAX * numThreads * sizeof(int16_t), 64);
+    H16_ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16_MAX * numThreads * sizeof(int16_t), 64);
+    H16__ = (int16_t *)_mm_malloc(MAX_SEQ_LEN16 * SIMD_WIDTH16_MAX * numThreads * sizeof(int16_t), 64);
 
     if (F8_ == NULL || H8_ == NULL || H8__ == NULL) {
         printf("BSW8 Memory not alloacted!!!\n"); exit(EXIT_FAILURE);
@@ -94,12 +98,20 @@ BandedPairWiseSW::BandedPairWiseSW(const int o_del, const int e_del, const int o
     if (F16_ == NULL || H16_ == NULL || H16__ == NULL) {
         printf("BSW16 Memory not alloacted!!!\n"); exit(EXIT_FAILURE);
     }       
+
+    pairs8_ = pairs16_ = pairsIntra_ = NULL;
+    index8_ = index16_ = indexIntra_ = NULL;
+    pairsAlloc = 0;
+    intraLen = 0;
+    refill = 0;
 }
 
 // destructor 
 BandedPairWiseSW::~BandedPairWiseSW() {
     _mm_free(F8_); _mm_free(H8_); _mm_free(H8__);
     _mm_free(F16_);_mm_free(H16_); _mm_free(H16__);
+    _mm_free(pairs8_); _mm_free(pairs16_); _mm_free(pairsIntra_);
+    _mm_free(index8_); _mm_free(index16_); _mm_free(indexIntra_);
 }
 
 int64_t BandedPairWiseSW::getTicks()
@@ -275,8 +287,219 @@ void BandedPairWiseSW::scalarBandedSWAWrapper(SeqPair *seqPairArray,
 
 }
 
+// ------------------------------------------------------------------------------------
+// Banded SWA - run time selection of the vector code
+// ------------------------------------------------------------------------------------
+
+static int simd_width = BSW_SIMD_AUTO;
+
+static int simdSupported(int width)
+{
+    if (width == BSW_SIMD_SCALAR) return 1;
+#if (__ARM_FEATURE_SVE)
+    return width == (int) svcntb() * 8;
+#elif (defined(__x86_64__) || defined(__i386__))
+    // Also checks that the OS saves the AVX/AVX512 registers.
+    __builtin_cpu_init();
+    switch (width) {
+        case 512: return __builtin_cpu_supports("avx512bw");
+        case 256: return __builtin_cpu_supports("avx2");
+        case 128: return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 0;
+}
+
+int BandedPairWiseSW::setSimdWidth(int width)
+{
+    if (width == BSW_SIMD_AUTO) {
+#if (__ARM_FEATURE_SVE)
+        width = svcntb() * 8;
+#else
+        for (width = 512; width >= 128 && !simdSupported(width); width /= 2);
+        if (width < 128) width = BSW_SIMD_SCALAR;
+#endif
+    }
+    if (!simdSupported(width)) return -1;
+    simd_width = width;
+    return 0;
+}
+
+int BandedPairWiseSW::simdWidth()
+{
+    if (simd_width == BSW_SIMD_AUTO) setSimdWidth(BSW_SIMD_AUTO);
+    return simd_width;
+}
+
+const char *BandedPairWiseSW::simdName()
+{
+    if (simdWidth() == BSW_SIMD_SCALAR) return "scalar";
+#if (__ARM_FEATURE_SVE)
+    return "SVE";
+#else
+    return simdWidth() == 512 ? "AVX512BW" : simdWidth() == 256 ? "AVX2" : "SSE4.1";
+#endif
+}
+
+void BandedPairWiseSW::getScores8(SeqPair *pairArray,
+                                  uint8_t *seqBufRef,
+                                  uint8_t *seqBufQer,
+                                  int32_t numPairs,
+                                  uint16_t numThreads,
+                                  int32_t w)
+{
+    switch (simdWidth()) {
+#if (!__ARM_FEATURE_SVE)
+        case 512:
+            getScores512_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        case 256:
+            getScores256_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+#endif
+        case BSW_SIMD_SCALAR:
+            scalarBandedSWAWrapper(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        default:
+            getScores128_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    }
+}
+
+void BandedPairWiseSW::getScores16(SeqPair *pairArray,
+                                   uint8_t *seqBufRef,
+                                   uint8_t *seqBufQer,
+                                   int32_t numPairs,
+                                   uint16_t numThreads,
+                                   int32_t w)
+{
+    if (refill) {
+        getScoresRefill(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+        return;
+    }
+    switch (simdWidth()) {
+#if (!__ARM_FEATURE_SVE)
+        case 512:
+            getScores512_16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        case 256:
+            getScores256_16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+#endif
+        case BSW_SIMD_SCALAR:
+            scalarBandedSWAWrapper(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        default:
+            getScores128_16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+// Banded SWA - 8 bit and 16 bit vector code
+// ------------------------------------------------------------------------------------
+
+static inline void copyScores(SeqPair *dst, const SeqPair *src)
+{
+    dst->score = src->score;
+    dst->tle = src->tle;
+    dst->gtle = src->gtle;
+    dst->qle = src->qle;
+    dst->gscore = src->gscore;
+    dst->max_off = src->max_off;
+}
+
+// The kernels round numPairs up to a full vector and read the query of the
+// padding pairs, so these must point at a real sequence.
+static inline void padPairs(SeqPair *pairs, int32_t numPairs)
+{
+    for (int32_t i = numPairs; i < numPairs + SIMD_WIDTH8_MAX; i++)
+        pairs[i] = pairs[numPairs - 1];
+}
+
+void BandedPairWiseSW::getScores(SeqPair *pairArray,
+                                 uint8_t *seqBufRef,
+                                 uint8_t *seqBufQer,
+                                 int32_t numPairs,
+                                 uint16_t numThreads,
+                                 int32_t w)
+{
+    // The kernels pad the pairs to a full vector and prefetch past them.
+    int32_t alloc = numPairs + SIMD_WIDTH8_MAX + 16;
+    if (pairsAlloc < alloc) {
+        _mm_free(pairs8_); _mm_free(pairs16_); _mm_free(pairsIntra_);
+        _mm_free(index8_); _mm_free(index16_); _mm_free(indexIntra_);
+        pairs8_ = (SeqPair *)_mm_malloc(alloc * sizeof(SeqPair), 64);
+        pairs16_ = (SeqPair *)_mm_malloc(alloc * sizeof(SeqPair), 64);
+        pairsIntra_ = (SeqPair *)_mm_malloc(alloc * sizeof(SeqPair), 64);
+        index8_ = (int32_t *)_mm_malloc(alloc * sizeof(int32_t), 64);
+        index16_ = (int32_t *)_mm_malloc(alloc * sizeof(int32_t), 64);
+        indexIntra_ = (int32_t *)_mm_malloc(alloc * sizeof(int32_t), 64);
+        if (pairs8_ == NULL || pairs16_ == NULL || pairsIntra_ == NULL ||
+            index8_ == NULL || index16_ == NULL || indexIntra_ == NULL) {
+            printf("BSW Memory not alloacted!!!\n"); exit(EXIT_FAILURE);
+        }
+        pairsAlloc = alloc;
+    }
+
+    // The kernels need the ids of the pairs to be their index.
+    int32_t n8 = 0, n16 = 0, nIntra = 0;
+    for (int32_t i = 0; i < numPairs; i++) {
+        SeqPair *sp = pairArray + i;
+        int32_t maxScore = sp->h0 + min_(sp->len1, sp->len2) * w_match;
+        int fits16 = sp->len1 < MAX_SEQ_LEN16 && sp->len2 < MAX_SEQ_LEN16 &&
+                     maxScore < MAX_SEQ_LEN16;
+        if (!fits16 || (intraLen > 0 && max_(sp->len1, sp->len2) >= intraLen)) {
+            pairsIntra_[nIntra] = *sp;
+            indexIntra_[nIntra++] = i;
+        } else if (sp->len1 < MAX_SEQ_LEN8 && sp->len2 < MAX_SEQ_LEN8 &&
+            sp->h0 + w_match < MAX_SEQ_LEN8) {
+            pairs8_[n8] = *sp;
+            pairs8_[n8].id = n8;
+            index8_[n8++] = i;
+        } else {
+            pairs16_[n16] = *sp;
+            pairs16_[n16].id = n16;
+            index16_[n16++] = i;
+        }
+    }
+    numPairs8 += n8;
+    numPairs16 += n16;
+
+    if (n8 > 0) {
+        padPairs(pairs8_, n8);
+        getScores8(pairs8_, seqBufRef, seqBufQer, n8, numThreads, w);
+    }
+
+    // The first cell to overflow 8 bits follows a diagonal one of at least
+    // MAX_SEQ_LEN8 - w_match, so the pairs that score less are exact.
+    for (int32_t i = 0; i < n8; i++) {
+        SeqPair *sp = pairs8_ + i;
+        int32_t maxScore = sp->h0 + min_(sp->len1, sp->len2) * w_match;
+        if (maxScore >= MAX_SEQ_LEN8 && sp->score + w_match >= MAX_SEQ_LEN8) {
+            pairs16_[n16] = pairArray[index8_[i]];
+            pairs16_[n16].id = n16;
+            index16_[n16++] = index8_[i];
+            numPairs8Overflow++;
+        } else {
+            copyScores(pairArray + index8_[i], sp);
+        }
+    }
+
+    if (n16 > 0) {
+        padPairs(pairs16_, n16);
+        getScores16(pairs16_, seqBufRef, seqBufQer, n16, numThreads, w);
+    }
+    for (int32_t i = 0; i < n16; i++)
+        copyScores(pairArray + index16_[i], pairs16_ + i);
+
+    if (nIntra > 0)
+        getScoresIntra(pairsIntra_, seqBufRef, seqBufQer, nIntra, numThreads, w);
+    for (int32_t i = 0; i < nIntra; i++)
+        copyScores(pairArray + indexIntra_[i], pairsIntra_ + i);
+}
+#endif  // !BSW_SIMD
+
 
-#if ((!__AVX512BW__) & (__AVX2__))
+#if (BSW_SIMD == 256)
 
 //------------------------------------------------------------------------------
 // MACROs
@@ -369,8 +592,8 @@ void BandedPairWiseSW::scalarBandedSWAWrapper(SeqPair *seqPairArray,
 //----------------------------------------------------------------------------------
 // B-SWA - Vector code
 // ------------------------- AVX2 - 8 bit SIMD_LANES ---------------------------
-inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
-                         int16_t *hist)
+static inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
+                                int16_t *hist)
 {
 
     int32_t i;
@@ -406,8 +629,8 @@ inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
     }
 }
 
-inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
-                        SeqPair *tempArray)
+static inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
+                               SeqPair *tempArray)
 {
 
     int32_t i;
@@ -425,16 +648,16 @@ inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
 
 /******************* Vector code, version 2.0 *************************/
 #define PFD 2
-void BandedPairWiseSW::getScores8(SeqPair *pairArray,
-                                  uint8_t *seqBufRef,
-                                  uint8_t *seqBufQer,
-                                  int32_t numPairs,
-                                  uint16_t numThreads,
-                                  int32_t w)
+void BandedPairWiseSW::getScores256_8(SeqPair *pairArray,
+                                      uint8_t *seqBufRef,
+                                      uint8_t *seqBufQer,
+                                      int32_t numPairs,
+                                      uint16_t numThreads,
+                                      int32_t w)
 {
     int64_t startTick, endTick;
     
-    smithWatermanBatchWrapper8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    smithWatermanBatchWrapper256_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
 
 #if MAXI
     printf("AVX2 Vecor code: Writing output..\n");
@@ -449,12 +672,12 @@ void BandedPairWiseSW::getScores8(SeqPair *pairArray,
     
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                                  uint8_t *seqBufRef,
-                                                  uint8_t *seqBufQer,
-                                                  int32_t numPairs,
-                                                  uint16_t numThreads,
-                                                  int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper256_8(SeqPair *pairArray,
+                                                      uint8_t *seqBufRef,
+                                                      uint8_t *seqBufQer,
+                                                      int32_t numPairs,
+                                                      uint16_t numThreads,
+                                                      int32_t w)
 {
     int64_t st1, st2, st3, st4, st5;
 #if RDT
@@ -491,14 +714,14 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     // Sort the sequences according to decreasing order of lengths
     SeqPair *tempArray = (SeqPair *)_mm_malloc(SORT_BLOCK_SIZE * numThreads *
                                                sizeof(SeqPair), 64);
-    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
+    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN16 + 32) * numThreads *
                                           sizeof(int16_t), 64);
 
 #pragma omp parallel num_threads(numThreads)
     {
         int32_t tid = omp_get_thread_num();
         SeqPair *myTempArray = tempArray + tid * SORT_BLOCK_SIZE;
-        int16_t *myHist = hist + tid * (MAX_SEQ_LEN8 + 32);
+        int16_t *myHist = hist + tid * (MAX_SEQ_LEN16 + 32);
 
 #pragma omp for
         for(ii = 0; ii < roundNumPairs; ii+=SORT_BLOCK_SIZE)
@@ -521,8 +744,8 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
 // #pragma omp parallel num_threads(numThreads)
     {
         int32_t i;
-        uint16_t tid = omp_get_thread_num();
-        // uint16_t tid = 0;
+        // uint16_t tid = omp_get_thread_num();
+        uint16_t tid = 0;
         uint8_t *mySeq1SoA = NULL;
         mySeq1SoA = seq1SoA + tid * MAX_SEQ_LEN8 * SIMD_WIDTH8;
 
@@ -614,6 +837,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH8 + j] = (seq2[k]==AMBIG?0xFF:seq2[k]);
                     H1[k * SIMD_WIDTH8 + j] = 0;                    
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
 
@@ -669,6 +893,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                 }
             }
             
+            vectorCells += (uint64_t)SIMD_WIDTH8 * maxLen1 * maxLen2;
             smithWaterman256_8(mySeq1SoA,
                                mySeq2SoA,
                                maxLen1,
@@ -1125,16 +1350,16 @@ void BandedPairWiseSW::smithWaterman256_8(uint8_t seq1SoA[],
 
 // ------------------------- AVX2 - 16 bit SIMD_LANES ---------------------------
 #define PFD 2
-void BandedPairWiseSW::getScores16(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w)
+void BandedPairWiseSW::getScores256_16(SeqPair *pairArray,
+                                       uint8_t *seqBufRef,
+                                       uint8_t *seqBufQer,
+                                       int32_t numPairs,
+                                       uint16_t numThreads,
+                                       int32_t w)
 {
     int64_t startTick, endTick;
 
-    smithWatermanBatchWrapper16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    smithWatermanBatchWrapper256_16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
 
 
 #if MAXI
@@ -1151,12 +1376,12 @@ void BandedPairWiseSW::getScores16(SeqPair *pairArray,
     
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                                   uint8_t *seqBufRef,
-                                                   uint8_t *seqBufQer,
-                                                   int32_t numPairs,
-                                                   uint16_t numThreads,
-                                                   int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper256_16(SeqPair *pairArray,
+                                                       uint8_t *seqBufRef,
+                                                       uint8_t *seqBufQer,
+                                                       int32_t numPairs,
+                                                       uint16_t numThreads,
+                                                       int32_t w)
 {
     int64_t st1, st2, st3, st4, st5;
 #if RDT     
@@ -1316,6 +1541,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH16 + j] = (seq2[k]==AMBIG?0xFFFF:seq2[k]);
                     H1[k * SIMD_WIDTH16 + j] = 0;                   
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
             
@@ -1370,6 +1596,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
 #if RDT
             int64_t tim_c = __rdtsc();
 #endif
+            vectorCells += (uint64_t)SIMD_WIDTH16 * maxLen1 * maxLen2;
             smithWaterman256_16(mySeq1SoA,
                                 mySeq2SoA,
                                 maxLen1,
@@ -1836,7 +2063,7 @@ void BandedPairWiseSW::smithWaterman256_16(uint16_t seq1SoA[],
 
 #endif // AVX2
 
-#if __AVX512BW__
+#if (BSW_SIMD == 512)
 
 // ----------------------------------------------------------------------------------
 // AVX512- vec8, vec16 SIMD code
@@ -1927,8 +2154,8 @@ void BandedPairWiseSW::smithWaterman256_16(uint16_t seq1SoA[],
     }
 
 
-inline void sortPairsLen(SeqPair *pairArray, int32_t count,
-                         SeqPair *tempArray, int16_t *hist)
+static inline void sortPairsLen(SeqPair *pairArray, int32_t count,
+                                SeqPair *tempArray, int16_t *hist)
 {
     int32_t i;
     __m512i zero512 = _mm512_setzero_si512();
@@ -1969,8 +2196,8 @@ inline void sortPairsLen(SeqPair *pairArray, int32_t count,
     }
 }
 
-inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
-                        SeqPair *tempArray)
+static inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
+                               SeqPair *tempArray)
 {
     int32_t i;
     
@@ -1987,18 +2214,18 @@ inline void sortPairsId(SeqPair *pairArray, int32_t first, int32_t count,
 
 // ____________________________ AVX512 - getScore() _______________________________________
 #define PFD8 5
-void BandedPairWiseSW::getScores8(SeqPair *pairArray,
-                                  uint8_t *seqBufRef,
-                                  uint8_t *seqBufQer,
-                                  int32_t numPairs,
-                                  uint16_t numThreads,
-                                  int32_t w)
+void BandedPairWiseSW::getScores512_8(SeqPair *pairArray,
+                                      uint8_t *seqBufRef,
+                                      uint8_t *seqBufQer,
+                                      int32_t numPairs,
+                                      uint16_t numThreads,
+                                      int32_t w)
 {
     assert(SIMD_WIDTH8 == 64 && SIMD_WIDTH16 == 32);
     int i;
     int64_t startTick, endTick;
 
-    smithWatermanBatchWrapper8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    smithWatermanBatchWrapper512_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
     
 #if MAXI
     printf("AVX512/8 Vecor code: Writing output..\n");
@@ -2014,12 +2241,12 @@ void BandedPairWiseSW::getScores8(SeqPair *pairArray,
 
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                                  uint8_t *seqBufRef,
-                                                  uint8_t *seqBufQer,
-                                                  int32_t numPairs,
-                                                  uint16_t numThreads,
-                                                  int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper512_8(SeqPair *pairArray,
+                                                      uint8_t *seqBufRef,
+                                                      uint8_t *seqBufQer,
+                                                      int32_t numPairs,
+                                                      uint16_t numThreads,
+                                                      int32_t w)
 {
     int64_t st1, st2, st3, st4, st5;
 #if RDT
@@ -2045,7 +2272,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     // Sort the sequences according to decreasing order of lengths
     SeqPair *tempArray = (SeqPair *)_mm_malloc(SORT_BLOCK_SIZE * numThreads *
                                                sizeof(SeqPair), 64);
-    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
+    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN16 + 32) * numThreads *
                                           sizeof(int16_t), 64);
     // int16_t *histb = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
     //                                        sizeof(int16_t), 64);
@@ -2053,7 +2280,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     {
         int32_t tid = omp_get_thread_num();
         SeqPair *myTempArray = tempArray + tid * SORT_BLOCK_SIZE;
-        int16_t *myHist = hist + tid * (MAX_SEQ_LEN8 + 32);
+        int16_t *myHist = hist + tid * (MAX_SEQ_LEN16 + 32);
         // int16_t *myHistb = histb + tid * (MAX_SEQ_LEN8 + 32);
 
 #pragma omp for
@@ -2173,6 +2400,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH8 + j] = (seq2[k]==AMBIG?0xFF:seq2[k]);
                     H1[k * SIMD_WIDTH8 + j] = 0;                    
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
             
@@ -2224,6 +2452,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                 }
             }
 
+            vectorCells += (uint64_t)SIMD_WIDTH8 * maxLen1 * maxLen2;
             smithWaterman512_8(mySeq1SoA,
                                mySeq2SoA,
                                maxLen1,
@@ -2676,17 +2905,17 @@ void BandedPairWiseSW::smithWaterman512_8(uint8_t seq1SoA[],
 }
 //----------------------------AVX512 vec 16 bit SIMD lane -------------------------------------
 #define PFD16 2
-void BandedPairWiseSW::getScores16(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w)
+void BandedPairWiseSW::getScores512_16(SeqPair *pairArray,
+                                       uint8_t *seqBufRef,
+                                       uint8_t *seqBufQer,
+                                       int32_t numPairs,
+                                       uint16_t numThreads,
+                                       int32_t w)
 {
     int i;
     int64_t startTick, endTick;
 
-    smithWatermanBatchWrapper16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    smithWatermanBatchWrapper512_16(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
     
 #if MAXI
     printf("AVX512 Vecor code: Writing output..\n");
@@ -2702,12 +2931,12 @@ void BandedPairWiseSW::getScores16(SeqPair *pairArray,
 
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                                   uint8_t *seqBufRef,
-                                                   uint8_t *seqBufQer,
-                                                   int32_t numPairs,
-                                                   uint16_t numThreads,
-                                                   int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper512_16(SeqPair *pairArray,
+                                                       uint8_t *seqBufRef,
+                                                       uint8_t *seqBufQer,
+                                                       int32_t numPairs,
+                                                       uint16_t numThreads,
+                                                       int32_t w)
 {
     int64_t st1, st2, st3, st4, st5;
 #if RDT
@@ -2866,6 +3095,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH16 + j] = (seq2[k]==AMBIG?dmask4:seq2[k]);
                     H1[k * SIMD_WIDTH16 + j] = 0;                   
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
             
@@ -2918,6 +3148,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                 }               
             }
 
+            vectorCells += (uint64_t)SIMD_WIDTH16 * maxLen1 * maxLen2;
             smithWaterman512_16(mySeq1SoA,
                                 mySeq2SoA,
                                 maxLen1,
@@ -3367,7 +3598,7 @@ void BandedPairWiseSW::smithWaterman512_16(uint16_t seq1SoA[],
 
 
 /**************** SSE2 code ******************/
-#if ((!__AVX512BW__) && (!__AVX2__) && (__SSE2__))
+#if ((BSW_SIMD == 128) && (__SSE2__))
 
 // SSE2 =- 16 bit version
 static inline __m128i
@@ -3416,8 +3647,8 @@ _mm_blendv_epi16(__m128i x, __m128i y, __m128i mask)
     }
 
 
-inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
-                         int16_t *hist)
+static inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
+                                int16_t *hist)
 {
     int32_t i;
 
@@ -3454,8 +3685,8 @@ inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
     }
 }
 
-inline void sortPairsId(SeqPair *pairArray, int32_t first,
-                        int32_t count, SeqPair *tempArray)
+static inline void sortPairsId(SeqPair *pairArray, int32_t first,
+                               int32_t count, SeqPair *tempArray)
 {
 
     int32_t i;
@@ -3475,16 +3706,16 @@ inline void sortPairsId(SeqPair *pairArray, int32_t first,
 
 // SSE2
 #define PFD 2
-void BandedPairWiseSW::getScores16(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w)
+void BandedPairWiseSW::getScores128_16(SeqPair *pairArray,
+                                       uint8_t *seqBufRef,
+                                       uint8_t *seqBufQer,
+                                       int32_t numPairs,
+                                       uint16_t numThreads,
+                                       int32_t w)
 {
-    smithWatermanBatchWrapper16(pairArray, seqBufRef,
-                                seqBufQer, numPairs,
-                                numThreads, w);
+    smithWatermanBatchWrapper128_16(pairArray, seqBufRef,
+                                    seqBufQer, numPairs,
+                                    numThreads, w);
 
 #if MAXI
     for (int l=0; l<numPairs; l++)
@@ -3498,12 +3729,12 @@ void BandedPairWiseSW::getScores16(SeqPair *pairArray,
     
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                                   uint8_t *seqBufRef,
-                                                   uint8_t *seqBufQer,
-                                                   int32_t numPairs,
-                                                   uint16_t numThreads,
-                                                   int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper128_16(SeqPair *pairArray,
+                                                       uint8_t *seqBufRef,
+                                                       uint8_t *seqBufQer,
+                                                       int32_t numPairs,
+                                                       uint16_t numThreads,
+                                                       int32_t w)
 {
 #if RDT
     int64_t st1, st2, st3, st4, st5;
@@ -3658,6 +3889,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH16 + j] = (seq2[k]==AMBIG?0xFFFF:seq2[k]);
                     H1[k * SIMD_WIDTH16 + j] = 0;                   
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
             
@@ -3708,6 +3940,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                 }
             }
 
+            vectorCells += (uint64_t)SIMD_WIDTH16 * maxLen1 * maxLen2;
             smithWaterman128_16(mySeq1SoA,
                                 mySeq2SoA,
                                 maxLen1,
@@ -4199,15 +4432,15 @@ static inline __m128i _mm_blendv_epi8 (__m128i x, __m128i y, __m128i mask)
 
 
 // #define PFD 2 // SSE2
-void BandedPairWiseSW::getScores8(SeqPair *pairArray,
-                                  uint8_t *seqBufRef,
-                                  uint8_t *seqBufQer,
-                                  int32_t numPairs,
-                                  uint16_t numThreads,
-                                  int32_t w)
+void BandedPairWiseSW::getScores128_8(SeqPair *pairArray,
+                                      uint8_t *seqBufRef,
+                                      uint8_t *seqBufQer,
+                                      int32_t numPairs,
+                                      uint16_t numThreads,
+                                      int32_t w)
 {
     assert(SIMD_WIDTH8 == 16 && SIMD_WIDTH16 == 8);
-    smithWatermanBatchWrapper8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    smithWatermanBatchWrapper128_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
 
     
 #if MAXI
@@ -4224,12 +4457,12 @@ void BandedPairWiseSW::getScores8(SeqPair *pairArray,
     
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                                  uint8_t *seqBufRef,
-                                                  uint8_t *seqBufQer,
-                                                  int32_t numPairs,
-                                                  uint16_t numThreads,
-                                                  int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper128_8(SeqPair *pairArray,
+                                                      uint8_t *seqBufRef,
+                                                      uint8_t *seqBufQer,
+                                                      int32_t numPairs,
+                                                      uint16_t numThreads,
+                                                      int32_t w)
 {
 #if RDT
     int64_t st1, st2, st3, st4, st5;
@@ -4261,7 +4494,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     // Sort the sequences according to decreasing order of lengths
     SeqPair *tempArray = (SeqPair *)_mm_malloc(SORT_BLOCK_SIZE * numThreads *
                                                sizeof(SeqPair), 64);
-    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
+    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN16 + 32) * numThreads *
                                           sizeof(int16_t), 64);
     // int16_t *histb = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
     //                                        sizeof(int16_t), 64);
@@ -4269,7 +4502,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     {
         int32_t tid = omp_get_thread_num();
         SeqPair *myTempArray = tempArray + tid * SORT_BLOCK_SIZE;
-        int16_t *myHist = hist + tid * (MAX_SEQ_LEN8 + 32);
+        int16_t *myHist = hist + tid * (MAX_SEQ_LEN16 + 32);
         // int16_t *myHistb = histb + tid * (MAX_SEQ_LEN8 + 32);
 
 #pragma omp for
@@ -4378,6 +4611,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH8 + j] = (seq2[k]==AMBIG?0xFF:seq2[k]);
                     H1[k * SIMD_WIDTH8 + j] = 0;                    
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
             
@@ -4431,6 +4665,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                 }
             }
 
+            vectorCells += (uint64_t)SIMD_WIDTH8 * maxLen1 * maxLen2;
             smithWaterman128_8(mySeq1SoA,
                                mySeq2SoA,
                                maxLen1,
@@ -4868,9 +5103,9 @@ void BandedPairWiseSW::smithWaterman128_8(uint8_t seq1SoA[],
 
 #endif
 
-#if (__ARM_FEATURE_SVE)
+#if ((BSW_SIMD == 128) && (__ARM_FEATURE_SVE))
 
-inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
+static inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
 						 int16_t *hist)
 {
     int32_t i;
@@ -4911,7 +5146,7 @@ inline void sortPairsLen(SeqPair *pairArray, int32_t count, SeqPair *tempArray,
 	}
 }
 
-inline void sortPairsId(SeqPair *pairArray, int32_t first,
+static inline void sortPairsId(SeqPair *pairArray, int32_t first,
 						int32_t count, SeqPair *tempArray)
 {
 
@@ -4932,16 +5167,16 @@ inline void sortPairsId(SeqPair *pairArray, int32_t first,
 
 // SSE2
 #define PFD 2
-void BandedPairWiseSW::getScores16(SeqPair *pairArray,
-								   uint8_t *seqBufRef,
-								   uint8_t *seqBufQer,
-								   int32_t numPairs,
-								   uint16_t numThreads,
-								   int32_t w)
+void BandedPairWiseSW::getScores128_16(SeqPair *pairArray,
+									   uint8_t *seqBufRef,
+									   uint8_t *seqBufQer,
+									   int32_t numPairs,
+									   uint16_t numThreads,
+									   int32_t w)
 {
-	smithWatermanBatchWrapper16(pairArray, seqBufRef,
-                                seqBufQer, numPairs,
-                                numThreads, w);
+	smithWatermanBatchWrapper128_16(pairArray, seqBufRef,
+                                    seqBufQer, numPairs,
+                                    numThreads, w);
 
 #if MAXI
 	for (int l=0; l<numPairs; l++)
@@ -4955,12 +5190,12 @@ void BandedPairWiseSW::getScores16(SeqPair *pairArray,
 	
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
-												   uint8_t *seqBufRef,
-												   uint8_t *seqBufQer,
-												   int32_t numPairs,
-												   uint16_t numThreads,
-												   int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper128_16(SeqPair *pairArray,
+													   uint8_t *seqBufRef,
+													   uint8_t *seqBufQer,
+													   int32_t numPairs,
+													   uint16_t numThreads,
+													   int32_t w)
 {
 #if RDT
     int64_t st1, st2, st3, st4, st5;
@@ -5112,6 +5347,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH16 + j] = (seq2[k]==AMBIG?0xFFFF:seq2[k]);
 					H1[k * SIMD_WIDTH16 + j] = 0;					
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
 			
@@ -5162,6 +5398,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper16(SeqPair *pairArray,
 				}
 			}
 
+            vectorCells += (uint64_t)SIMD_WIDTH16 * maxLen1 * maxLen2;
             smithWaterman128_16(mySeq1SoA,
 								mySeq2SoA,
 								maxLen1,
@@ -5646,15 +5883,15 @@ void BandedPairWiseSW::smithWaterman128_16(uint16_t seq1SoA[],
 /********************************************************************************/
 
 // #define PFD 2 // SSE2
-void BandedPairWiseSW::getScores8(SeqPair *pairArray,
-								  uint8_t *seqBufRef,
-								  uint8_t *seqBufQer,
-								  int32_t numPairs,
-								  uint16_t numThreads,
-								  int32_t w)
+void BandedPairWiseSW::getScores128_8(SeqPair *pairArray,
+									  uint8_t *seqBufRef,
+									  uint8_t *seqBufQer,
+									  int32_t numPairs,
+									  uint16_t numThreads,
+									  int32_t w)
 {
 	//assert(SIMD_WIDTH8 == 16 && SIMD_WIDTH16 == 8);
-	smithWatermanBatchWrapper8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+	smithWatermanBatchWrapper128_8(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
 
 	
 #if MAXI
@@ -5671,12 +5908,12 @@ void BandedPairWiseSW::getScores8(SeqPair *pairArray,
 	
 }
 
-void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
-												  uint8_t *seqBufRef,
-												  uint8_t *seqBufQer,
-												  int32_t numPairs,
-												  uint16_t numThreads,
-												  int32_t w)
+void BandedPairWiseSW::smithWatermanBatchWrapper128_8(SeqPair *pairArray,
+													  uint8_t *seqBufRef,
+													  uint8_t *seqBufQer,
+													  int32_t numPairs,
+													  uint16_t numThreads,
+													  int32_t w)
 {
 #if RDT
     int64_t st1, st2, st3, st4, st5;
@@ -5708,13 +5945,13 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
     // Sort the sequences according to decreasing order of lengths
     SeqPair *tempArray = (SeqPair *)_mm_malloc(SORT_BLOCK_SIZE * numThreads *
 											   sizeof(SeqPair), 64);
-    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN8 + 32) * numThreads *
+    int16_t *hist = (int16_t *)_mm_malloc((MAX_SEQ_LEN16 + 32) * numThreads *
 										  sizeof(int16_t), 64);
 #pragma omp parallel num_threads(numThreads)
     {
         int32_t tid = omp_get_thread_num();
         SeqPair *myTempArray = tempArray + tid * SORT_BLOCK_SIZE;
-        int16_t *myHist = hist + tid * (MAX_SEQ_LEN8 + 32);
+        int16_t *myHist = hist + tid * (MAX_SEQ_LEN16 + 32);
 
 #pragma omp for
         for(ii = 0; ii < roundNumPairs; ii+=SORT_BLOCK_SIZE)
@@ -5822,6 +6059,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
                     mySeq2SoA[k * SIMD_WIDTH8 + j] = (seq2[k]==AMBIG?0xFF:seq2[k]);
 					H1[k * SIMD_WIDTH8 + j] = 0;					
                 }
+                laneCells += (uint64_t)sp.len1 * sp.len2;
                 if(maxLen2 < sp.len2) maxLen2 = sp.len2;
             }
 			
@@ -5875,6 +6113,7 @@ void BandedPairWiseSW::smithWatermanBatchWrapper8(SeqPair *pairArray,
 				}
 			}
 
+            vectorCells += (uint64_t)SIMD_WIDTH8 * maxLen1 * maxLen2;
             smithWaterman128_8(mySeq1SoA,
 							   mySeq2SoA,
 							   maxLen1,
@@ -6366,3 +6605,974 @@ void BandedPairWiseSW::smithWaterman128_8(uint8_t seq1SoA[],
 }
 
 #endif
+
+// ------------------------------------------------------------------------------------
+// Banded SWA with traceback
+// ------------------------------------------------------------------------------------
+// The DP of scalarBandedSWA, run for LANES pairs at a time with one lane per
+// pair, like the kernels above. The loops over the lanes are vectorized by
+// the compiler, with the flags of BSW_SIMD. Every cell of the band keeps its
+// directions, and the CIGARs are traced back from them lane by lane.
+// Compiled in every object, LANES is 1 for the scalar code.
+
+// Directions of a cell: where H comes from, and whether the E of the next
+// row and the F of the next column extend a gap
+#define CIGAR_FROM_M 0
+#define CIGAR_FROM_E 1
+#define CIGAR_FROM_F 2
+#define CIGAR_FROM_MASK 3
+#define CIGAR_E_EXT 4
+#define CIGAR_F_EXT 8
+
+// Scoring of a BandedPairWiseSW, for the kernels below
+typedef struct {
+    int o_del, e_del, o_ins, e_ins;
+    int zdrop, end_bonus;
+    int w_match, w_mismatch, w_ambig;
+    const int8_t *mat;
+} BswParams;
+
+// Buffers of a batch, grown as needed
+typedef struct {
+    void *H, *E;
+    uint8_t *seq2SoA;
+    size_t hAlloc, eAlloc, seqAlloc;
+    uint8_t *dir;
+    size_t dirAlloc;
+    // Columns [rowBeg[i], rowEnd[i]) of row i, at dir + rowOff[i] * LANES
+    int32_t *rowBeg, *rowEnd;
+    int64_t *rowOff;
+    int32_t rowAlloc;
+} CigarWork;
+
+static void *growBuffer(void *p, size_t *alloc, size_t size)
+{
+    if (*alloc >= size) return p;
+    *alloc = size + size / 2;
+    _mm_free(p);
+    p = _mm_malloc(*alloc, 64);
+    if (p == NULL) {
+        printf("BSW Memory not alloacted!!!\n"); exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Append @op to the CIGAR starting at ops[@start]
+static inline void pushCigar(BswCigars *c, int64_t start, int op, int len)
+{
+    if (c->numOps > start && (c->ops[c->numOps - 1] & 0xf) == (uint32_t)op) {
+        c->ops[c->numOps - 1] += len << 4;
+        return;
+    }
+    if (c->numOps == c->maxOps) {
+        c->maxOps = c->maxOps ? c->maxOps * 2 : 1024;
+        c->ops = (uint32_t *)realloc(c->ops, c->maxOps * sizeof(uint32_t));
+    }
+    c->ops[c->numOps++] = len << 4 | op;
+}
+
+// Alignment of lane @l ending at (i, j) in H, from the seed at (-1, -1)
+static void traceCigar(const CigarWork *wk, int lanes, int l, int i, int j,
+                       BswCigars *c, int64_t *start, int32_t *len)
+{
+#define DIR(i, j) wk->dir[(wk->rowOff[i] + (j) - wk->rowBeg[i]) * lanes + l]
+    enum { H, M, E, F } state = H;
+    *start = c->numOps;
+    while (i >= 0 && j >= 0) {
+        assert(j >= wk->rowBeg[i] && j < wk->rowEnd[i]);
+        if (state == H) {
+            int from = DIR(i, j) & CIGAR_FROM_MASK;
+            state = from == CIGAR_FROM_M ? M : from == CIGAR_FROM_E ? E : F;
+        }
+        if (state == M) {
+            pushCigar(c, *start, BSW_CIGAR_M, 1);
+            i--; j--;
+            state = H;
+        } else if (state == E) {
+            // E(i, j) was computed with the cell above
+            pushCigar(c, *start, BSW_CIGAR_D, 1);
+            i--;
+            state = (DIR(i, j) & CIGAR_E_EXT) ? E : M;
+        } else {
+            pushCigar(c, *start, BSW_CIGAR_I, 1);
+            j--;
+            state = (DIR(i, j) & CIGAR_F_EXT) ? F : M;
+        }
+    }
+    // Gap from the seed, along the first row or column
+    if (i >= 0) pushCigar(c, *start, BSW_CIGAR_D, i + 1);
+    if (j >= 0) pushCigar(c, *start, BSW_CIGAR_I, j + 1);
+#undef DIR
+    *len = c->numOps - *start;
+    for (int64_t a = *start, b = c->numOps - 1; a < b; a++, b--) {
+        uint32_t t = c->ops[a]; c->ops[a] = c->ops[b]; c->ops[b] = t;
+    }
+}
+
+// One group of up to LANES pairs (NULL for the empty lanes), with the
+// scores in score_t. The CIGARs of pairs[l] go to index[l] of @c. The
+// comments of scalarBandedSWA apply.
+template <typename score_t, int LANES>
+static void smithWatermanCigar(const BswParams &p, SeqPair *const *pairs,
+                               const int32_t *index,
+                               const uint8_t *seqBufRef, const uint8_t *seqBufQer,
+                               int32_t w, CigarWork *wk, BswCigars *c)
+{
+    int tlen[LANES], qlen[LANES], h0[LANES], band[LANES], active[LANES];
+    int beg[LANES], end[LANES];
+    int max[LANES], max_i[LANES], max_j[LANES], max_ie[LANES], gscore[LANES], max_off[LANES];
+    // Lane state of the row, all in score_t for the compiler to vectorize
+    score_t h1[LANES], f[LANES], m[LANES], mj[LANES], tb[LANES], begS[LANES], endS[LANES];
+    const score_t oe_del = p.o_del + p.e_del, oe_ins = p.o_ins + p.e_ins;
+    const score_t e_del = p.e_del, e_ins = p.e_ins;
+    const score_t w_match = p.w_match, w_mismatch = p.w_mismatch, w_ambig = p.w_ambig;
+    const uint8_t *target[LANES];
+    int l, maxTlen = 0, maxQlen = 0;
+
+    for (l = 0; l < LANES; l++) {
+        SeqPair *sp = pairs[l];
+        tlen[l] = sp ? sp->len1 : 0;
+        qlen[l] = sp ? sp->len2 : 0;
+        h0[l] = sp ? sp->h0 : 0;
+        target[l] = sp ? seqBufRef + sp->idr : NULL;
+        maxTlen = max_(maxTlen, tlen[l]);
+        maxQlen = max_(maxQlen, qlen[l]);
+    }
+
+    size_t ehSize = (maxQlen + 1) * LANES * sizeof(score_t);
+    wk->H = growBuffer(wk->H, &wk->hAlloc, ehSize);
+    wk->E = growBuffer(wk->E, &wk->eAlloc, ehSize);
+    wk->seq2SoA = (uint8_t *)growBuffer(wk->seq2SoA, &wk->seqAlloc, (maxQlen + 1) * LANES);
+    if (wk->rowAlloc < maxTlen) {
+        wk->rowAlloc = maxTlen + maxTlen / 2;
+        wk->rowBeg = (int32_t *)realloc(wk->rowBeg, wk->rowAlloc * sizeof(int32_t));
+        wk->rowEnd = (int32_t *)realloc(wk->rowEnd, wk->rowAlloc * sizeof(int32_t));
+        wk->rowOff = (int64_t *)realloc(wk->rowOff, wk->rowAlloc * sizeof(int64_t));
+    }
+    score_t *H = (score_t *)wk->H, *E = (score_t *)wk->E;
+    uint8_t *seq2SoA = wk->seq2SoA;
+    memset(H, 0, ehSize);
+    memset(E, 0, ehSize);
+
+    for (l = 0; l < LANES; l++) {
+        SeqPair *sp = pairs[l];
+        int j;
+        for (j = 0; j < qlen[l]; j++)
+            seq2SoA[j * LANES + l] = seqBufQer[sp->idq + j];
+        for (; j <= maxQlen; j++)
+            seq2SoA[j * LANES + l] = 0;
+        active[l] = sp != NULL;
+        beg[l] = end[l] = 0;
+        if (!active[l]) continue;
+
+        // fill the first row
+        H[l] = h0[l];
+        if (qlen[l] > 0) H[LANES + l] = h0[l] > oe_ins ? h0[l] - oe_ins : 0;
+        for (j = 2; j <= qlen[l] && H[(j - 1) * LANES + l] > p.e_ins; ++j)
+            H[j * LANES + l] = H[(j - 1) * LANES + l] - p.e_ins;
+
+        // adjust $w if it is too large
+        int max_ins = (int)((double)(qlen[l] * p.w_match + p.end_bonus - p.o_ins) / p.e_ins + 1.);
+        max_ins = max_ins > 1 ? max_ins : 1;
+        band[l] = w < max_ins ? w : max_ins;
+        int max_del = (int)((double)(qlen[l] * p.w_match + p.end_bonus - p.o_del) / p.e_del + 1.);
+        max_del = max_del > 1 ? max_del : 1;
+        band[l] = band[l] < max_del ? band[l] : max_del;
+
+        max[l] = h0[l]; max_i[l] = max_j[l] = -1; max_ie[l] = -1; gscore[l] = -1;
+        max_off[l] = 0;
+        beg[l] = 0; end[l] = qlen[l];
+    }
+
+    // The band of a row spans at most 2 * band + 1 columns in every lane.
+    int maxBand = 0;
+    for (l = 0; l < LANES; l++)
+        if (active[l]) maxBand = max_(maxBand, band[l]);
+    int64_t maxRowSize = min_(maxQlen, 2 * maxBand + 1);
+    wk->dir = (uint8_t *)growBuffer(wk->dir, &wk->dirAlloc, maxTlen * maxRowSize * LANES);
+
+    int64_t dirSize = 0;
+    int i;
+    for (i = 0; i < maxTlen; i++) {
+        int rowBeg = INT32_MAX, rowEnd = 0, numActive = 0;
+        for (l = 0; l < LANES; l++) {
+            if (active[l] && i >= tlen[l]) active[l] = 0;
+            if (!active[l]) {
+                beg[l] = end[l] = 0;
+                h1[l] = f[l] = m[l] = 0;
+                tb[l] = 0;
+                continue;
+            }
+            // apply the band and the constraint (if provided)
+            if (beg[l] < i - band[l]) beg[l] = i - band[l];
+            if (end[l] > i + band[l] + 1) end[l] = i + band[l] + 1;
+            if (end[l] > qlen[l]) end[l] = qlen[l];
+            // compute the first column
+            if (beg[l] == 0) {
+                int t = h0[l] - (p.o_del + p.e_del * (i + 1));
+                h1[l] = t < 0 ? 0 : t;
+            } else h1[l] = 0;
+            f[l] = m[l] = 0;
+            mj[l] = -1;
+            tb[l] = target[l][i];
+            rowBeg = min_(rowBeg, beg[l]);
+            rowEnd = max_(rowEnd, end[l]);
+            numActive++;
+        }
+        if (numActive == 0) break;
+        if (rowBeg >= rowEnd) {
+            rowBeg = rowEnd = 0;
+        }
+        wk->rowBeg[i] = rowBeg;
+        wk->rowEnd[i] = rowEnd;
+        wk->rowOff[i] = dirSize;
+        dirSize += rowEnd - rowBeg;
+        uint8_t *dir = wk->dir + wk->rowOff[i] * LANES;
+
+        for (l = 0; l < LANES; l++) {
+            begS[l] = beg[l];
+            endS[l] = end[l];
+        }
+        for (score_t j = rowBeg; j < rowEnd; j++) {
+            score_t *Hj = H + j * LANES, *Ej = E + j * LANES;
+            const uint8_t *qj = seq2SoA + j * LANES;
+            uint8_t *dj = dir + (j - rowBeg) * LANES;
+            #pragma omp simd
+            for (l = 0; l < LANES; l++) {
+                score_t in = -(score_t)((j >= begS[l]) & (j < endS[l]));
+                score_t q = qj[l];
+                score_t s = q == tb[l] ? w_match : w_mismatch;
+                s = (q == AMBIG || tb[l] == AMBIG) ? w_ambig : s;
+                score_t M = Hj[l], e = Ej[l], h, t, d;
+                M = M ? M + s : 0;
+                d = M >= e ? CIGAR_FROM_M : CIGAR_FROM_E;
+                h = M >= e ? M : e;
+                d = h >= f[l] ? d : CIGAR_FROM_F;
+                h = h >= f[l] ? h : f[l];
+                score_t mj1 = m[l] > h ? mj[l] : j;
+                score_t m1 = m[l] > h ? m[l] : h;
+                t = M - oe_del;
+                t = t > 0 ? t : 0;
+                e -= e_del;
+                d |= e > t ? CIGAR_E_EXT : 0;
+                e = e > t ? e : t;
+                t = M - oe_ins;
+                t = t > 0 ? t : 0;
+                score_t f1 = f[l] - e_ins;
+                d |= f1 > t ? CIGAR_F_EXT : 0;
+                f1 = f1 > t ? f1 : t;
+
+                // Blend rather than branch, the lanes outside their band
+                // keep their state
+                Hj[l] = (h1[l] & in) | (Hj[l] & ~in);
+                Ej[l] = (e & in) | (Ej[l] & ~in);
+                h1[l] = (h & in) | (h1[l] & ~in);
+                f[l] = (f1 & in) | (f[l] & ~in);
+                m[l] = (m1 & in) | (m[l] & ~in);
+                mj[l] = (mj1 & in) | (mj[l] & ~in);
+                dj[l] = d;
+            }
+        }
+
+        for (l = 0; l < LANES; l++) {
+            if (!active[l]) continue;
+            int j = beg[l] < end[l] ? end[l] : beg[l];
+            H[end[l] * LANES + l] = h1[l]; E[end[l] * LANES + l] = 0;
+            if (j == qlen[l]) {
+                max_ie[l] = gscore[l] > h1[l] ? max_ie[l] : i;
+                gscore[l] = gscore[l] > h1[l] ? gscore[l] : h1[l];
+            }
+            if (m[l] == 0) {
+                active[l] = 0;
+                continue;
+            }
+            if (m[l] > max[l]) {
+                max[l] = m[l], max_i[l] = i, max_j[l] = mj[l];
+                max_off[l] = max_off[l] > abs(mj[l] - i) ? max_off[l] : abs(mj[l] - i);
+            } else if (p.zdrop > 0) {
+                if (i - max_i[l] > mj[l] - max_j[l]) {
+                    if (max[l] - m[l] - ((i - max_i[l]) - (mj[l] - max_j[l])) * p.e_del > p.zdrop) active[l] = 0;
+                } else {
+                    if (max[l] - m[l] - ((mj[l] - max_j[l]) - (i - max_i[l])) * p.e_ins > p.zdrop) active[l] = 0;
+                }
+                if (!active[l]) continue;
+            }
+            // update beg and end for the next round
+            for (j = beg[l]; j < end[l] && H[j * LANES + l] == 0 && E[j * LANES + l] == 0; ++j);
+            beg[l] = j;
+            for (j = end[l]; j >= beg[l] && H[j * LANES + l] == 0 && E[j * LANES + l] == 0; --j);
+            end[l] = j + 2 < qlen[l] ? j + 2 : qlen[l];
+        }
+    }
+
+    for (l = 0; l < LANES; l++) {
+        SeqPair *sp = pairs[l];
+        if (sp == NULL) continue;
+        sp->score = max[l];
+        sp->qle = max_j[l] + 1;
+        sp->tle = max_i[l] + 1;
+        sp->gtle = max_ie[l] + 1;
+        sp->gscore = gscore[l];
+        sp->max_off = max_off[l];
+
+        int64_t k = index[l];
+        if (max_i[l] >= 0)
+            traceCigar(wk, LANES, l, max_i[l], max_j[l], c, &c->start[2 * k], &c->len[2 * k]);
+        else
+            c->start[2 * k] = c->numOps, c->len[2 * k] = 0;
+        if (gscore[l] > 0)
+            traceCigar(wk, LANES, l, max_ie[l], qlen[l] - 1, c, &c->start[2 * k + 1], &c->len[2 * k + 1]);
+        else
+            c->start[2 * k + 1] = c->numOps, c->len[2 * k + 1] = 0;
+    }
+}
+
+// Groups of LANES pairs, in 16-bit lanes for the pairs that fit in 16 bits
+// (see getScores) and in 32-bit lanes for the others.
+template <int LANES>
+static void smithWatermanCigarBatch(const BswParams &p, SeqPair *pairArray,
+                                    const uint8_t *seqBufRef, const uint8_t *seqBufQer,
+                                    int32_t numPairs, int32_t w, BswCigars *c)
+{
+    CigarWork wk;
+    memset(&wk, 0, sizeof(CigarWork));
+    SeqPair *pairs16[LANES], *pairs32[LANES];
+    int32_t index16[LANES], index32[LANES];
+    int n16 = 0, n32 = 0;
+    for (int32_t i = 0; i < numPairs; i++) {
+        SeqPair *sp = pairArray + i;
+        int32_t maxScore = sp->h0 + min_(sp->len1, sp->len2) * p.w_match;
+        if (sp->len1 < MAX_SEQ_LEN16 && sp->len2 < MAX_SEQ_LEN16 && maxScore < MAX_SEQ_LEN16) {
+            pairs16[n16] = sp;
+            index16[n16++] = i;
+            if (n16 == LANES) {
+                smithWatermanCigar<int16_t, LANES>(p, pairs16, index16, seqBufRef, seqBufQer, w, &wk, c);
+                n16 = 0;
+            }
+        } else {
+            pairs32[n32] = sp;
+            index32[n32++] = i;
+            if (n32 == LANES) {
+                smithWatermanCigar<int32_t, LANES>(p, pairs32, index32, seqBufRef, seqBufQer, w, &wk, c);
+                n32 = 0;
+            }
+        }
+    }
+    if (n16 > 0) {
+        for (int l = n16; l < LANES; l++) pairs16[l] = NULL;
+        smithWatermanCigar<int16_t, LANES>(p, pairs16, index16, seqBufRef, seqBufQer, w, &wk, c);
+    }
+    if (n32 > 0) {
+        for (int l = n32; l < LANES; l++) pairs32[l] = NULL;
+        smithWatermanCigar<int32_t, LANES>(p, pairs32, index32, seqBufRef, seqBufQer, w, &wk, c);
+    }
+    _mm_free(wk.H); _mm_free(wk.E); _mm_free(wk.seq2SoA); _mm_free(wk.dir);
+    free(wk.rowBeg); free(wk.rowEnd); free(wk.rowOff);
+}
+
+#define BSW_PARAMS {o_del, e_del, o_ins, e_ins, zdrop, end_bonus, w_match, w_mismatch, w_ambig, mat}
+
+#ifndef BSW_SIMD
+void BandedPairWiseSW::getScoresCigar(SeqPair *pairArray,
+                                      uint8_t *seqBufRef,
+                                      uint8_t *seqBufQer,
+                                      int32_t numPairs,
+                                      int32_t w,
+                                      BswCigars *cigars)
+{
+    if (cigars->maxPairs < numPairs) {
+        cigars->maxPairs = numPairs;
+        cigars->start = (int64_t *)realloc(cigars->start, 2 * numPairs * sizeof(int64_t));
+        cigars->len = (int32_t *)realloc(cigars->len, 2 * numPairs * sizeof(int32_t));
+    }
+    cigars->numOps = 0;
+
+    switch (simdWidth()) {
+#if (!__ARM_FEATURE_SVE)
+        case 512:
+            getScoresCigar512(pairArray, seqBufRef, seqBufQer, numPairs, w, cigars);
+            break;
+        case 256:
+            getScoresCigar256(pairArray, seqBufRef, seqBufQer, numPairs, w, cigars);
+            break;
+#endif
+        case BSW_SIMD_SCALAR: {
+            BswParams p = BSW_PARAMS;
+            smithWatermanCigarBatch<1>(p, pairArray, seqBufRef, seqBufQer, numPairs, w, cigars);
+            break;
+        }
+        default:
+            getScoresCigar128(pairArray, seqBufRef, seqBufQer, numPairs, w, cigars);
+    }
+}
+#else
+#if (BSW_SIMD == 512)
+void BandedPairWiseSW::getScoresCigar512(
+#elif (BSW_SIMD == 256)
+void BandedPairWiseSW::getScoresCigar256(
+#else
+void BandedPairWiseSW::getScoresCigar128(
+#endif
+                                         SeqPair *pairArray,
+                                         uint8_t *seqBufRef,
+                                         uint8_t *seqBufQer,
+                                         int32_t numPairs,
+                                         int32_t w,
+                                         BswCigars *cigars)
+{
+    // One lane per byte of a vector: the directions are stored in bytes, so
+    // this is the narrowest group the compiler vectorizes in full.
+    BswParams p = BSW_PARAMS;
+    smithWatermanCigarBatch<BSW_SIMD / 8>(p, pairArray, seqBufRef, seqBufQer, numPairs, w, cigars);
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+// Banded SWA, one pair at a time
+// ------------------------------------------------------------------------------------
+// The kernels above run a pair per lane, over the longest pair of the group,
+// so a pair much longer than the others keeps the whole group busy. These
+// ones vectorize the DP of scalarBandedSWA within a single pair instead, over
+// the columns of the band of every row. E and M only depend on the previous
+// row, and F on the M of the row: F(i,j+1) = max{M(i,j)-gapo, F(i,j)} - gape,
+// the same max-plus scan as the F of SSE2-SW. It is computed over the band in
+// log steps, and H last.
+
+// Buffers of a pair, grown as needed
+typedef struct {
+    void *prof, *H, *E, *HM, *F, *F2;
+    size_t profAlloc, hAlloc, eAlloc, hmAlloc, fAlloc, f2Alloc;
+} IntraWork;
+
+// The loops over the band run in blocks of LANES columns, the last one
+// masked, so the compiler vectorizes them without a remainder loop.
+template <typename score_t, int LANES>
+static void smithWatermanIntra(const BswParams &p, SeqPair *sp,
+                               const uint8_t *seqBufRef, const uint8_t *seqBufQer,
+                               int32_t w, IntraWork *wk)
+{
+    const int qlen = sp->len2, tlen = sp->len1, h0 = sp->h0;
+    const uint8_t *query = seqBufQer + sp->idq, *target = seqBufRef + sp->idr;
+    const score_t oe_del = p.o_del + p.e_del, oe_ins = p.o_ins + p.e_ins;
+    const score_t e_del = p.e_del, e_ins = p.e_ins;
+    int i, j, l, c, max, max_i, max_j, max_ie, gscore, max_off;
+    score_t lane[LANES], maxF[LANES], rowMax[LANES], first[LANES], last[LANES], mk[LANES];
+    for (l = 0; l < LANES; l++)
+        lane[l] = l;
+
+    // Room for a block past the end of every row, and for the F of the
+    // columns up to three bands before the band in front of F (zeros)
+    int64_t cols = (qlen + 2 * LANES) / LANES * LANES;
+    score_t *prof = (score_t *)(wk->prof = growBuffer(wk->prof, &wk->profAlloc, 5 * cols * sizeof(score_t)));
+    score_t *H = (score_t *)(wk->H = growBuffer(wk->H, &wk->hAlloc, cols * sizeof(score_t)));
+    score_t *E = (score_t *)(wk->E = growBuffer(wk->E, &wk->eAlloc, cols * sizeof(score_t)));
+    score_t *HM = (score_t *)(wk->HM = growBuffer(wk->HM, &wk->hmAlloc, cols * sizeof(score_t)));
+    score_t *F = (score_t *)(wk->F = growBuffer(wk->F, &wk->fAlloc, 4 * cols * sizeof(score_t)));
+    score_t *F2 = (score_t *)(wk->F2 = growBuffer(wk->F2, &wk->f2Alloc, 4 * cols * sizeof(score_t)));
+    memset(F, 0, 4 * cols * sizeof(score_t));
+    memset(F2, 0, 4 * cols * sizeof(score_t));
+    F += 3 * cols;
+    F2 += 3 * cols;
+
+    // query profile
+    for (c = 0; c < 5; c++) {
+        const int8_t *row = &p.mat[c * 5];
+        for (j = 0; j < qlen; j++)
+            prof[c * cols + j] = row[query[j]];
+        for (; j < cols; j++)
+            prof[c * cols + j] = 0;
+    }
+
+    // fill the first row
+    memset(H, 0, cols * sizeof(score_t));
+    memset(E, 0, cols * sizeof(score_t));
+    H[0] = h0; H[1] = h0 > oe_ins ? h0 - oe_ins : 0;
+    for (j = 2; j <= qlen && H[j - 1] > e_ins; ++j)
+        H[j] = H[j - 1] - e_ins;
+
+    // adjust $w if it is too large
+    for (i = 0, max = 0; i < 25; ++i)
+        max = max > p.mat[i] ? max : p.mat[i];
+    int max_ins = (int)((double)(qlen * max + p.end_bonus - p.o_ins) / p.e_ins + 1.);
+    max_ins = max_ins > 1 ? max_ins : 1;
+    w = w < max_ins ? w : max_ins;
+    int max_del = (int)((double)(qlen * max + p.end_bonus - p.o_del) / p.e_del + 1.);
+    max_del = max_del > 1 ? max_del : 1;
+    w = w < max_del ? w : max_del;
+
+    max = h0, max_i = max_j = -1; max_ie = -1, gscore = -1;
+    max_off = 0;
+    int beg = 0, end = qlen;
+    for (i = 0; i < tlen; ++i) {
+        const score_t *q = prof + target[i] * cols;
+        int h1, m = 0, mj = -1;
+        if (beg < i - w) beg = i - w;
+        if (end > i + w + 1) end = i + w + 1;
+        if (end > qlen) end = qlen;
+        if (beg == 0) {
+            h1 = h0 - (p.o_del + p.e_del * (i + 1));
+            if (h1 < 0) h1 = 0;
+        } else h1 = 0;
+        if (end <= beg) {
+            H[end] = h1; E[end] = 0;
+            if (beg == qlen) {
+                max_ie = gscore > h1 ? max_ie : i;
+                gscore = gscore > h1 ? gscore : h1;
+            }
+            break;
+        }
+
+        // Column beg + k of the band is at k, and its F at k + 1: E(i+1,j),
+        // max{M(i,j), E(i,j)} and max{M(i,j)-gapo, 0}
+        const int n = end - beg;
+        score_t *Hb = H + beg, *Eb = E + beg;
+        const score_t *qb = q + beg;
+        for (l = 0; l < LANES; l++)
+            maxF[l] = 0;
+        for (int b = 0; b < n; b += LANES) {
+            const score_t left = n - b;
+            #pragma omp simd
+            for (l = 0; l < LANES; l++) {
+                score_t in = -(score_t)(lane[l] < left);
+                score_t M = Hb[b + l], e = Eb[b + l], s = qb[b + l], t;
+                M = M ? M + s : 0;
+                HM[b + l] = M > e ? M : e;
+                t = M - oe_del;
+                t = t > 0 ? t : 0;
+                score_t e1 = e - e_del;
+                e1 = e1 > t ? e1 : t;
+                Eb[b + l] = (e1 & in) | (e & ~in);
+                t = M - oe_ins;
+                t = (t > 0 ? t : 0) & in;
+                F[b + l + 1] = t;
+                maxF[l] = maxF[l] > t ? maxF[l] : t;
+            }
+        }
+        F[0] = 0;
+
+        // F(i,j) = max{F[k'] - (k-k') * gape, k' <= k}: add the terms 1-3,
+        // 4-12, 16-48... columns back, until these are all below the largest
+        // one. A term more than topF below is not needed, which keeps the
+        // gaps in score_t.
+        score_t topF = 0;
+        for (l = 0; l < LANES; l++)
+            topF = topF > maxF[l] ? topF : maxF[l];
+        for (int s = 1; s <= n && s * p.e_ins < topF; s <<= 2) {
+            const score_t gap = s * e_ins;
+            const score_t gap2 = min_(2 * s * p.e_ins, topF), gap3 = min_(3 * s * p.e_ins, topF);
+            for (int b = 0; b <= n; b += LANES) {
+                #pragma omp simd
+                for (l = 0; l < LANES; l++) {
+                    score_t f = F[b + l];
+                    score_t t1 = F[b + l - s] - gap;
+                    score_t t2 = F[b + l - 2 * s] - gap2;
+                    score_t t3 = F[b + l - 3 * s] - gap3;
+                    f = t1 > f ? t1 : f;
+                    f = t2 > f ? t2 : f;
+                    F2[b + l] = t3 > f ? t3 : f;
+                }
+            }
+            score_t *tmp = F; F = F2; F2 = tmp;
+        }
+
+        // H(i,j) to eh[j+1], the maximum and the columns left non-zero
+        Hb[0] = h1;
+        E[end] = 0;
+        for (l = 0; l < LANES; l++) {
+            rowMax[l] = 0; first[l] = end; last[l] = -1; mk[l] = -1;
+        }
+        for (int b = 0; b < n; b += LANES) {
+            const score_t left = n - b, col0 = beg + 1 + b;
+            #pragma omp simd
+            for (l = 0; l < LANES; l++) {
+                score_t in = -(score_t)(lane[l] < left);
+                score_t h = (HM[b + l] > F[b + l] ? HM[b + l] : F[b + l]) & in;
+                score_t col = col0 + lane[l];
+                Hb[b + l + 1] = h | (Hb[b + l + 1] & ~in);
+                rowMax[l] = rowMax[l] > h ? rowMax[l] : h;
+                score_t nz = -(score_t)((h | Eb[b + l + 1]) != 0) & in;
+                score_t lo = (col < end) & (col < first[l]), hi = col > last[l];
+                first[l] = (nz & -lo) ? col : first[l];
+                last[l] = (nz & -hi) ? col : last[l];
+            }
+        }
+        int firstNz = end, lastNz = -1;
+        for (l = 0; l < LANES; l++) {
+            m = m > rowMax[l] ? m : rowMax[l];
+            firstNz = firstNz < first[l] ? firstNz : first[l];
+            lastNz = lastNz > last[l] ? lastNz : last[l];
+        }
+        if (h1 != 0 || E[beg] != 0) {
+            firstNz = beg;
+            lastNz = lastNz > beg ? lastNz : beg;
+        }
+        // The last column with the maximum
+        for (int b = 0; b < n; b += LANES) {
+            const score_t left = n - b, rm = m;
+            #pragma omp simd
+            for (l = 0; l < LANES; l++) {
+                score_t k = b + lane[l];
+                score_t hit = (lane[l] < left) & (Hb[b + l + 1] == rm) & (k > mk[l]);
+                mk[l] = hit ? k : mk[l];
+            }
+        }
+        for (l = 0, mj = -1; l < LANES; l++)
+            mj = mj > mk[l] ? mj : mk[l];
+        mj += beg;
+
+        h1 = H[end];
+        if (end == qlen) {
+            max_ie = gscore > h1 ? max_ie : i;
+            gscore = gscore > h1 ? gscore : h1;
+        }
+        if (m == 0) break;
+        if (m > max) {
+            max = m, max_i = i, max_j = mj;
+            max_off = max_off > abs(mj - i) ? max_off : abs(mj - i);
+        } else if (p.zdrop > 0) {
+            if (i - max_i > mj - max_j) {
+                if (max - m - ((i - max_i) - (mj - max_j)) * p.e_del > p.zdrop) break;
+            } else {
+                if (max - m - ((mj - max_j) - (i - max_i)) * p.e_ins > p.zdrop) break;
+            }
+        }
+        // update beg and end for the next round
+        beg = firstNz;
+        lastNz = lastNz > beg - 1 ? lastNz : beg - 1;
+        end = lastNz + 2 < qlen ? lastNz + 2 : qlen;
+    }
+    sp->score = max;
+    sp->qle = max_j + 1;
+    sp->tle = max_i + 1;
+    sp->gtle = max_ie + 1;
+    sp->gscore = gscore;
+    sp->max_off = max_off;
+}
+
+#ifndef BSW_SIMD
+void BandedPairWiseSW::getScoresIntra(SeqPair *pairArray,
+                                      uint8_t *seqBufRef,
+                                      uint8_t *seqBufQer,
+                                      int32_t numPairs,
+                                      uint16_t numThreads,
+                                      int32_t w)
+{
+    switch (simdWidth()) {
+#if (!__ARM_FEATURE_SVE)
+        case 512:
+            getScoresIntra512(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        case 256:
+            getScoresIntra256(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+#endif
+        case BSW_SIMD_SCALAR:
+            scalarBandedSWAWrapper(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            numPairsScalar += numPairs;
+            return;
+        default:
+            getScoresIntra128(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    }
+    numPairsIntra += numPairs;
+}
+#else
+#if (BSW_SIMD == 512)
+void BandedPairWiseSW::getScoresIntra512(
+#elif (BSW_SIMD == 256)
+void BandedPairWiseSW::getScoresIntra256(
+#else
+void BandedPairWiseSW::getScoresIntra128(
+#endif
+                                         SeqPair *pairArray,
+                                         uint8_t *seqBufRef,
+                                         uint8_t *seqBufQer,
+                                         int32_t numPairs,
+                                         uint16_t numThreads,
+                                         int32_t w)
+{
+    BswParams p = BSW_PARAMS;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        IntraWork wk;
+        memset(&wk, 0, sizeof(IntraWork));
+        #pragma omp for schedule(dynamic, 1)
+        for (int32_t i = 0; i < numPairs; i++) {
+            SeqPair *sp = pairArray + i;
+            int32_t maxScore = sp->h0 + min_(sp->len1, sp->len2) * w_match;
+            if (sp->len1 < MAX_SEQ_LEN16 && sp->len2 < MAX_SEQ_LEN16 && maxScore < MAX_SEQ_LEN16)
+                smithWatermanIntra<int16_t, BSW_SIMD / 16>(p, sp, seqBufRef, seqBufQer, w, &wk);
+            else
+                smithWatermanIntra<int32_t, BSW_SIMD / 32>(p, sp, seqBufRef, seqBufQer, w, &wk);
+        }
+        _mm_free(wk.prof); _mm_free(wk.H); _mm_free(wk.E);
+        _mm_free(wk.HM); _mm_free(wk.F); _mm_free(wk.F2);
+    }
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+// Banded SWA with lane refill
+// ------------------------------------------------------------------------------------
+// A group of the kernels above runs until its last pair ends, so the lanes of
+// the pairs that end early, by the zdrop or a row of zeros, idle until then.
+// Here every lane takes the next pair of the batch as soon as its own pair
+// ends, and the lanes are at different rows. Each step computes one row of
+// every lane, over the columns of all their bands, with the DP and the
+// vectorization of smithWatermanCigar.
+
+// Buffers of a batch, grown as needed
+typedef struct {
+    void *H, *E, *Q;
+    size_t hAlloc, eAlloc, qAlloc;
+} RefillWork;
+
+// Pairs in 16-bit lanes, the bound of getScores16. Adds the band cells of the
+// pairs to @laneCells and the cells computed for them to @vectorCells. The
+// comments of scalarBandedSWA apply.
+template <int LANES>
+static void smithWatermanRefill(const BswParams &p, SeqPair *pairArray, int32_t numPairs,
+                                const uint8_t *seqBufRef, const uint8_t *seqBufQer,
+                                int32_t w, RefillWork *wk,
+                                uint64_t *laneCells, uint64_t *vectorCells)
+{
+    typedef int16_t score_t;
+    SeqPair *pair[LANES];
+    const uint8_t *target[LANES];
+    // Lane state, all in score_t for the compiler to vectorize. A lane whose
+    // row reaches tlen is retired and refilled before the next row.
+    score_t row[LANES], tlen[LANES], qlen[LANES], h0[LANES], band[LANES], beg[LANES], end[LANES];
+    score_t max[LANES], max_i[LANES], max_j[LANES], max_ie[LANES], gscore[LANES], max_off[LANES];
+    score_t h1[LANES], f[LANES], m[LANES], mj[LANES], tb[LANES], first[LANES], last[LANES];
+    const score_t oe_del = p.o_del + p.e_del, oe_ins = p.o_ins + p.e_ins;
+    const score_t e_del = p.e_del, e_ins = p.e_ins;
+    const score_t w_match = p.w_match, w_mismatch = p.w_mismatch, w_ambig = p.w_ambig;
+    const int zdrop = p.zdrop;
+    int32_t l, j, next = 0, maxQlen = 0;
+
+    for (int32_t i = 0; i < numPairs; i++)
+        maxQlen = max_(maxQlen, pairArray[i].len2);
+    size_t ehSize = (maxQlen + 1) * LANES * sizeof(score_t);
+    score_t *H = (score_t *)(wk->H = growBuffer(wk->H, &wk->hAlloc, ehSize));
+    score_t *E = (score_t *)(wk->E = growBuffer(wk->E, &wk->eAlloc, ehSize));
+    score_t *Q = (score_t *)(wk->Q = growBuffer(wk->Q, &wk->qAlloc, ehSize));
+    memset(Q, 0, ehSize);
+    for (l = 0; l < LANES; l++) {
+        pair[l] = NULL;
+        row[l] = tlen[l] = qlen[l] = beg[l] = end[l] = 0;
+    }
+
+    for (;;) {
+        int numActive = 0;
+        for (l = 0; l < LANES; l++) {
+            while (row[l] >= tlen[l]) {
+                SeqPair *sp = pair[l];
+                if (sp != NULL) {
+                    sp->score = max[l];
+                    sp->qle = max_j[l] + 1;
+                    sp->tle = max_i[l] + 1;
+                    sp->gtle = max_ie[l] + 1;
+                    sp->gscore = gscore[l];
+                    sp->max_off = max_off[l];
+                    pair[l] = NULL;
+                }
+                if (next == numPairs) break;
+                sp = pair[l] = pairArray + next++;
+                tlen[l] = sp->len1;
+                qlen[l] = sp->len2;
+                h0[l] = sp->h0;
+                target[l] = seqBufRef + sp->idr;
+                const uint8_t *query = seqBufQer + sp->idq;
+                for (j = 0; j < qlen[l]; j++) {
+                    Q[j * LANES + l] = query[j];
+                    H[j * LANES + l] = E[j * LANES + l] = 0;
+                }
+                H[j * LANES + l] = E[j * LANES + l] = 0;
+
+                // fill the first row
+                H[l] = h0[l];
+                if (qlen[l] > 0) H[LANES + l] = h0[l] > oe_ins ? h0[l] - oe_ins : 0;
+                for (j = 2; j <= qlen[l] && H[(j - 1) * LANES + l] > p.e_ins; ++j)
+                    H[j * LANES + l] = H[(j - 1) * LANES + l] - p.e_ins;
+
+                // adjust $w if it is too large
+                int max_ins = (int)((double)(qlen[l] * p.w_match + p.end_bonus - p.o_ins) / p.e_ins + 1.);
+                max_ins = max_ins > 1 ? max_ins : 1;
+                band[l] = w < max_ins ? w : max_ins;
+                int max_del = (int)((double)(qlen[l] * p.w_match + p.end_bonus - p.o_del) / p.e_del + 1.);
+                max_del = max_del > 1 ? max_del : 1;
+                band[l] = band[l] < max_del ? band[l] : max_del;
+
+                max[l] = h0[l]; max_i[l] = max_j[l] = -1; max_ie[l] = -1; gscore[l] = -1;
+                max_off[l] = 0;
+                beg[l] = 0; end[l] = qlen[l];
+                row[l] = 0;
+            }
+            if (pair[l] == NULL) {
+                // An empty band, for the rest of the batch
+                row[l] = tlen[l] = 1;
+                beg[l] = end[l] = 0;
+                tb[l] = 0;
+                continue;
+            }
+            tb[l] = target[l][row[l]];
+            numActive++;
+        }
+        if (numActive == 0) break;
+
+        score_t rowBeg = INT16_MAX, rowEnd = 0;
+        #pragma omp simd reduction(min:rowBeg) reduction(max:rowEnd)
+        for (l = 0; l < LANES; l++) {
+            // apply the band and the constraint (if provided)
+            int i = row[l], b = beg[l], e = end[l];
+            b = b < i - band[l] ? i - band[l] : b;
+            e = e > i + band[l] + 1 ? i + band[l] + 1 : e;
+            e = e > qlen[l] ? qlen[l] : e;
+            // compute the first column
+            int t = h0[l] - (p.o_del + p.e_del * (i + 1));
+            h1[l] = (b == 0) & (t > 0) ? t : 0;
+            f[l] = m[l] = 0;
+            mj[l] = -1;
+            first[l] = e;
+            last[l] = -1;
+            beg[l] = b;
+            end[l] = e;
+            rowBeg = (b < e) & (b < rowBeg) ? b : rowBeg;
+            rowEnd = (b < e) & (e > rowEnd) ? e : rowEnd;
+        }
+        if (rowBeg >= rowEnd) {
+            rowBeg = rowEnd = 0;
+        }
+        uint64_t cells = 0;
+        for (l = 0; l < LANES; l++)
+            cells += beg[l] < end[l] ? end[l] - beg[l] : 0;
+        *laneCells += cells;
+        *vectorCells += (uint64_t)LANES * (rowEnd - rowBeg);
+
+        // Up to column rowEnd, for the H(i,end) of every lane
+        for (score_t jj = rowBeg; jj <= rowEnd; jj++) {
+            score_t *Hj = H + jj * LANES, *Ej = E + jj * LANES;
+            const score_t *qj = Q + jj * LANES;
+            #pragma omp simd
+            for (l = 0; l < LANES; l++) {
+                score_t in = -(score_t)((jj >= beg[l]) & (jj < end[l]));
+                score_t atEnd = -(score_t)(jj == end[l]);
+                score_t q = qj[l];
+                score_t s = q == tb[l] ? w_match : w_mismatch;
+                s = ((q == AMBIG) | (tb[l] == AMBIG)) ? w_ambig : s;
+                score_t M = Hj[l], e = Ej[l], h, t;
+                M = M ? M + s : 0;
+                h = M >= e ? M : e;
+                h = h >= f[l] ? h : f[l];
+                score_t mj1 = m[l] > h ? mj[l] : jj;
+                score_t m1 = m[l] > h ? m[l] : h;
+                t = M - oe_del;
+                t = t > 0 ? t : 0;
+                e -= e_del;
+                e = e > t ? e : t;
+                t = M - oe_ins;
+                t = t > 0 ? t : 0;
+                score_t f1 = f[l] - e_ins;
+                f1 = f1 > t ? f1 : t;
+                // eh[jj] of the next row is not zero
+                score_t nz = -(score_t)((h1[l] | e) != 0) & in;
+
+                // Blend rather than branch, the lanes outside their band
+                // keep their state
+                Hj[l] = (h1[l] & (in | atEnd)) | (Hj[l] & ~(in | atEnd));
+                Ej[l] = (e & in) | (Ej[l] & ~(in | atEnd));
+                h1[l] = (h & in) | (h1[l] & ~in);
+                f[l] = (f1 & in) | (f[l] & ~in);
+                m[l] = (m1 & in) | (m[l] & ~in);
+                mj[l] = (mj1 & in) | (mj[l] & ~in);
+                score_t lo = nz & -(score_t)(jj < first[l]);
+                first[l] = (jj & lo) | (first[l] & ~lo);
+                last[l] = (jj & nz) | (last[l] & ~nz);
+            }
+        }
+
+        // The selects are blends: AVX2 and SSE have no masked 16-bit stores
+        #pragma omp simd
+        for (l = 0; l < LANES; l++) {
+            int i = row[l], b = beg[l], e = end[l];
+            int j = b < e ? e : b;
+            int g = -((j == qlen[l]) & (h1[l] >= gscore[l]));
+            max_ie[l] = (i & g) | (max_ie[l] & ~g);
+            gscore[l] = (h1[l] & g) | (gscore[l] & ~g);
+            int up = -(m[l] > max[l]);
+            int di = i - max_i[l], dj = mj[l] - max_j[l];
+            int zd = di > dj ? max[l] - m[l] - (di - dj) * p.e_del : max[l] - m[l] - (dj - di) * p.e_ins;
+            int ended = -((m[l] == 0) | (~up & (zdrop > 0) & (zd > zdrop)));
+            int off = mj[l] > i ? mj[l] - i : i - mj[l];
+            int upOff = up & -(off > max_off[l]);
+            max_off[l] = (off & upOff) | (max_off[l] & ~upOff);
+            max_i[l] = (i & up) | (max_i[l] & ~up);
+            max_j[l] = (mj[l] & up) | (max_j[l] & ~up);
+            max[l] = (m[l] & up) | (max[l] & ~up);
+            // update beg and end for the next round
+            int nb = first[l];
+            int nz = -(last[l] >= 0), hz = -(h1[l] != 0);
+            int ne = (last[l] & nz) | ((nb - 1) & ~nz);
+            ne = (e & hz) | (ne & ~hz);
+            ne = ne + 2 < qlen[l] ? ne + 2 : qlen[l];
+            beg[l] = nb;
+            end[l] = ne;
+            row[l] = (tlen[l] & ended) | ((i + 1) & ~ended);
+        }
+    }
+}
+
+#ifndef BSW_SIMD
+void BandedPairWiseSW::getScoresRefill(SeqPair *pairArray,
+                                       uint8_t *seqBufRef,
+                                       uint8_t *seqBufQer,
+                                       int32_t numPairs,
+                                       uint16_t numThreads,
+                                       int32_t w)
+{
+    switch (simdWidth()) {
+#if (!__ARM_FEATURE_SVE)
+        case 512:
+            getScoresRefill512(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        case 256:
+            getScoresRefill256(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+#endif
+        case BSW_SIMD_SCALAR:
+            scalarBandedSWAWrapper(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+            break;
+        default:
+            getScoresRefill128(pairArray, seqBufRef, seqBufQer, numPairs, numThreads, w);
+    }
+}
+#else
+#if (BSW_SIMD == 512)
+void BandedPairWiseSW::getScoresRefill512(
+#elif (BSW_SIMD == 256)
+void BandedPairWiseSW::getScoresRefill256(
+#else
+void BandedPairWiseSW::getScoresRefill128(
+#endif
+                                          SeqPair *pairArray,
+                                          uint8_t *seqBufRef,
+                                          uint8_t *seqBufQer,
+                                          int32_t numPairs,
+                                          uint16_t numThreads,
+                                          int32_t w)
+{
+    BswParams p = BSW_PARAMS;
+    uint64_t lanes = 0, vector = 0;
+    #pragma omp parallel num_threads(numThreads) reduction(+:lanes, vector)
+    {
+        int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+        int32_t first = (int64_t)numPairs * tid / nt, last = (int64_t)numPairs * (tid + 1) / nt;
+        RefillWork wk;
+        memset(&wk, 0, sizeof(RefillWork));
+        smithWatermanRefill<BSW_SIMD / 16>(p, pairArray + first, last - first, seqBufRef, seqBufQer,
+                                           w, &wk, &lanes, &vector);
+        _mm_free(wk.H); _mm_free(wk.E); _mm_free(wk.Q);
+    }
+    laneCells += lanes;
+    vectorCells += vector;
+}
+#endif
@@ -37,16 +37,6 @@ Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@i
 #include "macro.h"
 #include "utils.h"
 
-#if (__AVX512BW__ || __AVX2__)
-#include <immintrin.h>
-#endif
-
-#if ((!__AVX512BW__) & (!__AVX2__) & (__SSE2__))
-#include <smmintrin.h>  // for SSE4.1
-#define __mmask8 uint8_t
-#define __mmask16 uint16_t
-#endif
-
 #if (__ARM_FEATURE_SVE)
 #include "sse2sve.h"
 #include <arm_sve.h>
@@ -62,34 +52,35 @@ Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@i
 #define DEFAULT_AMBIG -1
 
 
-// SIMD_WIDTH in bits
-// AVX2
-#if ((!__AVX512BW__) & (__AVX2__))
-#define SIMD_WIDTH8 32
-#define SIMD_WIDTH16 16
-#endif
+// The vector kernels of bandedSWA.cpp are compiled once per SIMD width, with
+// BSW_SIMD set to the width in bits (see the Makefile), and the widest one
+// supported by the CPU is selected at run time (see simdWidth()).
+#define BSW_SIMD_AUTO -1
+#define BSW_SIMD_SCALAR 0
 
-// AVX512
-#if __AVX512BW__
+// SIMD_WIDTH in lanes, of the kernels being compiled
+#if (__ARM_FEATURE_SVE)
+#include <arm_sve.h>
+#define SIMD_WIDTH8 svcntb()
+#define SIMD_WIDTH16 svcnth()
+#elif (BSW_SIMD == 512)
 #define SIMD_WIDTH8 64
 #define SIMD_WIDTH16 32
-#endif
-
-#if ((!__AVX512BW__) & (!__AVX2__) & (__SSE2__))
+#elif (BSW_SIMD == 256)
+#define SIMD_WIDTH8 32
+#define SIMD_WIDTH16 16
+#elif (BSW_SIMD == 128)
 #define SIMD_WIDTH8 16
 #define SIMD_WIDTH16 8
 #endif
 
+// Widest kernels, used to size the buffers shared by all of them
 #if (__ARM_FEATURE_SVE)
-#include <arm_sve.h>
-#define SIMD_WIDTH8 svcntb()
-#define SIMD_WIDTH16 svcnth()
-#endif
-
-// Scalar
-#if ((!__AVX512BW__) & (!__AVX2__) & (!__SSE2__) & (!__ARM_FEATURE_SVE))
-#define SIMD_WIDTH8 1
-#define SIMD_WIDTH16 1
+#define SIMD_WIDTH8_MAX svcntb()
+#define SIMD_WIDTH16_MAX svcnth()
+#else
+#define SIMD_WIDTH8_MAX 64
+#define SIMD_WIDTH16_MAX 32
 #endif
 
 #define MAX_LINE_LEN 256
@@ -123,11 +114,43 @@ typedef struct {
     int32_t h, e;
 } eh_t;
 
+// CIGAR operations of getScoresCigar(), as in BAM: length << 4 | op
+#define BSW_CIGAR_M 0
+#define BSW_CIGAR_I 1
+#define BSW_CIGAR_D 2
+
+// CIGARs of the pairs of one call of getScoresCigar(), zero-initialized
+// before the first call. Pair i has len[2 * i] operations from
+// ops[start[2 * i]] for its extension alignment, which ends at (tle, qle),
+// and len[2 * i + 1] from ops[start[2 * i + 1]] for its global alignment,
+// which ends at (gtle, len2). These are empty if score == h0 or gscore <= 0.
+// I is an insertion to the reference (seq1), D a deletion.
+typedef struct {
+    uint32_t *ops;
+    int64_t numOps, maxOps;
+    int64_t *start;
+    int32_t *len;
+    int32_t maxPairs;
+} BswCigars;
+
 
 class BandedPairWiseSW {
     
 public:
     uint64_t SW_cells;
+    // Pairs scored by getScores() per kernel, numPairs8Overflow of the
+    // numPairs8 being rerun with 16 bits
+    uint64_t numPairs8, numPairs8Overflow, numPairs16, numPairsIntra, numPairsScalar;
+    // getScores() runs the pairs of at least intraLen bases (reference or
+    // query) with getScoresIntra(), 0 (the default) for none
+    int32_t intraLen;
+    // getScores16() runs with getScoresRefill() if set, 0 (the default) for
+    // its groups of pairs
+    int32_t refill;
+    // Cells of the pairs scored by the SIMD kernels, and cells computed for
+    // them (SIMD width x longest len1 x longest len2 of every group). With
+    // refill, the cells of the bands and the columns computed for them.
+    uint64_t laneCells, vectorCells;
 
     BandedPairWiseSW(const int o_del, const int e_del, const int o_ins,
                      const int e_ins, const int zdrop,
@@ -148,9 +171,19 @@ public:
                                 int nthreads,
                                 int32_t w);
 
-#if ((!__AVX512BW__) & (!__AVX2__) & (__SSE2__))
-    // AVX256 is not updated for banding and separate ins/del in the inner loop.
-    // 8 bit vector code section    
+    // Scores of pairs of any length. The pairs short enough for 8 bits run
+    // with getScores8, at twice the lanes of getScores16, first. The ones
+    // whose scores may have overflowed are then rerun with getScores16,
+    // together with the pairs that need 16 bits. Longer pairs, and the ones
+    // of intraLen bases, run with getScoresIntra.
+    void getScores(SeqPair *pairArray,
+                   uint8_t *seqBufRef,
+                   uint8_t *seqBufQer,
+                   int32_t numPairs,
+                   uint16_t numThreads,
+                   int32_t w);
+
+    // Vector code, run with the kernels of simdWidth()
     void getScores8(SeqPair *pairArray,
                     uint8_t *seqBufRef,
                     uint8_t *seqBufQer,
@@ -158,12 +191,75 @@ public:
                     uint16_t numThreads,
                     int32_t w);
 
-    void smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w);
+    void getScores16(SeqPair *pairArray,
+                     uint8_t *seqBufRef,
+                     uint8_t *seqBufQer,
+                     int32_t numPairs,
+                     uint16_t numThreads,
+                     int32_t w);
+
+    // Scores of getScores16, with one pair per vector lane as in the kernels
+    // of getScores16, but a lane takes the next pair as soon as its own one
+    // ends (zdrop or a row of zeros) instead of waiting for the rest of its
+    // group, so the lanes run at different rows. The scalar code runs every
+    // pair with scalarBandedSWA.
+    void getScoresRefill(SeqPair *pairArray,
+                         uint8_t *seqBufRef,
+                         uint8_t *seqBufQer,
+                         int32_t numPairs,
+                         uint16_t numThreads,
+                         int32_t w);
+
+    // Scores of getScores(), one pair at a time: the DP of every row runs
+    // over the band of a single pair, in 16-bit lanes when it fits as in
+    // getScores16 and 32-bit ones otherwise. For the pairs much longer than
+    // the others, which would hold a whole group of the kernels above. The
+    // scalar code runs every pair with scalarBandedSWA.
+    void getScoresIntra(SeqPair *pairArray,
+                        uint8_t *seqBufRef,
+                        uint8_t *seqBufQer,
+                        int32_t numPairs,
+                        uint16_t numThreads,
+                        int32_t w);
+
+    // Scores of getScores() and CIGARs of the alignments of every pair. Groups
+    // of pairs run the DP of scalarBandedSWA with one pair per vector lane,
+    // keeping 4 direction bits per cell of the band, and are then traced
+    // back lane by lane. Pairs up to the bound of getScores16 run with 16-bit
+    // lanes, the others with 32-bit ones.
+    void getScoresCigar(SeqPair *pairArray,
+                        uint8_t *seqBufRef,
+                        uint8_t *seqBufQer,
+                        int32_t numPairs,
+                        int32_t w,
+                        BswCigars *cigars);
+
+    // Width in bits of the vector kernels used by getScores8/16: 512, 256 or
+    // 128 (the vector length with SVE), or BSW_SIMD_SCALAR. The first call
+    // selects the widest kernels supported by the CPU.
+    static int simdWidth();
+    // Use the kernels of @width (BSW_SIMD_AUTO for the widest supported).
+    // Returns -1 if the CPU or the build does not support them.
+    static int setSimdWidth(int width);
+    // Name of the instruction set of the kernels of simdWidth().
+    static const char *simdName();
+
+    // 128-bit kernels: SSE4.1, or SVE of any vector length
+    // AVX256 is not updated for banding and separate ins/del in the inner loop.
+    // 8 bit vector code section    
+    void getScores128_8(SeqPair *pairArray,
+                        uint8_t *seqBufRef,
+                        uint8_t *seqBufQer,
+                        int32_t numPairs,
+                        uint16_t numThreads,
+                        int32_t w);
+
+    void smithWatermanBatchWrapper128_8(SeqPair *pairArray,
+                                        uint8_t *seqBufRef,
+                                        uint8_t *seqBufQer,
+                                        int32_t numPairs,
+                                        uint16_t numThreads,
+                                        int32_t w);
 
     void smithWaterman128_8(uint8_t seq1SoA[],
                             uint8_t seq2SoA[],
@@ -177,21 +273,43 @@ public:
                             int32_t w,
                             uint8_t qlen[],
                             uint8_t myband[]);
-    // 16 bit vector code section
-    void getScores16(SeqPair *pairArray,
-                     uint8_t *seqBufRef,
-                     uint8_t *seqBufQer,
-                     int32_t numPairs,
-                     uint16_t numThreads,
-                     int32_t w);
 
-    void smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                     uint8_t *seqBufRef,
-                                     uint8_t *seqBufQer,
-                                     int32_t numPairs,
-                                     uint16_t numThreads,
-                                     int32_t w);
+    // 16 bit vector code section
+    void getScores128_16(SeqPair *pairArray,
+                         uint8_t *seqBufRef,
+                         uint8_t *seqBufQer,
+                         int32_t numPairs,
+                         uint16_t numThreads,
+                         int32_t w);
+
+    void smithWatermanBatchWrapper128_16(SeqPair *pairArray,
+                                         uint8_t *seqBufRef,
+                                         uint8_t *seqBufQer,
+                                         int32_t numPairs,
+                                         uint16_t numThreads,
+                                         int32_t w);
     
+    void getScoresRefill128(SeqPair *pairArray,
+                            uint8_t *seqBufRef,
+                            uint8_t *seqBufQer,
+                            int32_t numPairs,
+                            uint16_t numThreads,
+                            int32_t w);
+
+    void getScoresIntra128(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           uint16_t numThreads,
+                           int32_t w);
+
+    void getScoresCigar128(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           int32_t w,
+                           BswCigars *cigars);
+
     void smithWaterman128_16(uint16_t seq1SoA[],
                              uint16_t seq2SoA[],
                              uint16_t nrow,
@@ -204,25 +322,24 @@ public:
                              int32_t w,
                              uint16_t qlen[],
                              uint16_t myband[]);
-    
-#endif  //SSE2
 
-#if ((!__AVX512BW__) & (__AVX2__))
+#if (!__ARM_FEATURE_SVE)
+    // AVX2 kernels
     // AVX256 is not updated for banding and separate ins/del in the inner loop.
     // 8 bit vector code section    
-    void getScores8(SeqPair *pairArray,
-                    uint8_t *seqBufRef,
-                    uint8_t *seqBufQer,
-                    int32_t numPairs,
-                    uint16_t numThreads,
-                    int32_t w);
-
-    void smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w);
+    void getScores256_8(SeqPair *pairArray,
+                        uint8_t *seqBufRef,
+                        uint8_t *seqBufQer,
+                        int32_t numPairs,
+                        uint16_t numThreads,
+                        int32_t w);
+
+    void smithWatermanBatchWrapper256_8(SeqPair *pairArray,
+                                        uint8_t *seqBufRef,
+                                        uint8_t *seqBufQer,
+                                        int32_t numPairs,
+                                        uint16_t numThreads,
+                                        int32_t w);
 
     void smithWaterman256_8(uint8_t seq1SoA[],
                             uint8_t seq2SoA[],
@@ -236,21 +353,43 @@ public:
                             int32_t w,
                             uint8_t qlen[],
                             uint8_t myband[]);
-    // 16 bit vector code section
-    void getScores16(SeqPair *pairArray,
-                     uint8_t *seqBufRef,
-                     uint8_t *seqBufQer,
-                     int32_t numPairs,
-                     uint16_t numThreads,
-                     int32_t w);
 
-    void smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                     uint8_t *seqBufRef,
-                                     uint8_t *seqBufQer,
-                                     int32_t numPairs,
-                                     uint16_t numThreads,
-                                     int32_t w);
+    // 16 bit vector code section
+    void getScores256_16(SeqPair *pairArray,
+                         uint8_t *seqBufRef,
+                         uint8_t *seqBufQer,
+                         int32_t numPairs,
+                         uint16_t numThreads,
+                         int32_t w);
+
+    void smithWatermanBatchWrapper256_16(SeqPair *pairArray,
+                                         uint8_t *seqBufRef,
+                                         uint8_t *seqBufQer,
+                                         int32_t numPairs,
+                                         uint16_t numThreads,
+                                         int32_t w);
     
+    void getScoresRefill256(SeqPair *pairArray,
+                            uint8_t *seqBufRef,
+                            uint8_t *seqBufQer,
+                            int32_t numPairs,
+                            uint16_t numThreads,
+                            int32_t w);
+
+    void getScoresIntra256(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           uint16_t numThreads,
+                           int32_t w);
+
+    void getScoresCigar256(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           int32_t w,
+                           BswCigars *cigars);
+
     void smithWaterman256_16(uint16_t seq1SoA[],
                              uint16_t seq2SoA[],
                              uint16_t nrow,
@@ -264,24 +403,22 @@ public:
                              uint16_t qlen[],
                              uint16_t myband[],
                              int64_t* nCellsComputed);
-    
-#endif  //axv2
 
-#if __AVX512BW__
+    // AVX512BW kernels
     // 8 bit vector code section    
-    void getScores8(SeqPair *pairArray,
-                    uint8_t *seqBufRef,
-                    uint8_t *seqBufQer,
-                    int32_t numPairs,
-                    uint16_t numThreads,
-                    int32_t w);
-
-    void smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w);
+    void getScores512_8(SeqPair *pairArray,
+                        uint8_t *seqBufRef,
+                        uint8_t *seqBufQer,
+                        int32_t numPairs,
+                        uint16_t numThreads,
+                        int32_t w);
+
+    void smithWatermanBatchWrapper512_8(SeqPair *pairArray,
+                                        uint8_t *seqBufRef,
+                                        uint8_t *seqBufQer,
+                                        int32_t numPairs,
+                                        uint16_t numThreads,
+                                        int32_t w);
 
     void smithWaterman512_8(uint8_t seq1SoA[],
                             uint8_t seq2SoA[],
@@ -297,78 +434,42 @@ public:
                             uint8_t myband[]);
 
     // 16 bit vector code section
-    void getScores16(SeqPair *pairArray,
-                     uint8_t *seqBufRef,
-                     uint8_t *seqBufQer,
-                     int32_t numPairs,
-                     uint16_t numThreads,
-                     int32_t w);
-
-    void smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                     uint8_t *seqBufRef,
-                                     uint8_t *seqBufQer,
-                                     int32_t numPairs,
-                                     uint16_t numThreads,
-                                     int32_t w);
+    void getScores512_16(SeqPair *pairArray,
+                         uint8_t *seqBufRef,
+                         uint8_t *seqBufQer,
+                         int32_t numPairs,
+                         uint16_t numThreads,
+                         int32_t w);
+
+    void smithWatermanBatchWrapper512_16(SeqPair *pairArray,
+                                         uint8_t *seqBufRef,
+                                         uint8_t *seqBufQer,
+                                         int32_t numPairs,
+                                         uint16_t numThreads,
+                                         int32_t w);
     
-    void smithWaterman512_16(uint16_t seq1SoA[],
-                             uint16_t seq2SoA[],
-                             uint16_t nrow,
-                             uint16_t ncol,
-                             SeqPair *p,
-                             uint16_t h0[],
-                             uint16_t tid,
-                             int32_t numPairs,
-                             int zdrop,
-                             int32_t w,
-                             uint16_t qlen[],
-                             uint16_t myband[]);
-#endif
-
-#if (__ARM_FEATURE_SVE)
-    // 8 bit vector code section    
-    void getScores8(SeqPair *pairArray,
-                    uint8_t *seqBufRef,
-                    uint8_t *seqBufQer,
-                    int32_t numPairs,
-                    uint16_t numThreads,
-                    int32_t w);
-
-    void smithWatermanBatchWrapper8(SeqPair *pairArray,
-                                   uint8_t *seqBufRef,
-                                   uint8_t *seqBufQer,
-                                   int32_t numPairs,
-                                   uint16_t numThreads,
-                                   int32_t w);
-
-    void smithWaterman128_8(uint8_t seq1SoA[],
-                            uint8_t seq2SoA[],
-                            uint8_t nrow,
-                            uint8_t ncol,
-                            SeqPair *p,
-                            uint8_t h0[],
-                            uint16_t tid,
+    void getScoresRefill512(SeqPair *pairArray,
+                            uint8_t *seqBufRef,
+                            uint8_t *seqBufQer,
                             int32_t numPairs,
-                            int zdrop,
-                            int32_t w,
-                            uint8_t qlen[],
-                            uint8_t myband[]);
-    // 16 bit vector code section
-    void getScores16(SeqPair *pairArray,
-                     uint8_t *seqBufRef,
-                     uint8_t *seqBufQer,
-                     int32_t numPairs,
-                     uint16_t numThreads,
-                     int32_t w);
+                            uint16_t numThreads,
+                            int32_t w);
+
+    void getScoresIntra512(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           uint16_t numThreads,
+                           int32_t w);
+
+    void getScoresCigar512(SeqPair *pairArray,
+                           uint8_t *seqBufRef,
+                           uint8_t *seqBufQer,
+                           int32_t numPairs,
+                           int32_t w,
+                           BswCigars *cigars);
 
-    void smithWatermanBatchWrapper16(SeqPair *pairArray,
-                                     uint8_t *seqBufRef,
-                                     uint8_t *seqBufQer,
-                                     int32_t numPairs,
-                                     uint16_t numThreads,
-                                     int32_t w);
-    
-    void smithWaterman128_16(uint16_t seq1SoA[],
+    void smithWaterman512_16(uint16_t seq1SoA[],
                              uint16_t seq2SoA[],
                              uint16_t nrow,
                              uint16_t ncol,
@@ -401,6 +502,11 @@ private:
     int16_t *F16_;
     int16_t *H16_, *H16__;
 
+    // Pairs of getScores() per kernel, and their index in its input
+    SeqPair *pairs8_, *pairs16_, *pairsIntra_;
+    int32_t *index8_, *index16_, *indexIntra_;
+    int32_t pairsAlloc;
+
     int64_t sort1Ticks;
     int64_t setupTicks;
     int64_t swTicks;
@@ -36,36 +36,19 @@ Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@i
 #include <unistd.h>
 #include <omp.h>
 #include <fstream>
+#include <algorithm>
 #include <inttypes.h>
 #include <fcntl.h>
 
 #include "utils.h"
 #include "bandedSWA.h"
+#include "pair_file.h"
 
 // #define VTUNE_ANALYSIS 1
 
 #define CLMUL 8
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
 
 #define DEFAULT_MATCH 1
 #define DEFAULT_MISMATCH 4
@@ -84,6 +67,12 @@ Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@i
 // #define AMBIG 52
 double freq = 2.6*1e9;
 int32_t w_match, w_mismatch, w_open, w_extend, w_ambig, numThreads = 1, batchSize = 0;
+int32_t simdWidth = BSW_SIMD_AUTO;
+int32_t bits = 0;
+int32_t sched = 1;
+int32_t cigar = 0;
+int32_t intraLen = 0;
+int32_t refill = 0;
 uint64_t SW_cells;
 char *pairFileName;
 FILE *pairFile;
@@ -142,11 +131,33 @@ void parseCmdLine(int argc, char *argv[])
         if(strcmp(argv[i], "-b") == 0) {
 			batchSize = atoi(argv[i + 1]);
 		}
+		if(strcmp(argv[i], "-simd") == 0) { // kernel width in bits, 0 for scalar
+			simdWidth = atoi(argv[i + 1]);
+		}
+		if(strcmp(argv[i], "-bits") == 0) { // 16: all pairs with 16 bits
+			bits = atoi(argv[i + 1]);
+		}
+		if(strcmp(argv[i], "-sched") == 0) { // 0: batches in input order
+			sched = atoi(argv[i + 1]);
+		}
+		if(strcmp(argv[i], "-cigar") == 0) { // 1: scores and CIGARs
+			cigar = atoi(argv[i + 1]);
+		}
+		if(strcmp(argv[i], "-intra") == 0) { // pairs of this length one at a time, 0 for none
+			intraLen = atoi(argv[i + 1]);
+		}
+		if(strcmp(argv[i], "-refill") == 0) { // 1: 16-bit pairs with lane refill
+			refill = atoi(argv[i + 1]);
+		}
 	}
 	if(pairFlag == 0) {
 		fprintf(stderr, "ERROR! pairFileName not specified.\n");
 		exit(EXIT_FAILURE);
 	}
+	if(bits != 0 && bits != 16) {
+		fprintf(stderr, "ERROR! -bits must be 0 (8 or 16 bits per pair) or 16.\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 // -------------------------------------------------------------------------
@@ -161,8 +172,13 @@ void parseCmdLine(int argc, char *argv[])
 // 01230123
 // 0123
 
-void loadPairs(SeqPair *seqPairArray, uint8_t *seqBufRef, uint8_t* seqBufQer, size_t numPairs)
+// The pairs are stored from index first on, idr and idq are offsets from
+// the start of seqBufRef and seqBufQer, id is the index within the batch.
+void loadPairs(SeqPair *seqPairArray, uint8_t *seqBufRef, uint8_t* seqBufQer, size_t first, size_t numPairs)
 {
+	seqPairArray += first;
+	seqBufRef += first * MAX_SEQ_LEN_REF;
+	seqBufQer += first * MAX_SEQ_LEN_QER;
 	size_t numPairsRead = 0;
 	while (numPairsRead < numPairs) {
 		int32_t h0 = 0;
@@ -189,8 +205,8 @@ void loadPairs(SeqPair *seqPairArray, uint8_t *seqBufRef, uint8_t* seqBufQer, si
 		sp.h0 = h0;
 		uint8_t *seq1 = seqBufRef + numPairsRead * MAX_SEQ_LEN_REF;
 		uint8_t *seq2 = seqBufQer + numPairsRead * MAX_SEQ_LEN_QER;
-		sp.idr =  numPairsRead * MAX_SEQ_LEN_REF;
-		sp.idq =  numPairsRead * MAX_SEQ_LEN_QER;
+		sp.idr =  (first + numPairsRead) * MAX_SEQ_LEN_REF;
+		sp.idq =  (first + numPairsRead) * MAX_SEQ_LEN_QER;
 		for (int l = 0; l < sp.len1; l++) {
 			seq1[l] -= 48;
         }
@@ -204,6 +220,127 @@ void loadPairs(SeqPair *seqPairArray, uint8_t *seqBufRef, uint8_t* seqBufQer, si
 		// SW_cells += (sp.len1 * sp.len2);
 	}
 }
+// -------------------------------------------------------------------------
+// LENGTH-BINNED SCHEDULING
+// -------------------------------------------------------------------------
+// The kernels score SIMD_WIDTH pairs at a time over the largest len1 x len2
+// of the group, so pairs of different lengths waste lanes. The pairs are
+// ordered by (len1, len2) with counting sorts over the histograms of the
+// lengths, and split into tasks of taskSize pairs (a multiple of the widest
+// group). Tasks are run from the most expensive one on, estimated by their
+// number of cells, so the long ones do not end up last on a single thread.
+
+#define SCHED_GROUP 64
+#define SCHED_TASKS_PER_THREAD 16
+#define SCHED_MIN_TASK 1024
+
+typedef struct {
+	int64_t first;
+	int32_t numPairs;
+	double cells;
+} SchedTask;
+
+// Permutation of the pairs ordered by (len1, len2), stable: counting sorts
+// over the histogram of len2, then of len1.
+void sortPairsByLen(const SeqPair *seqPairArray, size_t numPairs, int64_t *order)
+{
+	int32_t maxLen1 = 0, maxLen2 = 0;
+	for (size_t i = 0; i < numPairs; i++) {
+		maxLen1 = max_(maxLen1, seqPairArray[i].len1);
+		maxLen2 = max_(maxLen2, seqPairArray[i].len2);
+	}
+	int64_t *hist = (int64_t *)malloc((max_(maxLen1, maxLen2) + 2) * sizeof(int64_t));
+	int64_t *tmp = (int64_t *)malloc(numPairs * sizeof(int64_t));
+
+	memset(hist, 0, (maxLen2 + 2) * sizeof(int64_t));
+	for (size_t i = 0; i < numPairs; i++) {
+		hist[seqPairArray[i].len2 + 1]++;
+	}
+	for (int32_t l = 1; l <= maxLen2 + 1; l++) {
+		hist[l] += hist[l - 1];
+	}
+	for (size_t i = 0; i < numPairs; i++) {
+		tmp[hist[seqPairArray[i].len2]++] = i;
+	}
+
+	memset(hist, 0, (maxLen1 + 2) * sizeof(int64_t));
+	for (size_t i = 0; i < numPairs; i++) {
+		hist[seqPairArray[i].len1 + 1]++;
+	}
+	for (int32_t l = 1; l <= maxLen1 + 1; l++) {
+		hist[l] += hist[l - 1];
+	}
+	for (size_t i = 0; i < numPairs; i++) {
+		int64_t p = tmp[i];
+		order[hist[seqPairArray[p].len1]++] = p;
+	}
+	free(tmp);
+	free(hist);
+}
+
+// Copy the pairs in the order of sortPairsByLen() to schedArray and split
+// them into tasks, most expensive first. Return the number of tasks.
+int64_t schedulePairs(const SeqPair *seqPairArray, size_t numPairs, int64_t *order,
+					  SeqPair *schedArray, SchedTask *tasks, int64_t taskSize)
+{
+	sortPairsByLen(seqPairArray, numPairs, order);
+	int64_t numTasks = 0;
+	for (size_t first = 0; first < numPairs; first += taskSize) {
+		SchedTask &t = tasks[numTasks++];
+		t.first = first;
+		t.numPairs = min_(numPairs - first, (size_t)taskSize);
+		t.cells = 0;
+		for (int32_t j = 0; j < t.numPairs; j++) {
+			SeqPair &sp = schedArray[first + j];
+			sp = seqPairArray[order[first + j]];
+			sp.id = j;
+			t.cells += (double)sp.len1 * sp.len2;
+		}
+	}
+	std::stable_sort(tasks, tasks + numTasks, [](const SchedTask &a, const SchedTask &b) {
+		return a.cells > b.cells;
+	});
+	return numTasks;
+}
+
+// Pairs [first, first + numPairs) of a binary pair file (see pair_file.h),
+// id is the index within the batch.
+void loadPairsBinary(const PairFile *pf, SeqPair *seqPairArray, size_t first, size_t numPairs)
+{
+	for (size_t i = first; i < first + numPairs; i++) {
+		SeqPair sp;
+		sp.id = i - first;
+		sp.idr = pf->refOff[i];
+		sp.idq = pf->qerOff[i];
+		sp.len1 = pf->refOff[i + 1] - pf->refOff[i];
+		sp.len2 = pf->qerOff[i + 1] - pf->qerOff[i];
+		sp.h0 = pf->h0[i];
+		sp.seqid = sp.regid = sp.score = sp.tle = sp.gtle = sp.qle = -1;
+		sp.gscore = sp.max_off = -1;
+		seqPairArray[i] = sp;
+	}
+}
+
+// Score one batch with the kernels selected by -bits and -cigar.
+void scoreBatch(BandedPairWiseSW *bsw, SeqPair *pairs, uint8_t *seqBufRef, uint8_t *seqBufQer,
+				int32_t numPairs, int32_t w, BswCigars *cigars)
+{
+	if (cigar)
+		bsw->getScoresCigar(pairs, seqBufRef, seqBufQer, numPairs, w, cigars);
+	else if (bits == 16)
+		bsw->getScores16(pairs, seqBufRef, seqBufQer, numPairs, 1, w);
+	else
+		bsw->getScores(pairs, seqBufRef, seqBufQer, numPairs, 1, w);
+}
+
+void printCigar(FILE *fp, const uint32_t *ops, int32_t n)
+{
+	if (n == 0)
+		fputc('*', fp);
+	for (int32_t i = 0; i < n; i++)
+		fprintf(fp, "%u%c", ops[i] >> 4, "MID"[ops[i] & 0xf]);
+}
+
 // profiling stats
 uint64_t find_stats(uint64_t *val, int nt, double &min, double &max, double &avg) {
 	min = 1e10;
@@ -222,46 +359,77 @@ uint64_t find_stats(uint64_t *val, int nt, double &min, double &max, double &avg
 int main(int argc, char *argv[])
 {
 	if (argc < 3) {
-		fprintf(stderr, "usage: bsw -pairs <InSeqFile> -t <threads> -b <batch_size>\n");
+		fprintf(stderr, "usage: bsw -pairs <InSeqFile> -t <threads> -b <batch_size> [-simd <512|256|128|0>] [-bits <0|16>] [-sched <1|0>] [-cigar <0|1>] [-intra <len>] [-refill <0|1>]\n");
 		exit(EXIT_FAILURE);
 	}
 	
 	parseCmdLine(argc, argv);
-
-	pairFile = fopen(pairFileName, "r");	
-	if (pairFile == NULL) {
-		fprintf(stderr, "Could not open file: %s\n", pairFileName);
+	if (BandedPairWiseSW::setSimdWidth(simdWidth) != 0) {
+		fprintf(stderr, "ERROR! %d-bit kernels not supported on this CPU.\n", simdWidth);
 		exit(EXIT_FAILURE);
 	}
 
-    const int bufSize = 1024 * 1024;
-    char* buffer = (char*)malloc(bufSize * sizeof(char));
-    size_t numLines = 0;
-    size_t n;
-    while (n = fread(buffer, sizeof(char), bufSize, pairFile)) {
-        for (int i = 0; i < n; i++) {
-            if (buffer[i] == '\n') {
-                numLines++;
-            }
-        }
-    }
-    free(buffer);
+	double ioStart = roi_wtime();
+	PairFile pf;
+	int binaryInput = pairFileDetect(pairFileName);
+	size_t numPairs;
+	if (binaryInput) {
+		pairFileOpen(pairFileName, &pf);
+		numPairs = pf.numPairs;
+	}
+	else {
+		pairFile = fopen(pairFileName, "r");	
+		if (pairFile == NULL) {
+			fprintf(stderr, "Could not open file: %s\n", pairFileName);
+			exit(EXIT_FAILURE);
+		}
 
-    // Reset file pointer back to the beginning
-    fseek(pairFile, 0L, SEEK_SET);
+		const int bufSize = 1024 * 1024;
+		char* buffer = (char*)malloc(bufSize * sizeof(char));
+		size_t numLines = 0;
+		size_t n;
+		while (n = fread(buffer, sizeof(char), bufSize, pairFile)) {
+			for (int i = 0; i < n; i++) {
+				if (buffer[i] == '\n') {
+					numLines++;
+				}
+			}
+		}
+		free(buffer);
 
-    size_t numPairs = numLines / 3;
-    size_t roundNumPairs = ((numPairs + SIMD_WIDTH16 - 1) / SIMD_WIDTH16 ) * SIMD_WIDTH16;
+		// Reset file pointer back to the beginning
+		fseek(pairFile, 0L, SEEK_SET);
+		numPairs = numLines / 3;
+	}
+
+    size_t simdWidth16 = max_(BandedPairWiseSW::simdWidth() / 16, 1);
+    size_t roundNumPairs = ((numPairs + simdWidth16 - 1) / simdWidth16 ) * simdWidth16;
     if (batchSize == 0) { 
         batchSize = roundNumPairs;
     }
+    // The kernels pad the batches in place to a multiple of the SIMD width,
+    // which would overwrite the first pairs of the next batch.
+    batchSize = ((batchSize + simdWidth16 - 1) / simdWidth16) * simdWidth16;
     printf("Number of input pairs: %ld\n", numPairs);
 
-    size_t memAlloc = roundNumPairs * (sizeof(SeqPair) + MAX_SEQ_LEN_QER * sizeof(int8_t) + MAX_SEQ_LEN_REF * sizeof(int8_t));
-	printf("Allocating %.3f GB memory for input buffers...\n", (memAlloc * 1.0)/ (1024 * 1024 * 1024));
-	SeqPair *seqPairArray = (SeqPair *)_mm_malloc(roundNumPairs * sizeof(SeqPair), 64);
-    uint8_t *seqBufQer = (uint8_t*) _mm_malloc(MAX_SEQ_LEN_QER * roundNumPairs * sizeof(int8_t), 64);
-    uint8_t *seqBufRef = (uint8_t*) _mm_malloc(MAX_SEQ_LEN_REF * roundNumPairs * sizeof(int8_t), 64);
+	SeqPair *seqPairArray;
+	uint8_t *seqBufQer, *seqBufRef;
+	if (binaryInput) {
+		// The sequences are used in place.
+		size_t memAlloc = roundNumPairs * sizeof(SeqPair);
+		printf("Mapped %.3f GB of pairs, allocating %.3f GB memory for input buffers...\n",
+			   (pf.mapSize * 1.0) / (1024 * 1024 * 1024), (memAlloc * 1.0) / (1024 * 1024 * 1024));
+		seqPairArray = (SeqPair *)_mm_malloc(roundNumPairs * sizeof(SeqPair), 64);
+		seqBufRef = pf.seqBufRef;
+		seqBufQer = pf.seqBufQer;
+	}
+	else {
+		size_t memAlloc = roundNumPairs * (sizeof(SeqPair) + MAX_SEQ_LEN_QER * sizeof(int8_t) + MAX_SEQ_LEN_REF * sizeof(int8_t));
+		printf("Allocating %.3f GB memory for input buffers...\n", (memAlloc * 1.0)/ (1024 * 1024 * 1024));
+		seqPairArray = (SeqPair *)_mm_malloc(roundNumPairs * sizeof(SeqPair), 64);
+		seqBufQer = (uint8_t*) _mm_malloc(MAX_SEQ_LEN_QER * roundNumPairs * sizeof(int8_t), 64);
+		seqBufRef = (uint8_t*) _mm_malloc(MAX_SEQ_LEN_REF * roundNumPairs * sizeof(int8_t), 64);
+	}
 
     int8_t mat[25];
 	bwa_fill_scmat(w_match, w_mismatch, w_ambig, mat);
@@ -273,6 +441,8 @@ int main(int argc, char *argv[])
         bsw[i] = new BandedPairWiseSW(w_open, w_extend, w_open, w_extend,
                     zdrop, end_bonus, mat,
                     w_match, w_mismatch, 1);
+        bsw[i]->intraLen = intraLen;
+        bsw[i]->refill = refill;
     }
 
 	int64_t startTick, totalTicks = 0, readTim = 0;
@@ -282,131 +452,126 @@ int main(int argc, char *argv[])
     int64_t numPairsIndex = 0;
     for (int64_t i = 0; i < roundNumPairs; i += batchSize) {
         int nPairsBatch = (numPairs - i) >= batchSize ? batchSize : numPairs - i;
-        loadPairs(seqPairArray + numPairsIndex, seqBufRef + numPairsIndex * MAX_SEQ_LEN_REF, seqBufQer + numPairsIndex * MAX_SEQ_LEN_QER, nPairsBatch);
+        if (binaryInput)
+            loadPairsBinary(&pf, seqPairArray, numPairsIndex, nPairsBatch);
+        else
+            loadPairs(seqPairArray, seqBufRef, seqBufQer, numPairsIndex, nPairsBatch);
         numPairsIndex += nPairsBatch;
     }
     readTim += __rdtsc() - tim;
+    double ioSeconds = roi_wtime() - ioStart;
+
+    // Scheduled tasks: a multiple of SCHED_GROUP pairs, so only the last one
+    // is padded by the kernels, in the room left at the end of schedArray.
+    int64_t taskSize = batchSize;
+    if (sched && taskSize == (int64_t)roundNumPairs) {
+        taskSize = max_((int64_t)(numPairs + numThreads * SCHED_TASKS_PER_THREAD - 1) /
+                        (numThreads * SCHED_TASKS_PER_THREAD), SCHED_MIN_TASK);
+    }
+    taskSize = (taskSize + SCHED_GROUP - 1) / SCHED_GROUP * SCHED_GROUP;
+    int64_t maxTasks = (numPairs + taskSize - 1) / taskSize;
+    SeqPair *schedArray = NULL;
+    int64_t *order = NULL;
+    SchedTask *tasks = NULL;
+    if (sched) {
+        schedArray = (SeqPair *)_mm_malloc((numPairs + 2 * SCHED_GROUP) * sizeof(SeqPair), 64);
+        order = (int64_t *)malloc(numPairs * sizeof(int64_t));
+        tasks = (SchedTask *)malloc(max_(maxTasks, 1) * sizeof(SchedTask));
+    }
+    // CIGARs of every task, or batch
+    int64_t cigarBatchSize = sched ? taskSize : batchSize;
+    BswCigars *cigars = NULL;
+    if (cigar) {
+        cigars = (BswCigars *)calloc((numPairs + cigarBatchSize - 1) / cigarBatchSize + 1, sizeof(BswCigars));
+    }
 
     startTick = __rdtsc();
 
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-    }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-	__itt_resume();
-#endif
-#if FAPP_ANALYSIS
-	fapp_start("getScores", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-	__DR_START_TRACE();
-#endif
-
-    int64_t workTicks[CLMUL * numThreads];
-    memset(workTicks, 0, CLMUL * numThreads * sizeof(int64_t));
-
-	#pragma omp parallel num_threads(numThreads)
-	{
-		int tid = omp_get_thread_num();
-		#pragma omp for schedule(dynamic, 1) 
-		for (int64_t i = 0; i < roundNumPairs; i += batchSize) {
-			int nPairsBatch = (numPairs - i) >= batchSize ? batchSize : numPairs - i;
-			int64_t st1 = __rdtsc();
-			bsw[tid]->getScores16(seqPairArray + i, seqBufRef + i * MAX_SEQ_LEN_REF, seqBufQer + i * MAX_SEQ_LEN_QER, nPairsBatch, 1, w);
-			int64_t et1 = __rdtsc();
-			workTicks[CLMUL * tid] += (et1 - st1);
+    roi_phase_t roi_kernel = roi_phase("getScores");
+    roi_phase_t roi_batches = roi_phase("batches");
+    roi_begin(roi_kernel);
+
+	if (sched) {
+		int64_t numTasks = schedulePairs(seqPairArray, numPairs, order, schedArray, tasks, taskSize);
+
+		#pragma omp parallel num_threads(numThreads)
+		{
+			int tid = omp_get_thread_num();
+			roi_thread_begin(roi_batches);
+			#pragma omp for schedule(dynamic, 1)
+			for (int64_t t = 0; t < numTasks; t++) {
+				SeqPair *pairs = schedArray + tasks[t].first;
+				roi_task_begin(roi_batches);
+				scoreBatch(bsw[tid], pairs, seqBufRef, seqBufQer, tasks[t].numPairs, w,
+						   cigars ? cigars + tasks[t].first / taskSize : NULL);
+				roi_task_end(roi_batches, tasks[t].cells);
+			}
+			roi_thread_end(roi_batches);
+		}
+
+		for (size_t i = 0; i < numPairs; i++) {
+			SeqPair &sp = seqPairArray[order[i]];
+			int64_t id = sp.id;
+			sp = schedArray[i];
+			sp.id = id;
+		}
+	}
+	else {
+		#pragma omp parallel num_threads(numThreads)
+		{
+			int tid = omp_get_thread_num();
+			roi_thread_begin(roi_batches);
+			#pragma omp for schedule(dynamic, 1) 
+			for (int64_t i = 0; i < roundNumPairs; i += batchSize) {
+				int nPairsBatch = (numPairs - i) >= batchSize ? batchSize : numPairs - i;
+				double batchCells = 0;
+				for (int j = 0; j < nPairsBatch; ++j) {
+					batchCells += (double)seqPairArray[i + j].len1 * seqPairArray[i + j].len2;
+				}
+				roi_task_begin(roi_batches);
+				scoreBatch(bsw[tid], seqPairArray + i, seqBufRef, seqBufQer, nPairsBatch, w,
+						   cigars ? cigars + i / batchSize : NULL);
+				roi_task_end(roi_batches, batchCells);
+			}
+			roi_thread_end(roi_batches);
 		}
-		printf("%d] workTicks = %ld\n", tid, workTicks[CLMUL * tid]);  
 	}
 
     totalTicks += __rdtsc() - startTick;
 
-#if DYNAMORIO_ANALYSIS
-	__DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-	__itt_pause();
-#endif
-#if FAPP_ANALYSIS
-	fapp_stop("getScores", 1, 0);
-#endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	printf("Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
-
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-	}
-
-	printf("Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
-#endif
-
-#if __AVX512BW__
-	printf("Executed AVX512 vector code...\n");
-#elif __AVX2__
-	printf("Executed AVX2 vector code...\n");
-#elif __SSE2__
-	printf("Executed SSE2 vector code...\n");
-#elif __ARM_FEATURE_SVE
-	printf("Executed SVE vector code...\n");
-#else
-	printf("Executed serial code...\n");
-#endif
+    roi_end(roi_kernel);
+
+	if (BandedPairWiseSW::simdWidth() == BSW_SIMD_SCALAR)
+		printf("Executed serial code...\n");
+	else
+		printf("Executed %s vector code...\n", BandedPairWiseSW::simdName());
 
 	tim = __rdtsc();
 	sleep(1);
 	freq = __rdtsc() - tim;
 	
-	for (int64_t i = 0; i < roundNumPairs; ++i) {
-		fprintf(stderr, "[%d] score=%d\n", i, seqPairArray[i].score);
-    }
+	if (cigar) {
+		// Index of every pair in the batches
+		int64_t *pos = (int64_t *)malloc(max_(numPairs, 1) * sizeof(int64_t));
+		for (size_t i = 0; i < numPairs; ++i) {
+			pos[sched ? order[i] : i] = i;
+		}
+		for (size_t i = 0; i < numPairs; ++i) {
+			const BswCigars *c = cigars + pos[i] / cigarBatchSize;
+			int64_t k = pos[i] % cigarBatchSize;
+			fprintf(stderr, "[%d] score=%d cigar=", i, seqPairArray[i].score);
+			printCigar(stderr, c->ops + c->start[2 * k], c->len[2 * k]);
+			fprintf(stderr, " gcigar=");
+			printCigar(stderr, c->ops + c->start[2 * k + 1], c->len[2 * k + 1]);
+			fputc('\n', stderr);
+		}
+		free(pos);
+	}
+	else {
+		for (int64_t i = 0; i < roundNumPairs; ++i) {
+			fprintf(stderr, "[%d] score=%d\n", i, seqPairArray[i].score);
+		}
+	}
 
 	printf("Processor freq: %0.2lf MHz\n", freq/1e6);
 
@@ -414,16 +579,50 @@ int main(int argc, char *argv[])
 	printf("Read time = %0.2lf s\n", readTim/freq);
 	printf("Overall SW cycles = %ld, %0.2lf s\n", totalTicks, totalTicks * 1.0 / freq);
 	printf("Total Pairs processed: %d\n", numPairs);
-    
-    int64_t sumTicks = 0;
-    int64_t maxTicks = 0;
-    for(int i = 0; i < numThreads; i++)
-    {
-        sumTicks += workTicks[CLMUL * i];
-        if(workTicks[CLMUL * i] > maxTicks) maxTicks = workTicks[CLMUL * i];
-    }
-    double avgTicks = (sumTicks * 1.0) / numThreads;
-    printf("avgTicks = %lf, maxTicks = %ld, load imbalance = %lf\n", avgTicks, maxTicks, maxTicks/avgTicks);
+
+	uint64_t numPairs8 = 0, numPairs8Overflow = 0, numPairs16 = 0, numPairsIntra = 0, numPairsScalar = 0;
+	uint64_t laneCells = 0, vectorCells = 0;
+	for (int i = 0; i < numThreads; i++) {
+		laneCells += bsw[i]->laneCells;
+		vectorCells += bsw[i]->vectorCells;
+		numPairs8 += bsw[i]->numPairs8;
+		numPairs8Overflow += bsw[i]->numPairs8Overflow;
+		numPairs16 += bsw[i]->numPairs16;
+		numPairsIntra += bsw[i]->numPairsIntra;
+		numPairsScalar += bsw[i]->numPairsScalar;
+	}
+	if (bits == 0 && !cigar) {
+		printf("Pairs with 8 bits: %ld (%ld rerun with 16 bits), 16 bits: %ld, intra-sequence: %ld, scalar: %ld\n",
+			   numPairs8, numPairs8Overflow, numPairs16, numPairsIntra, numPairsScalar);
+	}
+	// Cells of the pairs over the cells computed by the SIMD kernels.
+	double laneUtilization = vectorCells > 0 ? (double)laneCells / vectorCells : 0;
+	if (BandedPairWiseSW::simdWidth() != BSW_SIMD_SCALAR && !cigar) {
+		printf("Lane utilization: %0.2lf%% (%s scheduling%s)\n", 100 * laneUtilization,
+			   sched ? "length-binned" : "input order", refill ? ", lane refill" : "");
+	}
+
+	double numCells = 0;
+	for (size_t i = 0; i < numPairs; ++i) {
+		numCells += (double)seqPairArray[i].len1 * seqPairArray[i].len2;
+	}
+	roi_result_str("kernel", "bsw");
+	roi_result_str("input", pairFileName);
+	roi_result_num("threads", numThreads);
+	roi_result_str("simd", BandedPairWiseSW::simdName());
+	roi_result_num("io_seconds", ioSeconds);
+	roi_result_throughput("cells", numCells);
+	if (bits == 0 && !cigar) {
+		roi_result_num("pairs8", numPairs8);
+		roi_result_num("pairs8_overflow", numPairs8Overflow);
+		roi_result_num("pairs16", numPairs16);
+		roi_result_num("pairs_intra", numPairsIntra);
+		roi_result_num("pairs_scalar", numPairsScalar);
+	}
+	roi_result_num("sched", sched);
+	roi_result_num("lane_utilization", laneUtilization);
+	roi_result_num("cigar", cigar);
+	roi_result_num("refill", refill);
 
 
 	// printf("SW cells(T)  = %ld\n", SW_cells);
@@ -448,14 +647,33 @@ int main(int argc, char *argv[])
 
 	/**** free memory *****/
 	_mm_free(seqPairArray);
-	_mm_free(seqBufRef);
-	_mm_free(seqBufQer); 
+	if (binaryInput) {
+		pairFileClose(&pf);
+	}
+	else {
+		_mm_free(seqBufRef);
+		_mm_free(seqBufQer); 
+		fclose(pairFile);
+	}
+	if (cigar) {
+		for (int64_t i = 0; i <= (int64_t)(numPairs + cigarBatchSize - 1) / cigarBatchSize; i++) {
+			free(cigars[i].ops);
+			free(cigars[i].start);
+			free(cigars[i].len);
+		}
+		free(cigars);
+	}
+	if (sched) {
+		_mm_free(schedArray);
+		free(order);
+		free(tasks);
+	}
     // bsw->getTicks();
     for (int i = 0; i < numThreads; i++) {
         bsw[i]->getTicks();
 	    delete bsw[i];
     }
 
-	fclose(pairFile);
+	roi_finalize();
 	return EXIT_SUCCESS;
 }
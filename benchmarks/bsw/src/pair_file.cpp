@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pair_file.h"
+
+#define PAIR_FILE_ALIGN 64
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t numPairs;
+    uint64_t refBases;
+    uint64_t qerBases;
+    uint64_t numAmbig;
+} PairFileHeader;
+
+static inline size_t alignUp(size_t x)
+{
+    return (x + PAIR_FILE_ALIGN - 1) / PAIR_FILE_ALIGN * PAIR_FILE_ALIGN;
+}
+
+static void corrupt(const char *path)
+{
+    fprintf(stderr, "ERROR! %s is not a valid pair file of version %d.\n", path, PAIR_FILE_VERSION);
+    exit(EXIT_FAILURE);
+}
+
+int pairFileDetect(const char *path)
+{
+    uint64_t magic = 0;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    size_t n = fread(&magic, sizeof(magic), 1, fp);
+    fclose(fp);
+    return n == 1 && magic == PAIR_FILE_MAGIC;
+}
+
+// Bases of packed[first, first + n) to one byte each.
+static void unpack2bit(const uint8_t *packed, uint64_t first, uint64_t n, uint8_t *out)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t p = first + i;
+        out[i] = (packed[p >> 2] >> ((p & 3) << 1)) & 3;
+    }
+}
+
+void pairFileOpen(const char *path, PairFile *pf)
+{
+    memset(pf, 0, sizeof(PairFile));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("ERROR! Unable to stat the pair file");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < alignUp(sizeof(PairFileHeader))) {
+        corrupt(path);
+    }
+    // Private mapping: the kernels do not write the sequences, so no page
+    // is ever copied.
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("ERROR! Unable to map the pair file");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    pf->map = map;
+    pf->mapSize = st.st_size;
+
+    const PairFileHeader *h = (const PairFileHeader *)map;
+    if (h->magic != PAIR_FILE_MAGIC || h->version != PAIR_FILE_VERSION) {
+        corrupt(path);
+    }
+    int packed = (h->flags & PAIR_FILE_2BIT) != 0;
+    size_t offBytes = alignUp((h->numPairs + 1) * sizeof(uint64_t));
+    size_t refBytes = alignUp(packed ? (h->refBases + 3) / 4 : h->refBases);
+    size_t qerBytes = alignUp(packed ? (h->qerBases + 3) / 4 : h->qerBases);
+    size_t pos = alignUp(sizeof(PairFileHeader));
+    size_t refOffPos = pos;  pos += offBytes;
+    size_t qerOffPos = pos;  pos += offBytes;
+    size_t h0Pos = pos;      pos += alignUp(h->numPairs * sizeof(int32_t));
+    size_t refPos = pos;     pos += refBytes;
+    size_t qerPos = pos;     pos += qerBytes;
+    size_t ambigPos = pos;   pos += h->numAmbig * sizeof(uint64_t);
+    if (pos > (size_t)st.st_size) {
+        corrupt(path);
+    }
+
+    uint8_t *base = (uint8_t *)map;
+    pf->numPairs = h->numPairs;
+    pf->refOff = (const uint64_t *)(base + refOffPos);
+    pf->qerOff = (const uint64_t *)(base + qerOffPos);
+    pf->h0 = (const int32_t *)(base + h0Pos);
+    // The kernels trust the offsets, check that every pair is within the
+    // sequence sections.
+    if (pf->refOff[h->numPairs] != h->refBases || pf->qerOff[h->numPairs] != h->qerBases) {
+        corrupt(path);
+    }
+    for (uint64_t i = 0; i < h->numPairs; i++) {
+        if (pf->refOff[i] > pf->refOff[i + 1] || pf->qerOff[i] > pf->qerOff[i + 1]) {
+            corrupt(path);
+        }
+    }
+
+    if (!packed) {
+        pf->seqBufRef = base + refPos;
+        pf->seqBufQer = base + qerPos;
+        return;
+    }
+
+    uint64_t numBases = h->refBases + h->qerBases;
+    pf->unpacked = (uint8_t *)malloc(alignUp(numBases));
+    if (pf->unpacked == NULL) {
+        fprintf(stderr, "ERROR! Unable to allocate %0.3f GB for the sequences.\n",
+                numBases * 1.0 / (1024 * 1024 * 1024));
+        exit(EXIT_FAILURE);
+    }
+    pf->seqBufRef = pf->unpacked;
+    pf->seqBufQer = pf->unpacked + h->refBases;
+    #pragma omp parallel
+    {
+        const uint64_t chunk = 1 << 20;
+        #pragma omp for schedule(dynamic, 1)
+        for (uint64_t i = 0; i < h->refBases; i += chunk) {
+            unpack2bit(base + refPos, i, h->refBases - i < chunk ? h->refBases - i : chunk, pf->seqBufRef + i);
+        }
+        #pragma omp for schedule(dynamic, 1)
+        for (uint64_t i = 0; i < h->qerBases; i += chunk) {
+            unpack2bit(base + qerPos, i, h->qerBases - i < chunk ? h->qerBases - i : chunk, pf->seqBufQer + i);
+        }
+    }
+    const uint64_t *ambig = (const uint64_t *)(base + ambigPos);
+    for (uint64_t i = 0; i < h->numAmbig; i++) {
+        if (ambig[i] >= numBases) {
+            corrupt(path);
+        }
+        pf->unpacked[ambig[i]] = 4;
+    }
+}
+
+void pairFileClose(PairFile *pf)
+{
+    munmap(pf->map, pf->mapSize);
+    free(pf->unpacked);
+    memset(pf, 0, sizeof(PairFile));
+}
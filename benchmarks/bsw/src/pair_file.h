@@ -0,0 +1,60 @@
+/**
+ * Binary input of bsw, written by scripts/pairs2bin.py from the text format.
+ *
+ *   header  uint64 magic (PAIR_FILE_MAGIC), uint32 version, uint32 flags,
+ *           uint64 numPairs, refBases, qerBases and numAmbig, padded to 64
+ *           bytes
+ *   refOff  uint64[numPairs + 1], start of every reference in ref (in bases)
+ *   qerOff  uint64[numPairs + 1], start of every query in qer
+ *   h0      int32[numPairs], seed score of every pair
+ *   ref     the references, one after the other
+ *   qer     the queries
+ *   ambig   uint64[numAmbig], with PAIR_FILE_2BIT only
+ *
+ * Every section starts at a multiple of 64 bytes and the values are
+ * little-endian. The length of pair i is refOff[i + 1] - refOff[i], there
+ * are no fixed-size slots.
+ *
+ * By default, the bases take one byte each, with the codes used by the
+ * kernels (0-3, 4 for an ambiguous base), so the sequences are used in place
+ * in the mapping of the file. With PAIR_FILE_2BIT, four bases are packed per
+ * byte (the first one in the lowest bits), the ambiguous ones are stored as
+ * 0 and ambig holds their positions (in ref, then in qer counting from
+ * refBases). These are unpacked on load.
+ */
+
+#ifndef BSW_PAIR_FILE_H
+#define BSW_PAIR_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAIR_FILE_MAGIC 0x3152494150575342L // "BSWPAIR1"
+#define PAIR_FILE_VERSION 1
+#define PAIR_FILE_2BIT 0x1
+
+typedef struct {
+    uint64_t numPairs;
+    const uint64_t *refOff, *qerOff;
+    const int32_t *h0;
+    // Bases of the pairs, one per byte, at refOff/qerOff.
+    uint8_t *seqBufRef, *seqBufQer;
+
+    void *map;
+    size_t mapSize;
+    uint8_t *unpacked; // PAIR_FILE_2BIT only.
+} PairFile;
+
+/**
+ * Return 1 if @path starts with PAIR_FILE_MAGIC.
+ */
+int pairFileDetect(const char *path);
+
+/**
+ * Map @path into @pf, exit on error.
+ */
+void pairFileOpen(const char *path, PairFile *pf);
+
+void pairFileClose(PairFile *pf);
+
+#endif // BSW_PAIR_FILE_H
@@ -0,0 +1,562 @@
+/**
+ * Cell-update throughput (GCUPS) of the Smith-Waterman engines of the
+ * benchmarks, on synthetic pairs of controlled lengths and divergence:
+ *
+ *   ksw_extend   ksw_extend2() of bwa-mem2, scalar banded extension
+ *   bsw_scalar   BandedPairWiseSW::scalarBandedSWAWrapper()
+ *   bsw          BandedPairWiseSW::getScores(), 8 bits rerun with 16
+ *   bsw16        BandedPairWiseSW::getScores16()
+ *   bsw_intra    BandedPairWiseSW::getScoresIntra()
+ *   bsw_refill   BandedPairWiseSW::getScores16() with refill
+ *   ksw_align8   ksw_align2() of bwa-mem2, SSE2 local alignment, 8 bits
+ *   ksw_align16  ksw_align2(), 16 bits
+ *   kswv8        kswv::getScores8() of bwa-mem2, AVX512BW, 8 bits
+ *   kswv16       kswv::getScores16(), 16 bits
+ *
+ * The extension engines are checked against ksw_extend, the local ones
+ * against ksw_align8/16 with the same bits. The cells of a pair are
+ * len1 x len2, as in main_bsw, also for the banded engines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <omp.h>
+
+#include "bandedSWA.h"
+#include "roi.h"
+#include "ksw.h"
+#if GCUPS_KSWV
+// Includes the bandedSWA.h of bwa-mem2, skipped for the one above: the
+// SeqPair of both is the same.
+#include "kswv.h"
+#endif
+
+#define DEFAULT_MATCH 1
+#define DEFAULT_MISMATCH 4
+#define DEFAULT_OPEN 6
+#define DEFAULT_EXTEND 1
+#define DEFAULT_AMBIG -1
+
+// Minimum score of the second best local hit (KSW_XSUBO), as in the mate
+// rescue of bwa-mem2 (min_seed_len x match).
+#define LOCAL_MIN_SUBO 19
+
+// Batches are a multiple of the widest group of all the engines, so only the
+// last one is padded by the kernels.
+#define BATCH_GROUP 64
+
+enum {
+    ENG_KSW_EXTEND, ENG_BSW_SCALAR, ENG_BSW, ENG_BSW16, ENG_BSW_INTRA, ENG_BSW_REFILL,
+    ENG_KSW_ALIGN8, ENG_KSW_ALIGN16, ENG_KSWV8, ENG_KSWV16, NUM_ENGINES
+};
+
+typedef struct {
+    const char *name;
+    int local; // local alignment (ksw_align2) instead of extension
+    int bits;  // 8 or 16 for the local engines
+    int ref;   // engine the results are checked against
+} Engine;
+
+static const Engine engines[NUM_ENGINES] = {
+    {"ksw_extend", 0, 0, ENG_KSW_EXTEND},
+    {"bsw_scalar", 0, 0, ENG_KSW_EXTEND},
+    {"bsw", 0, 0, ENG_KSW_EXTEND},
+    {"bsw16", 0, 0, ENG_KSW_EXTEND},
+    {"bsw_intra", 0, 0, ENG_KSW_EXTEND},
+    {"bsw_refill", 0, 0, ENG_KSW_EXTEND},
+    {"ksw_align8", 1, 8, ENG_KSW_ALIGN8},
+    {"ksw_align16", 1, 16, ENG_KSW_ALIGN16},
+    {"kswv8", 1, 8, ENG_KSW_ALIGN8},
+    {"kswv16", 1, 16, ENG_KSW_ALIGN16},
+};
+
+int32_t w_match, w_mismatch, w_open, w_extend, w_ambig, numThreads = 1, batchSize = 1024;
+int32_t simdWidth = BSW_SIMD_AUTO;
+int32_t numPairs = 100000, minLen = 100, maxLen = 150, tail = 10, band = 100, h0 = 30;
+double divergence = 0.05, indelFrac = 0.2;
+uint64_t seed = 11;
+int32_t check = 1;
+const char *engineList = "all";
+int8_t mat[25];
+int zdrop = 100, end_bonus = 5;
+
+void bwa_fill_scmat(int a, int b, int ambig, int8_t mat[25]) {
+    int i, j, k;
+    for (i = k = 0; i < 4; ++i) {
+        for (j = 0; j < 4; ++j)
+            mat[k++] = i == j? a : -b;
+        mat[k++] = ambig; // ambiguous base
+    }
+    for (j = 0; j < 5; ++j) mat[k++] = ambig;
+}
+
+void parseCmdLine(int argc, char *argv[])
+{
+    w_match = DEFAULT_MATCH;
+    w_mismatch = DEFAULT_MISMATCH;
+    w_open = DEFAULT_OPEN;
+    w_extend = DEFAULT_EXTEND;
+    w_ambig = DEFAULT_AMBIG;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-engine") == 0) { // comma-separated list, or all
+            engineList = argv[i + 1];
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            numPairs = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-len") == 0) { // query length, or min:max
+            if (sscanf(argv[i + 1], "%d:%d", &minLen, &maxLen) == 1)
+                maxLen = minLen;
+        }
+        if (strcmp(argv[i], "-tail") == 0) { // reference bases past the query
+            tail = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-div") == 0) { // differences per query base
+            divergence = atof(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-indel") == 0) { // fraction of the differences
+            indelFrac = atof(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-w") == 0) {
+            band = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-h0") == 0) {
+            h0 = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        if (strcmp(argv[i], "-t") == 0) {
+            numThreads = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-b") == 0) {
+            batchSize = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-simd") == 0) { // width of the bsw kernels, 0 for scalar
+            simdWidth = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-check") == 0) { // 0: do not check the results
+            check = atoi(argv[i + 1]);
+        }
+    }
+    if (numPairs <= 0 || minLen <= 0 || maxLen < minLen || tail < 0 || numThreads <= 0 ||
+        batchSize <= 0 || divergence < 0 || divergence > 1 || indelFrac < 0 || indelFrac > 1) {
+        fprintf(stderr, "ERROR! Invalid parameters.\n");
+        exit(EXIT_FAILURE);
+    }
+    batchSize = (batchSize + BATCH_GROUP - 1) / BATCH_GROUP * BATCH_GROUP;
+}
+
+// -------------------------------------------------------------------------
+// SYNTHETIC PAIRS
+// -------------------------------------------------------------------------
+// The query is random, of minLen to maxLen bases. The reference is a copy of
+// the query with divergence differences per base, indelFrac of them
+// insertions or deletions of one base, followed by tail random bases.
+
+static inline uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline double uniform(uint64_t *state)
+{
+    return (splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Bases of every pair at idr/idq, id is the index of the pair.
+void generatePairs(SeqPair *pairs, uint8_t **seqBufRef, uint8_t **seqBufQer,
+                   int32_t *maxLen1, int32_t *maxLen2)
+{
+    int64_t maxRef = (int64_t)2 * maxLen + tail;
+    uint8_t *ref = (uint8_t *)malloc((size_t)numPairs * maxRef);
+    uint8_t *qer = (uint8_t *)malloc((size_t)numPairs * maxLen);
+    int64_t refBases = 0, qerBases = 0;
+    uint64_t state = seed;
+    *maxLen1 = *maxLen2 = 0;
+
+    for (int32_t i = 0; i < numPairs; i++) {
+        SeqPair &sp = pairs[i];
+        int32_t len2 = minLen + splitmix64(&state) % (maxLen - minLen + 1);
+        uint8_t *q = qer + qerBases, *r = ref + refBases;
+        int32_t len1 = 0;
+        for (int32_t k = 0; k < len2; k++)
+            q[k] = splitmix64(&state) & 3;
+        for (int32_t k = 0; k < len2; k++) {
+            double u = uniform(&state);
+            if (u >= divergence) {
+                r[len1++] = q[k];
+            }
+            else if (u >= divergence * indelFrac) {
+                r[len1++] = (q[k] + 1 + splitmix64(&state) % 3) & 3;
+            }
+            else if (splitmix64(&state) & 1) {
+                r[len1++] = splitmix64(&state) & 3;
+                r[len1++] = q[k];
+            }
+        }
+        for (int32_t k = 0; k < tail; k++)
+            r[len1++] = splitmix64(&state) & 3;
+        if (len1 == 0)
+            r[len1++] = 0;
+
+        sp.id = i;
+        sp.idr = refBases;
+        sp.idq = qerBases;
+        sp.len1 = len1;
+        sp.len2 = len2;
+        sp.h0 = h0;
+        sp.seqid = sp.regid = sp.score = sp.tle = sp.gtle = sp.qle = -1;
+        sp.gscore = sp.max_off = -1;
+        refBases += len1;
+        qerBases += len2;
+        *maxLen1 = max_(*maxLen1, len1);
+        *maxLen2 = max_(*maxLen2, len2);
+    }
+    *seqBufRef = ref;
+    *seqBufQer = qer;
+}
+
+// -------------------------------------------------------------------------
+// ENGINES
+// -------------------------------------------------------------------------
+
+typedef struct {
+    BandedPairWiseSW *bsw;
+#if GCUPS_KSWV
+    kswv *kv;
+#endif
+} ThreadState;
+
+int engineSupported(int e)
+{
+    if (e == ENG_KSWV8 || e == ENG_KSWV16) {
+#if GCUPS_KSWV
+        return __builtin_cpu_supports("avx512bw");
+#else
+        return 0;
+#endif
+    }
+    return 1;
+}
+
+// The 8-bit local engines keep the end of the query in 8 bits, bwa-mem2
+// only runs them on queries that score less than 250.
+int engineFits(int e)
+{
+    return !(engines[e].local && engines[e].bits == 8) || maxLen * w_match < 250;
+}
+
+const char *engineSimd(int e)
+{
+    switch (e) {
+    case ENG_KSW_EXTEND:
+    case ENG_BSW_SCALAR:
+        return "scalar";
+    case ENG_KSW_ALIGN8:
+    case ENG_KSW_ALIGN16:
+#if (__ARM_FEATURE_SVE)
+        return "SVE";
+#else
+        return "SSE2";
+#endif
+    case ENG_KSWV8:
+    case ENG_KSWV16:
+        return "AVX512BW";
+    default:
+        return BandedPairWiseSW::simdName();
+    }
+}
+
+// Score pairs [0, n) of a batch. The local engines write the result of pair
+// p to aln[p.regid].
+void runBatch(int e, ThreadState *ts, SeqPair *pairs, int32_t n,
+              uint8_t *seqBufRef, uint8_t *seqBufQer, kswr_t *aln)
+{
+    switch (e) {
+    case ENG_KSW_EXTEND:
+        for (int32_t i = 0; i < n; i++) {
+            SeqPair *p = pairs + i;
+            p->score = ksw_extend2(p->len2, seqBufQer + p->idq, p->len1, seqBufRef + p->idr, 5, mat,
+                                   w_open, w_extend, w_open, w_extend, band, end_bonus, zdrop, p->h0,
+                                   &p->qle, &p->tle, &p->gtle, &p->gscore, &p->max_off);
+        }
+        break;
+    case ENG_BSW_SCALAR:
+        ts->bsw->scalarBandedSWAWrapper(pairs, seqBufRef, seqBufQer, n, 1, band);
+        break;
+    case ENG_BSW:
+        ts->bsw->getScores(pairs, seqBufRef, seqBufQer, n, 1, band);
+        break;
+    case ENG_BSW16:
+    case ENG_BSW_REFILL:
+        ts->bsw->refill = e == ENG_BSW_REFILL;
+        ts->bsw->getScores16(pairs, seqBufRef, seqBufQer, n, 1, band);
+        break;
+    case ENG_BSW_INTRA:
+        ts->bsw->getScoresIntra(pairs, seqBufRef, seqBufQer, n, 1, band);
+        break;
+    case ENG_KSW_ALIGN8:
+    case ENG_KSW_ALIGN16:
+        for (int32_t i = 0; i < n; i++) {
+            SeqPair *p = pairs + i;
+            aln[p->regid] = ksw_align2(p->len2, seqBufQer + p->idq, p->len1, seqBufRef + p->idr, 5, mat,
+                                       w_open, w_extend, w_open, w_extend, p->h0, NULL);
+        }
+        break;
+#if GCUPS_KSWV
+    case ENG_KSWV8:
+        ts->kv->getScores8(pairs, seqBufRef, seqBufQer, aln, n, 1, 0);
+        break;
+    case ENG_KSWV16:
+        ts->kv->getScores16(pairs, seqBufRef, seqBufQer, aln, n, 1, 0);
+        break;
+#endif
+    }
+}
+
+// Copy of the pairs for engine e: id is the index within the batch for bsw,
+// regid the index of the pair for the local engines, and h0 their xtra.
+void preparePairs(int e, const SeqPair *pairs, SeqPair *dst)
+{
+    int32_t xtra = KSW_XSUBO | LOCAL_MIN_SUBO | (engines[e].bits == 8 ? KSW_XBYTE : 0);
+    for (int32_t i = 0; i < numPairs; i++) {
+        dst[i] = pairs[i];
+        dst[i].id = i % batchSize;
+        if (engines[e].local) {
+            dst[i].regid = i;
+            dst[i].h0 = xtra;
+        }
+    }
+}
+
+// Run engine e over the pairs in batches of batchSize, return the seconds.
+double runEngine(int e, ThreadState *ts, SeqPair *pairs, uint8_t *seqBufRef, uint8_t *seqBufQer,
+                 kswr_t *aln, const double *batchCells)
+{
+    int64_t numBatches = ((int64_t)numPairs + batchSize - 1) / batchSize;
+    roi_phase_t roi_engine = roi_phase(engines[e].name);
+    roi_phase_t roi_batches = roi_phase("batches");
+
+    double start = roi_wtime();
+    roi_begin(roi_engine);
+    #pragma omp parallel num_threads(numThreads)
+    {
+        int tid = omp_get_thread_num();
+        roi_thread_begin(roi_batches);
+        #pragma omp for schedule(dynamic, 1)
+        for (int64_t b = 0; b < numBatches; b++) {
+            int64_t first = b * batchSize;
+            int32_t n = min_((int64_t)batchSize, numPairs - first);
+            roi_task_begin(roi_batches);
+            runBatch(e, ts + tid, pairs + first, n, seqBufRef, seqBufQer, aln);
+            roi_task_end(roi_batches, batchCells[b]);
+        }
+        roi_thread_end(roi_batches);
+    }
+    roi_end(roi_engine);
+    return roi_wtime() - start;
+}
+
+// Results of the reference engine r, outside of the ROI.
+void runReference(int r, SeqPair *pairs, uint8_t *seqBufRef, uint8_t *seqBufQer, kswr_t *aln)
+{
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic, BATCH_GROUP)
+    for (int32_t i = 0; i < numPairs; i++)
+        runBatch(r, NULL, pairs + i, 1, seqBufRef, seqBufQer, aln);
+}
+
+// Number of pairs whose results differ from the ones of the reference.
+int64_t compareResults(int e, const SeqPair *pairs, const kswr_t *aln,
+                       const SeqPair *refPairs, const kswr_t *refAln)
+{
+    int64_t mismatches = 0;
+    for (int32_t i = 0; i < numPairs; i++) {
+        int same;
+        if (engines[e].local) {
+            const kswr_t *a = aln + i, *r = refAln + i;
+            same = a->score == r->score && a->te == r->te && a->qe == r->qe &&
+                   a->score2 == r->score2 && a->te2 == r->te2;
+            if (!same && mismatches < 5) {
+                fprintf(stderr, "%s: pair %d: score=%d te=%d qe=%d score2=%d te2=%d, expected %d %d %d %d %d\n",
+                        engines[e].name, i, a->score, a->te, a->qe, a->score2, a->te2,
+                        r->score, r->te, r->qe, r->score2, r->te2);
+            }
+        }
+        else {
+            const SeqPair *p = pairs + i, *r = refPairs + i;
+            same = p->score == r->score && p->qle == r->qle && p->tle == r->tle &&
+                   p->gtle == r->gtle && p->gscore == r->gscore;
+            if (!same && mismatches < 5) {
+                fprintf(stderr, "%s: pair %d: score=%d qle=%d tle=%d gtle=%d gscore=%d, expected %d %d %d %d %d\n",
+                        engines[e].name, i, p->score, p->qle, p->tle, p->gtle, p->gscore,
+                        r->score, r->qle, r->tle, r->gtle, r->gscore);
+            }
+        }
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        fprintf(stderr, "usage: sw_gcups [-engine <all|name,...>] [-n <pairs>] [-len <min>[:<max>]] [-tail <bases>] "
+                        "[-div <rate>] [-indel <fraction>] [-w <band>] [-h0 <score>] [-seed <seed>] "
+                        "[-t <threads>] [-b <batch_size>] [-simd <512|256|128|0>] [-check <1|0>]\n");
+        exit(EXIT_FAILURE);
+    }
+    parseCmdLine(argc, argv);
+    if (BandedPairWiseSW::setSimdWidth(simdWidth) != 0) {
+        fprintf(stderr, "ERROR! %d-bit kernels not supported on this CPU.\n", simdWidth);
+        exit(EXIT_FAILURE);
+    }
+
+    int selected[NUM_ENGINES] = {0};
+    int numSelected = 0;
+    if (strcmp(engineList, "all") == 0) {
+        for (int e = 0; e < NUM_ENGINES; e++) {
+            numSelected += selected[e] = engineSupported(e) && engineFits(e);
+            if (engineSupported(e) && !engineFits(e))
+                printf("Skipping %s: queries too long for 8 bits.\n", engines[e].name);
+        }
+    }
+    else {
+        char *list = strdup(engineList), *save = NULL;
+        for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            int e = 0;
+            while (e < NUM_ENGINES && strcmp(engines[e].name, name) != 0)
+                e++;
+            if (e == NUM_ENGINES || !engineSupported(e) || !engineFits(e)) {
+                fprintf(stderr, "ERROR! Engine %s %s.\n", name,
+                        e == NUM_ENGINES ? "does not exist" :
+                        !engineSupported(e) ? "not supported on this CPU or build" :
+                        "needs queries that score less than 250");
+                exit(EXIT_FAILURE);
+            }
+            numSelected += !selected[e];
+            selected[e] = 1;
+        }
+        free(list);
+    }
+
+    double ioStart = roi_wtime();
+    bwa_fill_scmat(w_match, w_mismatch, w_ambig, mat);
+    // The kernels pad the last batch to a full group and prefetch past it.
+    size_t allocPairs = (size_t)numPairs + 2 * BATCH_GROUP;
+    SeqPair *pairs = (SeqPair *)_mm_malloc(allocPairs * sizeof(SeqPair), 64);
+    SeqPair *runPairs = (SeqPair *)_mm_malloc(allocPairs * sizeof(SeqPair), 64);
+    uint8_t *seqBufRef, *seqBufQer;
+    int32_t maxLen1, maxLen2;
+    generatePairs(pairs, &seqBufRef, &seqBufQer, &maxLen1, &maxLen2);
+
+    int64_t numBatches = ((int64_t)numPairs + batchSize - 1) / batchSize;
+    double *batchCells = (double *)calloc(numBatches, sizeof(double));
+    double numCells = 0;
+    for (int32_t i = 0; i < numPairs; i++) {
+        batchCells[i / batchSize] += (double)pairs[i].len1 * pairs[i].len2;
+        numCells += (double)pairs[i].len1 * pairs[i].len2;
+    }
+
+    ThreadState *ts = (ThreadState *)calloc(numThreads, sizeof(ThreadState));
+    for (int i = 0; i < numThreads; i++) {
+        ts[i].bsw = new BandedPairWiseSW(w_open, w_extend, w_open, w_extend,
+                                         zdrop, end_bonus, mat,
+                                         w_match, w_mismatch, 1);
+#if GCUPS_KSWV
+        // The mismatch score, not the penalty, as in bwa-mem2.
+        if (selected[ENG_KSWV8] || selected[ENG_KSWV16])
+            ts[i].kv = new kswv(w_open, w_extend, w_open, w_extend, w_match, -w_mismatch, 1,
+                                maxLen1, maxLen2);
+#endif
+    }
+
+    // Results of the references, computed when first needed.
+    SeqPair *refPairs[NUM_ENGINES] = {NULL};
+    kswr_t *refAln[NUM_ENGINES] = {NULL};
+    kswr_t *aln = (kswr_t *)malloc(allocPairs * sizeof(kswr_t));
+    double ioSeconds = roi_wtime() - ioStart;
+
+    char input[256];
+    snprintf(input, sizeof(input), "synthetic n=%d len=%d:%d tail=%d div=%g indel=%g w=%d h0=%d seed=%lu",
+             numPairs, minLen, maxLen, tail, divergence, indelFrac, band, h0, (unsigned long)seed);
+    printf("Pairs: %s\n", input);
+    printf("Cells: %.4e (reference x query)\n", numCells);
+    printf("%-12s %-10s %7s %10s %10s %12s  %s\n",
+           "engine", "simd", "threads", "seconds", "GCUPS", "GCUPS/thread", "check");
+
+    int64_t totalMismatches = 0;
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        if (!selected[e])
+            continue;
+        preparePairs(e, pairs, runPairs);
+        double seconds = runEngine(e, ts, runPairs, seqBufRef, seqBufQer, aln, batchCells);
+        double gcups = numCells / seconds / 1e9;
+
+        char result[64] = "-";
+        int r = engines[e].ref;
+        if (check && r != e) {
+            if (refPairs[r] == NULL) {
+                refPairs[r] = (SeqPair *)_mm_malloc(allocPairs * sizeof(SeqPair), 64);
+                refAln[r] = (kswr_t *)malloc(allocPairs * sizeof(kswr_t));
+                preparePairs(r, pairs, refPairs[r]);
+                runReference(r, refPairs[r], seqBufRef, seqBufQer, refAln[r]);
+            }
+            int64_t mismatches = compareResults(e, runPairs, aln, refPairs[r], refAln[r]);
+            totalMismatches += mismatches;
+            if (mismatches == 0)
+                snprintf(result, sizeof(result), "ok (%s)", engines[r].name);
+            else
+                snprintf(result, sizeof(result), "%ld mismatches (%s)", mismatches, engines[r].name);
+        }
+        printf("%-12s %-10s %7d %10.4f %10.3f %12.3f  %s\n", engines[e].name, engineSimd(e),
+               numThreads, seconds, gcups, gcups / numThreads, result);
+
+        char key[64];
+        snprintf(key, sizeof(key), "gcups_%s", engines[e].name);
+        roi_result_num(key, gcups);
+        if (numSelected == 1) {
+            roi_result_str("algorithm", engines[e].name);
+            roi_result_str("simd", engineSimd(e));
+        }
+    }
+
+    roi_result_str("kernel", "sw_gcups");
+    roi_result_str("input", input);
+    roi_result_num("threads", numThreads);
+    roi_result_num("io_seconds", ioSeconds);
+    roi_result_num("check_mismatches", totalMismatches);
+    // The throughput of the runs of all the selected engines.
+    roi_result_throughput("cells", numCells * numSelected);
+    if (numSelected > 1)
+        roi_result_str("algorithm", engineList);
+
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        if (refPairs[e] != NULL) {
+            _mm_free(refPairs[e]);
+            free(refAln[e]);
+        }
+    }
+    for (int i = 0; i < numThreads; i++) {
+        delete ts[i].bsw;
+#if GCUPS_KSWV
+        delete ts[i].kv;
+#endif
+    }
+    free(ts);
+    free(aln);
+    free(batchCells);
+    _mm_free(runPairs);
+    _mm_free(pairs);
+    free(seqBufRef);
+    free(seqBufQer);
+
+    roi_finalize();
+    return totalMismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
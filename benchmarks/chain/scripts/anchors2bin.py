@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""
+Convert a text anchor file of chain to the binary format of src/anchor_file.h.
+
+Usage: anchors2bin.py ANCHORS.txt ANCHORS.bin
+
+chain detects the format of -i by its magic number, and maps binary files
+instead of parsing them.
+"""
+
+import argparse
+import struct
+import sys
+from array import array
+
+ANCHOR_FILE_MAGIC = 0x314E414E49414843
+ANCHOR_FILE_VERSION = 1
+ALIGN = 64
+SEG_SHIFT = 48
+
+
+def read_calls(f):
+    """Parameters and anchor lines of every call, as read_calls reads them."""
+    while True:
+        header = f.readline()
+        while header and not header.strip():
+            header = f.readline()
+        fields = header.split()
+        if len(fields) < 6:
+            return
+        n = int(fields[0])
+        params = (n, float(fields[1])) + tuple(int(v) for v in fields[2:6])
+        anchors = [f.readline() for _ in range(n)]
+        eor = f.readline()
+        if b'EOR' not in eor:
+            sys.exit('call with %d anchors is not closed by EOR' % n)
+        yield params, anchors
+
+
+def pad(out, size):
+    out.write(bytes(-size % ALIGN))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('anchors', help='text anchor file')
+    parser.add_argument('output', help='binary anchor file to write')
+    args = parser.parse_args()
+
+    calls = bytearray()
+    xs, ys = array('Q'), array('Q')
+    with open(args.anchors, 'rb') as f:
+        for i, (params, lines) in enumerate(read_calls(f)):
+            calls += struct.pack('<qfiiiii', *params, 0)
+            for line in lines:
+                fields = line.split()
+                if len(fields) != 2:
+                    sys.exit(f'{args.anchors}: call {i} is truncated')
+                xs.append(int(fields[0]))
+                ys.append(int(fields[1]))
+    q_span = array('i', (y >> 32 & 0xff for y in ys))
+    seg_id = array('i', (y >> SEG_SHIFT & 0xff for y in ys))
+
+    num_calls, num_anchors = len(calls) // 32, len(xs)
+    header = struct.pack('<QIIQQ', ANCHOR_FILE_MAGIC, ANCHOR_FILE_VERSION, 0,
+                         num_calls, num_anchors)
+    if sys.byteorder != 'little':
+        for a in (xs, ys, q_span, seg_id):
+            a.byteswap()
+    with open(args.output, 'wb') as out:
+        for section in (header, calls, xs, ys, q_span):
+            section = bytes(section)
+            out.write(section)
+            pad(out, len(section))
+        out.write(bytes(seg_id))
+    print(f'{num_calls} calls, {num_anchors} anchors', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "anchor_file.h"
+#include "host_data_io.h"
+
+#define ANCHOR_FILE_ALIGN 64
+
+struct anchor_file_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t n_calls;
+    uint64_t n_anchors;
+};
+
+static inline size_t align_up(size_t x) {
+    return (x + ANCHOR_FILE_ALIGN - 1) / ANCHOR_FILE_ALIGN * ANCHOR_FILE_ALIGN;
+}
+
+static void corrupt(const char *path) {
+    fprintf(stderr, "ERROR! %s is not a valid anchor file of version %d.\n", path, ANCHOR_FILE_VERSION);
+    exit(EXIT_FAILURE);
+}
+
+bool anchor_file_detect(const char *path) {
+    uint64_t magic = 0;
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    size_t n = fread(&magic, sizeof(magic), 1, fp);
+    fclose(fp);
+    return n == 1 && magic == ANCHOR_FILE_MAGIC;
+}
+
+void anchor_file_open(const char *path, std::vector<call_t> &calls, anchor_set_t &anchors) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("ERROR! Unable to stat the anchor file");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < align_up(sizeof(anchor_file_header_t))) {
+        corrupt(path);
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("ERROR! Unable to map the anchor file");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    anchors.map = map;
+    anchors.map_size = st.st_size;
+
+    const anchor_file_header_t *h = (const anchor_file_header_t *)map;
+    if (h->magic != ANCHOR_FILE_MAGIC || h->version != ANCHOR_FILE_VERSION) {
+        corrupt(path);
+    }
+    size_t pos = align_up(sizeof(anchor_file_header_t));
+    size_t calls_pos = pos;  pos += align_up(h->n_calls * sizeof(anchor_file_call_t));
+    size_t x_pos = pos;      pos += align_up(h->n_anchors * sizeof(uint64_t));
+    size_t y_pos = pos;      pos += align_up(h->n_anchors * sizeof(uint64_t));
+    size_t q_span_pos = pos; pos += align_up(h->n_anchors * sizeof(int32_t));
+    size_t seg_id_pos = pos; pos += h->n_anchors * sizeof(int32_t);
+    if (pos > (size_t)st.st_size) {
+        corrupt(path);
+    }
+
+    const uint8_t *base = (const uint8_t *)map;
+    anchors.n = h->n_anchors;
+    anchors.x = (const uint64_t *)(base + x_pos);
+    anchors.y = (const uint64_t *)(base + y_pos);
+    anchors.q_span = (const int32_t *)(base + q_span_pos);
+    anchors.seg_id = (const int32_t *)(base + seg_id_pos);
+
+    const anchor_file_call_t *fc = (const anchor_file_call_t *)(base + calls_pos);
+    anchor_idx_t first = 0;
+    calls.reserve(calls.size() + h->n_calls);
+    for (uint64_t i = 0; i < h->n_calls; i++) {
+        call_t call;
+        call.n = fc[i].n;
+        call.avg_qspan = fc[i].avg_qspan;
+        call.max_dist_x = fc[i].max_dist_x;
+        call.max_dist_y = fc[i].max_dist_y;
+        call.bw = fc[i].bw;
+        call.n_segs = fc[i].n_segs;
+        call.first = first;
+        if (call.n < 0 || call.n > anchors.n - first) {
+            corrupt(path);
+        }
+        first += call.n;
+        calls.push_back(call);
+    }
+    if (first != anchors.n) {
+        corrupt(path);
+    }
+    bind_calls(calls, anchors);
+}
+
+void anchor_file_close(anchor_set_t &anchors) {
+    if (anchors.map != nullptr) {
+        munmap(anchors.map, anchors.map_size);
+    }
+    anchors = anchor_set_t();
+}
@@ -0,0 +1,41 @@
+// Binary input of chain, written by scripts/anchors2bin.py from the text
+// format.
+//
+//   header  uint64 magic (ANCHOR_FILE_MAGIC), uint32 version, uint32 flags,
+//           uint64 n_calls and n_anchors, padded to 64 bytes
+//   calls   anchor_file_call_t[n_calls], the parameters of every call
+//   x       uint64[n_anchors], the anchors of the calls one after the other
+//   y       uint64[n_anchors]
+//   q_span  int32[n_anchors], y >> 32 & 0xff
+//   seg_id  int32[n_anchors], (y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT
+//
+// Every section starts at a multiple of 64 bytes and the values are
+// little-endian. The anchors of call i follow the ones of call i - 1, so the
+// file is used in place and nothing is parsed.
+
+#ifndef ANCHOR_FILE_H
+#define ANCHOR_FILE_H
+
+#include <vector>
+#include <cstdint>
+#include "host_data.h"
+
+#define ANCHOR_FILE_MAGIC 0x314e414e49414843ULL // "CHAINAN1"
+#define ANCHOR_FILE_VERSION 1
+
+struct anchor_file_call_t {
+    int64_t n;
+    float avg_qspan;
+    int32_t max_dist_x, max_dist_y, bw, n_segs;
+    int32_t pad;
+};
+
+// Return true if @path starts with ANCHOR_FILE_MAGIC.
+bool anchor_file_detect(const char *path);
+
+// Map @path into @anchors and append its calls to @calls, exit on error.
+void anchor_file_open(const char *path, std::vector<call_t> &calls, anchor_set_t &anchors);
+
+void anchor_file_close(anchor_set_t &anchors);
+
+#endif // ANCHOR_FILE_H
@@ -2,6 +2,7 @@
 #define HOST_INPUT_H
 
 #include <vector>
+#include <cstddef>
 #include <cstdint>
 
 typedef int64_t anchor_idx_t;
@@ -15,16 +16,38 @@ typedef int32_t peak_score_t;
 
 #define ANCHOR_NULL (anchor_idx_t)(-1)
 
-struct anchor_t {
-    uint64_t x;
-    uint64_t y;
+#define MM_SEED_SEG_SHIFT  48
+#define MM_SEED_SEG_MASK   (0xffULL<<(MM_SEED_SEG_SHIFT))
+
+// Anchors of all the calls, one array per field. As in minimap2, x is the
+// reference position (with the reference id and strand in the upper bits)
+// and y holds the query position in its lower 32 bits, the query span in
+// bits 32-39 and the segment id in bits 48-55. q_span and seg_id are split
+// out of y when the anchors are loaded.
+//
+// The arrays point into the mapping of a binary anchor file (see
+// anchor_file.h), or into the vectors below when read from text.
+struct anchor_set_t {
+    anchor_idx_t n = 0;
+    const uint64_t *x = nullptr, *y = nullptr;
+    const int32_t *q_span = nullptr, *seg_id = nullptr;
+
+    std::vector<uint64_t> x_buf, y_buf;
+    std::vector<int32_t> q_span_buf, seg_id_buf;
+
+    void *map = nullptr;
+    size_t map_size = 0;
 };
 
 struct call_t {
     anchor_idx_t n;
     float avg_qspan;
     int max_dist_x, max_dist_y, bw, n_segs;
-    std::vector<anchor_t> anchors;
+    // Anchors [first, first + n) of the anchor set, x to seg_id point at the
+    // first one.
+    anchor_idx_t first;
+    const uint64_t *x, *y;
+    const int32_t *q_span, *seg_id;
 };
 
 struct return_t {
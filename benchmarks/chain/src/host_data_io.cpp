@@ -1,53 +1,105 @@
+#include <cstdlib>
+#include <cstring>
+
 #include "host_data_io.h"
 #include "host_data.h"
 
-void skip_to_EOR(FILE *fp) {
-    const char *loc = "EOR";
-    while (*loc != '\0') {
-        if (fgetc(fp) == *loc) {
-            loc++;
-        }
-    }
+static void truncated_call(size_t num_call) {
+    fprintf(stderr, "ERROR! Call %zu of the input is truncated.\n", num_call);
+    exit(EXIT_FAILURE);
 }
 
-call_t read_call(FILE *fp) {
-    call_t call;
-
-    long long n;
-    float avg_qspan;
-    int max_dist_x, max_dist_y, bw, n_segs;
-
-    int t = fscanf(fp, "%lld%f%d%d%d%d",
-            &n, &avg_qspan, &max_dist_x, &max_dist_y, &bw, &n_segs);
-    // fprintf(stderr, "read %d arguments\n", t);
-    if (t != 6) {
-        call.n = ANCHOR_NULL;
-        call.avg_qspan = .0;
-        return call;
+// Parse an unsigned decimal at *p, skipping leading whitespace. Return false
+// if there is no number.
+static inline bool parse_u64(const char **p, uint64_t *v) {
+    const char *s = *p;
+    while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r') {
+        s++;
+    }
+    if (*s < '0' || *s > '9') {
+        return false;
     }
+    uint64_t r = 0;
+    while (*s >= '0' && *s <= '9') {
+        r = r * 10 + (*s++ - '0');
+    }
+    *v = r;
+    *p = s;
+    return true;
+}
 
-    call.n = n;
-    call.avg_qspan = avg_qspan;
-    call.max_dist_x = max_dist_x;
-    call.max_dist_y = max_dist_y;
-    call.bw = bw;
-    call.n_segs = n_segs;
-    // fprintf(stderr, "%lld\t%f\t%d\t%d\t%d\t%d\n", n, avg_qspan, max_dist_x, max_dist_y, bw, n_segs);
+// Read the whole input at once and parse it in memory, the anchors are most
+// of the file and fscanf made loading slower than the kernel.
+void read_calls(FILE *fp, std::vector<call_t> &calls, anchor_set_t &anchors) {
+    std::vector<char> text;
+    char chunk[1 << 16];
+    size_t len;
+    while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        text.insert(text.end(), chunk, chunk + len);
+    }
+    text.push_back('\0');
 
-    call.anchors.resize(call.n);
+    const char *p = text.data();
+    while (true) {
+        char *end;
+        long long n = strtoll(p, &end, 10);
+        if (end == p) break;
+        p = end;
+        float avg_qspan = strtof(p, &end);
+        if (end == p) break;
+        p = end;
+        long params[4];
+        int t = 0;
+        for (; t < 4; t++) {
+            params[t] = strtol(p, &end, 10);
+            if (end == p) break;
+            p = end;
+        }
+        if (t != 4) break;
 
-    for (anchor_idx_t i = 0; i < call.n; i++) {
-        uint64_t x, y;
-        fscanf(fp, "%llu%llu", &x, &y);
+        call_t call;
+        call.n = n;
+        call.avg_qspan = avg_qspan;
+        call.max_dist_x = params[0];
+        call.max_dist_y = params[1];
+        call.bw = params[2];
+        call.n_segs = params[3];
+        call.first = anchors.x_buf.size();
 
-        anchor_t t;
-        t.x = x; t.y = y;
+        for (anchor_idx_t i = 0; i < call.n; i++) {
+            uint64_t x, y;
+            if (!parse_u64(&p, &x) || !parse_u64(&p, &y)) {
+                truncated_call(calls.size());
+            }
+            anchors.x_buf.push_back(x);
+            anchors.y_buf.push_back(y);
+            anchors.q_span_buf.push_back(y >> 32 & 0xff);
+            anchors.seg_id_buf.push_back((y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT);
+        }
 
-        call.anchors[i] = t;
+        const char *eor = strstr(p, "EOR");
+        if (eor == NULL) {
+            truncated_call(calls.size());
+        }
+        p = eor + 3;
+        calls.push_back(call);
     }
 
-    skip_to_EOR(fp);
-    return call;
+    anchors.n = anchors.x_buf.size();
+    anchors.x = anchors.x_buf.data();
+    anchors.y = anchors.y_buf.data();
+    anchors.q_span = anchors.q_span_buf.data();
+    anchors.seg_id = anchors.seg_id_buf.data();
+    bind_calls(calls, anchors);
+}
+
+void bind_calls(std::vector<call_t> &calls, const anchor_set_t &anchors) {
+    for (auto it = calls.begin(); it != calls.end(); it++) {
+        it->x = anchors.x + it->first;
+        it->y = anchors.y + it->first;
+        it->q_span = anchors.q_span + it->first;
+        it->seg_id = anchors.seg_id + it->first;
+    }
 }
 
 void print_return(FILE *fp, const return_t &data)
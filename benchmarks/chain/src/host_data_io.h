@@ -2,9 +2,14 @@
 #define HOST_KERNEL_IO_H
 
 #include <cstdio>
+#include <vector>
 #include "host_data.h"
 
-call_t read_call(FILE *fp);
+// Append the calls of a text anchor file to @calls and their anchors to
+// @anchors.
+void read_calls(FILE *fp, std::vector<call_t> &calls, anchor_set_t &anchors);
+// Point x, y, q_span and seg_id of every call at its anchors in @anchors.
+void bind_calls(std::vector<call_t> &calls, const anchor_set_t &anchors);
 void print_return(FILE *fp, const return_t &data);
 
 #endif // HOST_KERNEL_IO_H
@@ -24,8 +24,13 @@ static inline int ilog2_32(uint32_t v)
 }
 
 const int BACKSEARCH = 65;
-#define MM_SEED_SEG_SHIFT  48
-#define MM_SEED_SEG_MASK   (0xffULL<<(MM_SEED_SEG_SHIFT))
+
+// With NO_HEURISTICS the kernel keeps only the chaining recurrence, as
+// fast-chain does: every anchor is in the same segment and max_skip never
+// stops the search. fast-chain is checked against this build.
+#ifndef NO_HEURISTICS
+#define NO_HEURISTICS 0
+#endif
 
 void chain_dp(call_t* a, return_t* ret)
 {
@@ -35,10 +40,10 @@ void chain_dp(call_t* a, return_t* ret)
 	int is_cdna = 0;
     const float gap_scale = 1.0f;
     const int max_iter = 5000;
-    const int max_skip = 25;
+    const int max_skip = NO_HEURISTICS? INT32_MAX : 25;
     int max_dist_x = a->max_dist_x, max_dist_y = a->max_dist_y, bw = a->bw;
     float avg_qspan = a->avg_qspan;
-    int n_segs = a->n_segs; 
+    int n_segs = NO_HEURISTICS? 1 : a->n_segs;
     int64_t n = a->n;
 	ret->n = n;
 	ret->scores.resize(n);
@@ -48,17 +53,17 @@ void chain_dp(call_t* a, return_t* ret)
 
 	// fill the score and backtrack arrays
 	for (i = 0; i < n; ++i) {
-		uint64_t ri = a->anchors[i].x;
+		uint64_t ri = a->x[i];
 		int64_t max_j = -1;
-		int32_t qi = (int32_t)a->anchors[i].y, q_span = a->anchors[i].y>>32&0xff; // NB: only 8 bits of span is used!!!
+		int32_t qi = (int32_t)a->y[i], q_span = a->q_span[i]; // NB: only 8 bits of span is used!!!
 		int32_t max_f = q_span, n_skip = 0, min_d;
-		int32_t sidi = (a->anchors[i].y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT;
-		while (st < i && ri > a->anchors[st].x + max_dist_x) ++st;
+		int32_t sidi = NO_HEURISTICS? 0 : a->seg_id[i];
+		while (st < i && ri > a->x[st] + max_dist_x) ++st;
 		if (i - st > max_iter) st = i - max_iter;
 		for (j = i - 1; j >= st; --j) {
-			int64_t dr = ri - a->anchors[j].x;
-			int32_t dq = qi - (int32_t)a->anchors[j].y, dd, sc, log_dd, gap_cost;
-			int32_t sidj = (a->anchors[j].y & MM_SEED_SEG_MASK) >> MM_SEED_SEG_SHIFT;
+			int64_t dr = ri - a->x[j];
+			int32_t dq = qi - (int32_t)a->y[j], dd, sc, log_dd, gap_cost;
+			int32_t sidj = NO_HEURISTICS? 0 : a->seg_id[j];
 			if ((sidi == sidj && dr == 0) || dq <= 0) continue; // don't skip if an anchor is used by multiple segments; see below
 			if ((sidi == sidj && dq > max_dist_y) || dq > max_dist_x) continue;
 			dd = dr > dq? dr - dq : dq - dr;
@@ -0,0 +1,1257 @@
+#define _GNU_SOURCE
+
+#include "roi.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+#endif
+
+#if RAPL_STOPWATCH
+    #include <rapl_stopwatch.h>
+#endif
+#if PWR
+    #include <pwr.h>
+#endif
+#if VTUNE_ANALYSIS
+    #include <ittnotify.h>
+#endif
+#if FAPP_ANALYSIS
+    #include <fj_tool/fapp.h>
+#endif
+#if DYNAMORIO_ANALYSIS && !(defined(__x86_64__) || defined(_M_X64))
+    #error invalid TARGET
+#endif
+
+#ifndef PERF_ANALYSIS
+    #define PERF_ANALYSIS 0
+#endif
+#ifndef VTUNE_ANALYSIS
+    #define VTUNE_ANALYSIS 0
+#endif
+#ifndef FAPP_ANALYSIS
+    #define FAPP_ANALYSIS 0
+#endif
+#ifndef DYNAMORIO_ANALYSIS
+    #define DYNAMORIO_ANALYSIS 0
+#endif
+#ifndef PWR
+    #define PWR 0
+#endif
+#ifndef RAPL_STOPWATCH
+    #define RAPL_STOPWATCH 0
+#endif
+
+#define ROI_PARENT_UNSET -2
+#define ROI_MAX_BACKENDS 8
+#define ROI_MAX_RESULTS 32
+
+/**
+ * Timer of one thread in one phase. Padded to a cache line to avoid false
+ * sharing between threads.
+ */
+typedef struct {
+    double start;
+    double total;
+    uint64_t calls;
+    uint8_t padding[40];
+} roi_slot_t;
+
+typedef struct {
+    char name[ROI_NAME_LEN];
+    int parent;
+    int target; // Bracketed by the backends when GENARCH_ROI_PHASE is set.
+    int process; // Opened at least once with roi_begin().
+    roi_slot_t *slots;
+} roi_phase_info_t;
+
+typedef struct {
+    const char *name;
+    int (*init)(void); // Returns 0 on success.
+    void (*start)(roi_phase_t phase, const char *name);
+    void (*stop)(roi_phase_t phase, const char *name);
+    void (*thread_start)(roi_phase_t phase, const char *name);
+    void (*thread_stop)(roi_phase_t phase, const char *name);
+    void (*finalize)(void);
+} roi_backend_t;
+
+static roi_phase_info_t roi_phases[ROI_MAX_PHASES];
+static int roi_nphases = 0;
+static volatile int roi_lock = 0;
+static int roi_initialized = 0;
+
+static const roi_backend_t *roi_active[ROI_MAX_BACKENDS];
+static int roi_nactive = 0;
+static const roi_backend_t *roi_thread_active[ROI_MAX_BACKENDS];
+static int roi_nthread_active = 0;
+static char roi_target[ROI_NAME_LEN] = "";
+
+/**
+ * Field of the JSON record. @str is NULL for numbers.
+ */
+typedef struct {
+    char key[ROI_NAME_LEN];
+    char *str;
+    double num;
+} roi_result_t;
+
+#define ROI_HIST_BINS 32
+
+/**
+ * Tasks of one thread in one parallel loop. The histograms count the tasks
+ * per power-of-two range of size and of duration in microseconds. Padded to
+ * a multiple of a cache line.
+ */
+typedef struct {
+    double start;
+    double busy;
+    double size;
+    uint64_t tasks;
+    uint32_t size_hist[ROI_HIST_BINS];
+    uint32_t time_hist[ROI_HIST_BINS];
+    uint8_t padding[32];
+} roi_task_slot_t;
+
+// Allocated on the first task of each phase.
+static roi_task_slot_t *roi_task_slots[ROI_MAX_PHASES];
+
+/**
+ * Load balance of one parallel loop, over the threads that opened its phase.
+ */
+typedef struct {
+    uint64_t tasks;
+    int threads;
+    double busy_max;
+    double busy_avg;
+    double idle_avg;
+} roi_loop_stats_t;
+
+static roi_result_t roi_results[ROI_MAX_RESULTS];
+static int roi_nresults = 0;
+static char roi_work_unit[ROI_NAME_LEN] = "";
+static double roi_work = 0.0;
+
+// Energy of the ROI in Joules, reported by the PWR/RAPL backends.
+static double roi_energy = 0.0;
+static int roi_energy_valid = 0;
+
+// Stack of open process-wide phases.
+static int roi_pstack[ROI_MAX_DEPTH];
+static int roi_pdepth = 0;
+
+// Stack of open per-thread phases.
+static __thread int roi_tstack[ROI_MAX_DEPTH];
+static __thread int roi_tdepth = 0;
+
+static double roi_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int roi_tid(void) {
+#ifdef _OPENMP
+    int tid = omp_get_thread_num();
+    return tid < ROI_MAX_THREADS ? tid : ROI_MAX_THREADS - 1;
+#else
+    return 0;
+#endif
+}
+
+static void roi_acquire(void) {
+    while (__sync_lock_test_and_set(&roi_lock, 1)) {
+        while (roi_lock) {}
+    }
+}
+
+static void roi_release(void) {
+    __sync_lock_release(&roi_lock);
+}
+
+/*
+ * Perf: enable/disable the counters of an external "perf record/stat -D -1"
+ * through the perf control fifo.
+ */
+
+static int roi_perf_fd = -1;
+
+static int roi_perf_write(const char *msg) {
+    size_t len = strlen(msg);
+    return write(roi_perf_fd, msg, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int roi_perf_init(void) {
+    return 0;
+}
+
+static void roi_perf_start(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    if (roi_perf_fd == -1) {
+        const char *fifo = getenv("GENARCH_ROI_PERF_FIFO");
+        roi_perf_fd = open(fifo ? fifo : "perf_ctl.fifo", O_WRONLY);
+        if (roi_perf_fd == -1) {
+            fprintf(stderr, "ERROR opening the Perf pipe\n");
+            return;
+        }
+    }
+    if (roi_perf_write("enable")) {
+        fprintf(stderr, "ERROR writing to the Perf pipe\n");
+    }
+}
+
+static void roi_perf_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    if (roi_perf_fd != -1 && roi_perf_write("disable")) {
+        fprintf(stderr, "ERROR writing to the Perf pipe\n");
+    }
+}
+
+static void roi_perf_finalize(void) {
+    if (roi_perf_fd != -1) {
+        close(roi_perf_fd);
+        roi_perf_fd = -1;
+    }
+}
+
+/*
+ * DynamoRIO (MOD): start/stop markers recognized by the modified client.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64)
+static int roi_dynamorio_init(void) {
+    return 0;
+}
+
+static void roi_dynamorio_start(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    __asm__ volatile ("nopw 0x24");
+}
+
+static void roi_dynamorio_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    __asm__ volatile ("nopw 0x42");
+}
+#endif
+
+/*
+ * Intel VTune: resume/pause the collection around the target phase and
+ * annotate every per-thread phase as an ITT task.
+ */
+
+#if VTUNE_ANALYSIS
+static __itt_domain *roi_itt_domain = NULL;
+static __itt_string_handle *roi_itt_handles[ROI_MAX_PHASES];
+
+static int roi_vtune_init(void) {
+    roi_itt_domain = __itt_domain_create("genarch");
+    for (int i = 0; i < ROI_MAX_PHASES; ++i) {
+        roi_itt_handles[i] = NULL;
+    }
+    __itt_pause();
+    return 0;
+}
+
+static void roi_vtune_start(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    __itt_resume();
+}
+
+static void roi_vtune_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    __itt_pause();
+}
+
+static void roi_vtune_thread_start(roi_phase_t phase, const char *name) {
+    // Benign race: every thread would store the same handle.
+    if (roi_itt_handles[phase] == NULL) {
+        roi_itt_handles[phase] = __itt_string_handle_create(name);
+    }
+    __itt_task_begin(roi_itt_domain, __itt_null, __itt_null,
+                     roi_itt_handles[phase]);
+}
+
+static void roi_vtune_thread_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    __itt_task_end(roi_itt_domain);
+}
+#endif
+
+/*
+ * Fujitsu Advanced Performance Profiler.
+ */
+
+#if FAPP_ANALYSIS
+static int roi_fapp_init(void) {
+    return 0;
+}
+
+static void roi_fapp_start(roi_phase_t phase, const char *name) {
+    (void)phase;
+    fapp_start(name, 1, 0);
+}
+
+static void roi_fapp_stop(roi_phase_t phase, const char *name) {
+    (void)phase;
+    fapp_stop(name, 1, 0);
+}
+#endif
+
+/*
+ * Fujitsu PWR library: energy of the whole node.
+ */
+
+#if PWR
+static PWR_Cntxt roi_pwr_cntxt = NULL;
+static PWR_Obj roi_pwr_obj = NULL;
+static double roi_pwr_energy0 = 0.0;
+
+static int roi_pwr_init(void) {
+    // 1. Initialize Power API
+    if (PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &roi_pwr_cntxt) != PWR_RET_SUCCESS) {
+        return -1;
+    }
+    // 2. Get Object (In this step, get an Object that indicates the entire compute node.)
+    PWR_CntxtGetObjByName(roi_pwr_cntxt, "plat.node", &roi_pwr_obj);
+    return 0;
+}
+
+static void roi_pwr_start(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    // 3. Get electric energy at the start.
+    PWR_ObjAttrGetValue(roi_pwr_obj, PWR_ATTR_MEASURED_ENERGY, &roi_pwr_energy0, NULL);
+}
+
+static void roi_pwr_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    // 3. Get electric energy at the end.
+    double energy1 = 0.0;
+    PWR_ObjAttrGetValue(roi_pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
+
+    fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - roi_pwr_energy0);
+    roi_energy += energy1 - roi_pwr_energy0;
+    roi_energy_valid = 1;
+}
+
+static void roi_pwr_finalize(void) {
+    // 4. Terminate processing of Power API
+    PWR_CntxtDestroy(roi_pwr_cntxt);
+}
+#endif
+
+/*
+ * RAPL-Stopwatch library: energy of the RAPL node domain.
+ */
+
+#if RAPL_STOPWATCH
+static rapl_stopwatch_t roi_rapl_sw;
+static uint64_t roi_rapl_count = 0;
+
+static int roi_rapl_init(void) {
+    int err = rapl_stopwatch_api_init();
+    if (err) {
+        fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
+        return err;
+    }
+    rapl_stopwatch_init(&roi_rapl_sw);
+    return 0;
+}
+
+static void roi_rapl_start(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    rapl_stopwatch_play(&roi_rapl_sw);
+}
+
+static void roi_rapl_stop(roi_phase_t phase, const char *name) {
+    (void)phase; (void)name;
+    rapl_stopwatch_pause(&roi_rapl_sw);
+
+    // The stopwatch accumulates across plays, report the last interval.
+    uint64_t count = 0;
+    int err = rapl_stopwatch_get_mj(&roi_rapl_sw, RAPL_NODE, &count);
+    if (err) {
+        fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
+    }
+
+    fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)(count - roi_rapl_count) / 1E3);
+    roi_energy += (double)(count - roi_rapl_count) / 1E3;
+    roi_energy_valid = 1;
+    roi_rapl_count = count;
+}
+
+static void roi_rapl_finalize(void) {
+    rapl_stopwatch_destroy(&roi_rapl_sw);
+    rapl_stopwatch_api_destroy();
+}
+#endif
+
+/*
+ * Hardware counters read with perf_event_open, one set per thread. Process-wide
+ * phases open a parallel region to start/stop the counters of every OpenMP
+ * thread (only the calling thread if already inside a parallel region), and
+ * print their table when they end. Per-thread phases are printed on
+ * finalize.
+ */
+
+#ifdef __linux__
+#define ROI_PERFCTR_NEVENTS 5
+
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} roi_perfctr_event_t;
+
+#define ROI_HW_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const roi_perfctr_event_t roi_perfctr_events[ROI_PERFCTR_NEVENTS] = {
+    {"Cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"Instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"LLC-misses", PERF_TYPE_HW_CACHE, ROI_HW_CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dTLB-misses", PERF_TYPE_HW_CACHE, ROI_HW_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"Branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/**
+ * Value, time enabled and time running of one counter, as returned by read()
+ * with PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING.
+ */
+typedef struct {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+} roi_perfctr_read_t;
+
+/**
+ * Counters of one thread in one phase. Padded to a multiple of a cache line
+ * to avoid false sharing between threads.
+ */
+typedef struct {
+    roi_perfctr_read_t start[ROI_PERFCTR_NEVENTS];
+    double total[ROI_PERFCTR_NEVENTS]; // Scaled if the counters were multiplexed.
+    uint64_t calls;
+    uint8_t padding[24];
+} roi_perfctr_slot_t;
+
+static roi_perfctr_slot_t *roi_perfctr_slots[ROI_MAX_PHASES];
+static int roi_perfctr_printed[ROI_MAX_PHASES];
+static int roi_perfctr_unsupported[ROI_PERFCTR_NEVENTS];
+
+// Counters of the calling thread, opened on first use.
+static __thread int roi_perfctr_fds[ROI_PERFCTR_NEVENTS];
+static __thread int roi_perfctr_opened = 0;
+
+// Every descriptor opened by any thread, closed on finalize.
+static int roi_perfctr_allfds[ROI_MAX_THREADS * ROI_PERFCTR_NEVENTS];
+static int roi_perfctr_nallfds = 0;
+
+static int roi_perfctr_open(const roi_perfctr_event_t *event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event->type;
+    attr.config = event->config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Count the calling thread on any CPU.
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void roi_perfctr_open_thread(void) {
+    if (roi_perfctr_opened) {
+        return;
+    }
+    roi_perfctr_opened = 1;
+    for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+        int fd = roi_perfctr_open(&roi_perfctr_events[e]);
+        roi_perfctr_fds[e] = fd;
+        if (fd == -1) {
+            roi_perfctr_unsupported[e] = 1;
+            continue;
+        }
+        int i = __sync_fetch_and_add(&roi_perfctr_nallfds, 1);
+        if (i < ROI_MAX_THREADS * ROI_PERFCTR_NEVENTS) {
+            roi_perfctr_allfds[i] = fd;
+        }
+    }
+}
+
+static void roi_perfctr_read(roi_perfctr_read_t *values) {
+    roi_perfctr_open_thread();
+    for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+        if (roi_perfctr_fds[e] == -1 ||
+            read(roi_perfctr_fds[e], &values[e], sizeof(values[e])) != sizeof(values[e])) {
+            memset(&values[e], 0, sizeof(values[e]));
+        }
+    }
+}
+
+static roi_perfctr_slot_t *roi_perfctr_slot(roi_phase_t phase) {
+    if (roi_perfctr_slots[phase] == NULL) {
+        roi_acquire();
+        if (roi_perfctr_slots[phase] == NULL) {
+            roi_perfctr_slot_t *slots =
+                (roi_perfctr_slot_t *)calloc(ROI_MAX_THREADS, sizeof(roi_perfctr_slot_t));
+            if (slots == NULL) {
+                roi_release();
+                fprintf(stderr, "[ROI] Could not allocate the counters of phase %d\n", phase);
+                exit(EXIT_FAILURE);
+            }
+            __sync_synchronize();
+            roi_perfctr_slots[phase] = slots;
+        }
+        roi_release();
+    }
+    return &roi_perfctr_slots[phase][roi_tid()];
+}
+
+static void roi_perfctr_thread_start(roi_phase_t phase, const char *name) {
+    (void)name;
+    roi_perfctr_slot_t *slot = roi_perfctr_slot(phase);
+    roi_perfctr_read(slot->start);
+}
+
+static void roi_perfctr_thread_stop(roi_phase_t phase, const char *name) {
+    (void)name;
+    roi_perfctr_read_t end[ROI_PERFCTR_NEVENTS];
+    roi_perfctr_read(end);
+
+    roi_perfctr_slot_t *slot = roi_perfctr_slot(phase);
+    for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+        uint64_t value = end[e].value - slot->start[e].value;
+        uint64_t enabled = end[e].enabled - slot->start[e].enabled;
+        uint64_t running = end[e].running - slot->start[e].running;
+        slot->total[e] += running > 0 ? (double)value * enabled / running : 0.0;
+    }
+    slot->calls++;
+}
+
+static void roi_perfctr_print_row(const char *label, const double *counts) {
+    fprintf(stderr, "[PERF] %-8s", label);
+    for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+        if (roi_perfctr_unsupported[e]) {
+            fprintf(stderr, " %16s", "n/a");
+        }
+        else {
+            fprintf(stderr, " %16.0f", counts[e]);
+        }
+    }
+    fprintf(stderr, " %8.3f\n", counts[0] > 0.0 ? counts[1] / counts[0] : 0.0);
+}
+
+static void roi_perfctr_print(roi_phase_t phase, const char *name) {
+    const roi_perfctr_slot_t *slots = roi_perfctr_slots[phase];
+    if (slots == NULL) {
+        return;
+    }
+    roi_perfctr_printed[phase] = 1;
+
+    fprintf(stderr, "[PERF] Hardware counters of phase '%s':\n", name);
+    fprintf(stderr, "[PERF] %-8s", "Thread");
+    for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+        fprintf(stderr, " %16s", roi_perfctr_events[e].name);
+    }
+    fprintf(stderr, " %8s\n", "IPC");
+
+    double sum[ROI_PERFCTR_NEVENTS] = {0.0};
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        if (slots[t].calls == 0) {
+            continue;
+        }
+        char label[16];
+        snprintf(label, sizeof(label), "%d", t);
+        roi_perfctr_print_row(label, slots[t].total);
+        for (int e = 0; e < ROI_PERFCTR_NEVENTS; ++e) {
+            sum[e] += slots[t].total[e];
+        }
+    }
+    roi_perfctr_print_row("All", sum);
+}
+
+static int roi_perfctr_init(void) {
+    int fd = roi_perfctr_open(&roi_perfctr_events[0]);
+    if (fd == -1) {
+        perror("[ROI] perf_event_open");
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static void roi_perfctr_start(roi_phase_t phase, const char *name) {
+    roi_perfctr_printed[phase] = 0;
+#ifdef _OPENMP
+    if (!omp_in_parallel()) {
+        #pragma omp parallel
+        roi_perfctr_thread_start(phase, name);
+        return;
+    }
+#endif
+    roi_perfctr_thread_start(phase, name);
+}
+
+static void roi_perfctr_stop(roi_phase_t phase, const char *name) {
+#ifdef _OPENMP
+    if (!omp_in_parallel()) {
+        #pragma omp parallel
+        roi_perfctr_thread_stop(phase, name);
+    }
+    else {
+        roi_perfctr_thread_stop(phase, name);
+    }
+#else
+    roi_perfctr_thread_stop(phase, name);
+#endif
+    roi_perfctr_print(phase, name);
+}
+
+static void roi_perfctr_finalize(void) {
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        if (!roi_perfctr_printed[phase]) {
+            roi_perfctr_print(phase, roi_phases[phase].name);
+        }
+        free(roi_perfctr_slots[phase]);
+        roi_perfctr_slots[phase] = NULL;
+    }
+    int nfds = roi_perfctr_nallfds < ROI_MAX_THREADS * ROI_PERFCTR_NEVENTS ?
+               roi_perfctr_nallfds : ROI_MAX_THREADS * ROI_PERFCTR_NEVENTS;
+    for (int i = 0; i < nfds; ++i) {
+        close(roi_perfctr_allfds[i]);
+    }
+    roi_perfctr_nallfds = 0;
+}
+#endif
+
+static const roi_backend_t roi_backends[] = {
+    {"perf", roi_perf_init, roi_perf_start, roi_perf_stop, NULL, NULL, roi_perf_finalize},
+#ifdef __linux__
+    {"perfctr", roi_perfctr_init, roi_perfctr_start, roi_perfctr_stop, roi_perfctr_thread_start, roi_perfctr_thread_stop, roi_perfctr_finalize},
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+    {"dynamorio", roi_dynamorio_init, roi_dynamorio_start, roi_dynamorio_stop, NULL, NULL, NULL},
+#endif
+#if VTUNE_ANALYSIS
+    {"vtune", roi_vtune_init, roi_vtune_start, roi_vtune_stop, roi_vtune_thread_start, roi_vtune_thread_stop, NULL},
+#endif
+#if FAPP_ANALYSIS
+    {"fapp", roi_fapp_init, roi_fapp_start, roi_fapp_stop, NULL, NULL, NULL},
+#endif
+#if PWR
+    {"pwr", roi_pwr_init, roi_pwr_start, roi_pwr_stop, NULL, NULL, roi_pwr_finalize},
+#endif
+#if RAPL_STOPWATCH
+    {"rapl", roi_rapl_init, roi_rapl_start, roi_rapl_stop, NULL, NULL, roi_rapl_finalize},
+#endif
+};
+
+static const int roi_nbackends = sizeof(roi_backends) / sizeof(roi_backends[0]);
+
+/**
+ * The backends enabled with the compile-time flags of the Makefiles.
+ */
+static const char *roi_default_backends(void) {
+    static char list[128] = "";
+    if (PERF_ANALYSIS) strcat(list, "perf,");
+    if (DYNAMORIO_ANALYSIS) strcat(list, "dynamorio,");
+    if (VTUNE_ANALYSIS) strcat(list, "vtune,");
+    if (FAPP_ANALYSIS) strcat(list, "fapp,");
+    if (PWR) strcat(list, "pwr,");
+    if (RAPL_STOPWATCH) strcat(list, "rapl,");
+    return list;
+}
+
+static void roi_enable_backend(const char *name, size_t len) {
+    for (int i = 0; i < roi_nbackends; ++i) {
+        const roi_backend_t *backend = &roi_backends[i];
+        if (strlen(backend->name) != len || strncmp(backend->name, name, len) != 0) {
+            continue;
+        }
+        for (int j = 0; j < roi_nactive; ++j) {
+            if (roi_active[j] == backend) {
+                return;
+            }
+        }
+        if (backend->init() != 0) {
+            fprintf(stderr, "[ROI] Could not initialize backend '%s'\n", backend->name);
+            return;
+        }
+        roi_active[roi_nactive++] = backend;
+        if (backend->thread_start != NULL) {
+            roi_thread_active[roi_nthread_active++] = backend;
+        }
+        return;
+    }
+
+    fprintf(stderr, "[ROI] Backend '%.*s' not available, available backends:", (int)len, name);
+    for (int i = 0; i < roi_nbackends; ++i) {
+        fprintf(stderr, " %s", roi_backends[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+void roi_init(void) {
+    if (roi_initialized) {
+        return;
+    }
+    roi_initialized = 1;
+
+    const char *target = getenv("GENARCH_ROI_PHASE");
+    if (target != NULL) {
+        snprintf(roi_target, ROI_NAME_LEN, "%s", target);
+    }
+
+    const char *list = getenv("GENARCH_ROI_BACKENDS");
+    if (list == NULL) {
+        list = roi_default_backends();
+    }
+    if (strcmp(list, "none") == 0) {
+        return;
+    }
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        if (len > 0) {
+            roi_enable_backend(list, len);
+        }
+        list += len;
+        if (*list == ',') {
+            ++list;
+        }
+    }
+}
+
+roi_phase_t roi_phase(const char *name) {
+    roi_acquire();
+    roi_init();
+
+    roi_phase_t phase;
+    for (phase = 0; phase < roi_nphases; ++phase) {
+        if (strncmp(roi_phases[phase].name, name, ROI_NAME_LEN) == 0) {
+            roi_release();
+            return phase;
+        }
+    }
+
+    if (roi_nphases == ROI_MAX_PHASES) {
+        roi_release();
+        fprintf(stderr, "[ROI] Too many phases, increase ROI_MAX_PHASES\n");
+        exit(EXIT_FAILURE);
+    }
+
+    roi_phase_info_t *info = &roi_phases[phase];
+    snprintf(info->name, ROI_NAME_LEN, "%s", name);
+    info->parent = ROI_PARENT_UNSET;
+    info->target = roi_target[0] != '\0' && strcmp(roi_target, info->name) == 0;
+    info->process = 0;
+    info->slots = (roi_slot_t *)calloc(ROI_MAX_THREADS, sizeof(roi_slot_t));
+    if (info->slots == NULL) {
+        roi_release();
+        fprintf(stderr, "[ROI] Could not allocate the timers of phase '%s'\n", name);
+        exit(EXIT_FAILURE);
+    }
+    // Publish the phase after it is fully initialized.
+    __sync_synchronize();
+    roi_nphases = phase + 1;
+
+    roi_release();
+    return phase;
+}
+
+static void roi_set_parent(roi_phase_t phase, int parent) {
+    if (roi_phases[phase].parent == ROI_PARENT_UNSET) {
+        __sync_bool_compare_and_swap(&roi_phases[phase].parent, ROI_PARENT_UNSET, parent);
+    }
+}
+
+static void roi_slot_start(roi_phase_t phase) {
+    roi_slot_t *slot = &roi_phases[phase].slots[roi_tid()];
+    slot->start = roi_now();
+}
+
+static void roi_slot_stop(roi_phase_t phase) {
+    roi_slot_t *slot = &roi_phases[phase].slots[roi_tid()];
+    slot->total += roi_now() - slot->start;
+    slot->calls++;
+}
+
+void roi_begin(roi_phase_t phase) {
+    int parent = roi_pdepth > 0 ? roi_pstack[roi_pdepth - 1] : -1;
+    roi_set_parent(phase, parent);
+    roi_phases[phase].process = 1;
+    if (roi_pdepth < ROI_MAX_DEPTH) {
+        roi_pstack[roi_pdepth] = phase;
+    }
+    roi_pdepth++;
+
+    if (roi_nactive > 0 &&
+        (roi_phases[phase].target || (roi_target[0] == '\0' && parent == -1))) {
+        for (int i = 0; i < roi_nactive; ++i) {
+            roi_active[i]->start(phase, roi_phases[phase].name);
+        }
+    }
+
+    // Start the timer last and stop it first to leave out the backends.
+    roi_slot_start(phase);
+}
+
+void roi_end(roi_phase_t phase) {
+    roi_slot_stop(phase);
+
+    roi_pdepth--;
+    if (roi_pdepth < 0 ||
+        (roi_pdepth < ROI_MAX_DEPTH && roi_pstack[roi_pdepth] != phase)) {
+        fprintf(stderr, "[ROI] Mismatched end of phase '%s'\n", roi_phases[phase].name);
+        roi_pdepth = roi_pdepth < 0 ? 0 : roi_pdepth;
+    }
+    int parent = roi_pdepth > 0 ? roi_pstack[roi_pdepth - 1] : -1;
+
+    if (roi_nactive > 0 &&
+        (roi_phases[phase].target || (roi_target[0] == '\0' && parent == -1))) {
+        for (int i = roi_nactive - 1; i >= 0; --i) {
+            roi_active[i]->stop(phase, roi_phases[phase].name);
+        }
+    }
+}
+
+void roi_thread_begin(roi_phase_t phase) {
+    int parent;
+    if (roi_tdepth > 0) {
+        parent = roi_tstack[roi_tdepth - 1];
+    }
+    else {
+        // Per-thread phases hang from the enclosing process-wide phase.
+        parent = roi_pdepth > 0 ? roi_pstack[roi_pdepth - 1] : -1;
+    }
+    roi_set_parent(phase, parent);
+    if (roi_tdepth < ROI_MAX_DEPTH) {
+        roi_tstack[roi_tdepth] = phase;
+    }
+    roi_tdepth++;
+
+    if (roi_nthread_active > 0 &&
+        (roi_target[0] == '\0' || roi_phases[phase].target)) {
+        for (int i = 0; i < roi_nthread_active; ++i) {
+            roi_thread_active[i]->thread_start(phase, roi_phases[phase].name);
+        }
+    }
+
+    roi_slot_start(phase);
+}
+
+void roi_thread_end(roi_phase_t phase) {
+    roi_slot_stop(phase);
+
+    roi_tdepth--;
+    if (roi_tdepth < 0 ||
+        (roi_tdepth < ROI_MAX_DEPTH && roi_tstack[roi_tdepth] != phase)) {
+        fprintf(stderr, "[ROI] Mismatched end of phase '%s'\n", roi_phases[phase].name);
+        roi_tdepth = roi_tdepth < 0 ? 0 : roi_tdepth;
+    }
+
+    if (roi_nthread_active > 0 &&
+        (roi_target[0] == '\0' || roi_phases[phase].target)) {
+        for (int i = roi_nthread_active - 1; i >= 0; --i) {
+            roi_thread_active[i]->thread_stop(phase, roi_phases[phase].name);
+        }
+    }
+}
+
+static roi_task_slot_t *roi_task_slot(roi_phase_t phase) {
+    if (roi_task_slots[phase] == NULL) {
+        roi_acquire();
+        if (roi_task_slots[phase] == NULL) {
+            roi_task_slot_t *slots =
+                (roi_task_slot_t *)calloc(ROI_MAX_THREADS, sizeof(roi_task_slot_t));
+            if (slots == NULL) {
+                roi_release();
+                fprintf(stderr, "[ROI] Could not allocate the tasks of phase '%s'\n",
+                        roi_phases[phase].name);
+                exit(EXIT_FAILURE);
+            }
+            __sync_synchronize();
+            roi_task_slots[phase] = slots;
+        }
+        roi_release();
+    }
+    return &roi_task_slots[phase][roi_tid()];
+}
+
+/**
+ * Bin 0 is [0, 2), bin i is [2^i, 2^(i+1)), the last bin is unbounded.
+ */
+static int roi_hist_bin(double value) {
+    if (value < 2.0) {
+        return 0;
+    }
+    if (value >= (double)(1ULL << (ROI_HIST_BINS - 1))) {
+        return ROI_HIST_BINS - 1;
+    }
+    return 63 - __builtin_clzll((unsigned long long)value);
+}
+
+void roi_task_begin(roi_phase_t phase) {
+    roi_task_slot(phase)->start = roi_now();
+}
+
+void roi_task_end(roi_phase_t phase, double size) {
+    roi_task_slot_t *slot = roi_task_slot(phase);
+    double seconds = roi_now() - slot->start;
+    slot->busy += seconds;
+    slot->size += size;
+    slot->tasks++;
+    slot->size_hist[roi_hist_bin(size)]++;
+    slot->time_hist[roi_hist_bin(seconds * 1e6)]++;
+}
+
+double roi_seconds(roi_phase_t phase) {
+    double max = 0.0;
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        if (roi_phases[phase].slots[t].total > max) {
+            max = roi_phases[phase].slots[t].total;
+        }
+    }
+    return max;
+}
+
+static void roi_report_phase(FILE *fp, roi_phase_t phase, int depth) {
+    const roi_phase_info_t *info = &roi_phases[phase];
+
+    uint64_t calls = 0;
+    int threads = 0;
+    double sum = 0.0, max = 0.0;
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        const roi_slot_t *slot = &info->slots[t];
+        if (slot->calls == 0) {
+            continue;
+        }
+        calls += slot->calls;
+        threads++;
+        sum += slot->total;
+        if (slot->total > max) {
+            max = slot->total;
+        }
+    }
+
+    if (threads > 0) {
+        fprintf(fp, "[ROI] %*s%-*s %10llu %7d %10.4f %10.4f %10.4f\n",
+                2 * depth, "", 32 - 2 * depth, info->name,
+                (unsigned long long)calls, threads, max, sum / threads, sum);
+    }
+
+    for (roi_phase_t child = 0; child < roi_nphases; ++child) {
+        if (roi_phases[child].parent == phase) {
+            roi_report_phase(fp, child, depth + 1);
+        }
+    }
+}
+
+static void roi_loop_stats(roi_phase_t phase, roi_loop_stats_t *stats) {
+    const roi_slot_t *slots = roi_phases[phase].slots;
+    const roi_task_slot_t *tasks = roi_task_slots[phase];
+
+    memset(stats, 0, sizeof(*stats));
+    double busy = 0.0, idle = 0.0;
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        if (slots[t].calls == 0) {
+            continue;
+        }
+        stats->threads++;
+        stats->tasks += tasks[t].tasks;
+        busy += tasks[t].busy;
+        idle += slots[t].total - tasks[t].busy;
+        if (tasks[t].busy > stats->busy_max) {
+            stats->busy_max = tasks[t].busy;
+        }
+    }
+    if (stats->threads > 0) {
+        stats->busy_avg = busy / stats->threads;
+        stats->idle_avg = idle / stats->threads;
+    }
+}
+
+static void roi_report_hist(FILE *fp, const char *title, const roi_task_slot_t *tasks,
+                            int time) {
+    uint64_t hist[ROI_HIST_BINS] = {0};
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        const uint32_t *bins = time ? tasks[t].time_hist : tasks[t].size_hist;
+        for (int b = 0; b < ROI_HIST_BINS; ++b) {
+            hist[b] += bins[b];
+        }
+    }
+
+    fprintf(fp, "[ROI] %-24s %12s\n", title, "Tasks");
+    for (int b = 0; b < ROI_HIST_BINS; ++b) {
+        if (hist[b] == 0) {
+            continue;
+        }
+        unsigned long long low = b == 0 ? 0 : 1ULL << b;
+        if (b == ROI_HIST_BINS - 1) {
+            fprintf(fp, "[ROI] [%10llu,        inf) %12llu\n", low,
+                    (unsigned long long)hist[b]);
+        }
+        else {
+            fprintf(fp, "[ROI] [%10llu, %10llu) %12llu\n", low, 1ULL << (b + 1),
+                    (unsigned long long)hist[b]);
+        }
+    }
+}
+
+static void roi_report_loop(FILE *fp, roi_phase_t phase) {
+    const roi_slot_t *slots = roi_phases[phase].slots;
+    const roi_task_slot_t *tasks = roi_task_slots[phase];
+
+    fprintf(fp, "[ROI] Load balance of loop '%s':\n", roi_phases[phase].name);
+    fprintf(fp, "[ROI] %-8s %10s %14s %10s %10s\n",
+            "Thread", "Tasks", "Size", "Busy(s)", "Idle(s)");
+    for (int t = 0; t < ROI_MAX_THREADS; ++t) {
+        if (slots[t].calls == 0) {
+            continue;
+        }
+        fprintf(fp, "[ROI] %-8d %10llu %14.0f %10.4f %10.4f\n", t,
+                (unsigned long long)tasks[t].tasks, tasks[t].size, tasks[t].busy,
+                slots[t].total - tasks[t].busy);
+    }
+
+    roi_loop_stats_t stats;
+    roi_loop_stats(phase, &stats);
+    fprintf(fp, "[ROI] Busy max %.4f s, avg %.4f s, imbalance (max/avg) %.3f, idle avg %.4f s\n",
+            stats.busy_max, stats.busy_avg,
+            stats.busy_avg > 0.0 ? stats.busy_max / stats.busy_avg : 0.0, stats.idle_avg);
+
+    roi_report_hist(fp, "Task size", tasks, 0);
+    roi_report_hist(fp, "Task time (us)", tasks, 1);
+}
+
+void roi_report(FILE *fp) {
+    fprintf(fp, "[ROI] %-32s %10s %7s %10s %10s %10s\n",
+            "Phase", "Calls", "Threads", "Max(s)", "Avg(s)", "Sum(s)");
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        if (roi_phases[phase].parent < 0) {
+            roi_report_phase(fp, phase, 0);
+        }
+    }
+
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        if (roi_task_slots[phase] != NULL) {
+            roi_report_loop(fp, phase);
+        }
+    }
+}
+
+double roi_wtime(void) {
+    return roi_now();
+}
+
+static roi_result_t *roi_result_slot(const char *key) {
+    for (int i = 0; i < roi_nresults; ++i) {
+        if (strncmp(roi_results[i].key, key, ROI_NAME_LEN) == 0) {
+            free(roi_results[i].str);
+            roi_results[i].str = NULL;
+            return &roi_results[i];
+        }
+    }
+    if (roi_nresults == ROI_MAX_RESULTS) {
+        fprintf(stderr, "[ROI] Too many results, ignoring '%s'\n", key);
+        return NULL;
+    }
+    roi_result_t *result = &roi_results[roi_nresults++];
+    snprintf(result->key, ROI_NAME_LEN, "%s", key);
+    result->str = NULL;
+    return result;
+}
+
+void roi_result_str(const char *key, const char *value) {
+    roi_result_t *result = roi_result_slot(key);
+    if (result != NULL) {
+        result->str = strdup(value);
+    }
+}
+
+void roi_result_num(const char *key, double value) {
+    roi_result_t *result = roi_result_slot(key);
+    if (result != NULL) {
+        result->num = value;
+    }
+}
+
+void roi_result_throughput(const char *unit, double count) {
+    snprintf(roi_work_unit, ROI_NAME_LEN, "%s", unit);
+    roi_work = count;
+}
+
+static int roi_result_isset(const char *key) {
+    for (int i = 0; i < roi_nresults; ++i) {
+        if (strncmp(roi_results[i].key, key, ROI_NAME_LEN) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void roi_json_string(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(fp, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/**
+ * JSON has no NaN or infinity (e.g. the rates of an empty phase), write
+ * them as null.
+ */
+static void roi_json_number(FILE *fp, double num) {
+    if (isfinite(num)) {
+        fprintf(fp, "%.9g", num);
+    }
+    else {
+        fputs("null", fp);
+    }
+}
+
+/**
+ * Append the JSON record of this run to @path, one record per line.
+ */
+static void roi_write_json(const char *path) {
+    FILE *fp = fopen(path, "a");
+    if (fp == NULL) {
+        perror("[ROI] Could not open the JSON results file");
+        return;
+    }
+
+    // The ROI is the sum of the outermost process-wide phases.
+    double roi = 0.0;
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        if (roi_phases[phase].process && roi_phases[phase].parent == -1) {
+            roi += roi_seconds(phase);
+        }
+    }
+
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    long rss = self.ru_maxrss > children.ru_maxrss ? self.ru_maxrss : children.ru_maxrss;
+
+    fputc('{', fp);
+    for (int i = 0; i < roi_nresults; ++i) {
+        roi_json_string(fp, roi_results[i].key);
+        fputc(':', fp);
+        if (roi_results[i].str != NULL) {
+            roi_json_string(fp, roi_results[i].str);
+        }
+        else {
+            roi_json_number(fp, roi_results[i].num);
+        }
+        fputc(',', fp);
+    }
+    if (!roi_result_isset("threads")) {
+#ifdef _OPENMP
+        fprintf(fp, "\"threads\":%d,", omp_get_max_threads());
+#else
+        fprintf(fp, "\"threads\":1,");
+#endif
+    }
+    fprintf(fp, "\"roi_seconds\":");
+    roi_json_number(fp, roi);
+    fputc(',', fp);
+    fprintf(fp, "\"peak_rss_kb\":%ld,", rss);
+    if (roi_energy_valid) {
+        fprintf(fp, "\"energy_j\":");
+        roi_json_number(fp, roi_energy);
+        fputc(',', fp);
+    }
+    if (roi_work_unit[0] != '\0' && roi > 0.0) {
+        fprintf(fp, "\"throughput\":");
+        roi_json_number(fp, roi_work / roi);
+        fprintf(fp, ",\"throughput_unit\":");
+        char unit[ROI_NAME_LEN + 2];
+        snprintf(unit, sizeof(unit), "%s/s", roi_work_unit);
+        roi_json_string(fp, unit);
+        fputc(',', fp);
+    }
+    fprintf(fp, "\"phases\":{");
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        roi_json_string(fp, roi_phases[phase].name);
+        fputc(':', fp);
+        roi_json_number(fp, roi_seconds(phase));
+        fprintf(fp, "%s", phase + 1 < roi_nphases ? "," : "");
+    }
+    fputc('}', fp);
+
+    int nloops = 0;
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        if (roi_task_slots[phase] == NULL) {
+            continue;
+        }
+        roi_loop_stats_t stats;
+        roi_loop_stats(phase, &stats);
+        fprintf(fp, "%s", nloops++ == 0 ? ",\"loops\":{" : ",");
+        roi_json_string(fp, roi_phases[phase].name);
+        fprintf(fp, ":{\"tasks\":%llu,\"busy_max\":", (unsigned long long)stats.tasks);
+        roi_json_number(fp, stats.busy_max);
+        fprintf(fp, ",\"busy_avg\":");
+        roi_json_number(fp, stats.busy_avg);
+        fprintf(fp, ",\"idle_avg\":");
+        roi_json_number(fp, stats.idle_avg);
+        fprintf(fp, ",\"imbalance\":");
+        roi_json_number(fp, stats.busy_avg > 0.0 ? stats.busy_max / stats.busy_avg : 0.0);
+        fputc('}', fp);
+    }
+    fprintf(fp, "%s}\n", nloops > 0 ? "}" : "");
+
+    fclose(fp);
+}
+
+void roi_finalize(void) {
+    const char *report = getenv("GENARCH_ROI_REPORT");
+    if (report != NULL && strcmp(report, "0") != 0) {
+        roi_report(stderr);
+    }
+
+    const char *json = getenv("GENARCH_ROI_JSON");
+    if (json != NULL && json[0] != '\0') {
+        roi_write_json(json);
+    }
+    for (int i = 0; i < roi_nresults; ++i) {
+        free(roi_results[i].str);
+        roi_results[i].str = NULL;
+    }
+    roi_nresults = 0;
+
+    for (int i = roi_nactive - 1; i >= 0; --i) {
+        if (roi_active[i]->finalize != NULL) {
+            roi_active[i]->finalize();
+        }
+    }
+    roi_nactive = 0;
+    roi_nthread_active = 0;
+
+    for (roi_phase_t phase = 0; phase < roi_nphases; ++phase) {
+        free(roi_phases[phase].slots);
+        roi_phases[phase].slots = NULL;
+        free(roi_task_slots[phase]);
+        roi_task_slots[phase] = NULL;
+    }
+    roi_nphases = 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * Region-of-interest (ROI) instrumentation shared by all the kernels.
+ *
+ * A kernel registers named phases once and brackets them with begin/end
+ * calls. Phases nest: a phase opened while another one is open becomes its
+ * child in the final report. Every phase keeps one timer per thread.
+ *
+ * There are two kinds of begin/end calls:
+ *
+ *   - roi_begin()/roi_end(): process-wide phases, called by a single thread
+ *     (outside of parallel regions or inside an "omp master" block). These
+ *     toggle the process-wide backends (Perf, DynamoRIO, VTune, FAPP, PWR,
+ *     RAPL-Stopwatch, hardware counters).
+ *   - roi_thread_begin()/roi_thread_end(): per-thread phases, called by every
+ *     thread inside parallel regions. These only update the per-thread timers
+ *     and the backends that understand threads (VTune tasks, hardware
+ *     counters).
+ *
+ * The backends are selected at runtime with environment variables:
+ *
+ *   GENARCH_ROI_BACKENDS  Comma-separated list of backends, or "none". The
+ *                         default is the set of backends enabled at compile
+ *                         time (PERF_ANALYSIS=1, VTUNE_ANALYSIS=1, ...).
+ *                         "perf", "dynamorio" and "perfctr" are always
+ *                         compiled in. "perfctr" reads cycles, instructions,
+ *                         LLC, dTLB and branch misses with perf_event_open
+ *                         for every thread, and prints one table per phase.
+ *   GENARCH_ROI_PHASE     Name of the phase bracketed by the backends. By
+ *                         default, the outermost process-wide phases.
+ *   GENARCH_ROI_REPORT    If set to a value other than "0", print the
+ *                         per-phase timing table and the load balance of the
+ *                         loops to stderr on roi_finalize().
+ *   GENARCH_ROI_JSON      If set, append a JSON record of the run (see
+ *                         roi_result_str()) to this file on roi_finalize().
+ *   GENARCH_ROI_PERF_FIFO Control fifo of "perf -D -1 --control" (default
+ *                         "perf_ctl.fifo").
+ *
+ * When no backend is active, begin/end only read the clock.
+ */
+
+#ifndef GENARCH_ROI_H
+#define GENARCH_ROI_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROI_MAX_PHASES 64
+#define ROI_MAX_THREADS 1024
+#define ROI_MAX_DEPTH 16
+#define ROI_NAME_LEN 64
+
+typedef int roi_phase_t;
+
+/**
+ * Parse the environment and initialize the selected backends. Called
+ * automatically by the first roi_phase() if not called before.
+ */
+void roi_init(void);
+
+/**
+ * Return the handle of the phase called @name, registering it if needed.
+ * Thread-safe, but meant to be called outside of hot loops.
+ */
+roi_phase_t roi_phase(const char *name);
+
+void roi_begin(roi_phase_t phase);
+void roi_end(roi_phase_t phase);
+
+void roi_thread_begin(roi_phase_t phase);
+void roi_thread_end(roi_phase_t phase);
+
+/**
+ * Load-balance telemetry of parallel loops. Every thread brackets each task
+ * it runs (e.g. one chunk of a "schedule(dynamic)" loop) in the per-thread
+ * phase @phase with roi_task_begin()/roi_task_end(). @size is the size of the
+ * task in the units of the kernel (reads, cells, ...). The phase must be
+ * closed after the implicit barrier of the loop: the time of a thread in the
+ * phase outside of its tasks is reported as idle.
+ */
+void roi_task_begin(roi_phase_t phase);
+void roi_task_end(roi_phase_t phase, double size);
+
+/**
+ * Seconds spent in @phase by the slowest thread.
+ */
+double roi_seconds(roi_phase_t phase);
+
+/**
+ * Print the per-phase timing table and the load balance of the loops to @fp.
+ */
+void roi_report(FILE *fp);
+
+/**
+ * Wall-clock time in seconds, to time the work outside of the ROI (e.g. I/O).
+ */
+double roi_wtime(void);
+
+/**
+ * Add a field to the JSON record, overwriting it if already set. Kernels set
+ * at least "kernel", "input" and "io_seconds". The library adds "threads"
+ * (if not set), "roi_seconds" (outermost process-wide phases), "peak_rss_kb",
+ * "energy_j" (PWR/RAPL only), the seconds of every phase, and the load
+ * balance of the loops.
+ */
+void roi_result_str(const char *key, const char *value);
+void roi_result_num(const char *key, double value);
+
+/**
+ * Report @count units of work (e.g. "SMEMs") done in the ROI. The record
+ * contains count / roi_seconds as "throughput" in "<unit>/s".
+ */
+void roi_result_throughput(const char *unit, double count);
+
+/**
+ * Print the report and the JSON record (if requested) and release the
+ * backends.
+ */
+void roi_finalize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GENARCH_ROI_H
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Build a thread-scaling table from the JSON records written by the ROI library
+(GENARCH_ROI_JSON, see roi.h).
+
+Usage: scaling_table.py [--csv] RECORDS.jsonl [RECORDS.jsonl ...]
+
+Records are grouped by kernel, input and algorithm (if any), and sorted by
+number of threads. Repeated runs with the same number of threads are reduced
+to their median. Speedup and efficiency are relative to the run with the
+fewest threads of each group. The imbalance is the worst busy max/avg ratio
+of the parallel loops of the kernel.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+
+COLUMNS = ['threads', 'runs', 'roi_s', 'io_s', 'speedup', 'efficiency',
+           'throughput', 'unit', 'imbalance', 'peak_rss_mb', 'energy_j']
+
+
+def load_records(paths):
+    records = []
+    for path in paths:
+        with open(path) as f:
+            for num, line in enumerate(f, 1):
+                line = line.strip()
+                if not line:
+                    continue
+                try:
+                    records.append(json.loads(line))
+                except json.JSONDecodeError as e:
+                    print(f'{path}:{num}: skipping invalid record ({e})',
+                          file=sys.stderr)
+    return records
+
+
+def imbalance(record):
+    """Worst busy max/avg ratio of the parallel loops of a run."""
+    loops = record.get('loops', {})
+    return max((loop['imbalance'] for loop in loops.values()), default=None)
+
+
+def median(runs, key):
+    values = [r[key] for r in runs if isinstance(r.get(key), (int, float))]
+    return statistics.median(values) if values else None
+
+
+def build_rows(runs_by_threads):
+    rows = []
+    base = None
+    for threads in sorted(runs_by_threads):
+        runs = runs_by_threads[threads]
+        roi = median(runs, 'roi_seconds')
+        rss = median(runs, 'peak_rss_kb')
+        ratios = [r for r in map(imbalance, runs) if r is not None]
+        if base is None and roi:
+            base = (threads, roi)
+        speedup = efficiency = None
+        if base is not None and roi:
+            speedup = base[1] / roi
+            efficiency = speedup * base[0] / threads
+        rows.append({
+            'threads': threads,
+            'runs': len(runs),
+            'roi_s': roi,
+            'io_s': median(runs, 'io_seconds'),
+            'speedup': speedup,
+            'efficiency': efficiency,
+            'throughput': median(runs, 'throughput'),
+            'unit': runs[0].get('throughput_unit', ''),
+            'imbalance': statistics.median(ratios) if ratios else None,
+            'peak_rss_mb': rss / 1024 if rss is not None else None,
+            'energy_j': median(runs, 'energy_j'),
+        })
+    return rows
+
+
+def fmt(value):
+    if value is None:
+        return '-'
+    if isinstance(value, float):
+        return f'{value:.4g}' if abs(value) < 1e4 else f'{value:.4e}'
+    return str(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('records', nargs='+', help='JSON-lines files')
+    parser.add_argument('--csv', action='store_true',
+                        help='print comma-separated values')
+    args = parser.parse_args()
+
+    groups = {}
+    for r in load_records(args.records):
+        key = (r.get('kernel', '?'), r.get('input', '?'), r.get('algorithm'))
+        threads = int(r.get('threads', 1))
+        groups.setdefault(key, {}).setdefault(threads, []).append(r)
+
+    if args.csv:
+        print(','.join(['kernel', 'input', 'algorithm'] + COLUMNS))
+
+    for (kernel, input, algorithm), runs_by_threads in sorted(
+            groups.items(), key=lambda g: tuple(str(k) for k in g[0])):
+        rows = build_rows(runs_by_threads)
+
+        if args.csv:
+            for row in rows:
+                cells = [kernel, input, algorithm or '']
+                cells += ['' if row[c] is None else str(row[c])
+                          for c in COLUMNS]
+                print(','.join(cells))
+            continue
+
+        title = f'{kernel} ({algorithm})' if algorithm else kernel
+        print(f'{title}: {input}')
+        table = [COLUMNS] + [[fmt(row[c]) for c in COLUMNS] for row in rows]
+        widths = [max(len(line[i]) for line in table)
+                  for i in range(len(COLUMNS))]
+        for line in table:
+            print('  '.join(cell.rjust(w) for cell, w in zip(line, widths)))
+        print()
+
+
+if __name__ == '__main__':
+    main()
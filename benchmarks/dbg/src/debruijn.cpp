@@ -21,26 +21,7 @@
 
 // #define VTUNE_ANALYSIS 1
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
 
 inline char _getBase(uint8_t *s, int i) {
     char* baseLookup = "=ACMGRSVTWYHKDBN";
@@ -1553,6 +1534,7 @@ int main(int argc,char** argv){
     std::vector<Batch> batches;
 
     // extract reads from region    
+    double ioStart = roi_wtime();
     while (sam_itr_next(in, iter, b) >= 0) {
         getRead(readBuffer.reads.windowEnd, b); // copy the current read to the myread structure. See common.c for information
         // printRead(readBuffer.reads.windowEnd, header);  // print data in structure. See common.c for information;
@@ -1572,6 +1554,8 @@ int main(int argc,char** argv){
         }
     }
 
+    double ioSeconds = roi_wtime() - ioStart;
+
     // process reads
     const int assemblyRegionSize = 1500;
     int assemRegionShift = std::max(100, std::min(1000, assemblyRegionSize / 2));
@@ -1600,54 +1584,17 @@ int main(int argc,char** argv){
 }
 
     gettimeofday(&start_time, NULL);
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-    }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-    __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-    fapp_start("assembleReadsAndDetectVariants", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-    __DR_START_TRACE();
-#endif
+    roi_phase_t roi_kernel = roi_phase("assembleReadsAndDetectVariants");
+    roi_phase_t roi_batches = roi_phase("batches");
+    roi_begin(roi_kernel);
 
 #pragma omp parallel num_threads(numThreads)
 {
     int tid = omp_get_thread_num();
+    roi_thread_begin(roi_batches);
     #pragma omp for schedule(dynamic, 1)
         for (int i = 0; i < batches.size(); i++) {
+            roi_task_begin(roi_batches);
             int assemStart = batches[i].offset;
             int assemEnd = std::min(assemStart + assemblyRegionSize, end);
             int refStart = std::max(0, assemStart - assemblyRegionSize);
@@ -1657,44 +1604,11 @@ int main(int argc,char** argv){
             //     fprintf(stderr, "Assembling region %s:%d-%d, tid = %d\n", tmp, assemStart, assemEnd, tid);
             // }
             assembleReadsAndDetectVariants(refStart, refEnd, batches[i].windowStart, batches[i].windowEnd, batches[i].ref, verbose > 0);
+            roi_task_end(roi_batches, batches[i].windowEnd - batches[i].windowStart);
         }
+    roi_thread_end(roi_batches);
 }
-#if DYNAMORIO_ANALYSIS
-    __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-    __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-    fapp_stop("assembleReadsAndDetectVariants", 1, 0);
-#endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
-
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-	}
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
-#endif
+    roi_end(roi_kernel);
     gettimeofday(&end_time, NULL);
     runtime += (end_time.tv_sec - start_time.tv_sec)*1e6 + end_time.tv_usec - start_time.tv_usec;
 
@@ -1716,5 +1630,11 @@ int main(int argc,char** argv){
 
     fprintf(stderr, "Kernel runtime: %.2f s\n", runtime*1e-6);
     
+    roi_result_str("kernel", "dbg");
+    roi_result_str("input", argv[1]);
+    roi_result_num("threads", numThreads);
+    roi_result_num("io_seconds", ioSeconds);
+    roi_result_throughput("regions", batches.size());
+    roi_finalize();
     return 0;
 }
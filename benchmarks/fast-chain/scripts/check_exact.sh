@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Check that fast-chain gives the same scores and predecessors as chain built
+# with NO_HEURISTICS=1, for every instruction set of the host.
+#
+# usage: check_exact.sh [input ...]
+#
+# Without inputs it checks a file written by gen_anchors.py. ARCHS overrides
+# the instruction sets to check (e.g. ARCHS="avx2 avx512") and THREADS the
+# number of threads of fast-chain.
+
+scriptfolder="$(dirname $(realpath $0))"
+fast_chain_path="$(dirname "$scriptfolder")"
+chain_path="$fast_chain_path/../chain"
+
+if [[ -z "$ARCHS" ]]; then
+    ARCHS="scalar"
+    grep -qw avx2 /proc/cpuinfo && ARCHS+=" avx2"
+    grep -qw avx512bw /proc/cpuinfo && grep -qw avx512cd /proc/cpuinfo && ARCHS+=" avx512"
+    grep -qw sve /proc/cpuinfo && ARCHS+=" sve"
+fi
+THREADS="${THREADS:-4}"
+
+stage="$(mktemp -d)"
+trap 'rm -rf "$stage"' EXIT
+
+inputs=("$@")
+if [[ ${#inputs[@]} -eq 0 ]]; then
+    "$scriptfolder/gen_anchors.py" > "$stage/anchors.txt" || exit 1
+    inputs=("$stage/anchors.txt")
+fi
+
+echo "Building chain with NO_HEURISTICS=1"
+make -s -C "$chain_path" NO_HEURISTICS=1 BUILD_PATH=build-no-heuristics \
+    BIN_NAME=chain-no-heuristics >/dev/null || exit 1
+reference="$chain_path/chain-no-heuristics"
+
+status=0
+for arch in $ARCHS; do
+    case "$arch" in
+        scalar) arch_flag="" ;;
+        sve) arch_flag="-march=armv8-a+sve" ;;
+        *) arch_flag="$arch" ;;
+    esac
+    echo "Building fast-chain ($arch)"
+    make -s -C "$fast_chain_path" arch="$arch_flag" BUILD_PATH="build-$arch" \
+        BIN_NAME="chain-$arch" >/dev/null 2>&1 || { echo "FAILED to build $arch"; status=1; continue; }
+
+    for input in "${inputs[@]}"; do
+        name="$(basename "$input")"
+        "$reference" -i "$input" -o "$stage/reference.txt" -t "$THREADS" 2>/dev/null
+        "$fast_chain_path/chain-$arch" -i "$input" -o "$stage/out.txt" -t "$THREADS" 2>/dev/null
+        diff_line="$(cmp "$stage/reference.txt" "$stage/out.txt" 2>&1 | sed -n 's/.*line //p')"
+        if [[ -n "$diff_line" ]]; then
+            call="$(head -n "$diff_line" "$stage/reference.txt" | grep -c EOR)"
+            echo "$arch $name: FAILED, call $call differs (line $diff_line)"
+            status=1
+        elif ! cmp -s "$stage/reference.txt" "$stage/out.txt"; then
+            echo "$arch $name: FAILED, the outputs have different lengths"
+            status=1
+        else
+            echo "$arch $name: OK"
+        fi
+    done
+done
+
+exit $status
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""
+Generate a text anchor file that exercises the 32-bit deltas of fast-chain.
+
+Usage: gen_anchors.py [--calls N] [--seed S] > ANCHORS.txt
+
+Besides plain sorted calls, it writes calls that cover both strands or cross
+a multiple of 2^32 (sorted, so the 32-bit deltas stay exact), calls that are
+not sorted but narrow, and wide calls that chain_dp has to chain on the 64-bit
+x. Some calls use round avg_qspan values, where a float gap cost would differ
+from the double one of chain.
+"""
+
+import argparse
+import random
+import sys
+
+KINDS = ('sorted', 'strands', 'carry', 'unsorted', 'wide')
+STRAND = 1 << 63
+
+
+def walk(rng, n, start):
+    """n anchors of one read along a diagonal, as (ref, query, span)."""
+    ref, query = start, rng.randint(0, 1000)
+    anchors = []
+    for _ in range(n):
+        step = rng.randint(0, 30)
+        ref += step
+        query = max(0, query + step + rng.randint(-8, 8))
+        anchors.append((ref, query, rng.randint(11, 28)))
+    return anchors
+
+
+def gen_call(rng, kind):
+    n = rng.choice((0, 1, 4, 9, 40, 300, 2000))
+    if rng.random() < 0.3:
+        avg_qspan = rng.choice((0.04, 5.0, 10.0, 12.5, 20.0, 25.0, 40.0))
+    else:
+        avg_qspan = rng.uniform(8, 40)
+    rid = rng.randint(0, 1000)
+    if kind == 'carry':
+        start = (rid << 32) + (1 << 32) - rng.randint(0, 15 * n + 1)
+    else:
+        start = (rid << 32) + rng.randint(0, (1 << 32) - 1 - 40 * n)
+    anchors = walk(rng, n, start)
+    if kind in ('strands', 'wide'):
+        anchors = [(r | STRAND if rng.random() < 0.5 else r, q, s)
+                   for r, q, s in anchors]
+    if kind == 'strands':
+        anchors.sort()
+    if kind in ('unsorted', 'wide'):
+        # Swap close anchors, the predecessors then come before and after.
+        for i in range(len(anchors) - 1):
+            if rng.random() < 0.2:
+                anchors[i], anchors[i + 1] = anchors[i + 1], anchors[i]
+    lines = [f'{n}\t{avg_qspan:.6f}\t5000\t5000\t500\t1']
+    lines += [f'{r}\t{s << 32 | q}' for r, q, s in anchors]
+    lines.append('EOR')
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--calls', type=int, default=500)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    for i in range(args.calls):
+        sys.stdout.write(gen_call(rng, KINDS[i % len(KINDS)]))
+
+
+if __name__ == '__main__':
+    main()
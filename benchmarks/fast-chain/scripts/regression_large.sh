@@ -68,6 +68,17 @@ command_opts="-i \"$inputs_path/c_elegans_40x.10k.in\" -o out.txt -t \$OMP_NUM_T
 # Additional variables.
 #
 
+# fast-chain is exact for 64-bit anchors, so its output differs from
+# out-reference-no-heuristics-32b.txt of the inputs (written by a 32-bit
+# kernel). Check it against chain built with NO_HEURISTICS=1 instead, as
+# check_exact.sh does.
+chain_path="$binaries_path/../chain"
+make -s -C "$chain_path" NO_HEURISTICS=1 BUILD_PATH=build-no-heuristics \
+    BIN_NAME=chain-no-heuristics >/dev/null || exit 1
+reference="$chain_path/build-no-heuristics/$job.txt"
+"$chain_path/chain-no-heuristics" -i "$inputs_path/c_elegans_40x.10k.in" -o "$reference" -t 1 \
+    >/dev/null 2>&1 || exit 1
+
 #
 # This function is executed before launching a job. You can use this function to
 # prepare the stage folder of the job.
@@ -91,7 +102,7 @@ after_run() (
     echo "Time in kernel: $wall_time s"
 
     # Check if the output file is identical to the reference
-    diff --brief "out.txt" "$inputs_path/out-reference-no-heuristics-32b.txt" >/dev/null 2>&1
+    diff --brief "out.txt" "$reference" >/dev/null 2>&1
     if [[ $? -ne 0 ]]; then
         echo "The output file is not identical to the reference file"
         return 1 # Failure
@@ -32,10 +32,17 @@ struct call_t {
     float avg_qspan;
     int max_dist_x, max_dist_y, bw, n_segs;
     std::vector<uint64_t> anchors_x;
-    std::vector<uint32_t> anchors_x32; // WRONG in some cases.
+    std::vector<uint32_t> anchors_x32; // x - x_base
 
     std::vector<uint64_t> anchors_y;
-    std::vector<uint32_t> anchors_y32; // WRONG in some cases.
+    std::vector<uint32_t> anchors_y32; // Query position, the low 32 bits of y
+
+    // Minimum x of the call. The 32-bit deltas of the anchors that chain_dp
+    // compares are exact unless the call is wide: its anchors are not sorted
+    // by x and span 2^31 - max_dist_x or more positions. Wide calls are
+    // chained on the 64-bit x instead.
+    uint64_t x_base;
+    bool wide;
 
     std::vector<int32_t> q_spans;
 };
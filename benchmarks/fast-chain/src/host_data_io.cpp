@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "host_data_io.h"
 #include "host_data.h"
 
@@ -10,6 +12,28 @@ void skip_to_EOR(FILE *fp) {
     }
 }
 
+// Store x as 32-bit deltas from the minimum of the call and decide if the
+// call is wide. When the anchors are sorted, the predecessors of anchor i are
+// at most max_dist_x positions before it, so the deltas are exact however far
+// apart the anchors of the call are (e.g. both strands). Otherwise every
+// difference of two deltas, and that minus dq <= max_dist_x, has to fit in
+// an int32.
+static void rebase_call(call_t &call) {
+    const uint64_t *x = call.anchors_x.data() + 32;
+    uint64_t x_min = call.n > 0 ? x[0] : 0, x_max = x_min;
+    bool sorted = true;
+    for (anchor_idx_t i = 1; i < call.n; i++) {
+        sorted &= x[i] >= x[i - 1];
+        x_min = std::min(x_min, x[i]);
+        x_max = std::max(x_max, x[i]);
+    }
+    for (anchor_idx_t i = 0; i < call.n; i++) {
+        call.anchors_x32[i + 32] = x[i] - x_min;
+    }
+    call.x_base = x_min;
+    call.wide = !sorted && x_max - x_min >= (1ULL << 31) - (uint64_t)std::max(call.max_dist_x, 0);
+}
+
 call_t read_call(FILE *fp) {
     call_t call;
 
@@ -61,7 +85,6 @@ call_t read_call(FILE *fp) {
         fscanf(fp, "%llu%llu", &x, &y);
 
         call.anchors_x[i] = x;
-        call.anchors_x32[i] = x;
 
         call.anchors_y[i] = y;
         call.anchors_y32[i] = y;
@@ -69,6 +92,8 @@ call_t read_call(FILE *fp) {
         call.q_spans[i] = y >> 32 & 0xff;
     }
 
+    rebase_call(call);
+
     skip_to_EOR(fp);
     return call;
 }
@@ -83,10 +83,15 @@ void print_vector_f(svfloat64_t v) {
         __mmask16 neg_mask = _mm512_cmpneq_epi32_mask(dd_v, zero_v);
         __m512i log_dd_v = _mm512_srli_epi32(_mm512_maskz_or_epi32(neg_mask, r_v, zero_v), 1);
 
-        //dd * 0.01*avg_qspan
-        float avg_qspan_val = 0.01 * avg_qspan;
-        __m512 avg_qspan_v = _mm512_set1_ps(avg_qspan_val);
-        __m512i cost = _mm512_cvt_roundps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(dd_v), avg_qspan_v), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        //(int)(dd * .01 * avg_qspan), in double as the scalar code so that
+        //the result is the same
+        __m512d c001_v = _mm512_set1_pd(.01);
+        __m512d avg_qspan_v = _mm512_set1_pd(avg_qspan);
+        __m512d dd_lo = _mm512_cvtepi32_pd(_mm512_castsi512_si256(dd_v));
+        __m512d dd_hi = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(dd_v, 1));
+        __m256i cost_lo = _mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_mul_pd(dd_lo, c001_v), avg_qspan_v));
+        __m256i cost_hi = _mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_mul_pd(dd_hi, c001_v), avg_qspan_v));
+        __m512i cost = _mm512_inserti64x4(_mm512_castsi256_si512(cost_lo), cost_hi, 1);
 
         // gap_cost = (dd * 0.01*avg_qspan) + (log_dd>>1 + 0.499)
         __m512i gap_cost_v = (_mm512_add_epi32(cost, log_dd_v));
@@ -120,10 +125,15 @@ void print_vector_f(svfloat64_t v) {
         __m256i neg_mask = _mm256_cmpeq_epi32(dd_v, zero_avx2_v);
         __m256i log_dd_v = _mm256_srli_epi32(_mm256_andnot_si256(neg_mask, r_v), 1);
 
-        //dd * 0.01*avg_qspan
-        float avg_qspan_val = 0.01 * avg_qspan;
-        __m256 avg_qspan_v = _mm256_set1_ps(avg_qspan_val);
-        __m256i cost = _mm256_cvtps_epi32(_mm256_round_ps((_mm256_mul_ps(_mm256_cvtepi32_ps(dd_v), avg_qspan_v)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+        //(int)(dd * .01 * avg_qspan), in double as the scalar code so that
+        //the result is the same
+        __m256d c001_v = _mm256_set1_pd(.01);
+        __m256d avg_qspan_v = _mm256_set1_pd(avg_qspan);
+        __m256d dd_lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(dd_v));
+        __m256d dd_hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(dd_v, 1));
+        __m128i cost_lo = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_mul_pd(dd_lo, c001_v), avg_qspan_v));
+        __m128i cost_hi = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_mul_pd(dd_hi, c001_v), avg_qspan_v));
+        __m256i cost = _mm256_inserti128_si256(_mm256_castsi128_si256(cost_lo), cost_hi, 1);
 
         // gap_cost = (dd * 0.01*avg_qspan) + (log_dd>>1 + 0.499)
         __m256i gap_cost_v = (_mm256_add_epi32(cost, log_dd_v));
@@ -132,6 +142,68 @@ void print_vector_f(svfloat64_t v) {
     }
 #endif
 
+// chain_dp on the 64-bit x, for the wide calls (see call_t) where the 32-bit
+// deltas could wrap. Same as ../chain built with NO_HEURISTICS=1.
+static void chain_dp_wide(const call_t *a, int32_t *scores, int32_t *parents, int32_t *peak_scores) {
+    constexpr float gap_scale = 1.0f;
+    constexpr int max_iter = 5000;
+
+    const auto max_dist_x = a->max_dist_x;
+    const auto max_dist_y = a->max_dist_y;
+    const auto bw = a->bw;
+    const auto avg_qspan = a->avg_qspan;
+
+    const auto *anchors_x = a->anchors_x.data() + 32;
+    const auto *anchors_y32 = a->anchors_y32.data() + 32;
+    const auto *q_spans = a->q_spans.data() + 32;
+
+    int64_t st = 0;
+    for (int64_t i = 0; i < a->n; ++i) {
+        const uint64_t ri = anchors_x[i];
+        const int32_t qi = static_cast<int32_t>(anchors_y32[i]);
+        const int32_t q_spani = q_spans[i];
+
+        int64_t max_j = -1;
+        int32_t max_f = q_spani;
+
+        while (st < i && ri > anchors_x[st] + max_dist_x) {
+            ++st; //predecessor's position is too far
+        }
+        if (i - st > max_iter) {
+            st = i - max_iter; //predecessor's index is too far
+        }
+
+        for (int64_t j = i - 1; j >= st; --j) {
+            const int64_t dr = ri - anchors_x[j];
+            const int32_t dq = qi - static_cast<int32_t>(anchors_y32[j]);
+            if (dr == 0 || dq <= 0) {
+                continue;
+            }
+            if (dq > max_dist_y || dq > max_dist_x) {
+                continue;
+            }
+            // Truncated to 32 bits as in chain.
+            const int32_t dd = dr > dq ? dr - dq : dq - dr;
+            if (dd > bw) {
+                continue;
+            }
+            const int32_t min_d = dq < dr ? dq : dr;
+            int32_t score = min_d > q_spani ? q_spani : dq < dr ? dq : dr;
+            const int32_t log_dd = dd ? ilog2_32_dp_lib(dd) : 0;
+            const int32_t gap_cost = static_cast<int>(dd * .01 * avg_qspan) + (log_dd >> 1);
+            score -= static_cast<int>(static_cast<double>(gap_cost) * gap_scale + .499);
+            score += scores[j];
+            if (score > max_f) {
+                max_f = score;
+                max_j = j;
+            }
+        }
+        scores[i] = max_f;
+        parents[i] = max_j;
+        peak_scores[i] = max_j >= 0 && peak_scores[max_j] > max_f ? peak_scores[max_j] : max_f;
+    }
+}
+
 static void chain_dp(call_t *a, return_t *ret) {
     constexpr float gap_scale = 1.0f;
     // constexpr int max_skip = 25;
@@ -143,7 +215,6 @@ static void chain_dp(call_t *a, return_t *ret) {
     const auto bw = a->bw;
 
     const auto avg_qspan = a->avg_qspan;
-    const float avg_qspan001 = 0.01f * avg_qspan;
 
     // const auto n_segs = a->n_segs;
     const auto n = a->n;
@@ -170,6 +241,11 @@ static void chain_dp(call_t *a, return_t *ret) {
     auto *targets = ret->targets.data() + 32;
     auto *peak_scores = ret->peak_scores.data() + 32;
 
+    if (a->wide) {
+        chain_dp_wide(a, scores, parents, peak_scores);
+        return;
+    }
+
     int32_t st = 0;
 
 #ifdef __AVX512BW__
@@ -197,7 +273,7 @@ static void chain_dp(call_t *a, return_t *ret) {
 
 
         //uint64_t ri = anchors_x[i];
-        while (st < i && !(anchors_x[i] - anchors_x[st] <= (uint32_t)dr)) {
+        while (st < i && anchors_x[i] > anchors_x[st] + max_dist_x) {
             ++st;    //predecessor's position is too far
         }
 
@@ -429,7 +505,7 @@ static void chain_dp(call_t *a, return_t *ret) {
 
 
         //uint64_t ri = anchors_x[i];
-        while (st < i && !(anchors_x[i] - anchors_x[st] <= dr)) {
+        while (st < i && anchors_x[i] > anchors_x[st] + max_dist_x) {
             ++st;    //predecessor's position is too far
         }
 
@@ -695,7 +771,7 @@ static void chain_dp(call_t *a, return_t *ret) {
         int32_t max_j = -1;
         int32_t max_f = q_spani;
 
-        while (st < i && !(anchors_x[i] - anchors_x[st] <= max_dist_x)) {
+        while (st < i && anchors_x[i] > anchors_x[st] + max_dist_x) {
             ++st; //predecessor's position is too far
         }
         if (i - st > max_iter) {
@@ -759,10 +835,14 @@ static void chain_dp(call_t *a, return_t *ret) {
             log_dd = svlsr_n_s64_x(valid_elements,log_dd,1);
             gap_cost = svadd_s64_x(valid_elements,gap_cost,log_dd);
             */
-            svfloat32_t gap_cost_f = svcvt_f32_s32_x(valid_elements,dd);
-            //gap_cost_f = svmul_n_f64_x(valid_elements,gap_cost_f,0.01f);
-            gap_cost_f = svmul_n_f32_x(valid_elements,gap_cost_f,avg_qspan001);
-            svint32_t gap_cost = svcvt_s32_f32_x(valid_elements,gap_cost_f);
+            // (int)(dd * .01 * avg_qspan) in double, on the two halves of dd.
+            svbool_t ptrue64 = svptrue_b64();
+            svfloat64_t gap_cost_lo = svcvt_f64_s64_x(ptrue64,svunpklo_s64(dd));
+            svfloat64_t gap_cost_hi = svcvt_f64_s64_x(ptrue64,svunpkhi_s64(dd));
+            gap_cost_lo = svmul_n_f64_x(ptrue64,svmul_n_f64_x(ptrue64,gap_cost_lo,.01),avg_qspan);
+            gap_cost_hi = svmul_n_f64_x(ptrue64,svmul_n_f64_x(ptrue64,gap_cost_hi,.01),avg_qspan);
+            svint32_t gap_cost = svuzp1_s32(svreinterpret_s32(svcvt_s64_f64_x(ptrue64,gap_cost_lo)),
+                                            svreinterpret_s32(svcvt_s64_f64_x(ptrue64,gap_cost_hi)));
             log_dd = svreinterpret_s32(svlsr_n_u32_x(valid_elements,svreinterpret_u32(log_dd),1));
             gap_cost = svadd_s32_x(valid_elements,gap_cost,log_dd);
 
@@ -808,7 +888,7 @@ static void chain_dp(call_t *a, return_t *ret) {
         int32_t max_j = -1;
         int32_t max_f = q_spani;
 
-        while (st < i && !(anchors_x[i] - anchors_x[st] <= max_dist_x)) {
+        while (st < i && anchors_x[i] > anchors_x[st] + max_dist_x) {
             ++st; //predecessor's position is too far
         }
         if (i - st > max_iter) {
@@ -842,7 +922,7 @@ static void chain_dp(call_t *a, return_t *ret) {
 
             // TODO: CAN'T VECTORIZE __builtin_clz 
             const int32_t log_dd = (dd) ? ilog2_32(dd) : 0;
-            const int32_t gap_cost = static_cast<int>(dd * 0.01f * avg_qspan) + (log_dd >> 1);
+            const int32_t gap_cost = static_cast<int>(dd * .01 * avg_qspan) + (log_dd >> 1);
 
             const int32_t score = scores[j] + oc - gap_cost;
 
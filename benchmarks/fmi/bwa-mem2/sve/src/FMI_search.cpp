@@ -28,6 +28,12 @@ Authors: Sanchit Misra <sanchit.misra@intel.com>; Vasimuddin Md <vasimuddin.md@i
 *****************************************************************************************/
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <omp.h>
 #include "sais.h"
 #include "FMI_search.h"
 #include "memcpy_bwamem.h"
@@ -41,6 +47,20 @@ extern "C" {
 }
 #endif
 
+static size_t cp_occ_bytes(int64_t reference_seq_len)
+{
+    return ((reference_seq_len >> CP_SHIFT) + 1) * sizeof(CP_OCC);
+}
+
+static int64_t sa_entries(int64_t reference_seq_len)
+{
+    #if SA_COMPRESSION
+    return (reference_seq_len >> SA_COMPX) + 1;
+    #else
+    return reference_seq_len;
+    #endif
+}
+
 FMI_search::FMI_search(const char *fname)
 {
     fprintf(stderr, "* Entering FMI_search\n");
@@ -53,18 +73,47 @@ FMI_search::FMI_search(const char *fname)
     sa_ms_byte = NULL;
     cp_occ = NULL;
     one_hot_mask_array = NULL;
+    index_map = NULL;
+    index_map_size = 0;
+    memset(numa_replicas, 0, sizeof(numa_replicas));
+    home = NULL;
 }
 
 FMI_search::~FMI_search()
 {
-    if(sa_ms_byte)
+    if(home)
+    {
+        // Only the replicated arrays belong to a replica.
+        munmap(cp_occ, cp_occ_bytes(reference_seq_len));
+        if(sa_ms_byte != home->sa_ms_byte)
+        {
+            munmap(sa_ms_byte, sa_entries(reference_seq_len) * sizeof(int8_t));
+            munmap(sa_ls_word, sa_entries(reference_seq_len) * sizeof(uint32_t));
+        }
+        idx = NULL;
+        return;
+    }
+    for(int node = 0; node < FMI_MAX_NUMA_NODES; node++)
+    {
+        if(numa_replicas[node] && numa_replicas[node] != this)
+            delete numa_replicas[node];
+    }
+    if(sa_ms_byte && !is_mapped(sa_ms_byte))
         _mm_free(sa_ms_byte);
-    if(sa_ls_word)
+    if(sa_ls_word && !is_mapped(sa_ls_word))
         _mm_free(sa_ls_word);
-    if(cp_occ)
+    if(cp_occ && !is_mapped(cp_occ))
         _mm_free(cp_occ);
     if(one_hot_mask_array)
         _mm_free(one_hot_mask_array);
+    if(index_map)
+        munmap(index_map, index_map_size);
+}
+
+bool FMI_search::is_mapped(const void *ptr)
+{
+    return index_map != NULL && (const char *)ptr >= index_map &&
+           (const char *)ptr < index_map + index_map_size;
 }
 
 int64_t FMI_search::pac_seq_len(const char *fn_pac)
@@ -141,6 +190,16 @@ void FMI_search::pac2nt(const char *fn_pac, std::string &reference_seq)
 	free(buf2);
 }
 
+/**
+ * Pad @outstream with zeros up to the next multiple of @align bytes.
+ */
+static void write_padding(std::fstream &outstream, int64_t align)
+{
+    static const char zeros[CP_FILE_ALIGN] = {0};
+    int64_t pos = outstream.tellp();
+    outstream.write(zeros, (align - pos % align) % align);
+}
+
 int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int64_t ref_seq_len, int64_t *sa_bwt, int64_t *count) {
     printf("ref_seq_len = %ld\n", ref_seq_len);
     fflush(stdout);
@@ -160,8 +219,6 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     uint8_t *bwt;
 
     ref_seq_len++;
-    outstream.write((char *)(&ref_seq_len), 1 * sizeof(int64_t));
-    outstream.write((char*)count, 5 * sizeof(int64_t));
 
     int64_t i;
     int64_t ref_seq_len_aligned = ((ref_seq_len + CP_BLOCK_SIZE - 1) / CP_BLOCK_SIZE) * CP_BLOCK_SIZE;
@@ -200,6 +257,13 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     for(i = ref_seq_len; i < ref_seq_len_aligned; i++)
         bwt[i] = DUMMY_CHAR;
 
+    // The header fills the first CP_FILE_ALIGN bytes, see load_index().
+    int64_t magic = CP_FILE_MAGIC;
+    outstream.write((char *)(&magic), 1 * sizeof(int64_t));
+    outstream.write((char *)(&ref_seq_len), 1 * sizeof(int64_t));
+    outstream.write((char*)count, 5 * sizeof(int64_t));
+    outstream.write((char *)(&sentinel_index), 1 * sizeof(int64_t));
+
 
     printf("CP_SHIFT = %d, CP_MASK = %d\n", CP_SHIFT, CP_MASK);
     printf("sizeof CP_OCC = %ld\n", sizeof(CP_OCC));
@@ -273,6 +337,7 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     }
     fprintf(stderr, "pos: %d, ref_seq_len__: %ld\n", pos, ref_seq_len >> SA_COMPX);
     outstream.write((char*)sa_ms_byte, ((ref_seq_len >> SA_COMPX) + 1) * sizeof(int8_t));
+    write_padding(outstream, CP_FILE_ALIGN);
     outstream.write((char*)sa_ls_word, ((ref_seq_len >> SA_COMPX) + 1) * sizeof(uint32_t));
     
     #else
@@ -289,11 +354,11 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
         sa_ms_byte[i] = (sa_bwt[i] >> 32) & 0xff;
     }
     outstream.write((char*)sa_ms_byte, ref_seq_len * sizeof(int8_t));
+    write_padding(outstream, CP_FILE_ALIGN);
     outstream.write((char*)sa_ls_word, ref_seq_len * sizeof(uint32_t));
     
     #endif
 
-    outstream.write((char *)(&sentinel_index), 1 * sizeof(int64_t));
     outstream.close();
     printf("max_occ_ind = %ld\n", i >> CP_SHIFT);    
     fflush(stdout);
@@ -381,8 +446,104 @@ int FMI_search::build_index() {
     return 0;
 }
 
-void FMI_search::load_index()
+/**
+ * Offsets of the sections of an index file. The aligned layout (written by
+ * build_fm_index) starts with a CP_FILE_ALIGN-byte header:
+ *
+ *   magic, reference_seq_len, count[5], sentinel_index
+ *
+ * followed by cp_occ, sa_ms_byte and sa_ls_word, each one starting at a
+ * multiple of CP_FILE_ALIGN. The legacy layout starts with reference_seq_len
+ * and count[5], packs the sections back to back, and ends with the
+ * sentinel_index.
+ */
+typedef struct {
+    bool aligned;
+    int64_t reference_seq_len;
+    int64_t cp_occ_size;
+    int64_t sa_size;
+    int64_t cp_occ_offset;
+    int64_t sa_ms_byte_offset;
+    int64_t sa_ls_word_offset;
+    int64_t sentinel_offset;
+    int64_t count_offset;
+} index_layout_t;
+
+static int64_t align_offset(int64_t offset, bool aligned)
+{
+    return aligned ? (offset + CP_FILE_ALIGN - 1) / CP_FILE_ALIGN * CP_FILE_ALIGN : offset;
+}
+
+static void index_layout(FILE *cpstream, index_layout_t *layout)
 {
+    int64_t first;
+    err_fread_noeof(&first, sizeof(int64_t), 1, cpstream);
+    // The legacy files start with the reference length, below 2^40.
+    int sa_bits = (uint64_t)first >> CP_FILE_SA_SHIFT_BIT;
+    first &= CP_FILE_MAGIC_MASK;
+    if (sa_bits != 0 && sa_bits - 1 != SA_COMPX) {
+        fprintf(stderr, "ERROR! unsupported SA sampling in the index file\n");
+        exit(EXIT_FAILURE);
+    }
+    layout->aligned = first == CP_FILE_MAGIC;
+    if (layout->aligned) {
+        err_fread_noeof(&layout->reference_seq_len, sizeof(int64_t), 1, cpstream);
+        layout->count_offset = 2 * sizeof(int64_t);
+        layout->sentinel_offset = 7 * sizeof(int64_t);
+        layout->cp_occ_offset = CP_FILE_ALIGN;
+    }
+    else {
+        layout->reference_seq_len = first;
+        layout->count_offset = sizeof(int64_t);
+        layout->cp_occ_offset = 6 * sizeof(int64_t);
+    }
+    assert(layout->reference_seq_len > 0);
+    assert(layout->reference_seq_len <= 0x7fffffffffL);
+
+    layout->cp_occ_size = cp_occ_bytes(layout->reference_seq_len) / sizeof(CP_OCC);
+    layout->sa_size = sa_entries(layout->reference_seq_len);
+    layout->sa_ms_byte_offset = layout->cp_occ_offset + layout->cp_occ_size * sizeof(CP_OCC);
+    layout->sa_ls_word_offset = align_offset(layout->sa_ms_byte_offset + layout->sa_size * sizeof(int8_t),
+                                             layout->aligned);
+    if (!layout->aligned) {
+        layout->sentinel_offset = layout->sa_ls_word_offset + layout->sa_size * sizeof(uint32_t);
+    }
+}
+
+static void read_section(FILE *cpstream, int64_t offset, void *ptr, size_t size, size_t nmemb)
+{
+    err_fseek(cpstream, offset, SEEK_SET);
+    err_fread_noeof(ptr, size, nmemb, cpstream);
+}
+
+/**
+ * Return @size bytes at @offset of the mapping @map, or an aligned copy if
+ * they are not aligned to @align bytes.
+ */
+static void *mapped_section(char *map, int64_t offset, size_t size, size_t align, const char *name)
+{
+    if ((uintptr_t)(map + offset) % align == 0) {
+        return map + offset;
+    }
+    fprintf(stderr, "* %s is not aligned in the index file, copying it "
+            "(rebuild the index to share it between processes)\n", name);
+    void *copy = _mm_malloc(size, 64);
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR! unable to allocate %s memory\n", name);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, map + offset, size);
+    return copy;
+}
+
+void FMI_search::load_index(int flags, int cp_block_size)
+{
+    if (cp_block_size != 0 && cp_block_size != CP_BLOCK_SIZE)
+    {
+        fprintf(stderr, "ERROR! unsupported checkpoint block size %d\n", cp_block_size);
+        exit(EXIT_FAILURE);
+    }
+
     one_hot_mask_array = (uint64_t *)_mm_malloc(64 * sizeof(uint64_t), 64);
     one_hot_mask_array[0] = 0;
     uint64_t base = 0x8000000000000000L;
@@ -414,53 +575,76 @@ void FMI_search::load_index()
         fprintf(stderr, "* Index file found. Loading index from %s\n", cp_file_name);
     }
 
-    err_fread_noeof(&reference_seq_len, sizeof(int64_t), 1, cpstream);
-    assert(reference_seq_len > 0);
-    assert(reference_seq_len <= 0x7fffffffffL);
+    index_layout_t layout;
+    index_layout(cpstream, &layout);
+    reference_seq_len = layout.reference_seq_len;
 
     fprintf(stderr, "* Reference seq len for bi-index = %ld\n", reference_seq_len);
 
-    // create checkpointed occ
-    int64_t cp_occ_size = (reference_seq_len >> CP_SHIFT) + 1;
-    cp_occ = NULL;
+    read_section(cpstream, layout.count_offset, &count[0], sizeof(int64_t), 5);
+    sentinel_index = -1;
+    #if SA_COMPRESSION
+    read_section(cpstream, layout.sentinel_offset, &sentinel_index, sizeof(int64_t), 1);
+    fprintf(stderr, "* sentinel-index: %ld\n", sentinel_index);
+    #endif
 
-    err_fread_noeof(&count[0], sizeof(int64_t), 5, cpstream);
-    if ((cp_occ = (CP_OCC *)_mm_malloc(cp_occ_size * sizeof(CP_OCC), 64)) == NULL) {
-        fprintf(stderr, "ERROR! unable to allocated cp_occ memory\n");
-        exit(EXIT_FAILURE);
+    if (flags & FMI_LOAD_MMAP)
+    {
+        struct stat st;
+        if (fstat(fileno(cpstream), &st) != 0) {
+            perror("ERROR! Unable to stat the index file");
+            exit(EXIT_FAILURE);
+        }
+        index_map_size = st.st_size;
+        int map_flags = MAP_SHARED;
+        #ifdef MAP_POPULATE
+        if (flags & FMI_LOAD_POPULATE)
+            map_flags |= MAP_POPULATE;
+        #endif
+        void *map = mmap(NULL, index_map_size, PROT_READ, map_flags, fileno(cpstream), 0);
+        if (map == MAP_FAILED) {
+            perror("ERROR! Unable to map the index file");
+            exit(EXIT_FAILURE);
+        }
+        index_map = (char *)map;
+        #ifdef MADV_HUGEPAGE
+        if ((flags & FMI_LOAD_HUGEPAGE) && madvise(index_map, index_map_size, MADV_HUGEPAGE) != 0)
+            perror("* madvise(MADV_HUGEPAGE)");
+        #endif
+        fprintf(stderr, "* Index file mapped (%s layout%s%s)\n",
+                layout.aligned ? "aligned" : "legacy",
+                flags & FMI_LOAD_POPULATE ? ", populated" : "",
+                flags & FMI_LOAD_HUGEPAGE ? ", huge pages" : "");
+
+        cp_occ = (CP_OCC *)mapped_section(index_map, layout.cp_occ_offset,
+                                          layout.cp_occ_size * sizeof(CP_OCC), 64, "cp_occ");
+        sa_ms_byte = (int8_t *)(index_map + layout.sa_ms_byte_offset);
+        sa_ls_word = (uint32_t *)mapped_section(index_map, layout.sa_ls_word_offset,
+                                                layout.sa_size * sizeof(uint32_t),
+                                                sizeof(uint32_t), "sa_ls_word");
+    }
+    else
+    {
+        // create checkpointed occ
+        if ((cp_occ = (CP_OCC *)_mm_malloc(layout.cp_occ_size * sizeof(CP_OCC), 64)) == NULL) {
+            fprintf(stderr, "ERROR! unable to allocated cp_occ memory\n");
+            exit(EXIT_FAILURE);
+        }
+        read_section(cpstream, layout.cp_occ_offset, cp_occ, sizeof(CP_OCC), layout.cp_occ_size);
+
+        sa_ms_byte = (int8_t *)_mm_malloc(layout.sa_size * sizeof(int8_t), 64);
+        sa_ls_word = (uint32_t *)_mm_malloc(layout.sa_size * sizeof(uint32_t), 64);
+        read_section(cpstream, layout.sa_ms_byte_offset, sa_ms_byte, sizeof(int8_t), layout.sa_size);
+        read_section(cpstream, layout.sa_ls_word_offset, sa_ls_word, sizeof(uint32_t), layout.sa_size);
     }
+    fclose(cpstream);
 
-    err_fread_noeof(cp_occ, sizeof(CP_OCC), cp_occ_size, cpstream);
     int64_t ii = 0;
     for(ii = 0; ii < 5; ii++)// update read count structure
     {
         count[ii] = count[ii] + 1;
     }
 
-    #if SA_COMPRESSION
-
-    int64_t reference_seq_len_ = (reference_seq_len >> SA_COMPX) + 1;
-    sa_ms_byte = (int8_t *)_mm_malloc(reference_seq_len_ * sizeof(int8_t), 64);
-    sa_ls_word = (uint32_t *)_mm_malloc(reference_seq_len_ * sizeof(uint32_t), 64);
-    err_fread_noeof(sa_ms_byte, sizeof(int8_t), reference_seq_len_, cpstream);
-    err_fread_noeof(sa_ls_word, sizeof(uint32_t), reference_seq_len_, cpstream);
-    
-    #else
-    
-    sa_ms_byte = (int8_t *)_mm_malloc(reference_seq_len * sizeof(int8_t), 64);
-    sa_ls_word = (uint32_t *)_mm_malloc(reference_seq_len * sizeof(uint32_t), 64);
-    err_fread_noeof(sa_ms_byte, sizeof(int8_t), reference_seq_len, cpstream);
-    err_fread_noeof(sa_ls_word, sizeof(uint32_t), reference_seq_len, cpstream);
-
-    #endif
-
-    sentinel_index = -1;
-    #if SA_COMPRESSION
-    err_fread_noeof(&sentinel_index, sizeof(int64_t), 1, cpstream);
-    fprintf(stderr, "* sentinel-index: %ld\n", sentinel_index);
-    #endif
-    fclose(cpstream);
-
     int64_t x;
     #if !SA_COMPRESSION
     for(x = 0; x < reference_seq_len; x++)
@@ -495,8 +679,98 @@ void FMI_search::load_index()
     fprintf(stderr, "* Done reading Index!!\n");
 }
 
+/**
+ * NUMA node of the calling thread, or -1 if unknown.
+ */
+static int current_numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < FMI_MAX_NUMA_NODES)
+        return node;
+#endif
+    return -1;
+}
+
+/**
+ * Copy @size bytes of @src to pages bound to @node. Falls back to the first
+ * touch of the calling thread if the pages cannot be bound.
+ */
+static void *numa_copy(const void *src, size_t size, int node)
+{
+    void *dst = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (dst == MAP_FAILED) {
+        fprintf(stderr, "ERROR! unable to allocate %0.2lf GB on NUMA node %d\n",
+                size * 1.0 / (1024 * 1024 * 1024), node);
+        exit(EXIT_FAILURE);
+    }
+#if defined(__linux__) && defined(SYS_mbind)
+    const int mpol_bind = 2; // MPOL_BIND in <linux/mempolicy.h>
+    unsigned long nodemask[FMI_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // The kernel reads maxnode - 1 bits of the mask.
+    if (syscall(SYS_mbind, dst, size, mpol_bind, nodemask, FMI_MAX_NUMA_NODES + 1, 0) != 0)
+        perror("* mbind");
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise(dst, size, MADV_HUGEPAGE);
+#endif
+    memcpy(dst, src, size);
+    return dst;
+}
+
+FMI_search::FMI_search(FMI_search *home, int node, bool replicate_sa)
+{
+    bwaidx_fm_t *own_idx = idx; // Allocated by indexEle().
+    *this = *home;
+    free(own_idx);
+    this->home = home;
+    index_map = NULL;
+    index_map_size = 0;
+    memset(numa_replicas, 0, sizeof(numa_replicas));
+
+    cp_occ = (CP_OCC *)numa_copy(home->cp_occ, cp_occ_bytes(reference_seq_len), node);
+    if (replicate_sa) {
+        int64_t n = sa_entries(reference_seq_len);
+        sa_ms_byte = (int8_t *)numa_copy(home->sa_ms_byte, n * sizeof(int8_t), node);
+        sa_ls_word = (uint32_t *)numa_copy(home->sa_ls_word, n * sizeof(uint32_t), node);
+    }
+}
+
+int FMI_search::replicate_numa(int num_threads, bool replicate_sa)
+{
+    int home_node = current_numa_node();
+    if (home_node < 0) {
+        fprintf(stderr, "* Unknown NUMA topology, the index is not replicated\n");
+        return 1;
+    }
+    numa_replicas[home_node] = this;
+
+    // The first thread of every node copies the index to that node.
+    int replicas = 1;
+#pragma omp parallel num_threads(num_threads) reduction(+:replicas)
+    {
+        int node = current_numa_node();
+        if (node >= 0 && __sync_bool_compare_and_swap(&numa_replicas[node], NULL, this)) {
+            numa_replicas[node] = new FMI_search(this, node, replicate_sa);
+            replicas++;
+        }
+    }
+    fprintf(stderr, "* Index replicated on %d NUMA node(s) (%s)\n", replicas,
+            replicate_sa ? "cp_occ and SA" : "cp_occ");
+    return replicas;
+}
+
+FMI_search *FMI_search::local_replica()
+{
+    int node = current_numa_node();
+    if (node < 0 || numa_replicas[node] == NULL)
+        return this;
+    return numa_replicas[node];
+}
+
 void FMI_search::getSMEMsOnePosOneThread(uint8_t *enc_qdb,
-                                         int16_t *query_pos_array,
+                                         int32_t *query_pos_array,
                                          int32_t *min_intv_array,
                                          int32_t *rid_array,
                                          int32_t numReads,
@@ -506,7 +780,8 @@ void FMI_search::getSMEMsOnePosOneThread(uint8_t *enc_qdb,
                                          int32_t max_readlength,
                                          int32_t minSeedLen,
                                          SMEM *matchArray,
-                                         int64_t *__numTotalSmem)
+                                         int64_t *__numTotalSmem,
+                                         SMEM *scratch)
 {
     int64_t numTotalSmem = *__numTotalSmem;
     SMEM prevArray[NSEQS][max_readlength];
@@ -922,9 +1197,10 @@ void FMI_search::getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                          int32_t max_readlength,
                                          int32_t minSeedLen,
                                          SMEM *matchArray,
-                                         int64_t *__numTotalSmem)
+                                         int64_t *__numTotalSmem,
+                                         SMEM *scratch)
 {
-    int16_t *query_pos_array = (int16_t *)_mm_malloc(numReads * sizeof(int16_t), 64);
+    int32_t *query_pos_array = (int32_t *)_mm_malloc(numReads * sizeof(int32_t), 64);
     
     int32_t i;
     for(i = 0; i < numReads; i++)
@@ -959,7 +1235,8 @@ void FMI_search::getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                 max_readlength,
                                 minSeedLen,
                                 matchArray,
-                                __numTotalSmem);
+                                __numTotalSmem,
+                                scratch);
         numActive = tail;
     } while(numActive > 0);
 
@@ -981,7 +1258,7 @@ int64_t FMI_search::bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
     for(i = 0; i < numReads; i++)
     {
         int readlength = seq_[i].l_seq;
-        int16_t x = 0;
+        int32_t x = 0;
         while(x < readlength)
         {
             int next_x = x + 1;
@@ -1248,11 +1525,112 @@ int compare_smem(const void *a, const void *b)
     return 0;
 }
 
+// Number of bits needed to store @x.
+static inline int smem_key_bits(uint64_t x)
+{
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+#define SMEM_RADIX_BITS 8
+#define SMEM_RADIX_SIZE (1 << SMEM_RADIX_BITS)
+
+// Sort @n SMEMs in the order of compare_smem() with a stable LSD radix sort.
+// Each SMEM gets a 64-bit key (rid, m, ~n) followed by its index, so a pass
+// only streams 8 bytes per SMEM. The digit counts of all passes come from one
+// read of the keys, and passes where every key has the same digit are
+// skipped. The SMEMs are permuted in place once at the end. @keys holds
+// SMEM_SORT_KEYS(n) keys. Falls back to qsort when the key does not fit in
+// 64 bits.
+static void radix_sort_smems(SMEM *a, int64_t n, uint64_t *keys)
+{
+    if(n < 2)
+        return;
+
+    uint32_t min_rid = a[0].rid, max_rid = a[0].rid, max_pos = 0;
+    int64_t i;
+    for(i = 0; i < n; i++)
+    {
+        if(a[i].rid < min_rid) min_rid = a[i].rid;
+        if(a[i].rid > max_rid) max_rid = a[i].rid;
+        if(a[i].n > max_pos) max_pos = a[i].n;
+    }
+    int idx_bits = smem_key_bits(n - 1);
+    int pos_bits = smem_key_bits(max_pos);
+    int key_bits = smem_key_bits(max_rid - min_rid) + 2 * pos_bits;
+    if(idx_bits + key_bits > 64)
+    {
+        qsort(a, n, sizeof(SMEM), compare_smem);
+        return;
+    }
+
+    uint64_t *tmp = keys + n;
+    uint64_t pos_mask = (1ULL << pos_bits) - 1;
+    for(i = 0; i < n; i++)
+    {
+        uint64_t key = ((uint64_t)(a[i].rid - min_rid) << (2 * pos_bits)) |
+                       ((uint64_t)a[i].m << pos_bits) |
+                       (pos_mask - a[i].n);
+        keys[i] = (key << idx_bits) | i;
+    }
+
+    int passes = (key_bits + SMEM_RADIX_BITS - 1) / SMEM_RADIX_BITS;
+    int64_t count[64 / SMEM_RADIX_BITS][SMEM_RADIX_SIZE];
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < n; i++)
+    {
+        uint64_t key = keys[i] >> idx_bits;
+        for(int p = 0; p < passes; p++)
+            count[p][(key >> (p * SMEM_RADIX_BITS)) & (SMEM_RADIX_SIZE - 1)]++;
+    }
+
+    for(int p = 0; p < passes; p++)
+    {
+        int shift = idx_bits + p * SMEM_RADIX_BITS;
+        int64_t *c = count[p];
+        if(c[(keys[0] >> shift) & (SMEM_RADIX_SIZE - 1)] == n)
+            continue;
+        int64_t sum = 0;
+        for(int d = 0; d < SMEM_RADIX_SIZE; d++)
+        {
+            int64_t t = c[d];
+            c[d] = sum;
+            sum += t;
+        }
+        for(i = 0; i < n; i++)
+            tmp[c[(keys[i] >> shift) & (SMEM_RADIX_SIZE - 1)]++] = keys[i];
+        uint64_t *swap = keys; keys = tmp; tmp = swap;
+    }
+
+    // Follow the cycles of the permutation: SMEM i comes from src[i], and
+    // src[i] = i once it is in place.
+    uint64_t *src = keys;
+    uint64_t idx_mask = (1ULL << idx_bits) - 1;
+    for(i = 0; i < n; i++)
+        src[i] &= idx_mask;
+    for(i = 0; i < n; i++)
+    {
+        if(src[i] == (uint64_t)i)
+            continue;
+        SMEM first = a[i];
+        int64_t j = i;
+        while(src[j] != (uint64_t)i)
+        {
+            int64_t k = src[j];
+            a[j] = a[k];
+            src[j] = j;
+            j = k;
+        }
+        a[j] = first;
+        src[j] = j;
+    }
+}
+
 void FMI_search::sortSMEMs(SMEM *matchArray,
         int64_t numTotalSmem[],
         int32_t numReads,
         int32_t readlength,
-        int nthreads)
+        int nthreads,
+        uint64_t *sortKeys)
 {
     int tid;
     int32_t perThreadQuota = (numReads + (nthreads - 1)) / nthreads;
@@ -1260,7 +1638,12 @@ void FMI_search::sortSMEMs(SMEM *matchArray,
     {
         int32_t first = tid * perThreadQuota;
         SMEM *myMatchArray = matchArray + first * readlength;
-        qsort(myMatchArray, numTotalSmem[tid], sizeof(SMEM), compare_smem);
+        uint64_t *keys = sortKeys;
+        if(keys == NULL)
+            keys = (uint64_t *)_mm_malloc(SMEM_SORT_KEYS(numTotalSmem[tid]) * sizeof(uint64_t), 64);
+        radix_sort_smems(myMatchArray, numTotalSmem[tid], keys);
+        if(keys != sortKeys)
+            _mm_free(keys);
     }
 }
 
@@ -1619,3 +2002,133 @@ void FMI_search::get_sa_entries_prefetch(SMEM *smemArray, int64_t *coordArray,
     _mm_free(pos_ar);
     _mm_free(map_ar);
 }
+
+int64_t FMI_search::smem_sa_count(const SMEM *smems, int64_t n, int32_t max_occ)
+{
+    int64_t total = 0;
+    int64_t i;
+    for (i = 0; i < n; i++)
+    {
+        total += smems[i].s < max_occ ? smems[i].s : max_occ;
+    }
+    return total;
+}
+
+int64_t FMI_search::smem_sa_rows(const SMEM *smems, int64_t n, int32_t max_occ, int64_t *sa_pos)
+{
+    int64_t id = 0;
+    int64_t i;
+    for (i = 0; i < n; i++)
+    {
+        const SMEM *smem = &smems[i];
+        int64_t hi = smem->k + smem->s;
+        int64_t step = (smem->s > max_occ) ? smem->s / max_occ : 1;
+        int32_t c = 0;
+        int64_t j;
+        for (j = smem->k; (j < hi) && (c < max_occ); j += step, c++)
+        {
+            sa_pos[id++] = j;
+        }
+    }
+    return id;
+}
+
+typedef struct
+{
+    int64_t sp;     // Current row of the walk.
+    int64_t offset; // LF steps from the first row.
+    int64_t id;     // Index of the first row in sa_pos.
+} locate_lane_t;
+
+// The next step of the walk from row sp reads its SA entry if sampled, its
+// occurrences otherwise.
+#define PREFETCH_SA_ROW(sp) \
+        if (((sp) & SA_COMPX_MASK) == 0) { \
+            _mm_prefetch((const char *)&sa_ms_byte[(sp) >> SA_COMPX], _MM_HINT_T0); \
+            _mm_prefetch((const char *)&sa_ls_word[(sp) >> SA_COMPX], _MM_HINT_T0); \
+        } \
+        else { \
+            _mm_prefetch((const char *)&cp_occ[(sp) >> CP_SHIFT], _MM_HINT_T0); \
+        }
+
+void FMI_search::locate(const int64_t *sa_pos, int64_t *ref_pos, int64_t n, int lanes)
+{
+    locate_lane_t lane[LOCATE_MAX_LANES];
+    if (lanes < 1)
+        lanes = 1;
+    if (lanes > LOCATE_MAX_LANES)
+        lanes = LOCATE_MAX_LANES;
+    if (lanes > n)
+        lanes = n;
+
+    int64_t next = 0;
+    int l;
+    for (l = 0; l < lanes; l++)
+    {
+        lane[l].sp = sa_pos[next];
+        lane[l].offset = 0;
+        lane[l].id = next++;
+        PREFETCH_SA_ROW(lane[l].sp);
+    }
+
+    // Every lane takes one step in turn, its next row was prefetched on its
+    // previous step.
+    while (lanes > 0)
+    {
+        for (l = 0; l < lanes; l++)
+        {
+            locate_lane_t *w = &lane[l];
+            int64_t sp = w->sp;
+            if ((sp & SA_COMPX_MASK) == 0)
+            {
+                int64_t sa_entry = sa_ms_byte[sp >> SA_COMPX];
+                sa_entry = sa_entry << 32;
+                sa_entry = sa_entry + sa_ls_word[sp >> SA_COMPX];
+                ref_pos[w->id] = sa_entry + w->offset;
+            }
+            else
+            {
+                int64_t occ_id_pp_ = sp >> CP_SHIFT;
+                int64_t y_pp_ = CP_BLOCK_SIZE - (sp & CP_MASK) - 1;
+                uint64_t *one_hot_bwt_str = cp_occ[occ_id_pp_].one_hot_bwt_str;
+                uint8_t b;
+
+                if((one_hot_bwt_str[0] >> y_pp_) & 1)
+                    b = 0;
+                else if((one_hot_bwt_str[1] >> y_pp_) & 1)
+                    b = 1;
+                else if((one_hot_bwt_str[2] >> y_pp_) & 1)
+                    b = 2;
+                else if((one_hot_bwt_str[3] >> y_pp_) & 1)
+                    b = 3;
+                else
+                    b = 4;
+
+                if (b != 4)
+                {
+                    GET_OCC(sp, b, occ_id_sp, y_sp, occ_sp, one_hot_bwt_str_c_sp, match_mask_sp);
+                    w->sp = count[b] + occ_sp;
+                    w->offset++;
+                    PREFETCH_SA_ROW(w->sp);
+                    continue;
+                }
+                // The row of the sentinel is the start of the reference.
+                ref_pos[w->id] = w->offset;
+            }
+
+            if (next < n)
+            {
+                w->sp = sa_pos[next];
+                w->offset = 0;
+                w->id = next++;
+                PREFETCH_SA_ROW(w->sp);
+            }
+            else
+            {
+                // No more rows, keep the lanes that are still walking first.
+                *w = lane[--lanes];
+                l--;
+            }
+        }
+    }
+}
@@ -49,8 +49,18 @@ Authors: Sanchit Misra <sanchit.misra@intel.com>; Vasimuddin Md <vasimuddin.md@i
 
 #define CP_BLOCK_SIZE 64
 #define CP_FILENAME_SUFFIX ".bwt.2bit.64"
+// First word of the index files whose sections start at multiples of
+// CP_FILE_ALIGN bytes ("BWA2IDX\1"). Older files start with the reference
+// length and pack the sections back to back, so cp_occ is not aligned.
+#define CP_FILE_MAGIC 0x0158444932415742L
+#define CP_FILE_ALIGN 64
 #define CP_MASK 63
 #define CP_SHIFT 6
+// The upper 4 bits of the magic of the index files built with "bwa-mem2
+// index -s <rate>" are the SA sampling shift plus 1 (0 for SA_COMPX). Only
+// SA_COMPX is supported here.
+#define CP_FILE_MAGIC_MASK 0x0fffffffffffffffL
+#define CP_FILE_SA_SHIFT_BIT 60
 
 typedef struct checkpoint_occ_scalar
 {
@@ -89,6 +99,28 @@ typedef struct smem_struct
 
 #define SAL_PFD 16
 
+// Number of suffix array walks in flight in FMI_search::locate(): every
+// walk advances one LF step in turn, so the occurrence table misses of the
+// walks overlap. A finished walk is replaced by the next row.
+#define LOCATE_LANES 128
+#define LOCATE_MAX_LANES 1024
+
+// SMEMs of the scratch of getSMEMsOnePosOneThread() and
+// getSMEMsAllPosOneThread(). The SVE search keeps its state on the stack and
+// does not use the scratch, it is only there to match the x86_64 interface.
+#define SMEM_SCRATCH_SIZE(max_readlength) ((int64_t)0)
+
+// Keys of the scratch of sortSMEMs() for @n SMEMs per thread.
+#define SMEM_SORT_KEYS(n) (2 * (int64_t)(n))
+
+// Flags of FMI_search::load_index().
+#define FMI_LOAD_MMAP 0x1     // Map the index file instead of reading it.
+#define FMI_LOAD_POPULATE 0x2 // Prefault the whole mapping (MAP_POPULATE).
+#define FMI_LOAD_HUGEPAGE 0x4 // Ask for transparent huge pages (madvise).
+#define FMI_LOAD_NO_KMER 0x8  // Ignore the k-mer table (x86_64 only, no-op).
+
+#define FMI_MAX_NUMA_NODES 64
+
 class FMI_search: public indexEle
 {
     public:
@@ -99,7 +131,17 @@ class FMI_search: public indexEle
 #endif
     
     int build_index();
-    void load_index();
+    // Only the CP_BLOCK_SIZE occurrence table is supported here: @cp_block_size
+    // must be 0 or CP_BLOCK_SIZE.
+    void load_index(int flags = 0, int cp_block_size = 0);
+
+    // Copy cp_occ (and the suffix array if @replicate_sa) to the memory of
+    // every NUMA node that runs one of @num_threads OpenMP threads. Threads
+    // must be bound (OMP_PROC_BIND) for the copies to stay local. Returns the
+    // number of copies, including the original one.
+    int replicate_numa(int num_threads, bool replicate_sa);
+    // The copy of the index on the NUMA node of the calling thread.
+    FMI_search *local_replica();
 
     void getSMEMs(uint8_t *enc_qdb,
                   int32_t numReads,
@@ -111,7 +153,7 @@ class FMI_search: public indexEle
                   int64_t *numTotalSmem);
     
     void getSMEMsOnePosOneThread(uint8_t *enc_qdb,
-                                 int16_t *query_pos_array,
+                                 int32_t *query_pos_array,
                                  int32_t *min_intv_array,
                                  int32_t *rid_array,
                                  int32_t numReads,
@@ -121,7 +163,8 @@ class FMI_search: public indexEle
                                  int32_t  max_readlength,
                                  int32_t minSeedLen,
                                  SMEM *matchArray,
-                                 int64_t *__numTotalSmem);
+                                 int64_t *__numTotalSmem,
+                                 SMEM *scratch);
     
     void getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                  int32_t *min_intv_array,
@@ -133,7 +176,8 @@ class FMI_search: public indexEle
                                  int32_t max_readlength,
                                  int32_t minSeedLen,
                                  SMEM *matchArray,
-                                 int64_t *__numTotalSmem);
+                                 int64_t *__numTotalSmem,
+                                 SMEM *scratch);
         
     
     int64_t bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
@@ -144,11 +188,14 @@ class FMI_search: public indexEle
                                            int32_t minSeedLen,
                                            SMEM *matchArray);
         
+    // Sort the SMEMs of every thread. @sortKeys holds SMEM_SORT_KEYS() keys
+    // for the SMEMs of a thread, they are allocated for the call when NULL.
     void sortSMEMs(SMEM *matchArray,
                    int64_t numTotalSmem[],
                    int32_t numReads,
                    int32_t readlength,
-                   int nthreads);
+                   int nthreads,
+                   uint64_t *sortKeys = NULL);
     int64_t get_sa_entry(int64_t pos);
     void get_sa_entries(int64_t *posArray,
                         int64_t *coordArray,
@@ -170,6 +217,20 @@ class FMI_search: public indexEle
     void get_sa_entries_prefetch(SMEM *smemArray, int64_t *coordArray,
                                  int64_t *coordCountArray, int64_t count,
                                  const int32_t max_occ, int tid, int64_t &id_);
+
+    // Batched locate: the reference positions of the SA rows @sa_pos[0..n)
+    // into @ref_pos, the same as get_sa_entry_compressed() row by row, with
+    // @lanes walks in flight (up to LOCATE_MAX_LANES).
+    void locate(const int64_t *sa_pos, int64_t *ref_pos, int64_t n,
+                int lanes = LOCATE_LANES);
+    // Number of SA rows of @n SMEMs, at most @max_occ per SMEM.
+    static int64_t smem_sa_count(const SMEM *smems, int64_t n, int32_t max_occ);
+    // The SA rows of @n SMEMs into @sa_pos, at most @max_occ per SMEM evenly
+    // spaced in its interval (as get_sa_entries()). Returns their number.
+    static int64_t smem_sa_rows(const SMEM *smems, int64_t n, int32_t max_occ,
+                                int64_t *sa_pos);
+    // SA sampling rate of the index, fixed here.
+    int sa_rate() { return 1 << SA_COMPX; }
     
     int64_t reference_seq_len;
     int64_t sentinel_index;
@@ -183,6 +244,18 @@ private:
 
         uint64_t *one_hot_mask_array;
 
+        // Mapping of the index file (FMI_LOAD_MMAP), shared with the other
+        // processes that map the same file.
+        char *index_map;
+        size_t index_map_size;
+        bool is_mapped(const void *ptr);
+
+        // Copies of the index per NUMA node (replicate_numa()). A replica
+        // shares everything but the replicated arrays with its home.
+        FMI_search *numa_replicas[FMI_MAX_NUMA_NODES];
+        FMI_search *home;
+        FMI_search(FMI_search *home, int node, bool replicate_sa);
+
         //SMEM prevArray[NSEQS][128];
         //SMEM matchArray_aux[NSEQS][MAX_SEEDS_PER_READ];
 
@@ -573,7 +573,7 @@ SMEM *mem_collect_smem(FMI_search *fmi, const mem_opt_t *opt,
                        int nseq,
                        SMEM *matchArray,
                        int32_t *min_intv_ar,
-                       int16_t *query_pos_ar,
+                       int32_t *query_pos_ar,
                        uint8_t *enc_qdb,
                        int32_t *rid,
                        int64_t &tot_smem)
@@ -606,7 +606,7 @@ SMEM *mem_collect_smem(FMI_search *fmi, const mem_opt_t *opt,
 
     fmi->getSMEMsAllPosOneThread(enc_qdb, min_intv_ar, rid, nseq, nseq,
                                  seq_, query_cum_len_ar, max_readlength, opt->min_seed_len,
-                                 matchArray, &num_smem1);
+                                 matchArray, &num_smem1, NULL);
 
 
     for (int64_t i=0; i<num_smem1; i++)
@@ -639,7 +639,8 @@ SMEM *mem_collect_smem(FMI_search *fmi, const mem_opt_t *opt,
                                  max_readlength,
                                  opt->min_seed_len,
                                  matchArray + num_smem1,
-                                 &num_smem2);
+                                 &num_smem2,
+                                 NULL);
 
     if (opt->max_mem_intv > 0)
     {
@@ -902,8 +903,8 @@ int mem_kernel1_core(FMI_search *fmi,
             //realloc(mmc->matchArray[tid], mmc->wsize_mem[tid] *   sizeof(SMEM));
         mmc->min_intv_ar[tid]  = (int32_t *) realloc(mmc->min_intv_ar[tid],
                                                      mmc->wsize_mem[tid] *  sizeof(int32_t));
-        mmc->query_pos_ar[tid] = (int16_t *) realloc(mmc->query_pos_ar[tid],
-                                                     mmc->wsize_mem[tid] *  sizeof(int16_t));
+        mmc->query_pos_ar[tid] = (int32_t *) realloc(mmc->query_pos_ar[tid],
+                                                     mmc->wsize_mem[tid] *  sizeof(int32_t));
         mmc->enc_qdb[tid]      = (uint8_t *) realloc(mmc->enc_qdb[tid],
                                                       mmc->wsize_mem[tid] * sizeof(uint8_t));
         mmc->rid[tid]          = (int32_t *) realloc(mmc->rid[tid],
@@ -913,7 +914,7 @@ int mem_kernel1_core(FMI_search *fmi,
 
     SMEM    *matchArray   = mmc->matchArray[tid];
     int32_t *min_intv_ar  = mmc->min_intv_ar[tid];
-    int16_t *query_pos_ar = mmc->query_pos_ar[tid];
+    int32_t *query_pos_ar = mmc->query_pos_ar[tid];
     uint8_t *enc_qdb      = mmc->enc_qdb[tid];
     int32_t *rid          = mmc->rid[tid];
     int64_t  *wsize_mem   = &mmc->wsize_mem[tid];
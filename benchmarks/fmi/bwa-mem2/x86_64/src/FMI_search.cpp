@@ -28,6 +28,12 @@ Authors: Sanchit Misra <sanchit.misra@intel.com>; Vasimuddin Md <vasimuddin.md@i
 *****************************************************************************************/
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <omp.h>
 #include "sais.h"
 #include "FMI_search.h"
 #include "memcpy_bwamem.h"
@@ -41,6 +47,35 @@ extern "C" {
 }
 #endif
 
+static size_t cp_occ_bytes(int64_t reference_seq_len)
+{
+    return ((reference_seq_len >> CP_SHIFT) + 1) * sizeof(CP_OCC);
+}
+
+static int cp_occ2_words(int shift)
+{
+    return CP2_COUNT_WORDS + ((1 << shift) >> 5);
+}
+
+static size_t cp_occ2_bytes(int64_t reference_seq_len, int shift)
+{
+    return ((reference_seq_len >> shift) + 1) * cp_occ2_words(shift) * sizeof(uint64_t);
+}
+
+static size_t cp_occ2_super_bytes(int64_t reference_seq_len)
+{
+    return ((reference_seq_len >> CP2_SUPER_SHIFT) + 1) * 4 * sizeof(int64_t);
+}
+
+static int64_t sa_entries(int64_t reference_seq_len, int sa_shift)
+{
+    #if SA_COMPRESSION
+    return (reference_seq_len >> sa_shift) + 1;
+    #else
+    return reference_seq_len;
+    #endif
+}
+
 FMI_search::FMI_search(const char *fname)
 {
     fprintf(stderr, "* Entering FMI_search\n");
@@ -51,20 +86,75 @@ FMI_search::FMI_search(const char *fname)
     index_alloc = 0;
     sa_ls_word = NULL;
     sa_ms_byte = NULL;
+    #if SA_COMPRESSION
+    sa_shift = SA_COMPX;
+    #else
+    sa_shift = 0; // The whole SA, walked as if sampled (simulation).
+    #endif
+    sa_mask = SA_COMPX_MASK;
     cp_occ = NULL;
+    cp_occ2 = NULL;
+    cp_occ2_super = NULL;
+    cp2_shift = 0;
+    cp2_words = 0;
     one_hot_mask_array = NULL;
+    kmer_table = NULL;
+    kmer_k = 0;
+    kmer_map_size = 0;
+    index_map = NULL;
+    index_map_size = 0;
+    memset(numa_replicas, 0, sizeof(numa_replicas));
+    home = NULL;
 }
 
 FMI_search::~FMI_search()
 {
-    if(sa_ms_byte)
+    if(home)
+    {
+        // Only the replicated arrays belong to a replica.
+        if(cp_occ2)
+            munmap(cp_occ2, cp_occ2_bytes(reference_seq_len, cp2_shift));
+        else
+            munmap(cp_occ, cp_occ_bytes(reference_seq_len));
+        if(sa_ms_byte != home->sa_ms_byte)
+        {
+            munmap(sa_ms_byte, sa_entries(reference_seq_len, sa_shift) * sizeof(int8_t));
+            munmap(sa_ls_word, sa_entries(reference_seq_len, sa_shift) * sizeof(uint32_t));
+        }
+        if(kmer_table)
+            munmap(kmer_table, KMER_OFFSET(kmer_k + 1) * sizeof(KMER_INTV));
+        idx = NULL;
+        return;
+    }
+    for(int node = 0; node < FMI_MAX_NUMA_NODES; node++)
+    {
+        if(numa_replicas[node] && numa_replicas[node] != this)
+            delete numa_replicas[node];
+    }
+    if(sa_ms_byte && !is_mapped(sa_ms_byte))
         _mm_free(sa_ms_byte);
-    if(sa_ls_word)
+    if(sa_ls_word && !is_mapped(sa_ls_word))
         _mm_free(sa_ls_word);
-    if(cp_occ)
+    if(cp_occ && !is_mapped(cp_occ))
         _mm_free(cp_occ);
+    if(cp_occ2 && !is_mapped(cp_occ2))
+        _mm_free(cp_occ2);
+    if(cp_occ2_super && !is_mapped(cp_occ2_super))
+        _mm_free(cp_occ2_super);
+    if(kmer_table && kmer_map_size)
+        munmap((char *)kmer_table - CP_FILE_ALIGN, kmer_map_size);
+    else if(kmer_table)
+        _mm_free(kmer_table);
     if(one_hot_mask_array)
         _mm_free(one_hot_mask_array);
+    if(index_map)
+        munmap(index_map, index_map_size);
+}
+
+bool FMI_search::is_mapped(const void *ptr)
+{
+    return index_map != NULL && (const char *)ptr >= index_map &&
+           (const char *)ptr < index_map + index_map_size;
 }
 
 int64_t FMI_search::pac_seq_len(const char *fn_pac)
@@ -141,14 +231,109 @@ void FMI_search::pac2nt(const char *fn_pac, std::string &reference_seq)
 	free(buf2);
 }
 
-int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int64_t ref_seq_len, int64_t *sa_bwt, int64_t *count) {
+/**
+ * Pad @outstream with zeros up to the next multiple of @align bytes.
+ */
+static void write_padding(std::fstream &outstream, int64_t align)
+{
+    static const char zeros[CP_FILE_ALIGN] = {0};
+    int64_t pos = outstream.tellp();
+    outstream.write(zeros, (align - pos % align) % align);
+}
+
+/**
+ * Name of the index file of @prefix with 2^@shift symbols per checkpoint.
+ */
+static void cp_file_name(char *name, const char *prefix, int shift)
+{
+    strcpy_s(name, PATH_MAX, prefix);
+    if (shift == CP_SHIFT) {
+        strcat_s(name, PATH_MAX, CP_FILENAME_SUFFIX);
+    }
+    else {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "%s%d", CP2_FILENAME_SUFFIX, 1 << shift);
+        strcat_s(name, PATH_MAX, suffix);
+    }
+}
+
+/**
+ * log2 of @cp_block_size, or -1 if there is no index format with
+ * @cp_block_size symbols per checkpoint.
+ */
+static int cp_block_shift(int cp_block_size)
+{
+    if (cp_block_size == CP_BLOCK_SIZE)
+        return CP_SHIFT;
+    for (int shift = CP2_MIN_SHIFT; shift <= CP2_MAX_SHIFT; shift++) {
+        if (cp_block_size == (1 << shift))
+            return shift;
+    }
+    return -1;
+}
+
+/**
+ * Write the compressed occurrence table of @bwt (see CP2_FILENAME_SUFFIX):
+ * the checkpoints, then the counts of the superblocks, each section padded to
+ * CP_FILE_ALIGN bytes.
+ */
+void FMI_search::write_cp_occ2(std::fstream &outstream, const uint8_t *bwt, int64_t ref_seq_len, int shift)
+{
+    int words = cp_occ2_words(shift);
+    int64_t num_cp = (ref_seq_len >> shift) + 1;
+    int64_t num_super = (ref_seq_len >> CP2_SUPER_SHIFT) + 1;
+    int64_t (*super)[4] = (int64_t (*)[4])_mm_malloc(cp_occ2_super_bytes(ref_seq_len), 64);
+    assert_not_null(super, cp_occ2_super_bytes(ref_seq_len), index_alloc);
+
+    uint64_t cp[CP2_COUNT_WORDS + ((1 << CP2_MAX_SHIFT) >> 5)];
+    uint32_t *cp_count32 = (uint32_t *)cp;
+    int64_t cp_count[16];
+    memset(cp_count, 0, 16 * sizeof(int64_t));
+
+    int64_t i, j;
+    for(i = 0; i < num_cp; i++)
+    {
+        int64_t start = i << shift;
+        int64_t *super_count = super[start >> CP2_SUPER_SHIFT];
+        if((start & ((1L << CP2_SUPER_SHIFT) - 1)) == 0)
+        {
+            memcpy(super_count, cp_count, 4 * sizeof(int64_t));
+        }
+        int c;
+        for(c = 0; c < 4; c++)
+        {
+            cp_count32[c] = cp_count[c] - super_count[c];
+        }
+        memset(cp + CP2_COUNT_WORDS, 0, (words - CP2_COUNT_WORDS) * sizeof(uint64_t));
+        for(j = 0; (j < (1L << shift)) && (start + j < ref_seq_len); j++)
+        {
+            uint8_t c = bwt[start + j];
+            cp_count[c]++;
+            if(c < 4)
+            {
+                cp[CP2_COUNT_WORDS + (j >> 5)] |= (uint64_t)c << (2 * (j & 31));
+            }
+        }
+        outstream.write((char *)cp, words * sizeof(uint64_t));
+    }
+    write_padding(outstream, CP_FILE_ALIGN);
+    outstream.write((char *)super, num_super * 4 * sizeof(int64_t));
+    write_padding(outstream, CP_FILE_ALIGN);
+    _mm_free(super);
+}
+
+int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int64_t ref_seq_len, int64_t *sa_bwt, int64_t *count, int cp_block_size, int sa_shift) {
     printf("ref_seq_len = %ld\n", ref_seq_len);
     fflush(stdout);
 
     char outname[PATH_MAX];
+    int shift = cp_block_shift(cp_block_size);
+    if (shift < 0) {
+        fprintf(stderr, "ERROR! unsupported checkpoint block size %d\n", cp_block_size);
+        exit(EXIT_FAILURE);
+    }
 
-    strcpy_s(outname, PATH_MAX, ref_file_name);
-    strcat_s(outname, PATH_MAX, CP_FILENAME_SUFFIX);
+    cp_file_name(outname, ref_file_name, shift);
     //sprintf(outname, "%s.bwt.2bit.%d", ref_file_name, CP_BLOCK_SIZE);
 
     std::fstream outstream (outname, std::ios::out | std::ios::binary);
@@ -160,8 +345,6 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     uint8_t *bwt;
 
     ref_seq_len++;
-    outstream.write((char *)(&ref_seq_len), 1 * sizeof(int64_t));
-    outstream.write((char*)count, 5 * sizeof(int64_t));
 
     int64_t i;
     int64_t ref_seq_len_aligned = ((ref_seq_len + CP_BLOCK_SIZE - 1) / CP_BLOCK_SIZE) * CP_BLOCK_SIZE;
@@ -200,80 +383,100 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     for(i = ref_seq_len; i < ref_seq_len_aligned; i++)
         bwt[i] = DUMMY_CHAR;
 
+    // The header fills the first CP_FILE_ALIGN bytes, see load_index().
+    int64_t magic = shift == CP_SHIFT ? CP_FILE_MAGIC : CP2_FILE_MAGIC;
+    if (sa_shift != SA_COMPX)
+        magic |= (int64_t)(sa_shift + 1) << CP_FILE_SA_SHIFT_BIT;
+    outstream.write((char *)(&magic), 1 * sizeof(int64_t));
+    outstream.write((char *)(&ref_seq_len), 1 * sizeof(int64_t));
+    outstream.write((char*)count, 5 * sizeof(int64_t));
+    outstream.write((char *)(&sentinel_index), 1 * sizeof(int64_t));
 
-    printf("CP_SHIFT = %d, CP_MASK = %d\n", CP_SHIFT, CP_MASK);
-    printf("sizeof CP_OCC = %ld\n", sizeof(CP_OCC));
-    fflush(stdout);
-    // create checkpointed occ
-    int64_t cp_occ_size = (ref_seq_len >> CP_SHIFT) + 1;
-    CP_OCC *cp_occ = NULL;
-
-    size = cp_occ_size * sizeof(CP_OCC);
-    cp_occ = (CP_OCC *)_mm_malloc(size, 64);
-    assert_not_null(cp_occ, size, index_alloc);
-    memset(cp_occ, 0, cp_occ_size * sizeof(CP_OCC));
-    int64_t cp_count[16];
 
-    memset(cp_count, 0, 16 * sizeof(int64_t));
-    for(i = 0; i < ref_seq_len; i++)
-    {
-        if((i & CP_MASK) == 0)
+    if (shift != CP_SHIFT) {
+        printf("compressed occ, block size = %d, checkpoint = %ld bytes\n", 1 << shift,
+               cp_occ2_words(shift) * sizeof(uint64_t));
+        fflush(stdout);
+        write_cp_occ2(outstream, bwt, ref_seq_len, shift);
+    }
+    else {
+        printf("CP_SHIFT = %d, CP_MASK = %d\n", CP_SHIFT, CP_MASK);
+        printf("sizeof CP_OCC = %ld\n", sizeof(CP_OCC));
+        fflush(stdout);
+        // create checkpointed occ
+        int64_t cp_occ_size = (ref_seq_len >> CP_SHIFT) + 1;
+        CP_OCC *cp_occ = NULL;
+
+        size = cp_occ_size * sizeof(CP_OCC);
+        cp_occ = (CP_OCC *)_mm_malloc(size, 64);
+        assert_not_null(cp_occ, size, index_alloc);
+        memset(cp_occ, 0, cp_occ_size * sizeof(CP_OCC));
+        int64_t cp_count[16];
+
+        memset(cp_count, 0, 16 * sizeof(int64_t));
+        for(i = 0; i < ref_seq_len; i++)
         {
-            CP_OCC cpo;
-            cpo.cp_count[0] = cp_count[0];
-            cpo.cp_count[1] = cp_count[1];
-            cpo.cp_count[2] = cp_count[2];
-            cpo.cp_count[3] = cp_count[3];
-
-			int32_t j;
-            cpo.one_hot_bwt_str[0] = 0;
-            cpo.one_hot_bwt_str[1] = 0;
-            cpo.one_hot_bwt_str[2] = 0;
-            cpo.one_hot_bwt_str[3] = 0;
-
-			for(j = 0; j < CP_BLOCK_SIZE; j++)
-			{
-                cpo.one_hot_bwt_str[0] = cpo.one_hot_bwt_str[0] << 1;
-                cpo.one_hot_bwt_str[1] = cpo.one_hot_bwt_str[1] << 1;
-                cpo.one_hot_bwt_str[2] = cpo.one_hot_bwt_str[2] << 1;
-                cpo.one_hot_bwt_str[3] = cpo.one_hot_bwt_str[3] << 1;
-				uint8_t c = bwt[i + j];
-                //printf("c = %d\n", c);
-                if(c < 4)
-                {
-                    cpo.one_hot_bwt_str[c] += 1;
-                }
-			}
+            if((i & CP_MASK) == 0)
+            {
+                CP_OCC cpo;
+                cpo.cp_count[0] = cp_count[0];
+                cpo.cp_count[1] = cp_count[1];
+                cpo.cp_count[2] = cp_count[2];
+                cpo.cp_count[3] = cp_count[3];
+
+				int32_t j;
+                cpo.one_hot_bwt_str[0] = 0;
+                cpo.one_hot_bwt_str[1] = 0;
+                cpo.one_hot_bwt_str[2] = 0;
+                cpo.one_hot_bwt_str[3] = 0;
+
+				for(j = 0; j < CP_BLOCK_SIZE; j++)
+				{
+                    cpo.one_hot_bwt_str[0] = cpo.one_hot_bwt_str[0] << 1;
+                    cpo.one_hot_bwt_str[1] = cpo.one_hot_bwt_str[1] << 1;
+                    cpo.one_hot_bwt_str[2] = cpo.one_hot_bwt_str[2] << 1;
+                    cpo.one_hot_bwt_str[3] = cpo.one_hot_bwt_str[3] << 1;
+					uint8_t c = bwt[i + j];
+                    //printf("c = %d\n", c);
+                    if(c < 4)
+                    {
+                        cpo.one_hot_bwt_str[c] += 1;
+                    }
+				}
 
-            cp_occ[i >> CP_SHIFT] = cpo;
+                cp_occ[i >> CP_SHIFT] = cpo;
+            }
+            cp_count[bwt[i]]++;
         }
-        cp_count[bwt[i]]++;
+        outstream.write((char*)cp_occ, cp_occ_size * sizeof(CP_OCC));
+        _mm_free(cp_occ);
     }
-    outstream.write((char*)cp_occ, cp_occ_size * sizeof(CP_OCC));
-    _mm_free(cp_occ);
     _mm_free(bwt);
 
     #if SA_COMPRESSION  
 
-    size = ((ref_seq_len >> SA_COMPX)+ 1)  * sizeof(uint32_t);
+    printf("SA sampling rate = %d\n", 1 << sa_shift);
+    size = ((ref_seq_len >> sa_shift)+ 1)  * sizeof(uint32_t);
     uint32_t *sa_ls_word = (uint32_t *)_mm_malloc(size, 64);
     assert_not_null(sa_ls_word, size, index_alloc);
-    size = ((ref_seq_len >> SA_COMPX) + 1) * sizeof(int8_t);
+    size = ((ref_seq_len >> sa_shift) + 1) * sizeof(int8_t);
     int8_t *sa_ms_byte = (int8_t *)_mm_malloc(size, 64);
     assert_not_null(sa_ms_byte, size, index_alloc);
+    int64_t sa_mask = (1L << sa_shift) - 1;
     int64_t pos = 0;
     for(i = 0; i < ref_seq_len; i++)
     {
-        if ((i & SA_COMPX_MASK) == 0)
+        if ((i & sa_mask) == 0)
         {
             sa_ls_word[pos] = sa_bwt[i] & 0xffffffff;
             sa_ms_byte[pos] = (sa_bwt[i] >> 32) & 0xff;
             pos++;
         }
     }
-    fprintf(stderr, "pos: %d, ref_seq_len__: %ld\n", pos, ref_seq_len >> SA_COMPX);
-    outstream.write((char*)sa_ms_byte, ((ref_seq_len >> SA_COMPX) + 1) * sizeof(int8_t));
-    outstream.write((char*)sa_ls_word, ((ref_seq_len >> SA_COMPX) + 1) * sizeof(uint32_t));
+    fprintf(stderr, "pos: %ld, ref_seq_len__: %ld\n", pos, ref_seq_len >> sa_shift);
+    outstream.write((char*)sa_ms_byte, ((ref_seq_len >> sa_shift) + 1) * sizeof(int8_t));
+    write_padding(outstream, CP_FILE_ALIGN);
+    outstream.write((char*)sa_ls_word, ((ref_seq_len >> sa_shift) + 1) * sizeof(uint32_t));
     
     #else
     
@@ -289,11 +492,11 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
         sa_ms_byte[i] = (sa_bwt[i] >> 32) & 0xff;
     }
     outstream.write((char*)sa_ms_byte, ref_seq_len * sizeof(int8_t));
+    write_padding(outstream, CP_FILE_ALIGN);
     outstream.write((char*)sa_ls_word, ref_seq_len * sizeof(uint32_t));
     
     #endif
 
-    outstream.write((char *)(&sentinel_index), 1 * sizeof(int64_t));
     outstream.close();
     printf("max_occ_ind = %ld\n", i >> CP_SHIFT);    
     fflush(stdout);
@@ -303,7 +506,7 @@ int FMI_search::build_fm_index(const char *ref_file_name, char *binary_seq, int6
     return 0;
 }
 
-int FMI_search::build_index() {
+int FMI_search::build_index(int cp_block_size, int sa_rate) {
 
     char *prefix = file_name;
     uint64_t startTick;
@@ -374,14 +577,147 @@ int FMI_search::build_index() {
     fprintf(stderr, "build suffix-array ticks = %llu\n", __rdtsc() - startTick);
     startTick = __rdtsc();
 
-	build_fm_index(prefix, binary_ref_seq, pac_len, suffix_array, count);
+	int sa_shift = SA_COMPX;
+	if (sa_rate != 0) {
+		for (sa_shift = 0; sa_shift <= SA_MAX_SHIFT && (1 << sa_shift) != sa_rate; sa_shift++);
+		if (sa_shift > SA_MAX_SHIFT) {
+			fprintf(stderr, "ERROR! unsupported SA sampling rate %d\n", sa_rate);
+			exit(EXIT_FAILURE);
+		}
+	}
+	build_fm_index(prefix, binary_ref_seq, pac_len, suffix_array, count, cp_block_size, sa_shift);
     fprintf(stderr, "build fm-index ticks = %llu\n", __rdtsc() - startTick);
     _mm_free(binary_ref_seq);
     _mm_free(suffix_array);
     return 0;
 }
 
-void FMI_search::load_index()
+/**
+ * Offsets of the sections of an index file. The aligned layout (written by
+ * build_fm_index) starts with a CP_FILE_ALIGN-byte header:
+ *
+ *   magic, reference_seq_len, count[5], sentinel_index
+ *
+ * (the upper bits of the magic give the SA sampling, see CP_FILE_SA_SHIFT_BIT)
+ * followed by cp_occ, sa_ms_byte and sa_ls_word, each one starting at a
+ * multiple of CP_FILE_ALIGN. The legacy layout starts with reference_seq_len
+ * and count[5], packs the sections back to back, and ends with the
+ * sentinel_index. The compressed files (CP2_FILE_MAGIC) have the aligned
+ * layout, with the checkpoints and the superblock counts in place of cp_occ.
+ */
+typedef struct {
+    bool aligned;
+    int cp2_shift; // 0 for cp_occ.
+    int sa_shift;
+    int64_t reference_seq_len;
+    int64_t cp_occ_bytes;
+    int64_t cp_occ2_super_bytes;
+    int64_t sa_size;
+    int64_t cp_occ_offset;
+    int64_t cp_occ2_super_offset;
+    int64_t sa_ms_byte_offset;
+    int64_t sa_ls_word_offset;
+    int64_t sentinel_offset;
+    int64_t count_offset;
+} index_layout_t;
+
+static int64_t align_offset(int64_t offset, bool aligned)
+{
+    return aligned ? (offset + CP_FILE_ALIGN - 1) / CP_FILE_ALIGN * CP_FILE_ALIGN : offset;
+}
+
+/**
+ * Layout of the index file @cpstream, with 2^@shift symbols per checkpoint.
+ */
+static void index_layout(FILE *cpstream, int shift, index_layout_t *layout)
+{
+    int64_t first;
+    err_fread_noeof(&first, sizeof(int64_t), 1, cpstream);
+    // The legacy files start with the reference length, below 2^40.
+    int sa_bits = (uint64_t)first >> CP_FILE_SA_SHIFT_BIT;
+    first &= CP_FILE_MAGIC_MASK;
+    layout->sa_shift = sa_bits ? sa_bits - 1 : SA_COMPX;
+    if (layout->sa_shift > SA_MAX_SHIFT) {
+        fprintf(stderr, "ERROR! unsupported SA sampling in the index file\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((shift == CP_SHIFT) == (first == CP2_FILE_MAGIC)) {
+        fprintf(stderr, "ERROR! the index file does not have %d symbols per checkpoint\n",
+                1 << shift);
+        exit(EXIT_FAILURE);
+    }
+    layout->aligned = first == CP_FILE_MAGIC || first == CP2_FILE_MAGIC;
+    layout->cp2_shift = shift == CP_SHIFT ? 0 : shift;
+    if (layout->aligned) {
+        err_fread_noeof(&layout->reference_seq_len, sizeof(int64_t), 1, cpstream);
+        layout->count_offset = 2 * sizeof(int64_t);
+        layout->sentinel_offset = 7 * sizeof(int64_t);
+        layout->cp_occ_offset = CP_FILE_ALIGN;
+    }
+    else {
+        layout->reference_seq_len = first;
+        layout->count_offset = sizeof(int64_t);
+        layout->cp_occ_offset = 6 * sizeof(int64_t);
+    }
+    assert(layout->reference_seq_len > 0);
+    assert(layout->reference_seq_len <= 0x7fffffffffL);
+
+    layout->sa_size = sa_entries(layout->reference_seq_len, layout->sa_shift);
+    if (layout->cp2_shift) {
+        layout->cp_occ_bytes = cp_occ2_bytes(layout->reference_seq_len, layout->cp2_shift);
+        layout->cp_occ2_super_bytes = cp_occ2_super_bytes(layout->reference_seq_len);
+        layout->cp_occ2_super_offset = align_offset(layout->cp_occ_offset + layout->cp_occ_bytes, true);
+        layout->sa_ms_byte_offset = align_offset(layout->cp_occ2_super_offset +
+                                                 layout->cp_occ2_super_bytes, true);
+    }
+    else {
+        layout->cp_occ_bytes = cp_occ_bytes(layout->reference_seq_len);
+        layout->cp_occ2_super_bytes = 0;
+        layout->cp_occ2_super_offset = 0;
+        layout->sa_ms_byte_offset = layout->cp_occ_offset + layout->cp_occ_bytes;
+    }
+    layout->sa_ls_word_offset = align_offset(layout->sa_ms_byte_offset + layout->sa_size * sizeof(int8_t),
+                                             layout->aligned);
+    if (!layout->aligned) {
+        layout->sentinel_offset = layout->sa_ls_word_offset + layout->sa_size * sizeof(uint32_t);
+    }
+
+    struct stat st;
+    int64_t end = layout->sa_ls_word_offset + layout->sa_size * sizeof(uint32_t);
+    if (fstat(fileno(cpstream), &st) == 0 &&
+        (layout->aligned ? st.st_size != end : st.st_size < end)) {
+        fprintf(stderr, "ERROR! the index file is truncated or has another checkpoint size\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void read_section(FILE *cpstream, int64_t offset, void *ptr, size_t size, size_t nmemb)
+{
+    err_fseek(cpstream, offset, SEEK_SET);
+    err_fread_noeof(ptr, size, nmemb, cpstream);
+}
+
+/**
+ * Return @size bytes at @offset of the mapping @map, or an aligned copy if
+ * they are not aligned to @align bytes.
+ */
+static void *mapped_section(char *map, int64_t offset, size_t size, size_t align, const char *name)
+{
+    if ((uintptr_t)(map + offset) % align == 0) {
+        return map + offset;
+    }
+    fprintf(stderr, "* %s is not aligned in the index file, copying it "
+            "(rebuild the index to share it between processes)\n", name);
+    void *copy = _mm_malloc(size, 64);
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR! unable to allocate %s memory\n", name);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, map + offset, size);
+    return copy;
+}
+
+void FMI_search::load_index(int flags, int cp_block_size)
 {
     one_hot_mask_array = (uint64_t *)_mm_malloc(64 * sizeof(uint64_t), 64);
     one_hot_mask_array[0] = 0;
@@ -395,280 +731,824 @@ void FMI_search::load_index()
 
     char *ref_file_name = file_name;
     //beCalls = 0;
-    char cp_file_name[PATH_MAX];
-    strcpy_s(cp_file_name, PATH_MAX, ref_file_name);
-    strcat_s(cp_file_name, PATH_MAX, CP_FILENAME_SUFFIX);
+    char cp_file[PATH_MAX];
+    int shift = cp_block_shift(cp_block_size);
+    if (cp_block_size == 0)
+    {
+        // The first index file found, the uncompressed one first.
+        for (shift = CP_SHIFT; shift <= CP2_MAX_SHIFT; shift++)
+        {
+            cp_file_name(cp_file, ref_file_name, shift);
+            if (access(cp_file, F_OK) == 0)
+                break;
+        }
+        if (shift > CP2_MAX_SHIFT)
+            shift = CP_SHIFT;
+    }
+    else if (shift < 0)
+    {
+        fprintf(stderr, "ERROR! unsupported checkpoint block size %d\n", cp_block_size);
+        exit(EXIT_FAILURE);
+    }
+    cp_file_name(cp_file, ref_file_name, shift);
 
     // Read the BWT and FM index of the reference sequence
     FILE *cpstream = NULL;
-    cpstream = fopen(cp_file_name,"rb");
+    cpstream = fopen(cp_file,"rb");
     if (cpstream == NULL)
     {
-        fprintf(stderr, "ERROR! Unable to open the file: %s\n", cp_file_name);
+        fprintf(stderr, "ERROR! Unable to open the file: %s\n", cp_file);
         exit(EXIT_FAILURE);
     }
     else
     {
-        fprintf(stderr, "* Index file found. Loading index from %s\n", cp_file_name);
+        fprintf(stderr, "* Index file found. Loading index from %s\n", cp_file);
     }
 
-    err_fread_noeof(&reference_seq_len, sizeof(int64_t), 1, cpstream);
-    assert(reference_seq_len > 0);
-    assert(reference_seq_len <= 0x7fffffffffL);
+    index_layout_t layout;
+    index_layout(cpstream, shift, &layout);
+    reference_seq_len = layout.reference_seq_len;
+    cp2_shift = layout.cp2_shift;
+    cp2_words = cp2_shift ? cp_occ2_words(cp2_shift) : 0;
+    if (cp2_shift)
+        fprintf(stderr, "* Compressed occurrence table, %d symbols per checkpoint\n", 1 << cp2_shift);
 
     fprintf(stderr, "* Reference seq len for bi-index = %ld\n", reference_seq_len);
 
-    // create checkpointed occ
-    int64_t cp_occ_size = (reference_seq_len >> CP_SHIFT) + 1;
-    cp_occ = NULL;
+    read_section(cpstream, layout.count_offset, &count[0], sizeof(int64_t), 5);
+    sentinel_index = -1;
+    #if SA_COMPRESSION
+    read_section(cpstream, layout.sentinel_offset, &sentinel_index, sizeof(int64_t), 1);
+    fprintf(stderr, "* sentinel-index: %ld\n", sentinel_index);
+    sa_shift = layout.sa_shift;
+    sa_mask = (1L << sa_shift) - 1;
+    fprintf(stderr, "* SA sampling rate: %d\n", 1 << sa_shift);
+    #endif
 
-    err_fread_noeof(&count[0], sizeof(int64_t), 5, cpstream);
-    if ((cp_occ = (CP_OCC *)_mm_malloc(cp_occ_size * sizeof(CP_OCC), 64)) == NULL) {
-        fprintf(stderr, "ERROR! unable to allocated cp_occ memory\n");
-        exit(EXIT_FAILURE);
+    if (flags & FMI_LOAD_MMAP)
+    {
+        struct stat st;
+        if (fstat(fileno(cpstream), &st) != 0) {
+            perror("ERROR! Unable to stat the index file");
+            exit(EXIT_FAILURE);
+        }
+        index_map_size = st.st_size;
+        int map_flags = MAP_SHARED;
+        #ifdef MAP_POPULATE
+        if (flags & FMI_LOAD_POPULATE)
+            map_flags |= MAP_POPULATE;
+        #endif
+        void *map = mmap(NULL, index_map_size, PROT_READ, map_flags, fileno(cpstream), 0);
+        if (map == MAP_FAILED) {
+            perror("ERROR! Unable to map the index file");
+            exit(EXIT_FAILURE);
+        }
+        index_map = (char *)map;
+        #ifdef MADV_HUGEPAGE
+        if ((flags & FMI_LOAD_HUGEPAGE) && madvise(index_map, index_map_size, MADV_HUGEPAGE) != 0)
+            perror("* madvise(MADV_HUGEPAGE)");
+        #endif
+        fprintf(stderr, "* Index file mapped (%s layout%s%s)\n",
+                layout.aligned ? "aligned" : "legacy",
+                flags & FMI_LOAD_POPULATE ? ", populated" : "",
+                flags & FMI_LOAD_HUGEPAGE ? ", huge pages" : "");
+
+        if (cp2_shift) {
+            cp_occ2 = (uint64_t *)(index_map + layout.cp_occ_offset);
+            cp_occ2_super = (int64_t (*)[4])(index_map + layout.cp_occ2_super_offset);
+        }
+        else {
+            cp_occ = (CP_OCC *)mapped_section(index_map, layout.cp_occ_offset,
+                                              layout.cp_occ_bytes, 64, "cp_occ");
+        }
+        sa_ms_byte = (int8_t *)(index_map + layout.sa_ms_byte_offset);
+        sa_ls_word = (uint32_t *)mapped_section(index_map, layout.sa_ls_word_offset,
+                                                layout.sa_size * sizeof(uint32_t),
+                                                sizeof(uint32_t), "sa_ls_word");
     }
+    else
+    {
+        // create checkpointed occ
+        void *occ = _mm_malloc(layout.cp_occ_bytes, 64);
+        if (occ == NULL) {
+            fprintf(stderr, "ERROR! unable to allocated cp_occ memory\n");
+            exit(EXIT_FAILURE);
+        }
+        read_section(cpstream, layout.cp_occ_offset, occ, 1, layout.cp_occ_bytes);
+        if (cp2_shift) {
+            cp_occ2 = (uint64_t *)occ;
+            cp_occ2_super = (int64_t (*)[4])_mm_malloc(layout.cp_occ2_super_bytes, 64);
+            read_section(cpstream, layout.cp_occ2_super_offset, cp_occ2_super, 1,
+                         layout.cp_occ2_super_bytes);
+        }
+        else {
+            cp_occ = (CP_OCC *)occ;
+        }
+
+        sa_ms_byte = (int8_t *)_mm_malloc(layout.sa_size * sizeof(int8_t), 64);
+        sa_ls_word = (uint32_t *)_mm_malloc(layout.sa_size * sizeof(uint32_t), 64);
+        read_section(cpstream, layout.sa_ms_byte_offset, sa_ms_byte, sizeof(int8_t), layout.sa_size);
+        read_section(cpstream, layout.sa_ls_word_offset, sa_ls_word, sizeof(uint32_t), layout.sa_size);
+    }
+    fclose(cpstream);
 
-    err_fread_noeof(cp_occ, sizeof(CP_OCC), cp_occ_size, cpstream);
     int64_t ii = 0;
     for(ii = 0; ii < 5; ii++)// update read count structure
     {
         count[ii] = count[ii] + 1;
     }
 
-    #if SA_COMPRESSION
+    int64_t x;
+    #if !SA_COMPRESSION
+    for(x = 0; x < reference_seq_len; x++)
+    {
+        // fprintf(stderr, "x: %ld\n", x);
+        #if SA_COMPRESSION
+        if(get_sa_entry_compressed(x) == 0) {
+            sentinel_index = x;
+            break;
+        }
+        #else
+        if(get_sa_entry(x) == 0) {
+            sentinel_index = x;
+            break;
+        }
+        #endif
+    }
+    fprintf(stderr, "\nsentinel_index: %ld\n", x);    
+    #endif
 
-    int64_t reference_seq_len_ = (reference_seq_len >> SA_COMPX) + 1;
-    sa_ms_byte = (int8_t *)_mm_malloc(reference_seq_len_ * sizeof(int8_t), 64);
-    sa_ls_word = (uint32_t *)_mm_malloc(reference_seq_len_ * sizeof(uint32_t), 64);
-    err_fread_noeof(sa_ms_byte, sizeof(int8_t), reference_seq_len_, cpstream);
-    err_fread_noeof(sa_ls_word, sizeof(uint32_t), reference_seq_len_, cpstream);
-    
-    #else
-    
-    sa_ms_byte = (int8_t *)_mm_malloc(reference_seq_len * sizeof(int8_t), 64);
-    sa_ls_word = (uint32_t *)_mm_malloc(reference_seq_len * sizeof(uint32_t), 64);
-    err_fread_noeof(sa_ms_byte, sizeof(int8_t), reference_seq_len, cpstream);
-    err_fread_noeof(sa_ls_word, sizeof(uint32_t), reference_seq_len, cpstream);
+    fprintf(stderr, "* Count:\n");
+    for(x = 0; x < 5; x++)
+    {
+        fprintf(stderr, "%ld,\t%lu\n", x, (unsigned long)count[x]);
+    }
+    fprintf(stderr, "\n");  
 
-    #endif
+    if (!(flags & FMI_LOAD_NO_KMER))
+        load_kmer_table(flags);
 
-    sentinel_index = -1;
-    #if SA_COMPRESSION
-    err_fread_noeof(&sentinel_index, sizeof(int64_t), 1, cpstream);
-    fprintf(stderr, "* sentinel-index: %ld\n", sentinel_index);
-    #endif
-    fclose(cpstream);
+    fprintf(stderr, "* Reading other elements of the index from files %s\n",
+            ref_file_name);
+    bwa_idx_load_ele(ref_file_name, BWA_IDX_ALL);
+
+    fprintf(stderr, "* Done reading Index!!\n");
+}
+
+/**
+ * Header of the k-mer table file, the counts are those of the loaded index.
+ */
+static void kmer_header(int64_t header[8], int kmer_k, int64_t reference_seq_len,
+                        const int64_t count[5])
+{
+    header[0] = KMER_FILE_MAGIC;
+    header[1] = kmer_k;
+    header[2] = reference_seq_len;
+    memcpy(header + 3, count, 5 * sizeof(int64_t));
+}
+
+void FMI_search::load_kmer_table(int flags)
+{
+    char kmer_file[PATH_MAX];
+    strcpy_s(kmer_file, PATH_MAX, file_name);
+    strcat_s(kmer_file, PATH_MAX, KMER_FILENAME_SUFFIX);
+    FILE *kmerstream = fopen(kmer_file, "rb");
+    if (kmerstream == NULL)
+        return;
+
+    int64_t header[8], expected[8];
+    if (fread(header, sizeof(int64_t), 8, kmerstream) != 8) {
+        fprintf(stderr, "* Ignoring %s: truncated header\n", kmer_file);
+        fclose(kmerstream);
+        return;
+    }
+    int k = header[0] == KMER_FILE_MAGIC ? header[1] : 0;
+    kmer_header(expected, k, reference_seq_len, count);
+    if (k < KMER_MIN_K || k > KMER_MAX_K || memcmp(header, expected, sizeof(header)) != 0) {
+        fprintf(stderr, "* Ignoring %s: not built from this index\n", kmer_file);
+        fclose(kmerstream);
+        return;
+    }
+
+    size_t bytes = KMER_OFFSET(k + 1) * sizeof(KMER_INTV);
+    struct stat st;
+    if (fstat(fileno(kmerstream), &st) != 0 || (size_t)st.st_size != CP_FILE_ALIGN + bytes) {
+        fprintf(stderr, "* Ignoring %s: wrong size\n", kmer_file);
+        fclose(kmerstream);
+        return;
+    }
+    if (flags & FMI_LOAD_MMAP) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(kmerstream), 0);
+        if (map == MAP_FAILED) {
+            perror("ERROR! Unable to map the k-mer table");
+            exit(EXIT_FAILURE);
+        }
+        kmer_map_size = st.st_size;
+        kmer_table = (KMER_INTV *)((char *)map + CP_FILE_ALIGN);
+    }
+    else {
+        kmer_table = (KMER_INTV *)_mm_malloc(bytes, 64);
+        if (kmer_table == NULL) {
+            fprintf(stderr, "ERROR! unable to allocate the k-mer table\n");
+            exit(EXIT_FAILURE);
+        }
+        read_section(kmerstream, CP_FILE_ALIGN, kmer_table, 1, bytes);
+    }
+    fclose(kmerstream);
+    kmer_k = k;
+    fprintf(stderr, "* k-mer table loaded from %s (k = %d, %0.2lf MB)\n", kmer_file, k,
+            bytes * 1.0 / (1024 * 1024));
+}
+
+int FMI_search::build_kmer_table(int k)
+{
+    if (k < KMER_MIN_K || k > KMER_MAX_K) {
+        fprintf(stderr, "ERROR! unsupported k-mer table length %d\n", k);
+        return 1;
+    }
+    int64_t n = KMER_OFFSET(k + 1);
+    KMER_INTV *table = (KMER_INTV *)_mm_malloc(n * sizeof(KMER_INTV), 64);
+    assert_not_null(table, n * sizeof(KMER_INTV), n * sizeof(KMER_INTV));
+
+    // The same extensions as those of the SMEM search, so the search gets
+    // the same intervals from the table.
+    int a;
+    for (a = 0; a < 4; a++) {
+        table[a].k = count[a];
+        table[a].l = count[3 - a];
+        table[a].s = count[a + 1] - count[a];
+    }
+    int len;
+    for (len = 1; len < k; len++) {
+        const KMER_INTV *level = table + KMER_OFFSET(len);
+        KMER_INTV *next = table + KMER_OFFSET(len + 1);
+        int64_t code;
+#pragma omp parallel for schedule(static)
+        for (code = 0; code < (1L << (2 * len)); code++) {
+            SMEM smem_;
+            memset(&smem_, 0, sizeof(SMEM));
+            // Forward extension is backward extension with the BWT of reverse complement
+            smem_.k = level[code].l;
+            smem_.l = level[code].k;
+            smem_.s = level[code].s;
+            for (int b = 0; b < 4; b++) {
+                SMEM newSmem_ = backwardExt(smem_, 3 - b);
+                next[code * 4 + b].k = newSmem_.l;
+                next[code * 4 + b].l = newSmem_.k;
+                next[code * 4 + b].s = newSmem_.s;
+            }
+        }
+    }
+
+    char kmer_file[PATH_MAX];
+    strcpy_s(kmer_file, PATH_MAX, file_name);
+    strcat_s(kmer_file, PATH_MAX, KMER_FILENAME_SUFFIX);
+    FILE *kmerstream = fopen(kmer_file, "wb");
+    if (kmerstream == NULL) {
+        fprintf(stderr, "ERROR! Unable to open the file: %s\n", kmer_file);
+        _mm_free(table);
+        return 1;
+    }
+    int64_t header[8];
+    kmer_header(header, k, reference_seq_len, count);
+    err_fwrite(header, sizeof(int64_t), 8, kmerstream);
+    err_fwrite(table, sizeof(KMER_INTV), n, kmerstream);
+    err_fclose(kmerstream);
+    fprintf(stderr, "* k-mer table written to %s (k = %d, %0.2lf MB)\n", kmer_file, k,
+            n * sizeof(KMER_INTV) * 1.0 / (1024 * 1024));
+    _mm_free(table);
+    return 0;
+}
+
+/**
+ * NUMA node of the calling thread, or -1 if unknown.
+ */
+static int current_numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < FMI_MAX_NUMA_NODES)
+        return node;
+#endif
+    return -1;
+}
+
+/**
+ * Copy @size bytes of @src to pages bound to @node. Falls back to the first
+ * touch of the calling thread if the pages cannot be bound.
+ */
+static void *numa_copy(const void *src, size_t size, int node)
+{
+    void *dst = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (dst == MAP_FAILED) {
+        fprintf(stderr, "ERROR! unable to allocate %0.2lf GB on NUMA node %d\n",
+                size * 1.0 / (1024 * 1024 * 1024), node);
+        exit(EXIT_FAILURE);
+    }
+#if defined(__linux__) && defined(SYS_mbind)
+    const int mpol_bind = 2; // MPOL_BIND in <linux/mempolicy.h>
+    unsigned long nodemask[FMI_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // The kernel reads maxnode - 1 bits of the mask.
+    if (syscall(SYS_mbind, dst, size, mpol_bind, nodemask, FMI_MAX_NUMA_NODES + 1, 0) != 0)
+        perror("* mbind");
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise(dst, size, MADV_HUGEPAGE);
+#endif
+    memcpy(dst, src, size);
+    return dst;
+}
+
+FMI_search::FMI_search(FMI_search *home, int node, bool replicate_sa)
+{
+    bwaidx_fm_t *own_idx = idx; // Allocated by indexEle().
+    *this = *home;
+    free(own_idx);
+    this->home = home;
+    index_map = NULL;
+    index_map_size = 0;
+    memset(numa_replicas, 0, sizeof(numa_replicas));
+
+    // The superblock counts are small enough to stay in cache.
+    if (cp_occ2)
+        cp_occ2 = (uint64_t *)numa_copy(home->cp_occ2, cp_occ2_bytes(reference_seq_len, cp2_shift), node);
+    else
+        cp_occ = (CP_OCC *)numa_copy(home->cp_occ, cp_occ_bytes(reference_seq_len), node);
+    if (replicate_sa) {
+        int64_t n = sa_entries(reference_seq_len, sa_shift);
+        sa_ms_byte = (int8_t *)numa_copy(home->sa_ms_byte, n * sizeof(int8_t), node);
+        sa_ls_word = (uint32_t *)numa_copy(home->sa_ls_word, n * sizeof(uint32_t), node);
+    }
+    if (kmer_table)
+        kmer_table = (KMER_INTV *)numa_copy(home->kmer_table, KMER_OFFSET(kmer_k + 1) * sizeof(KMER_INTV), node);
+}
+
+int FMI_search::replicate_numa(int num_threads, bool replicate_sa)
+{
+    int home_node = current_numa_node();
+    if (home_node < 0) {
+        fprintf(stderr, "* Unknown NUMA topology, the index is not replicated\n");
+        return 1;
+    }
+    numa_replicas[home_node] = this;
+
+    // The first thread of every node copies the index to that node.
+    int replicas = 1;
+#pragma omp parallel num_threads(num_threads) reduction(+:replicas)
+    {
+        int node = current_numa_node();
+        if (node >= 0 && __sync_bool_compare_and_swap(&numa_replicas[node], NULL, this)) {
+            numa_replicas[node] = new FMI_search(this, node, replicate_sa);
+            replicas++;
+        }
+    }
+    fprintf(stderr, "* Index replicated on %d NUMA node(s) (%s)\n", replicas,
+            replicate_sa ? "cp_occ and SA" : "cp_occ");
+    return replicas;
+}
+
+FMI_search *FMI_search::local_replica()
+{
+    int node = current_numa_node();
+    if (node < 0 || numa_replicas[node] == NULL)
+        return this;
+    return numa_replicas[node];
+}
+
+/**
+ * Occurrences of A, C, G and T in the compressed BWT before @pos.
+ */
+inline void FMI_search::get_occ2(int64_t pos, int64_t occ[4])
+{
+    const uint64_t *cp = cp_occ2 + (pos >> cp2_shift) * cp2_words;
+    const uint32_t *cp_count = (const uint32_t *)cp;
+    const uint64_t *bwt_str = cp + CP2_COUNT_WORDS;
+    const int64_t *super_count = cp_occ2_super[pos >> CP2_SUPER_SHIFT];
+    int64_t y = pos & ((1L << cp2_shift) - 1);
+
+    // Symbol j of a word is in bits 2j and 2j + 1: count the pairs that are
+    // 00, 01 and 10 among the first y symbols, the rest are 11.
+    int64_t n[4];
+#if defined(__AVX512VPOPCNTDQ__)
+    // All the words of the checkpoint at once, masked to the first y symbols.
+    const __m512i lane = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    __m512i rem = _mm512_sub_epi64(_mm512_set1_epi64(y), _mm512_slli_epi64(lane, 5));
+    rem = _mm512_min_epi64(_mm512_max_epi64(rem, _mm512_setzero_si512()), _mm512_set1_epi64(32));
+    __m512i mask = _mm512_andnot_si512(_mm512_sllv_epi64(_mm512_set1_epi64(-1), _mm512_add_epi64(rem, rem)),
+                                       _mm512_set1_epi64(0x5555555555555555L));
+    __m512i lo = _mm512_maskz_loadu_epi64((__mmask8)((1 << (cp2_words - CP2_COUNT_WORDS)) - 1), bwt_str);
+    __m512i hi = _mm512_srli_epi64(lo, 1);
+    n[0] = _mm512_reduce_add_epi64(_mm512_popcnt_epi64(_mm512_andnot_si512(_mm512_or_si512(lo, hi), mask)));
+    n[1] = _mm512_reduce_add_epi64(_mm512_popcnt_epi64(_mm512_and_si512(_mm512_andnot_si512(hi, lo), mask)));
+    n[2] = _mm512_reduce_add_epi64(_mm512_popcnt_epi64(_mm512_and_si512(_mm512_andnot_si512(lo, hi), mask)));
+#else
+    n[0] = n[1] = n[2] = 0;
+    int64_t w;
+    for(w = 0; w <= (y >> 5); w++)
+    {
+        uint64_t lo = bwt_str[w];
+        uint64_t hi = lo >> 1;
+        uint64_t mask = 0x5555555555555555UL;
+        if(w == (y >> 5))
+            mask &= (1UL << (2 * (y & 31))) - 1;
+        n[0] += _mm_countbits_64(~(lo | hi) & mask);
+        n[1] += _mm_countbits_64(lo & ~hi & mask);
+        n[2] += _mm_countbits_64(~lo & hi & mask);
+    }
+#endif
+    n[3] = y - n[0] - n[1] - n[2];
+    // The sentinel is packed as an A.
+    if((uint64_t)(pos - 1 - sentinel_index) < (uint64_t)y)
+        n[0]--;
+
+    occ[0] = super_count[0] + cp_count[0] + n[0];
+    occ[1] = super_count[1] + cp_count[1] + n[1];
+    occ[2] = super_count[2] + cp_count[2] + n[2];
+    occ[3] = super_count[3] + cp_count[3] + n[3];
+}
+
+/**
+ * Occurrences of @c in the BWT before @pos.
+ */
+inline int64_t FMI_search::get_occ(int64_t pos, uint8_t c)
+{
+    if(cp_occ2)
+    {
+        int64_t occ[4];
+        get_occ2(pos, occ);
+        return occ[c];
+    }
+    GET_OCC(pos, c, occ_id_pos, y_pos, occ_pos, one_hot_bwt_str_c_pos, match_mask_pos);
+    return occ_pos;
+}
+
+/**
+ * Symbol at @pos of the BWT, 4 for the sentinel.
+ */
+inline uint8_t FMI_search::get_bwt_char(int64_t pos)
+{
+    if(cp_occ2)
+    {
+        if(pos == sentinel_index)
+            return 4;
+        int64_t y = pos & ((1L << cp2_shift) - 1);
+        const uint64_t *bwt_str = cp_occ2 + (pos >> cp2_shift) * cp2_words + CP2_COUNT_WORDS;
+        return (bwt_str[y >> 5] >> (2 * (y & 31))) & 3;
+    }
+
+    int64_t occ_id_pp_ = pos >> CP_SHIFT;
+    int64_t y_pp_ = CP_BLOCK_SIZE - (pos & CP_MASK) - 1;
+    uint64_t *one_hot_bwt_str = cp_occ[occ_id_pp_].one_hot_bwt_str;
+
+    if((one_hot_bwt_str[0] >> y_pp_) & 1)
+        return 0;
+    else if((one_hot_bwt_str[1] >> y_pp_) & 1)
+        return 1;
+    else if((one_hot_bwt_str[2] >> y_pp_) & 1)
+        return 2;
+    else if((one_hot_bwt_str[3] >> y_pp_) & 1)
+        return 3;
+    return 4;
+}
+
+/**
+ * Prefetch the checkpoint of @pos. The compressed checkpoints may span two
+ * cache lines.
+ */
+inline void FMI_search::prefetch_occ(int64_t pos)
+{
+    if(cp_occ2)
+    {
+        const char *cp = (const char *)(cp_occ2 + (pos >> cp2_shift) * cp2_words);
+        _mm_prefetch(cp, _MM_HINT_T0);
+        _mm_prefetch(cp + cp2_words * sizeof(uint64_t) - 1, _MM_HINT_T0);
+        return;
+    }
+    _mm_prefetch((const char *)(&cp_occ[pos >> CP_SHIFT]), _MM_HINT_T0);
+}
+
+#ifdef ENABLE_PREFETCH
+#define PREFETCH_OCC(pos) prefetch_occ(pos)
+#else
+#define PREFETCH_OCC(pos)
+#endif
+
+void FMI_search::smemStart(SMEM_LANE *lane, const uint8_t *enc_qdb)
+{
+    int x = lane->x;
+    uint8_t a = enc_qdb[lane->offset + x];
+
+    lane->next_x = x + 1;
+    lane->numPrev = 0;
+    lane->numOut = 0;
+    if(a > 3)
+    {
+        lane->phase = SMEM_DONE;
+        return;
+    }
+
+    SMEM &smem = lane->smem;
+    smem.rid = lane->rid;
+    smem.m = x;
+    smem.n = x;
+    smem.k = count[a];
+    smem.l = count[3 - a];
+    smem.s = count[a+1] - count[a];
+    lane->j = x + 1;
+    lane->kmer_code = a;
+    lane->phase = SMEM_FORWARD;
+    if(kmer_k > 1)
+    {
+        // The extensions of the 2-mers starting with a.
+        _mm_prefetch((const char *)&kmer_table[KMER_OFFSET(2) + 4 * a], _MM_HINT_T0);
+        return;
+    }
+    // The forward extension reads the occurrences at l and l + s.
+    PREFETCH_OCC(smem.l);
+    PREFETCH_OCC(smem.l + smem.s);
+}
+
+void FMI_search::smemForwardStep(SMEM_LANE *lane, const uint8_t *enc_qdb)
+{
+    int j = lane->j;
+    if(j >= lane->readlength)
+    {
+        smemForwardEnd(lane);
+        return;
+    }
+    uint8_t a = enc_qdb[lane->offset + j];
+    lane->next_x = j + 1;
+    if(a > 3)
+    {
+        smemForwardEnd(lane);
+        return;
+    }
+
+    SMEM smem = lane->smem;
+    SMEM newSmem = smem;
+    int len = j - lane->x + 1;
+    if(len <= kmer_k)
+    {
+        // The interval of the first len bases is in the k-mer table.
+        lane->kmer_code = lane->kmer_code * 4 + a;
+        const KMER_INTV *intv = &kmer_table[KMER_OFFSET(len) + lane->kmer_code];
+        newSmem.k = intv->k;
+        newSmem.l = intv->l;
+        newSmem.s = intv->s;
+    }
+    else
+    {
+        SMEM smem_ = smem;
+
+        // Forward extension is backward extension with the BWT of reverse complement
+        smem_.k = smem.l;
+        smem_.l = smem.k;
+        SMEM newSmem_ = backwardExt(smem_, 3 - a);
+        newSmem = newSmem_;
+        newSmem.k = newSmem_.l;
+        newSmem.l = newSmem_.k;
+    }
+    newSmem.n = j;
+
+    int32_t s_neq_mask = newSmem.s != smem.s;
+
+    lane->prev[lane->numPrev] = smem;
+    lane->numPrev += s_neq_mask;
+    if(newSmem.s < lane->min_intv)
+    {
+        lane->next_x = j;
+        smemForwardEnd(lane);
+        return;
+    }
+    lane->smem = newSmem;
+    lane->j = j + 1;
+    if(len < kmer_k)
+    {
+        _mm_prefetch((const char *)&kmer_table[KMER_OFFSET(len + 1) + 4 * lane->kmer_code], _MM_HINT_T0);
+        return;
+    }
+    PREFETCH_OCC(newSmem.l);
+    PREFETCH_OCC(newSmem.l + newSmem.s);
+}
+
+void FMI_search::smemForwardEnd(SMEM_LANE *lane)
+{
+    SMEM *prev = lane->prev;
+    int numPrev = lane->numPrev;
+    if(lane->smem.s >= lane->min_intv)
+    {
+        prev[numPrev++] = lane->smem;
+    }
+
+    int p;
+    for(p = 0; p < (numPrev/2); p++)
+    {
+        SMEM temp = prev[p];
+        prev[p] = prev[numPrev - p - 1];
+        prev[numPrev - p - 1] = temp;
+    }
+    lane->numPrev = numPrev;
+
+    if(numPrev == 0)
+    {
+        lane->phase = SMEM_DONE;
+        return;
+    }
+    lane->j = lane->x - 1;
+    lane->phase = SMEM_BACKWARD;
+    for(p = 0; p < numPrev; p++)
+    {
+        PREFETCH_OCC(prev[p].k);
+        PREFETCH_OCC(prev[p].k + prev[p].s);
+    }
+}
+
+void FMI_search::smemBackwardStep(SMEM_LANE *lane, const uint8_t *enc_qdb,
+                                  int32_t minSeedLen)
+{
+    int j = lane->j;
+    if(j < 0)
+    {
+        smemBackwardEnd(lane, minSeedLen);
+        return;
+    }
+    uint8_t a = enc_qdb[lane->offset + j];
+    if(a > 3)
+    {
+        smemBackwardEnd(lane, minSeedLen);
+        return;
+    }
 
-    int64_t x;
-    #if !SA_COMPRESSION
-    for(x = 0; x < reference_seq_len; x++)
+    SMEM *prev = lane->prev;
+    int numPrev = lane->numPrev;
+    int numCurr = 0;
+    int curr_s = -1;
+    int p;
+    for(p = 0; p < numPrev; p++)
     {
-        // fprintf(stderr, "x: %ld\n", x);
-        #if SA_COMPRESSION
-        if(get_sa_entry_compressed(x) == 0) {
-            sentinel_index = x;
+        SMEM smem = prev[p];
+        SMEM newSmem = backwardExt(smem, a);
+        newSmem.m = j;
+
+        if((newSmem.s < lane->min_intv) && ((smem.n - smem.m + 1) >= minSeedLen))
+        {
+            lane->out[lane->numOut++] = smem;
             break;
         }
-        #else
-        if(get_sa_entry(x) == 0) {
-            sentinel_index = x;
+        if((newSmem.s >= lane->min_intv) && (newSmem.s != curr_s))
+        {
+            curr_s = newSmem.s;
+            prev[numCurr++] = newSmem;
+            PREFETCH_OCC(newSmem.k);
+            PREFETCH_OCC(newSmem.k + newSmem.s);
             break;
         }
-        #endif
     }
-    fprintf(stderr, "\nsentinel_index: %ld\n", x);    
-    #endif
+    p++;
+    for(; p < numPrev; p++)
+    {
+        SMEM smem = prev[p];
 
-    fprintf(stderr, "* Count:\n");
-    for(x = 0; x < 5; x++)
+        SMEM newSmem = backwardExt(smem, a);
+        newSmem.m = j;
+
+        if((newSmem.s >= lane->min_intv) && (newSmem.s != curr_s))
+        {
+            curr_s = newSmem.s;
+            prev[numCurr++] = newSmem;
+            PREFETCH_OCC(newSmem.k);
+            PREFETCH_OCC(newSmem.k + newSmem.s);
+        }
+    }
+    lane->numPrev = numCurr;
+    if(numCurr == 0)
     {
-        fprintf(stderr, "%ld,\t%lu\n", x, (unsigned long)count[x]);
+        lane->phase = SMEM_DONE;
+        return;
     }
-    fprintf(stderr, "\n");  
-
-    fprintf(stderr, "* Reading other elements of the index from files %s\n",
-            ref_file_name);
-    bwa_idx_load_ele(ref_file_name, BWA_IDX_ALL);
+    lane->j = j - 1;
+}
 
-    fprintf(stderr, "* Done reading Index!!\n");
+void FMI_search::smemBackwardEnd(SMEM_LANE *lane, int32_t minSeedLen)
+{
+    if(lane->numPrev != 0)
+    {
+        SMEM smem = lane->prev[0];
+        if(((smem.n - smem.m + 1) >= minSeedLen))
+        {
+            lane->out[lane->numOut++] = smem;
+        }
+        lane->numPrev = 0;
+    }
+    lane->phase = SMEM_DONE;
 }
 
-void FMI_search::getSMEMsOnePosOneThread(uint8_t *enc_qdb,
-                                         int16_t *query_pos_array,
-                                         int32_t *min_intv_array,
-                                         int32_t *rid_array,
-                                         int32_t numReads,
-                                         int32_t batch_size,
-                                         const bseq1_t *seq_,
-                                         int32_t *query_cum_len_ar,
-                                         int32_t max_readlength,
-                                         int32_t minSeedLen,
-                                         SMEM *matchArray,
-                                         int64_t *__numTotalSmem)
+// Search the SMEMs of SMEM_BATCH reads at a time, one extension step per read
+// in turn, so that the prefetches of a read are in flight while the others
+// are extended. The SMEMs of every read are copied to matchArray when all the
+// previous reads are done, so the output is the same as that of searching
+// the reads one by one. @scratch holds SMEM_SCRATCH_SIZE(max_readlength)
+// SMEMs, 2 * (max_readlength + 1) per read of the window.
+void FMI_search::getSMEMsBatchOneThread(uint8_t *enc_qdb,
+                                        int32_t *query_pos_array,
+                                        int32_t *min_intv_array,
+                                        int32_t *rid_array,
+                                        int32_t numReads,
+                                        const bseq1_t *seq_,
+                                        int32_t *query_cum_len_ar,
+                                        int32_t max_readlength,
+                                        int32_t minSeedLen,
+                                        SMEM *matchArray,
+                                        int64_t *__numTotalSmem,
+                                        SMEM *scratch)
 {
     int64_t numTotalSmem = *__numTotalSmem;
-    SMEM prevArray[max_readlength];
+    SMEM_LANE lanes[SMEM_WINDOW];
 
-    uint32_t i;
-    // Perform SMEM for original reads
-    for(i = 0; i < numReads; i++)
+    int32_t w;
+    for(w = 0; w < SMEM_WINDOW; w++)
     {
-        int x = query_pos_array[i];
-        int32_t rid = rid_array[i];
-        int next_x = x + 1;
+        lanes[w].prev = scratch + (2 * w) * (max_readlength + 1);
+        lanes[w].out = scratch + (2 * w + 1) * (max_readlength + 1);
+    }
 
-        int readlength = seq_[rid].l_seq;
-        int offset = query_cum_len_ar[rid];
-        // uint8_t a = enc_qdb[rid * readlength + x];
-        uint8_t a = enc_qdb[offset + x];
+    int32_t head = 0, tail = 0, active = 0;
+    while(head < numReads)
+    {
+        while((tail < numReads) && (active < SMEM_BATCH) && (tail - head < SMEM_WINDOW))
+        {
+            SMEM_LANE *lane = &lanes[tail % SMEM_WINDOW];
+            int32_t rid = rid_array[tail];
+            lane->rid = rid;
+            lane->x = query_pos_array[tail];
+            lane->readlength = seq_[rid].l_seq;
+            lane->offset = query_cum_len_ar[rid];
+            lane->min_intv = min_intv_array[tail];
+            smemStart(lane, enc_qdb);
+            active += (lane->phase != SMEM_DONE);
+            tail++;
+        }
 
-        if(a < 4)
+        int32_t i;
+        for(i = head; i < tail; i++)
         {
-            SMEM smem;
-            smem.rid = rid;
-            smem.m = x;
-            smem.n = x;
-            smem.k = count[a];
-            smem.l = count[3 - a];
-            smem.s = count[a+1] - count[a];
-            int numPrev = 0;
-            
-            int j;
-            for(j = x + 1; j < readlength; j++)
-            {
-                // a = enc_qdb[rid * readlength + j];
-                a = enc_qdb[offset + j];
-                next_x = j + 1;
-                if(a < 4)
-                {
-                    SMEM smem_ = smem;
-
-                    // Forward extension is backward extension with the BWT of reverse complement
-                    smem_.k = smem.l;
-                    smem_.l = smem.k;
-                    SMEM newSmem_ = backwardExt(smem_, 3 - a);
-                    //SMEM newSmem_ = forwardExt(smem_, 3 - a);
-                    SMEM newSmem = newSmem_;
-                    newSmem.k = newSmem_.l;
-                    newSmem.l = newSmem_.k;
-                    newSmem.n = j;
-
-                    int32_t s_neq_mask = newSmem.s != smem.s;
-
-                    prevArray[numPrev] = smem;
-                    numPrev += s_neq_mask;
-                    if(newSmem.s < min_intv_array[i])
-                    {
-                        next_x = j;
-                        break;
-                    }
-                    smem = newSmem;
-#ifdef ENABLE_PREFETCH
-                    _mm_prefetch((const char *)(&cp_occ[(smem.k) >> CP_SHIFT]), _MM_HINT_T0);
-                    _mm_prefetch((const char *)(&cp_occ[(smem.l) >> CP_SHIFT]), _MM_HINT_T0);
-#endif
-                }
-                else
-                {
-                    break;
-                }
-            }
-            if(smem.s >= min_intv_array[i])
+            SMEM_LANE *lane = &lanes[i % SMEM_WINDOW];
+            if(lane->phase == SMEM_FORWARD)
             {
-
-                prevArray[numPrev] = smem;
-                numPrev++;
+                smemForwardStep(lane, enc_qdb);
             }
-
-            SMEM *prev;
-            prev = prevArray;
-
-            int p;
-            for(p = 0; p < (numPrev/2); p++)
+            else if(lane->phase == SMEM_BACKWARD)
             {
-                SMEM temp = prev[p];
-                prev[p] = prev[numPrev - p - 1];
-                prev[numPrev - p - 1] = temp;
+                smemBackwardStep(lane, enc_qdb, minSeedLen);
             }
-
-            // Backward search
-            int cur_j = readlength;
-            for(j = x - 1; j >= 0; j--)
+            else
             {
-                int numCurr = 0;
-                int curr_s = -1;
-                // a = enc_qdb[rid * readlength + j];
-                a = enc_qdb[offset + j];
-
-                if(a > 3)
-                {
-                    break;
-                }
-                for(p = 0; p < numPrev; p++)
-                {
-                    SMEM smem = prev[p];
-                    SMEM newSmem = backwardExt(smem, a);
-                    newSmem.m = j;
-
-                    if((newSmem.s < min_intv_array[i]) && ((smem.n - smem.m + 1) >= minSeedLen))
-                    {
-                        cur_j = j;
-
-                        matchArray[numTotalSmem++] = smem;
-                        break;
-                    }
-                    if((newSmem.s >= min_intv_array[i]) && (newSmem.s != curr_s))
-                    {
-                        curr_s = newSmem.s;
-                        prev[numCurr++] = newSmem;
-#ifdef ENABLE_PREFETCH
-                        _mm_prefetch((const char *)(&cp_occ[(newSmem.k) >> CP_SHIFT]), _MM_HINT_T0);
-                        _mm_prefetch((const char *)(&cp_occ[(newSmem.k + newSmem.s) >> CP_SHIFT]), _MM_HINT_T0);
-#endif
-                        break;
-                    }
-                }
-                p++;
-                for(; p < numPrev; p++)
-                {
-                    SMEM smem = prev[p];
-
-                    SMEM newSmem = backwardExt(smem, a);
-                    newSmem.m = j;
-
-
-                    if((newSmem.s >= min_intv_array[i]) && (newSmem.s != curr_s))
-                    {
-                        curr_s = newSmem.s;
-                        prev[numCurr++] = newSmem;
-#ifdef ENABLE_PREFETCH
-                        _mm_prefetch((const char *)(&cp_occ[(newSmem.k) >> CP_SHIFT]), _MM_HINT_T0);
-                        _mm_prefetch((const char *)(&cp_occ[(newSmem.k + newSmem.s) >> CP_SHIFT]), _MM_HINT_T0);
-#endif
-                    }
-                }
-                numPrev = numCurr;
-                if(numCurr == 0)
-                {
-                    break;
-                }
+                continue;
             }
-            if(numPrev != 0)
-            {
-                SMEM smem = prev[0];
-                if(((smem.n - smem.m + 1) >= minSeedLen))
-                {
+            active -= (lane->phase == SMEM_DONE);
+        }
 
-                    matchArray[numTotalSmem++] = smem;
-                }
-                numPrev = 0;
-            }
+        while((head < tail) && (lanes[head % SMEM_WINDOW].phase == SMEM_DONE))
+        {
+            SMEM_LANE *lane = &lanes[head % SMEM_WINDOW];
+            memcpy(matchArray + numTotalSmem, lane->out, lane->numOut * sizeof(SMEM));
+            numTotalSmem += lane->numOut;
+            query_pos_array[head] = lane->next_x;
+            head++;
         }
-        query_pos_array[i] = next_x;
     }
     (*__numTotalSmem) = numTotalSmem;
 }
 
+void FMI_search::getSMEMsOnePosOneThread(uint8_t *enc_qdb,
+                                         int32_t *query_pos_array,
+                                         int32_t *min_intv_array,
+                                         int32_t *rid_array,
+                                         int32_t numReads,
+                                         int32_t batch_size,
+                                         const bseq1_t *seq_,
+                                         int32_t *query_cum_len_ar,
+                                         int32_t max_readlength,
+                                         int32_t minSeedLen,
+                                         SMEM *matchArray,
+                                         int64_t *__numTotalSmem,
+                                         SMEM *scratch)
+{
+    getSMEMsBatchOneThread(enc_qdb,
+                           query_pos_array,
+                           min_intv_array,
+                           rid_array,
+                           numReads,
+                           seq_,
+                           query_cum_len_ar,
+                           max_readlength,
+                           minSeedLen,
+                           matchArray,
+                           __numTotalSmem,
+                           scratch);
+}
+
 void FMI_search::getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                          int32_t *min_intv_array,
                                          int32_t *rid_array,
@@ -679,9 +1559,10 @@ void FMI_search::getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                          int32_t max_readlength,
                                          int32_t minSeedLen,
                                          SMEM *matchArray,
-                                         int64_t *__numTotalSmem)
+                                         int64_t *__numTotalSmem,
+                                         SMEM *scratch)
 {
-    int16_t *query_pos_array = (int16_t *)_mm_malloc(numReads * sizeof(int16_t), 64);
+    int32_t *query_pos_array = (int32_t *)_mm_malloc(numReads * sizeof(int32_t), 64);
     
     int32_t i;
     for(i = 0; i < numReads; i++)
@@ -705,18 +1586,18 @@ void FMI_search::getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                 tail++;             
             }               
         }
-        getSMEMsOnePosOneThread(enc_qdb,
-                                query_pos_array,
-                                min_intv_array,
-                                rid_array,
-                                tail,
-                                batch_size,
-                                seq_,
-                                query_cum_len_ar,
-                                max_readlength,
-                                minSeedLen,
-                                matchArray,
-                                __numTotalSmem);
+        getSMEMsBatchOneThread(enc_qdb,
+                               query_pos_array,
+                               min_intv_array,
+                               rid_array,
+                               tail,
+                               seq_,
+                               query_cum_len_ar,
+                               max_readlength,
+                               minSeedLen,
+                               matchArray,
+                               __numTotalSmem,
+                               scratch);
         numActive = tail;
     } while(numActive > 0);
 
@@ -738,7 +1619,7 @@ int64_t FMI_search::bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
     for(i = 0; i < numReads; i++)
     {
         int readlength = seq_[i].l_seq;
-        int16_t x = 0;
+        int32_t x = 0;
         while(x < readlength)
         {
             int next_x = x + 1;
@@ -758,6 +1639,7 @@ int64_t FMI_search::bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
                 smem.k = count[a];
                 smem.l = count[3 - a];
                 smem.s = count[a+1] - count[a];
+                int32_t kmer_code = a;
 
 
                 int j;
@@ -766,7 +1648,27 @@ int64_t FMI_search::bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
                     next_x = j + 1;
                     // a = enc_qdb[i * readlength + j];
                     a = enc_qdb[offset + j];
-                    if(a < 4)
+                    if(a < 4 && j - x < kmer_k)
+                    {
+                        // The interval of the first j - x + 1 bases is in the
+                        // k-mer table.
+                        kmer_code = kmer_code * 4 + a;
+                        const KMER_INTV *intv = &kmer_table[KMER_OFFSET(j - x + 1) + kmer_code];
+                        smem.k = intv->k;
+                        smem.l = intv->l;
+                        smem.s = intv->s;
+                        smem.n = j;
+
+                        if((smem.s < max_intv_array[i]) && ((smem.n - smem.m + 1) >= minSeedLen))
+                        {
+                            if(smem.s > 0)
+                            {
+                                matchArray[numTotalSeed++] = smem;
+                            }
+                            break;
+                        }
+                    }
+                    else if(a < 4)
                     {
                         SMEM smem_ = smem;
 
@@ -782,8 +1684,8 @@ int64_t FMI_search::bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
                         newSmem.n = j;
                         smem = newSmem;
 #ifdef ENABLE_PREFETCH
-                        _mm_prefetch((const char *)(&cp_occ[(smem.k) >> CP_SHIFT]), _MM_HINT_T0);
-                        _mm_prefetch((const char *)(&cp_occ[(smem.l) >> CP_SHIFT]), _MM_HINT_T0);
+                        prefetch_occ(smem.k);
+                        prefetch_occ(smem.l);
 #endif
 
 
@@ -1005,11 +1907,112 @@ int compare_smem(const void *a, const void *b)
     return 0;
 }
 
+// Number of bits needed to store @x.
+static inline int smem_key_bits(uint64_t x)
+{
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+#define SMEM_RADIX_BITS 8
+#define SMEM_RADIX_SIZE (1 << SMEM_RADIX_BITS)
+
+// Sort @n SMEMs in the order of compare_smem() with a stable LSD radix sort.
+// Each SMEM gets a 64-bit key (rid, m, ~n) followed by its index, so a pass
+// only streams 8 bytes per SMEM. The digit counts of all passes come from one
+// read of the keys, and passes where every key has the same digit are
+// skipped. The SMEMs are permuted in place once at the end. @keys holds
+// SMEM_SORT_KEYS(n) keys. Falls back to qsort when the key does not fit in
+// 64 bits.
+static void radix_sort_smems(SMEM *a, int64_t n, uint64_t *keys)
+{
+    if(n < 2)
+        return;
+
+    uint32_t min_rid = a[0].rid, max_rid = a[0].rid, max_pos = 0;
+    int64_t i;
+    for(i = 0; i < n; i++)
+    {
+        if(a[i].rid < min_rid) min_rid = a[i].rid;
+        if(a[i].rid > max_rid) max_rid = a[i].rid;
+        if(a[i].n > max_pos) max_pos = a[i].n;
+    }
+    int idx_bits = smem_key_bits(n - 1);
+    int pos_bits = smem_key_bits(max_pos);
+    int key_bits = smem_key_bits(max_rid - min_rid) + 2 * pos_bits;
+    if(idx_bits + key_bits > 64)
+    {
+        qsort(a, n, sizeof(SMEM), compare_smem);
+        return;
+    }
+
+    uint64_t *tmp = keys + n;
+    uint64_t pos_mask = (1ULL << pos_bits) - 1;
+    for(i = 0; i < n; i++)
+    {
+        uint64_t key = ((uint64_t)(a[i].rid - min_rid) << (2 * pos_bits)) |
+                       ((uint64_t)a[i].m << pos_bits) |
+                       (pos_mask - a[i].n);
+        keys[i] = (key << idx_bits) | i;
+    }
+
+    int passes = (key_bits + SMEM_RADIX_BITS - 1) / SMEM_RADIX_BITS;
+    int64_t count[64 / SMEM_RADIX_BITS][SMEM_RADIX_SIZE];
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < n; i++)
+    {
+        uint64_t key = keys[i] >> idx_bits;
+        for(int p = 0; p < passes; p++)
+            count[p][(key >> (p * SMEM_RADIX_BITS)) & (SMEM_RADIX_SIZE - 1)]++;
+    }
+
+    for(int p = 0; p < passes; p++)
+    {
+        int shift = idx_bits + p * SMEM_RADIX_BITS;
+        int64_t *c = count[p];
+        if(c[(keys[0] >> shift) & (SMEM_RADIX_SIZE - 1)] == n)
+            continue;
+        int64_t sum = 0;
+        for(int d = 0; d < SMEM_RADIX_SIZE; d++)
+        {
+            int64_t t = c[d];
+            c[d] = sum;
+            sum += t;
+        }
+        for(i = 0; i < n; i++)
+            tmp[c[(keys[i] >> shift) & (SMEM_RADIX_SIZE - 1)]++] = keys[i];
+        uint64_t *swap = keys; keys = tmp; tmp = swap;
+    }
+
+    // Follow the cycles of the permutation: SMEM i comes from src[i], and
+    // src[i] = i once it is in place.
+    uint64_t *src = keys;
+    uint64_t idx_mask = (1ULL << idx_bits) - 1;
+    for(i = 0; i < n; i++)
+        src[i] &= idx_mask;
+    for(i = 0; i < n; i++)
+    {
+        if(src[i] == (uint64_t)i)
+            continue;
+        SMEM first = a[i];
+        int64_t j = i;
+        while(src[j] != (uint64_t)i)
+        {
+            int64_t k = src[j];
+            a[j] = a[k];
+            src[j] = j;
+            j = k;
+        }
+        a[j] = first;
+        src[j] = j;
+    }
+}
+
 void FMI_search::sortSMEMs(SMEM *matchArray,
         int64_t numTotalSmem[],
         int32_t numReads,
         int32_t readlength,
-        int nthreads)
+        int nthreads,
+        uint64_t *sortKeys)
 {
     int tid;
     int32_t perThreadQuota = (numReads + (nthreads - 1)) / nthreads;
@@ -1017,7 +2020,12 @@ void FMI_search::sortSMEMs(SMEM *matchArray,
     {
         int32_t first = tid * perThreadQuota;
         SMEM *myMatchArray = matchArray + first * readlength;
-        qsort(myMatchArray, numTotalSmem[tid], sizeof(SMEM), compare_smem);
+        uint64_t *keys = sortKeys;
+        if(keys == NULL)
+            keys = (uint64_t *)_mm_malloc(SMEM_SORT_KEYS(numTotalSmem[tid]) * sizeof(uint64_t), 64);
+        radix_sort_smems(myMatchArray, numTotalSmem[tid], keys);
+        if(keys != sortKeys)
+            _mm_free(keys);
     }
 }
 
@@ -1028,6 +2036,18 @@ SMEM FMI_search::backwardExt(SMEM smem, uint8_t a)
     uint8_t b;
 
     int64_t k[4], l[4], s[4];
+    if(cp_occ2)
+    {
+        int64_t occ_sp[4], occ_ep[4];
+        get_occ2(smem.k, occ_sp);
+        get_occ2(smem.k + smem.s, occ_ep);
+        for(b = 0; b < 4; b++)
+        {
+            k[b] = count[b] + occ_sp[b];
+            s[b] = occ_ep[b] - occ_sp[b];
+        }
+    }
+    else
     for(b = 0; b < 4; b++)
     {
         int64_t sp = (int64_t)(smem.k);
@@ -1099,26 +2119,37 @@ void FMI_search::get_sa_entries(SMEM *smemArray, int64_t *coordArray, int32_t *c
     }
 }
 
+/**
+ * Reference position of the sampled SA row @pos.
+ */
+inline int64_t FMI_search::get_sa_sample(int64_t pos)
+{
+    int64_t sa_entry = sa_ms_byte[pos >> sa_shift];
+    sa_entry = sa_entry << 32;
+    sa_entry = sa_entry + sa_ls_word[pos >> sa_shift];
+    return sa_entry;
+}
+
+/**
+ * Prefetch what the next step of the walk from the SA row @pos reads: its
+ * SA entry if sampled, its occurrences otherwise.
+ */
+inline void FMI_search::prefetch_sa_row(int64_t pos)
+{
+    if ((pos & sa_mask) == 0) {
+        _mm_prefetch((const char *)&sa_ms_byte[pos >> sa_shift], _MM_HINT_T0);
+        _mm_prefetch((const char *)&sa_ls_word[pos >> sa_shift], _MM_HINT_T0);
+    }
+    else {
+        prefetch_occ(pos);
+    }
+}
+
 // sa_compression
 int64_t FMI_search::get_sa_entry_compressed(int64_t pos, int tid)
 {
-    if ((pos & SA_COMPX_MASK) == 0) {
-        
-        #if  SA_COMPRESSION
-        int64_t sa_entry = sa_ms_byte[pos >> SA_COMPX];
-        #else
-        int64_t sa_entry = sa_ms_byte[pos];     // simulation
-        #endif
-        
-        sa_entry = sa_entry << 32;
-        
-        #if  SA_COMPRESSION
-        sa_entry = sa_entry + sa_ls_word[pos >> SA_COMPX];
-        #else
-        sa_entry = sa_entry + sa_ls_word[pos];   // simulation
-        #endif
-        
-        return sa_entry;        
+    if ((pos & sa_mask) == 0) {
+        return get_sa_sample(pos);
     }
     else {
         // tprof[MEM_CHAIN][tid] ++;
@@ -1126,51 +2157,19 @@ int64_t FMI_search::get_sa_entry_compressed(int64_t pos, int tid)
         int64_t sp = pos;
         while(true)
         {
-            int64_t occ_id_pp_ = sp >> CP_SHIFT;
-            int64_t y_pp_ = CP_BLOCK_SIZE - (sp & CP_MASK) - 1; 
-            uint64_t *one_hot_bwt_str = cp_occ[occ_id_pp_].one_hot_bwt_str;
-            uint8_t b;
-
-            if((one_hot_bwt_str[0] >> y_pp_) & 1)
-                b = 0;
-            else if((one_hot_bwt_str[1] >> y_pp_) & 1)
-                b = 1;
-            else if((one_hot_bwt_str[2] >> y_pp_) & 1)
-                b = 2;
-            else if((one_hot_bwt_str[3] >> y_pp_) & 1)
-                b = 3;
-            else
-                b = 4;
+            uint8_t b = get_bwt_char(sp);
 
             if (b == 4) {
                 return offset;
             }
 
-            GET_OCC(sp, b, occ_id_sp, y_sp, occ_sp, one_hot_bwt_str_c_sp, match_mask_sp);
-
-            sp = count[b] + occ_sp;
+            sp = count[b] + get_occ(sp, b);
             
             offset ++;
             // tprof[ALIGN1][tid] ++;
-            if ((sp & SA_COMPX_MASK) == 0) break;
+            if ((sp & sa_mask) == 0) break;
         }
-        // assert((reference_seq_len >> SA_COMPX) - 1 >= (sp >> SA_COMPX));
-        #if  SA_COMPRESSION
-        int64_t sa_entry = sa_ms_byte[sp >> SA_COMPX];
-        #else
-        int64_t sa_entry = sa_ms_byte[sp];      // simultion
-        #endif
-        
-        sa_entry = sa_entry << 32;
-
-        #if  SA_COMPRESSION
-        sa_entry = sa_entry + sa_ls_word[sp >> SA_COMPX];
-        #else
-        sa_entry = sa_entry + sa_ls_word[sp];      // simulation
-        #endif
-        
-        sa_entry += offset;
-        return sa_entry;
+        return get_sa_sample(sp) + offset;
     }
 }
 
@@ -1201,10 +2200,8 @@ void FMI_search::get_sa_entries(SMEM *smemArray, int64_t *coordArray, int32_t *c
 // SA_COPMRESSION w/ PREFETCH
 int64_t FMI_search::call_one_step(int64_t pos, int64_t &sa_entry, int64_t &offset)
 {
-    if ((pos & SA_COMPX_MASK) == 0) {        
-        sa_entry = sa_ms_byte[pos >> SA_COMPX];        
-        sa_entry = sa_entry << 32;        
-        sa_entry = sa_entry + sa_ls_word[pos >> SA_COMPX];        
+    if ((pos & sa_mask) == 0) {        
+        sa_entry = get_sa_sample(pos) + offset;
         // return sa_entry;
         return 1;
     }
@@ -1212,36 +2209,18 @@ int64_t FMI_search::call_one_step(int64_t pos, int64_t &sa_entry, int64_t &offse
         // int64_t offset = 0; 
         int64_t sp = pos;
 
-        int64_t occ_id_pp_ = sp >> CP_SHIFT;
-        int64_t y_pp_ = CP_BLOCK_SIZE - (sp & CP_MASK) - 1; 
-        uint64_t *one_hot_bwt_str = cp_occ[occ_id_pp_].one_hot_bwt_str;
-        uint8_t b;
-
-        if((one_hot_bwt_str[0] >> y_pp_) & 1)
-            b = 0;
-        else if((one_hot_bwt_str[1] >> y_pp_) & 1)
-            b = 1;
-        else if((one_hot_bwt_str[2] >> y_pp_) & 1)
-            b = 2;
-        else if((one_hot_bwt_str[3] >> y_pp_) & 1)
-            b = 3;
-        else
-            b = 4;
+        uint8_t b = get_bwt_char(sp);
         if (b == 4) {
-            sa_entry = 0;
+            sa_entry = offset;
             return 1;
         }
         
-        GET_OCC(sp, b, occ_id_sp, y_sp, occ_sp, one_hot_bwt_str_c_sp, match_mask_sp);
-        
-        sp = count[b] + occ_sp;
+        sp = count[b] + get_occ(sp, b);
         
         offset ++;
-        if ((sp & SA_COMPX_MASK) == 0) {
+        if ((sp & sa_mask) == 0) {
     
-            sa_entry = sa_ms_byte[sp >> SA_COMPX];        
-            sa_entry = sa_entry << 32;
-            sa_entry = sa_entry + sa_ls_word[sp >> SA_COMPX];
+            sa_entry = get_sa_sample(sp);
             
             sa_entry += offset;
             // return sa_entry;
@@ -1258,118 +2237,114 @@ void FMI_search::get_sa_entries_prefetch(SMEM *smemArray, int64_t *coordArray,
                                          int64_t *coordCountArray, int64_t count,
                                          const int32_t max_occ, int tid, int64_t &id_)
 {
-    
-    // uint32_t i;
-    int32_t totalCoordCount = 0;
-    int32_t mem_lim = 0, id = 0;
-    
-    for(int i = 0; i < count; i++)
+    int64_t id = smem_sa_count(smemArray, count, max_occ);
+    int64_t *pos_ar = (int64_t *) _mm_malloc( id * sizeof(int64_t), 64);
+    smem_sa_rows(smemArray, count, max_occ, pos_ar);
+    *coordCountArray += id;
+    id_ += id;
+
+    locate(pos_ar, coordArray, id);
+
+    _mm_free(pos_ar);
+}
+
+int64_t FMI_search::smem_sa_count(const SMEM *smems, int64_t n, int32_t max_occ)
+{
+    int64_t total = 0;
+    int64_t i;
+    for (i = 0; i < n; i++)
     {
-        int32_t c = 0;
-        SMEM smem = smemArray[i];
-        mem_lim += smem.s;
+        total += smems[i].s < max_occ ? smems[i].s : max_occ;
     }
+    return total;
+}
 
-    int64_t *pos_ar = (int64_t *) _mm_malloc( mem_lim * sizeof(int64_t), 64);
-    int64_t *map_ar = (int64_t *) _mm_malloc( mem_lim * sizeof(int64_t), 64);
-
-    for(int i = 0; i < count; i++)
+int64_t FMI_search::smem_sa_rows(const SMEM *smems, int64_t n, int32_t max_occ, int64_t *sa_pos)
+{
+    int64_t id = 0;
+    int64_t i;
+    for (i = 0; i < n; i++)
     {
+        const SMEM *smem = &smems[i];
+        int64_t hi = smem->k + smem->s;
+        int64_t step = (smem->s > max_occ) ? smem->s / max_occ : 1;
         int32_t c = 0;
-        SMEM smem = smemArray[i];
-        int64_t hi = smem.k + smem.s;
-        int64_t step = (smem.s > max_occ) ? smem.s / max_occ : 1;
         int64_t j;
-        for(j = smem.k; (j < hi) && (c < max_occ); j+=step, c++)
+        for (j = smem->k; (j < hi) && (c < max_occ); j += step, c++)
         {
-            int64_t pos = j;
-             pos_ar[id]  = pos;
-             map_ar[id++] = totalCoordCount + c;
-            // int64_t sa_entry = get_sa_entry_compressed(pos, tid);
-            // coordArray[totalCoordCount + c] = sa_entry;
+            sa_pos[id++] = j;
         }
-        //coordCountArray[i] = c;
-        *coordCountArray += c;
-        totalCoordCount += c;
     }
-    
-    id_ += id;
-    
-    const int32_t sa_batch_size = 20;
-    int64_t working_set[sa_batch_size], map_pos[sa_batch_size];;
-    int64_t offset[sa_batch_size] = {-1};
-    
-    int i = 0, j = 0;    
-    while(i<id && j<sa_batch_size)
+    return id;
+}
+
+typedef struct
+{
+    int64_t sp;     // Current row of the walk.
+    int64_t offset; // LF steps from the first row.
+    int64_t id;     // Index of the first row in sa_pos.
+} locate_lane_t;
+
+void FMI_search::locate(const int64_t *sa_pos, int64_t *ref_pos, int64_t n, int lanes)
+{
+    locate_lane_t lane[LOCATE_MAX_LANES];
+    if (lanes < 1)
+        lanes = 1;
+    if (lanes > LOCATE_MAX_LANES)
+        lanes = LOCATE_MAX_LANES;
+    if (lanes > n)
+        lanes = n;
+
+    int64_t next = 0;
+    int l;
+    for (l = 0; l < lanes; l++)
     {
-        int64_t pos =  pos_ar[i];
-        working_set[j] = pos;
-        map_pos[j] = map_ar[i];
-        offset[j] = 0;
-        
-        if (pos & SA_COMPX_MASK == 0) {
-            _mm_prefetch(&sa_ms_byte[pos >> SA_COMPX], _MM_HINT_T0);
-            _mm_prefetch(&sa_ls_word[pos >> SA_COMPX], _MM_HINT_T0);
-        }
-        else {
-            int64_t occ_id_pp_ = pos >> CP_SHIFT;
-            _mm_prefetch(&cp_occ[occ_id_pp_], _MM_HINT_T0);
-        }
-        i++;
-        j++;
+        lane[l].sp = sa_pos[next];
+        lane[l].offset = 0;
+        lane[l].id = next++;
+        prefetch_sa_row(lane[l].sp);
     }
-        
-    int lim = j, all_quit = 0;
-    while (all_quit < id)
+
+    // Every lane takes one step in turn, its next row was prefetched on its
+    // previous step. The rows of an SMEM are consecutive, so the walks that
+    // start together mostly share their first cp_occ lines.
+    while (lanes > 0)
     {
-        
-        for (int k=0; k<lim; k++)
+        for (l = 0; l < lanes; l++)
         {
-            int64_t sp = 0, pos = 0;
-            bool quit;
-            if (offset[k] >= 0) {
-                quit = call_one_step(working_set[k], sp, offset[k]);
+            locate_lane_t *w = &lane[l];
+            int64_t sp = w->sp;
+            if ((sp & sa_mask) == 0)
+            {
+                ref_pos[w->id] = get_sa_sample(sp) + w->offset;
             }
             else
-                continue;
-            
-            if (quit) {
-                coordArray[map_pos[k]] = sp;
-                all_quit ++;
-                
-                if (i < id)
+            {
+                uint8_t b = get_bwt_char(sp);
+                if (b != 4)
                 {
-                    pos = pos_ar[i];
-                    working_set[k] = pos;
-                    map_pos[k] = map_ar[i++];
-                    offset[k] = 0;
-                    
-                    if (pos & SA_COMPX_MASK == 0) {
-                        _mm_prefetch(&sa_ms_byte[pos >> SA_COMPX], _MM_HINT_T0);
-                        _mm_prefetch(&sa_ls_word[pos >> SA_COMPX], _MM_HINT_T0);
-                    }
-                    else {
-                        int64_t occ_id_pp_ = pos >> CP_SHIFT;
-                        _mm_prefetch(&cp_occ[occ_id_pp_], _MM_HINT_T0);
-                    }
+                    w->sp = count[b] + get_occ(sp, b);
+                    w->offset++;
+                    prefetch_sa_row(w->sp);
+                    continue;
                 }
-                else
-                    offset[k] = -1;
+                // The row of the sentinel is the start of the reference.
+                ref_pos[w->id] = w->offset;
             }
-            else {
-                working_set[k] = sp;
-                if (sp & SA_COMPX_MASK == 0) {
-                    _mm_prefetch(&sa_ms_byte[sp >> SA_COMPX], _MM_HINT_T0);
-                    _mm_prefetch(&sa_ls_word[sp >> SA_COMPX], _MM_HINT_T0);
-                }
-                else {
-                    int64_t occ_id_pp_ = sp >> CP_SHIFT;
-                    _mm_prefetch(&cp_occ[occ_id_pp_], _MM_HINT_T0);
-                }                
+
+            if (next < n)
+            {
+                w->sp = sa_pos[next];
+                w->offset = 0;
+                w->id = next++;
+                prefetch_sa_row(w->sp);
+            }
+            else
+            {
+                // No more rows, keep the lanes that are still walking first.
+                *w = lane[--lanes];
+                l--;
             }
         }
     }
-    
-    _mm_free(pos_ar);
-    _mm_free(map_ar);
 }
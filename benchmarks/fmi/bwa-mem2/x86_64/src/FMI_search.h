@@ -48,9 +48,58 @@ Authors: Sanchit Misra <sanchit.misra@intel.com>; Vasimuddin Md <vasimuddin.md@i
 
 #define CP_BLOCK_SIZE 64
 #define CP_FILENAME_SUFFIX ".bwt.2bit.64"
+// First word of the index files whose sections start at multiples of
+// CP_FILE_ALIGN bytes ("BWA2IDX\1"). Older files start with the reference
+// length and pack the sections back to back, so cp_occ is not aligned.
+#define CP_FILE_MAGIC 0x0158444932415742L
+#define CP_FILE_ALIGN 64
 #define CP_MASK 63
 #define CP_SHIFT 6
 
+// Compressed occurrence table, built with "bwa-mem2 index -b <block size>"
+// into the file with suffix CP2_FILENAME_SUFFIX "<block size>". Every
+// checkpoint covers 2^cp2_shift BWT symbols (CP2_MIN_SHIFT to CP2_MAX_SHIFT)
+// with CP2_COUNT_WORDS words of 32-bit counts, relative to the superblock of
+// 2^CP2_SUPER_SHIFT symbols that contains the checkpoint, followed by the
+// symbols packed in 2 bits, 32 per word (the sentinel is packed as an A).
+// The file has the same header and SA sections as the CP_FILENAME_SUFFIX
+// one, with the checkpoints and the int64_t[4] counts of the superblocks in
+// place of cp_occ.
+#define CP2_FILENAME_SUFFIX ".bwt.2bit."
+#define CP2_FILE_MAGIC 0x0258444932415742L
+#define CP2_MIN_SHIFT 7
+#define CP2_MAX_SHIFT 8
+#define CP2_SUPER_SHIFT 31
+#define CP2_COUNT_WORDS 2
+
+// Suffix array sampling, set with "bwa-mem2 index -s <rate>": the index
+// keeps the SA entry of one row every 2^shift (0 to SA_MAX_SHIFT), and the
+// others are found by LF steps from the row up to the next sampled one. The
+// upper 4 bits of the magic of the index files are the shift plus 1, or 0
+// for SA_COMPX (the files built before the option have 0).
+#define CP_FILE_MAGIC_MASK 0x0fffffffffffffffL
+#define CP_FILE_SA_SHIFT_BIT 60
+#define SA_MAX_SHIFT 7
+
+// Table of the SA bi-intervals of all the k-mers of 1 to kmer_k bases, built
+// with "bwa-mem2 index -k <k>" into the file with suffix KMER_FILENAME_SUFFIX.
+// The k-mers of length len start at entry KMER_OFFSET(len), in the order of
+// their 2-bit codes (first base in the most significant bits). The forward
+// extension of the SMEM search reads the interval of the first kmer_k bases
+// there instead of computing it base by base. The file starts with
+// KMER_FILE_MAGIC, kmer_k, the reference length and the 5 counts of the
+// index, 64 bytes in all.
+#define KMER_FILENAME_SUFFIX ".bwt.kmer"
+#define KMER_FILE_MAGIC 0x0358444932415742L
+#define KMER_MIN_K 2
+#define KMER_MAX_K 14
+#define KMER_OFFSET(len) (((1L << (2 * (len))) - 4) / 3)
+
+typedef struct kmer_intv
+{
+    int64_t k, l, s;
+}KMER_INTV;
+
 typedef struct checkpoint_occ_scalar
 {
     int64_t cp_count[4];
@@ -84,6 +133,52 @@ typedef struct smem_struct
 
 #define SAL_PFD 16
 
+// Number of suffix array walks in flight in FMI_search::locate(): every
+// walk advances one LF step in turn, so the occurrence table misses of the
+// walks overlap. A finished walk is replaced by the next row.
+#define LOCATE_LANES 128
+#define LOCATE_MAX_LANES 1024
+
+// Number of reads whose SMEMs are searched in lockstep by one thread: every
+// read advances one extension step in turn, so the cp_occ misses of the
+// reads overlap. Finished reads are replaced by new ones, and retired in
+// order from a window of SMEM_WINDOW reads.
+#define SMEM_BATCH 8
+#define SMEM_WINDOW (2 * SMEM_BATCH)
+
+// SMEMs of the scratch of getSMEMsOnePosOneThread() and
+// getSMEMsAllPosOneThread() for reads of at most @max_readlength bases.
+#define SMEM_SCRATCH_SIZE(max_readlength) (2 * SMEM_WINDOW * ((int64_t)(max_readlength) + 1))
+
+// Keys of the scratch of sortSMEMs() for @n SMEMs per thread.
+#define SMEM_SORT_KEYS(n) (2 * (int64_t)(n))
+
+#define SMEM_FORWARD 0
+#define SMEM_BACKWARD 1
+#define SMEM_DONE 2
+
+typedef struct smem_lane
+{
+    int32_t rid;
+    int32_t x, next_x, j;
+    int32_t readlength, offset;
+    int32_t min_intv;
+    int32_t kmer_code; // Code of the bases [x, j) in the k-mer table.
+    int32_t numPrev, numOut;
+    int32_t phase;
+    SMEM smem;
+    SMEM *prev;  // SMEMs being extended backward.
+    SMEM *out;   // SMEMs found, max_readlength + 1 entries each.
+}SMEM_LANE;
+
+// Flags of FMI_search::load_index().
+#define FMI_LOAD_MMAP 0x1     // Map the index file instead of reading it.
+#define FMI_LOAD_POPULATE 0x2 // Prefault the whole mapping (MAP_POPULATE).
+#define FMI_LOAD_HUGEPAGE 0x4 // Ask for transparent huge pages (madvise).
+#define FMI_LOAD_NO_KMER 0x8  // Ignore the k-mer table (KMER_FILENAME_SUFFIX).
+
+#define FMI_MAX_NUMA_NODES 64
+
 class FMI_search: public indexEle
 {
     public:
@@ -91,8 +186,24 @@ class FMI_search: public indexEle
     ~FMI_search();
     //int64_t beCalls;
     
-    int build_index();
-    void load_index();
+    // @cp_block_size is CP_BLOCK_SIZE for the cp_occ table, or 128 or 256 for
+    // the compressed one. @sa_rate is the SA sampling rate, a power of 2 up
+    // to 2^SA_MAX_SHIFT, or 0 for 2^SA_COMPX.
+    int build_index(int cp_block_size = CP_BLOCK_SIZE, int sa_rate = 0);
+    // Load the index file given by @cp_block_size, or if 0, the first one
+    // found among CP_FILENAME_SUFFIX and the compressed block sizes.
+    void load_index(int flags = 0, int cp_block_size = 0);
+    // Build the k-mer table of the loaded index for k-mers of up to @kmer_k
+    // bases and write it next to the index file.
+    int build_kmer_table(int kmer_k);
+
+    // Copy cp_occ (and the suffix array if @replicate_sa) to the memory of
+    // every NUMA node that runs one of @num_threads OpenMP threads. Threads
+    // must be bound (OMP_PROC_BIND) for the copies to stay local. Returns the
+    // number of copies, including the original one.
+    int replicate_numa(int num_threads, bool replicate_sa);
+    // The copy of the index on the NUMA node of the calling thread.
+    FMI_search *local_replica();
 
     void getSMEMs(uint8_t *enc_qdb,
                   int32_t numReads,
@@ -104,7 +215,7 @@ class FMI_search: public indexEle
                   int64_t *numTotalSmem);
     
     void getSMEMsOnePosOneThread(uint8_t *enc_qdb,
-                                 int16_t *query_pos_array,
+                                 int32_t *query_pos_array,
                                  int32_t *min_intv_array,
                                  int32_t *rid_array,
                                  int32_t numReads,
@@ -114,7 +225,8 @@ class FMI_search: public indexEle
                                  int32_t  max_readlength,
                                  int32_t minSeedLen,
                                  SMEM *matchArray,
-                                 int64_t *__numTotalSmem);
+                                 int64_t *__numTotalSmem,
+                                 SMEM *scratch);
     
     void getSMEMsAllPosOneThread(uint8_t *enc_qdb,
                                  int32_t *min_intv_array,
@@ -126,7 +238,8 @@ class FMI_search: public indexEle
                                  int32_t max_readlength,
                                  int32_t minSeedLen,
                                  SMEM *matchArray,
-                                 int64_t *__numTotalSmem);
+                                 int64_t *__numTotalSmem,
+                                 SMEM *scratch);
         
     
     int64_t bwtSeedStrategyAllPosOneThread(uint8_t *enc_qdb,
@@ -137,11 +250,14 @@ class FMI_search: public indexEle
                                            int32_t minSeedLen,
                                            SMEM *matchArray);
         
+    // Sort the SMEMs of every thread. @sortKeys holds SMEM_SORT_KEYS() keys
+    // for the SMEMs of a thread, they are allocated for the call when NULL.
     void sortSMEMs(SMEM *matchArray,
                    int64_t numTotalSmem[],
                    int32_t numReads,
                    int32_t readlength,
-                   int nthreads);
+                   int nthreads,
+                   uint64_t *sortKeys = NULL);
     int64_t get_sa_entry(int64_t pos);
     void get_sa_entries(int64_t *posArray,
                         int64_t *coordArray,
@@ -163,6 +279,20 @@ class FMI_search: public indexEle
     void get_sa_entries_prefetch(SMEM *smemArray, int64_t *coordArray,
                                  int64_t *coordCountArray, int64_t count,
                                  const int32_t max_occ, int tid, int64_t &id_);
+
+    // Batched locate: the reference positions of the SA rows @sa_pos[0..n)
+    // into @ref_pos, the same as get_sa_entry_compressed() row by row, with
+    // @lanes walks in flight (up to LOCATE_MAX_LANES).
+    void locate(const int64_t *sa_pos, int64_t *ref_pos, int64_t n,
+                int lanes = LOCATE_LANES);
+    // Number of SA rows of @n SMEMs, at most @max_occ per SMEM.
+    static int64_t smem_sa_count(const SMEM *smems, int64_t n, int32_t max_occ);
+    // The SA rows of @n SMEMs into @sa_pos, at most @max_occ per SMEM evenly
+    // spaced in its interval (as get_sa_entries()). Returns their number.
+    static int64_t smem_sa_rows(const SMEM *smems, int64_t n, int32_t max_occ,
+                                int64_t *sa_pos);
+    // SA sampling rate of the loaded index.
+    int sa_rate() { return 1 << sa_shift; }
     
     int64_t reference_seq_len;
     int64_t sentinel_index;
@@ -172,10 +302,37 @@ private:
         int64_t count[5];
         uint32_t *sa_ls_word;
         int8_t *sa_ms_byte;
+        // Rows whose SA entry is stored are multiples of sa_mask + 1, the
+        // entry of row r is at r >> sa_shift.
+        int sa_shift;
+        int64_t sa_mask;
         CP_OCC *cp_occ;
+        // Compressed occurrence table, used instead of cp_occ if not NULL.
+        uint64_t *cp_occ2;
+        int64_t (*cp_occ2_super)[4];
+        int cp2_shift;
+        int cp2_words;
 
         uint64_t *one_hot_mask_array;
 
+        // k-mer table (KMER_FILENAME_SUFFIX), or NULL if not loaded.
+        KMER_INTV *kmer_table;
+        int kmer_k;
+        size_t kmer_map_size; // Size of the mapping of the file, if mapped.
+        void load_kmer_table(int flags);
+
+        // Mapping of the index file (FMI_LOAD_MMAP), shared with the other
+        // processes that map the same file.
+        char *index_map;
+        size_t index_map_size;
+        bool is_mapped(const void *ptr);
+
+        // Copies of the index per NUMA node (replicate_numa()). A replica
+        // shares everything but the replicated arrays with its home.
+        FMI_search *numa_replicas[FMI_MAX_NUMA_NODES];
+        FMI_search *home;
+        FMI_search(FMI_search *home, int node, bool replicate_sa);
+
         int64_t pac_seq_len(const char *fn_pac);
         void pac2nt(const char *fn_pac,
                     std::string &reference_seq);
@@ -183,8 +340,39 @@ private:
                                char *binary_seq,
                                int64_t ref_seq_len,
                                int64_t *sa_bwt,
-                               int64_t *count);
+                               int64_t *count,
+                               int cp_block_size,
+                               int sa_shift);
+        void write_cp_occ2(std::fstream &outstream,
+                           const uint8_t *bwt,
+                           int64_t ref_seq_len,
+                           int shift);
         SMEM backwardExt(SMEM smem, uint8_t a);
+        inline void get_occ2(int64_t pos, int64_t occ[4]);
+        inline int64_t get_occ(int64_t pos, uint8_t c);
+        inline uint8_t get_bwt_char(int64_t pos);
+        inline void prefetch_occ(int64_t pos);
+        inline int64_t get_sa_sample(int64_t pos);
+        inline void prefetch_sa_row(int64_t pos);
+
+        void getSMEMsBatchOneThread(uint8_t *enc_qdb,
+                                    int32_t *query_pos_array,
+                                    int32_t *min_intv_array,
+                                    int32_t *rid_array,
+                                    int32_t numReads,
+                                    const bseq1_t *seq_,
+                                    int32_t *query_cum_len_ar,
+                                    int32_t max_readlength,
+                                    int32_t minSeedLen,
+                                    SMEM *matchArray,
+                                    int64_t *__numTotalSmem,
+                                    SMEM *scratch);
+        void smemStart(SMEM_LANE *lane, const uint8_t *enc_qdb);
+        void smemForwardStep(SMEM_LANE *lane, const uint8_t *enc_qdb);
+        void smemForwardEnd(SMEM_LANE *lane);
+        void smemBackwardStep(SMEM_LANE *lane, const uint8_t *enc_qdb,
+                              int32_t minSeedLen);
+        void smemBackwardEnd(SMEM_LANE *lane, int32_t minSeedLen);
 };
 
 #endif
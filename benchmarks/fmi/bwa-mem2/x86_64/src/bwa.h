@@ -90,7 +90,8 @@ extern "C" {
 							 int64_t rb, int64_t re, int *score,
 							 int *n_cigar, int *NM);
 
-	int bwa_idx_build(const char *fa, const char *prefix);
+	int bwa_idx_build(const char *fa, const char *prefix, int cp_block_size = 64, int kmer_k = 0,
+					  int sa_rate = 0);
 
 	char *bwa_idx_infer_prefix(const char *hint);
 	bwt_t *bwa_idx_load_bwt(const char *hint);
@@ -44,21 +44,46 @@ int bwa_index(int argc, char *argv[]) // the "index" command
 {
 	int c;
 	char *prefix = 0;
-	while ((c = getopt(argc, argv, "p:")) >= 0) {
+	int cp_block_size = CP_BLOCK_SIZE;
+	int kmer_k = 0;
+	int sa_rate = 0;
+	while ((c = getopt(argc, argv, "p:b:k:s:")) >= 0) {
 		if (c == 'p') prefix = optarg;
+		else if (c == 'b') cp_block_size = atoi(optarg);
+		else if (c == 'k') kmer_k = atoi(optarg);
+		else if (c == 's') sa_rate = atoi(optarg);
 		else return 1;
 	}
 
 	if (optind + 1 > argc) {
-		fprintf(stderr, "Usage: bwa-mem2 index [-p prefix] <in.fasta>\n");
+		fprintf(stderr, "Usage: bwa-mem2 index [-p prefix] [-b 64|128|256] [-k %d-%d] [-s rate] <in.fasta>\n", KMER_MIN_K, KMER_MAX_K);
+		fprintf(stderr, "  -b  BWT symbols per checkpoint of the occurrence table [%d].\n", CP_BLOCK_SIZE);
+		fprintf(stderr, "      128 and 256 build a compressed table (%s<size>).\n", CP2_FILENAME_SUFFIX);
+		fprintf(stderr, "  -k  also build the table of the SA intervals of the k-mers of up to\n");
+		fprintf(stderr, "      <k> bases (%s, 24 * 4^k * 4/3 bytes) [none].\n", KMER_FILENAME_SUFFIX);
+		fprintf(stderr, "  -s  keep the suffix array entry of one row every <rate>, a power of 2\n");
+		fprintf(stderr, "      up to %d (5 bytes * length / rate) [%d].\n", 1 << SA_MAX_SHIFT, 1 << SA_COMPX);
+		return 1;
+	}
+	if (cp_block_size != CP_BLOCK_SIZE && cp_block_size != (1 << CP2_MIN_SHIFT) &&
+		cp_block_size != (1 << CP2_MAX_SHIFT)) {
+		fprintf(stderr, "[E::%s] unsupported checkpoint block size %d\n", __func__, cp_block_size);
+		return 1;
+	}
+	if (kmer_k != 0 && (kmer_k < KMER_MIN_K || kmer_k > KMER_MAX_K)) {
+		fprintf(stderr, "[E::%s] unsupported k-mer length %d\n", __func__, kmer_k);
+		return 1;
+	}
+	if (sa_rate != 0 && (sa_rate < 0 || sa_rate > (1 << SA_MAX_SHIFT) || (sa_rate & (sa_rate - 1)) != 0)) {
+		fprintf(stderr, "[E::%s] unsupported SA sampling rate %d\n", __func__, sa_rate);
 		return 1;
 	}
 	if (prefix == 0) prefix = argv[optind];
-	bwa_idx_build(argv[optind], prefix);
+	bwa_idx_build(argv[optind], prefix, cp_block_size, kmer_k, sa_rate);
 	return 0;
 }
 
-int bwa_idx_build(const char *fa, const char *prefix)
+int bwa_idx_build(const char *fa, const char *prefix, int cp_block_size, int kmer_k, int sa_rate)
 {
 	extern void bwa_pac_rev_core(const char *fn, const char *fn_rev);
 
@@ -73,8 +98,19 @@ int bwa_idx_build(const char *fa, const char *prefix)
 		fprintf(stderr, "%.2f sec\n", (float)(clock() - t) / CLOCKS_PER_SEC);
 		err_gzclose(fp);
         FMI_search *fmi = new FMI_search(prefix);
-        fmi->build_index();
+        fmi->build_index(cp_block_size, sa_rate);
         delete fmi;
 	}
+	if (kmer_k > 0) { // k-mer table, from the index just built
+		FMI_search *fmi = new FMI_search(prefix);
+		fmi->load_index(FMI_LOAD_NO_KMER, cp_block_size);
+		t = clock();
+		if (fmi->build_kmer_table(kmer_k) != 0) {
+			delete fmi;
+			return 1;
+		}
+		fprintf(stderr, "[bwa_index] %d-mer table: %.2f sec\n", kmer_k, (float)(clock() - t) / CLOCKS_PER_SEC);
+		delete fmi;
+	}
 	return 0;
 }
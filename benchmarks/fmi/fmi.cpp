@@ -27,6 +27,7 @@
 Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@intel.com>.
 *****************************************************************************************/
 
+
 #include<stdio.h>
 #include<stdlib.h>
 #include<stdint.h>
@@ -34,106 +35,256 @@ Authors: Vasimuddin Md <vasimuddin.md@intel.com>; Sanchit Misra <sanchit.misra@i
 #include <string.h>
 #include <chrono>
 #include <iostream>
+#include <string>
 #include <fcntl.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <errno.h>
 
 #include "bwa.h"
 #include "FMI_search.h"
+#include "kseq.h"
+KSEQ_DECLARE(gzFile)
 
 #ifdef ENABLE_PARSEC_HOOKS
 #include "hooks.h"
 #endif
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
+#include "smem_writer.h"
+#include "seed_server.h"
 
 #define PRINT_OUTPUT 1
 
 #define CLMUL 8 // 8 x 64 bit cache line
 // #define QUERY_DB_SIZE 1280000000
 #define QUERY_DB_SIZE 2560000000L
+// Default bases per chunk and thread of the streaming mode (FMI_STREAM).
+#define STREAM_CHUNK_SIZE 10000000L
+#define STREAM_DEPTH 2
+// Size of the chunks of the SMEM arenas, a multiple of the huge page size.
+#define SMEM_CHUNK_BYTES (4L << 20)
+#define HUGE_PAGE_BYTES (2L << 20)
+// Locate modes (FMI_LOCATE) and the default occurrences per SMEM (-c of
+// bwa mem).
+#define LOCATE_OFF 0
+#define LOCATE_BATCH 1
+#define LOCATE_SCALAR 2
+#define LOCATE_CHECK 3
+#define LOCATE_MAX_OCC 500
 int myrank, num_ranks;
 
-int main(int argc, char **argv) {
-    if(argc!=6)
-    {
-        printf("Need five arguments : ref_file query_set batch_size minSeedLen n_threads\n");
-        return 1;
-    }
+static roi_phase_t roi_batches;
+static roi_phase_t roi_smem;
+static roi_phase_t roi_reseed;
+static roi_phase_t roi_seed_strategy;
+static roi_phase_t roi_sort;
+static roi_phase_t roi_locate;
 
-    int32_t numReads = 0;
-    int64_t total_size = 0;
-    gzFile fp = gzopen(argv[2], "r");
-	if (fp == 0)
-	{
-		fprintf(stderr, "[E::%s] fail to open file `%s'.\n", __func__, argv[2]);
-        exit(EXIT_FAILURE);
-	}
-    
-    printf("before reading sequences\n");
-    std::chrono::steady_clock::time_point begin_reading = std::chrono::steady_clock::now();
+typedef struct {
+    int32_t batch_size;
+    int32_t minSeedLen;
+    int32_t split_len;
+    int32_t splitWidth;
+    int32_t maxMemIntv;
+    int32_t numthreads;
+    int32_t locate_mode;
+    int32_t locate_lanes;
+    int32_t max_occ;
+} seed_params_t;
 
-    bseq1_t *seqs = bseq_read_one_fasta_file(QUERY_DB_SIZE, &numReads, fp, &total_size);
+// Chunk of an SMEM arena.
+typedef struct smem_chunk {
+    struct smem_chunk *next;
+    SMEM *smems;
+    int64_t size, used;
+} smem_chunk_t;
 
-    if(seqs == NULL)
+// SMEMs found by a thread, in a list of chunks that are never moved: the
+// SMEMs of a batch stay where they were written until the arena is reset.
+typedef struct {
+    smem_chunk_t *head, *cur;
+} smem_arena_t;
+
+// SMEM arena of a thread, the work arrays of the seeding (with the lane
+// scratch of the SMEM search and the keys of the sort) and of the locate
+// (FMI_LOCATE), three cache lines per thread.
+typedef struct {
+    smem_arena_t arena;
+    int32_t *min_intv_array;
+    int32_t *rid_array;
+    int32_t *query_pos_array;
+    int32_t *query_cum_len_ar;
+    int64_t batchAlloc;
+    int64_t workAlloc;
+    SMEM *scratch;
+    int64_t scratchAlloc;
+    uint64_t *sortKeys;
+    int64_t sortAlloc;
+    int64_t *sa_pos;
+    int64_t *ref_pos;
+    int64_t locateAlloc;
+    int64_t numLocated;
+    uint64_t locateSum;
+    int64_t pad[3 * CLMUL - 17];
+} seed_buffers_t;
+
+// A chunk of reads of the streaming mode, encoded as in the default mode.
+typedef struct {
+    bseq1_t *seqs;
+    int32_t numReads;
+    int64_t first_rid;
+    uint8_t *enc_qdb;
+    int64_t *query_offset;
+    int64_t enc_qdb_alloc;
+    int32_t numReads_alloc;
+} query_chunk_t;
+
+// Ring of chunks filled by the reader thread of the streaming mode. Chunks
+// [head, tail) are ready to be seeded.
+typedef struct {
+    kseq_t *ks;
+    int64_t chunk_size;
+    int32_t depth;
+    query_chunk_t *ring;
+    int64_t head, tail;
+    bool eof;
+    double io_seconds;
+    std::mutex mutex;
+    std::condition_variable cv;
+} query_stream_t;
+
+/**
+ * New chunk for a reservation of @n SMEMs, backed by huge pages if
+ * available. The pages are touched first (and placed) by the thread that
+ * fills the chunk. The chunk holds 4 reservations, so that at most a
+ * quarter of it is left unused when the next one does not fit.
+ */
+static smem_chunk_t *smem_chunk_alloc(int64_t n)
+{
+    int64_t bytes = 4 * n * sizeof(SMEM);
+    if(bytes < SMEM_CHUNK_BYTES)
+        bytes = SMEM_CHUNK_BYTES;
+    bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    void *smems = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(smems == MAP_FAILED)
     {
-        printf("ERROR! seqs = NULL\n");
+        fprintf(stderr, "[E::%s] failed to allocate %ld bytes for the SMEMs.\n", __func__, (long)bytes);
         exit(EXIT_FAILURE);
     }
-    int32_t *query_cum_len_ar = (int32_t *)_mm_malloc(numReads * sizeof(int32_t), 64);
+#ifdef MADV_HUGEPAGE
+    madvise(smems, bytes, MADV_HUGEPAGE);
+#endif
+    smem_chunk_t *chunk = (smem_chunk_t *)malloc(sizeof(smem_chunk_t));
+    chunk->next = NULL;
+    chunk->smems = (SMEM *)smems;
+    chunk->size = bytes / sizeof(SMEM);
+    chunk->used = 0;
+    return chunk;
+}
 
-    FMI_search *fmiSearch = new FMI_search(argv[1]);
-    fmiSearch->load_index();
-    
-    std::chrono::steady_clock::time_point end_reading = std::chrono::steady_clock::now();
+/**
+ * Room for @n contiguous SMEMs at the end of @arena, in the current chunk,
+ * the next one if it is large enough, or a new one.
+ */
+static SMEM *smem_arena_reserve(smem_arena_t *arena, int64_t n)
+{
+    smem_chunk_t *cur = arena->cur;
+    if(cur != NULL && cur->size - cur->used >= n)
+        return cur->smems + cur->used;
 
-    int max_readlength = seqs[0].l_seq;
-    int min_readlength = seqs[0].l_seq;
-    for(int i = 1; i < numReads; i++)
+    smem_chunk_t *next = cur != NULL ? cur->next : arena->head;
+    if(next == NULL || next->size < 4 * n)
     {
-        if(max_readlength < seqs[i].l_seq)
-            max_readlength = seqs[i].l_seq;
-        if(min_readlength > seqs[i].l_seq)
-            min_readlength = seqs[i].l_seq;
+        smem_chunk_t *chunk = smem_chunk_alloc(n);
+        chunk->next = next;
+        if(cur != NULL)
+            cur->next = chunk;
+        else
+            arena->head = chunk;
+        next = chunk;
     }
-    assert(max_readlength > 0);
-    assert(max_readlength < 10000);
-    assert(numReads > 0);
-    assert(numReads * max_readlength < QUERY_DB_SIZE);
-    printf("numReads = %d, max_readlength = %d, min_readlength = %d\n", numReads, max_readlength, min_readlength);
-    uint8_t *enc_qdb=(uint8_t *)malloc((int64_t)numReads * max_readlength * sizeof(uint8_t));
+    next->used = 0;
+    arena->cur = next;
+    return next->smems;
+}
+
+/**
+ * Keep the first @n SMEMs of the last reservation.
+ */
+static inline void smem_arena_commit(smem_arena_t *arena, int64_t n)
+{
+    arena->cur->used += n;
+}
+
+/**
+ * Drop all the SMEMs of @arena, keeping its chunks for the next ones.
+ */
+static void smem_arena_reset(smem_arena_t *arena)
+{
+    for(smem_chunk_t *chunk = arena->head; chunk != NULL; chunk = chunk->next)
+        chunk->used = 0;
+    arena->cur = arena->head;
+}
+
+static int64_t smem_arena_bytes(const smem_arena_t *arena)
+{
+    int64_t bytes = 0;
+    for(smem_chunk_t *chunk = arena->head; chunk != NULL; chunk = chunk->next)
+        bytes += chunk->size * sizeof(SMEM);
+    return bytes;
+}
 
+static void smem_arena_free(smem_arena_t *arena)
+{
+    smem_chunk_t *chunk = arena->head;
+    while(chunk != NULL)
+    {
+        smem_chunk_t *next = chunk->next;
+        munmap(chunk->smems, chunk->size * sizeof(SMEM));
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = arena->cur = NULL;
+}
+
+/**
+ * Offsets of @numReads reads packed one after the other in @query_offset
+ * (numReads + 1 entries), return the number of bases.
+ */
+static int64_t query_offsets(const bseq1_t *seqs, int32_t numReads, int64_t *query_offset)
+{
+    int64_t st;
+    query_offset[0] = 0;
+    for (st=0; st < numReads; st++) {
+        query_offset[st + 1] = query_offset[st] + seqs[st].l_seq;
+    }
+    return query_offset[numReads];
+}
+
+/**
+ * Encode @numReads reads in @enc_qdb, one byte per base, at the offsets
+ * computed by query_offsets().
+ */
+static void encode_reads(const bseq1_t *seqs, int32_t numReads, const int64_t *query_offset,
+                         uint8_t *enc_qdb)
+{
     int64_t cind,st;
 #if 0
     printf("Priting query\n");
-    for(st = 0; st < max_readlength; st++)
+    for(st = 0; st < seqs[0].l_seq; st++)
     {
         printf("%c", seqs[0].seq[st]);
     }
     printf("\n");
 #endif
-    uint64_t r;
+    int64_t r;
     for (st=0; st < numReads; st++) {
-        query_cum_len_ar[st] = st * max_readlength;
-        cind=st*max_readlength;
-        for(r = 0; r < max_readlength; ++r) {
+        cind=query_offset[st];
+        for(r = 0; r < seqs[st].l_seq; ++r) {
             switch(seqs[st].seq[r])
             {
                 case 'A': enc_qdb[r+cind]=0;
@@ -149,266 +300,1020 @@ int main(int argc, char **argv) {
             //printf("%c %d\n", seqs[st].seq[r], enc_qdb[r + cind]);
         }
     }
+}
 
-    int batch_size=0;
-    batch_size=atoi(argv[3]);
-    assert(batch_size > 0);
-    assert(batch_size <= numReads);
-
-
-    int32_t minSeedLen = atoi(argv[4]);
-    int numthreads=atoi(argv[5]);
-
+/**
+ * Seeding parameters of bwa mem for @minSeedLen (-k), without locate.
+ */
+static void init_seed_params(seed_params_t *par, int32_t batch_size, int32_t minSeedLen,
+                             int32_t numthreads)
+{
     const int splitWidth = 10;
     const int maxMemIntv = 20;
     const double splitFactor = 1.5;
 
-    assert(numthreads > 0);
-    assert(numthreads <= omp_get_max_threads());
-    SMEM *matchArray[CLMUL * numthreads];
-    int32_t *min_intv_array[CLMUL * numthreads];
-    int32_t *rid_array[CLMUL * numthreads];
-    int16_t *query_pos_array[CLMUL * numthreads];
-
-    int64_t num_batches = (numReads + batch_size - 1 ) / batch_size;
-    int64_t *numTotalSmem = (int64_t *)_mm_malloc(num_batches * sizeof(int64_t), 64);;
-    SMEM **batchStart = (SMEM **)_mm_malloc(num_batches * sizeof(SMEM *), 64);;
-    
-    uint64_t tim = __rdtsc();
-    sleep(1);
-    uint64_t proc_freq = __rdtsc() - tim;
+    par->batch_size = batch_size;
+    par->minSeedLen = minSeedLen;
+    par->split_len = (int)(minSeedLen * splitFactor + .499);
+    par->splitWidth = splitWidth;
+    par->maxMemIntv = maxMemIntv;
+    par->numthreads = numthreads;
+    par->locate_mode = LOCATE_OFF;
+    par->locate_lanes = LOCATE_LANES;
+    par->max_occ = LOCATE_MAX_OCC;
+}
 
-#pragma omp parallel num_threads(numthreads)
+/**
+ * Reference positions of the @n SMEMs of a batch, at most max_occ per SMEM,
+ * as bwa mem does before chaining. Only the locate itself is timed (phase
+ * "locate"); LOCATE_CHECK then compares every position with the one found
+ * by get_sa_entry_compressed().
+ */
+static void locate_smems(FMI_search *fmi, seed_buffers_t *buf, const seed_params_t *par,
+                         const SMEM *smems, int64_t n)
+{
+    int64_t rows = FMI_search::smem_sa_count(smems, n, par->max_occ);
+    if(buf->locateAlloc < rows)
     {
-        int tid = omp_get_thread_num();
-
-        if(tid == 0)
-            printf("Running %d threads\n", omp_get_num_threads());
+        buf->locateAlloc = rows;
+        free(buf->sa_pos);
+        free(buf->ref_pos);
+        buf->sa_pos = (int64_t *)malloc(rows * sizeof(int64_t));
+        buf->ref_pos = (int64_t *)malloc(rows * sizeof(int64_t));
     }
+    FMI_search::smem_sa_rows(smems, n, par->max_occ, buf->sa_pos);
 
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
+    int64_t r;
+    roi_thread_begin(roi_locate);
+    if(par->locate_mode == LOCATE_SCALAR)
+    {
+        for(r = 0; r < rows; r++)
+            buf->ref_pos[r] = fmi->get_sa_entry_compressed(buf->sa_pos[r]);
+    }
+    else
+    {
+        fmi->locate(buf->sa_pos, buf->ref_pos, rows, par->locate_lanes);
+    }
+    roi_thread_end(roi_locate);
 
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
+    for(r = 0; r < rows; r++)
+    {
+        if(par->locate_mode == LOCATE_CHECK &&
+           buf->ref_pos[r] != fmi->get_sa_entry_compressed(buf->sa_pos[r]))
+        {
+            fprintf(stderr, "[E::%s] SA row %ld: located at %ld instead of %ld\n", __func__,
+                    (long)buf->sa_pos[r], (long)buf->ref_pos[r],
+                    (long)fmi->get_sa_entry_compressed(buf->sa_pos[r]));
+            exit(EXIT_FAILURE);
+        }
+        buf->locateSum += buf->ref_pos[r];
     }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-    __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-    fapp_start("computing", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-    __DR_START_TRACE();
-#endif
+    buf->numLocated += rows;
+}
 
+/**
+ * Seed @numReads reads encoded by encode_reads(), in batches of batch_size
+ * reads scheduled dynamically on the threads. The SMEMs of batch b are the
+ * numTotalSmem[b] entries at batchStart[b], in the arena of the thread that
+ * seeded it, with read ids starting at @first_rid. The arenas are reset
+ * first.
+ */
+static void seed_reads(FMI_search *fmiSearch, seed_buffers_t *buffers, const seed_params_t *par,
+                       uint8_t *enc_qdb, const bseq1_t *seqs, const int64_t *query_offset,
+                       int32_t numReads, int64_t first_rid,
+                       int64_t *numTotalSmem, SMEM **batchStart)
+{
+    const int32_t batch_size = par->batch_size;
+    const int32_t minSeedLen = par->minSeedLen;
     int64_t i;
-    int64_t startTick, endTick;
-    startTick = __rdtsc();
-
-    std::chrono::steady_clock::time_point begin_computing = std::chrono::steady_clock::now();
 
-    memset(numTotalSmem, 0, num_batches * sizeof(int64_t));
-    memset(batchStart, 0, num_batches * sizeof(int64_t));
-    //int64_t workTicks[CLMUL * numthreads];
-    //memset(workTicks, 0, CLMUL * numthreads * sizeof(int64_t));
-    int64_t perThreadQuota = numReads / numthreads;
-
-    int split_len = (int)(minSeedLen * splitFactor + .499);
-
-#ifdef ENABLE_PARSEC_HOOKS
-    __parsec_roi_begin();
-#endif
-
-#pragma omp parallel num_threads(numthreads)
+#pragma omp parallel num_threads(par->numthreads)
     {
         int32_t tid = omp_get_thread_num();
-        int64_t matchArrayAlloc = perThreadQuota * 20;
-        matchArray[CLMUL * tid] = (SMEM *)malloc(matchArrayAlloc * sizeof(SMEM));
-        min_intv_array[CLMUL * tid] = (int32_t *)malloc(matchArrayAlloc * sizeof(int32_t));
-        rid_array[CLMUL * tid] = (int32_t *)malloc(matchArrayAlloc * sizeof(int32_t));
-        query_pos_array[CLMUL * tid] = (int16_t *)malloc(matchArrayAlloc * sizeof(int16_t));
-
-        int64_t myTotalSmems = 0;
-        //int64_t startTick = __rdtsc();
+        FMI_search *fmi = fmiSearch->local_replica();
+        seed_buffers_t *buf = &buffers[tid];
+        // The buffers outlive a request of the server mode, the next one may
+        // have larger batches.
+        if(buf->batchAlloc < batch_size)
+        {
+            buf->batchAlloc = batch_size;
+            free(buf->query_cum_len_ar);
+            buf->query_cum_len_ar = (int32_t *)malloc(buf->batchAlloc * sizeof(int32_t));
+        }
+        smem_arena_reset(&buf->arena);
 
+        // Closed after the implicit barrier, the wait is reported as idle.
+        roi_thread_begin(roi_batches);
 #pragma omp for schedule(dynamic, 1)
         for(i = 0; i < numReads; i += batch_size)
         {
-            //int64_t st1 = __rdtsc();
+            roi_task_begin(roi_batches);
             int32_t batch_count = batch_size;
             if((i + batch_count) > numReads) batch_count = numReads - i;
+            // The offsets of the reads of the batch are relative to its first
+            // base, so that they fit in 32 bits.
+            uint8_t *batch_qdb = enc_qdb + query_offset[i];
+            int64_t batch_bases = query_offset[i + batch_count] - query_offset[i];
+            // Bound of the number of SMEMs of the batch (and of the reseeded
+            // positions).
+            int64_t batch_smems = batch_bases > batch_count ? batch_bases : batch_count;
+            if(buf->workAlloc < batch_smems)
+            {
+                // The work arrays do not outlive a batch, no need to copy.
+                buf->workAlloc = batch_smems;
+                free(buf->min_intv_array);
+                free(buf->rid_array);
+                free(buf->query_pos_array);
+                buf->min_intv_array = (int32_t *)malloc(buf->workAlloc * sizeof(int32_t));
+                buf->rid_array = (int32_t *)malloc(buf->workAlloc * sizeof(int32_t));
+                buf->query_pos_array = (int32_t *)malloc(buf->workAlloc * sizeof(int32_t));
+            }
+            int32_t max_readlength = 0;
             int32_t j;
             for(j = 0; j < batch_count; j++)
             {
-                min_intv_array[CLMUL * tid][j] = 1;
-                rid_array[CLMUL * tid][j] = j;
+                buf->min_intv_array[j] = 1;
+                buf->rid_array[j] = j;
+                buf->query_cum_len_ar[j] = query_offset[i + j] - query_offset[i];
+                if(max_readlength < seqs[i + j].l_seq)
+                    max_readlength = seqs[i + j].l_seq;
+            }
+            if(buf->scratchAlloc < SMEM_SCRATCH_SIZE(max_readlength))
+            {
+                buf->scratchAlloc = SMEM_SCRATCH_SIZE(max_readlength);
+                _mm_free(buf->scratch);
+                buf->scratch = (SMEM *)_mm_malloc(buf->scratchAlloc * sizeof(SMEM), 64);
             }
             int32_t batch_id = i/batch_size;
             //printf("%d] i = %d, batch_count = %d, batch_size = %d\n", tid, i, batch_count, batch_size);
             //fflush(stdout);
-            if((matchArrayAlloc - myTotalSmems) < (batch_size * max_readlength))
-            {
-                printf("%d] realloc\n", tid);
-                fflush(stdout);
-                matchArrayAlloc *= 2;
-                matchArray[CLMUL * tid] = (SMEM *)realloc(matchArray[CLMUL * tid], matchArrayAlloc * sizeof(SMEM)); 
-                min_intv_array[CLMUL * tid] = (int32_t *)realloc(min_intv_array[CLMUL * tid], matchArrayAlloc * sizeof(int32_t)); 
-                rid_array[CLMUL * tid] = (int32_t *)realloc(rid_array[CLMUL * tid], matchArrayAlloc * sizeof(int32_t));
-                query_pos_array[CLMUL * tid] = (int16_t *)realloc(query_pos_array[CLMUL * tid], matchArrayAlloc * sizeof(int16_t));
-            }
+            SMEM *matchArray = smem_arena_reserve(&buf->arena, batch_smems);
             int64_t num_smem1 = 0, num_smem2 = 0, num_smem3 = 0;
-            fmiSearch->getSMEMsAllPosOneThread(enc_qdb + i * max_readlength,
-                    min_intv_array[CLMUL * tid],
-                    rid_array[CLMUL * tid],
+            roi_thread_begin(roi_smem);
+            fmi->getSMEMsAllPosOneThread(batch_qdb,
+                    buf->min_intv_array,
+                    buf->rid_array,
                     batch_count,
                     batch_size,
                     seqs + i,
-                    query_cum_len_ar,
+                    buf->query_cum_len_ar,
                     max_readlength,
                     minSeedLen,
-                    &matchArray[CLMUL * tid][myTotalSmems],
-                    &num_smem1);
-            
+                    matchArray,
+                    &num_smem1,
+                    buf->scratch);
+            roi_thread_end(roi_smem);
+
+            roi_thread_begin(roi_reseed);
             int64_t pos = 0;
             for (j = 0; j < num_smem1; j++) {
-                SMEM *p = &matchArray[CLMUL * tid][myTotalSmems + j];
+                SMEM *p = &matchArray[j];
                 int start = p->m, end = p->n +1;
-                if (end - start < split_len || p->s > splitWidth) continue;
+                if (end - start < par->split_len || p->s > par->splitWidth) continue;
                 // printf("%d:%d:%ld\n", start, end, p->s);
-                rid_array[CLMUL * tid][pos] = p->rid;
-                query_pos_array[CLMUL * tid][pos] = (end + start)>>1;
-                min_intv_array[CLMUL * tid][pos] = p->s + 1;
+                buf->rid_array[pos] = p->rid;
+                buf->query_pos_array[pos] = (end + start)>>1;
+                buf->min_intv_array[pos] = p->s + 1;
                 pos++;
             }
             
             // Reseed
-            fmiSearch->getSMEMsOnePosOneThread(enc_qdb + i * max_readlength,
-                    query_pos_array[CLMUL * tid],
-                    min_intv_array[CLMUL * tid],
-                    rid_array[CLMUL * tid],
+            fmi->getSMEMsOnePosOneThread(batch_qdb,
+                    buf->query_pos_array,
+                    buf->min_intv_array,
+                    buf->rid_array,
                     pos,
                     pos,
                     seqs + i,
-                    query_cum_len_ar,
+                    buf->query_cum_len_ar,
                     max_readlength,
                     minSeedLen,
-                    &matchArray[CLMUL * tid][myTotalSmems + num_smem1],
-                    &num_smem2);
+                    &matchArray[num_smem1],
+                    &num_smem2,
+                    buf->scratch);
+            roi_thread_end(roi_reseed);
             // LAST
+            roi_thread_begin(roi_seed_strategy);
             for(j = 0; j < batch_count; j++)
             {
-                min_intv_array[CLMUL * tid][j] = maxMemIntv;
+                buf->min_intv_array[j] = par->maxMemIntv;
             }
-            num_smem3 = fmiSearch->bwtSeedStrategyAllPosOneThread(enc_qdb + i * max_readlength,
-                    min_intv_array[CLMUL * tid],
+            num_smem3 = fmi->bwtSeedStrategyAllPosOneThread(batch_qdb,
+                    buf->min_intv_array,
                     batch_count,
                     seqs + i,
-                    query_cum_len_ar,
+                    buf->query_cum_len_ar,
                     minSeedLen + 1,
-                    &matchArray[CLMUL * tid][myTotalSmems + num_smem1 + num_smem2]);
+                    &matchArray[num_smem1 + num_smem2]);
+            roi_thread_end(roi_seed_strategy);
             int64_t totalSmem = num_smem1 + num_smem2 + num_smem3; 
             numTotalSmem[batch_id] = totalSmem;
-            batchStart[batch_id] = matchArray[CLMUL * tid] + myTotalSmems;
+            batchStart[batch_id] = matchArray;
             for(j = 0; j < totalSmem; j++)
             {
-                matchArray[CLMUL * tid][myTotalSmems + j].rid += i;
+                matchArray[j].rid += first_rid + i;
+            }
+            roi_thread_begin(roi_sort);
+            if(buf->sortAlloc < SMEM_SORT_KEYS(totalSmem))
+            {
+                buf->sortAlloc = SMEM_SORT_KEYS(totalSmem);
+                _mm_free(buf->sortKeys);
+                buf->sortKeys = (uint64_t *)_mm_malloc(buf->sortAlloc * sizeof(uint64_t), 64);
             }
-            fmiSearch->sortSMEMs(matchArray[CLMUL * tid] + myTotalSmems,
+            fmi->sortSMEMs(matchArray,
                     numTotalSmem + batch_id,
                     batch_count,
                     max_readlength,
-                    1);
-            myTotalSmems += totalSmem; 
-            //int64_t et1 = __rdtsc();
-            //workTicks[CLMUL * tid] += (et1 - st1);
+                    1,
+                    buf->sortKeys);
+            roi_thread_end(roi_sort);
+            if(par->locate_mode != LOCATE_OFF)
+                locate_smems(fmi, buf, par, matchArray, numTotalSmem[batch_id]);
+            smem_arena_commit(&buf->arena, totalSmem);
+            roi_task_end(roi_batches, batch_count);
         }
+        roi_thread_end(roi_batches);
+    }
+}
 
-        //int64_t endTick = __rdtsc();
-        //printf("%d] %ld ticks, workTicks = %ld\n", tid, endTick - startTick, workTicks[CLMUL * tid]);
+/**
+ * Write the SMEMs of @num_batches batches found by seed_reads().
+ */
+static void print_smems(smem_writer_t *writer, const int64_t *numTotalSmem,
+                        SMEM *const *batchStart, int64_t num_batches)
+{
+    int64_t batch_id;
+    for(batch_id = 0; batch_id < num_batches; batch_id++)
+    {
+        smem_writer_write(writer, batchStart[batch_id], numTotalSmem[batch_id]);
     }
+}
 
-#ifdef ENABLE_PARSEC_HOOKS
-    __parsec_roi_end();
-#endif
+/**
+ * Reader thread of the streaming mode: read and encode chunks of about
+ * chunk_size bases while there is a free chunk in the ring.
+ */
+static void stream_reader(query_stream_t *qs)
+{
+    int64_t first_rid = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(qs->mutex);
+            qs->cv.wait(lock, [qs] { return qs->tail - qs->head < qs->depth; });
+        }
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        query_chunk_t *chunk = &qs->ring[qs->tail % qs->depth];
+        int64_t size = 0;
+        chunk->seqs = bseq_read_orig(qs->chunk_size, &chunk->numReads, qs->ks, NULL, &size);
+        if(chunk->numReads > 0)
+        {
+            if(chunk->numReads_alloc < chunk->numReads)
+            {
+                chunk->numReads_alloc = chunk->numReads;
+                chunk->query_offset = (int64_t *)realloc(chunk->query_offset, (chunk->numReads + 1) * sizeof(int64_t));
+            }
+            int64_t enc_size = query_offsets(chunk->seqs, chunk->numReads, chunk->query_offset);
+            if(chunk->enc_qdb_alloc < enc_size)
+            {
+                chunk->enc_qdb_alloc = enc_size;
+                chunk->enc_qdb = (uint8_t *)realloc(chunk->enc_qdb, enc_size * sizeof(uint8_t));
+            }
+            encode_reads(chunk->seqs, chunk->numReads, chunk->query_offset, chunk->enc_qdb);
+            chunk->first_rid = first_rid;
+            first_rid += chunk->numReads;
+        }
+        else
+        {
+            free(chunk->seqs);
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-    std::chrono::steady_clock::time_point end_computing = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(qs->mutex);
+        qs->io_seconds += std::chrono::duration<double>(end - begin).count();
+        if(chunk->numReads == 0)
+            qs->eof = true;
+        else
+            qs->tail++;
+        qs->cv.notify_all();
+        if(qs->eof)
+            return;
+    }
+}
 
-    endTick = __rdtsc();
+/**
+ * Next chunk of the streaming mode, or NULL at the end of the input.
+ */
+static query_chunk_t *stream_next(query_stream_t *qs)
+{
+    std::unique_lock<std::mutex> lock(qs->mutex);
+    qs->cv.wait(lock, [qs] { return qs->head < qs->tail || qs->eof; });
+    if(qs->head == qs->tail)
+        return NULL;
+    return &qs->ring[qs->head % qs->depth];
+}
 
-#if DYNAMORIO_ANALYSIS
-    __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
+/**
+ * Free the reads of the chunk returned by stream_next() and give it back to
+ * the reader.
+ */
+static void stream_release(query_stream_t *qs, query_chunk_t *chunk)
+{
+    for(int i = 0; i < chunk->numReads; i++)
+    {
+        free(chunk->seqs[i].name);
+        free(chunk->seqs[i].comment);
+        free(chunk->seqs[i].seq);
+        free(chunk->seqs[i].qual);
+    }
+    free(chunk->seqs);
+    chunk->seqs = NULL;
+
+    std::lock_guard<std::mutex> lock(qs->mutex);
+    qs->head++;
+    qs->cv.notify_all();
+}
+
+/**
+ * Load the index of @ref_file, see FMI_INDEX_MMAP and FMI_INDEX_CP.
+ */
+static FMI_search *load_fmi(const char *ref_file)
+{
+    FMI_search *fmiSearch = new FMI_search(ref_file);
+    // FMI_INDEX_MMAP=1[,populate][,hugepage] maps the index file instead of
+    // reading it, so that the processes of a node share the page cache copy.
+    int load_flags = 0;
+    const char *index_mmap = getenv("FMI_INDEX_MMAP");
+    if (index_mmap != NULL && index_mmap[0] != '\0' && strcmp(index_mmap, "0") != 0) {
+        load_flags |= FMI_LOAD_MMAP;
+        if (strstr(index_mmap, "populate") != NULL) load_flags |= FMI_LOAD_POPULATE;
+        if (strstr(index_mmap, "hugepage") != NULL) load_flags |= FMI_LOAD_HUGEPAGE;
+    }
+    // FMI_KMER=0 ignores the k-mer table of the index (bwa-mem2 index -k).
+    const char *kmer = getenv("FMI_KMER");
+    if (kmer != NULL && strcmp(kmer, "0") == 0) load_flags |= FMI_LOAD_NO_KMER;
+    // FMI_INDEX_CP=64|128|256 selects the index file by its checkpoint block
+    // size. By default, the first one found (.bwt.2bit.64, .128 then .256).
+    const char *index_cp = getenv("FMI_INDEX_CP");
+    fmiSearch->load_index(load_flags, index_cp != NULL ? atoi(index_cp) : 0);
+    return fmiSearch;
+}
+
+/**
+ * Start the threads and replicate the index, see FMI_NUMA_REPLICATE.
+ */
+static void start_threads(FMI_search *fmiSearch, int numthreads)
+{
+#pragma omp parallel num_threads(numthreads)
+    {
+        int tid = omp_get_thread_num();
+
+        if(tid == 0)
+            printf("Running %d threads\n", omp_get_num_threads());
+    }
+
+    // FMI_NUMA_REPLICATE=1[,sa] copies cp_occ (and the suffix array) to every
+    // NUMA node, each thread then searches its local copy.
+    const char *numa_replicate = getenv("FMI_NUMA_REPLICATE");
+    if (numa_replicate != NULL && numa_replicate[0] != '\0' && strcmp(numa_replicate, "0") != 0) {
+        fmiSearch->replicate_numa(numthreads, strstr(numa_replicate, "sa") != NULL);
+    }
+
+    roi_batches = roi_phase("batches");
+    roi_smem = roi_phase("smem");
+    roi_reseed = roi_phase("reseed");
+    roi_seed_strategy = roi_phase("seed_strategy");
+    roi_sort = roi_phase("sort");
+    roi_locate = roi_phase("locate");
+}
+
+/**
+ * Print the number of positions found by the locate (FMI_LOCATE) and its
+ * throughput, with a checksum of the positions to compare the modes.
+ */
+static void report_locate(FMI_search *fmiSearch, const seed_buffers_t *buffers,
+                          const seed_params_t *par)
+{
+    if(par->locate_mode == LOCATE_OFF)
+        return;
+    int64_t located = 0;
+    uint64_t checksum = 0;
+    for(int tid = 0; tid < par->numthreads; tid++)
+    {
+        located += buffers[tid].numLocated;
+        checksum += buffers[tid].locateSum;
+    }
+    static const char *mode[] = {"off", "batch", "scalar", "check"};
+    double seconds = roi_seconds(roi_locate);
+    double rate = seconds > 0 ? located / seconds : 0;
+    fprintf(stderr, "locate: %ld positions (%s, %d lanes, SA rate %d, max_occ %d) in %.4f s, "
+            "%.2f M/s, checksum %016lx\n", (long)located, mode[par->locate_mode],
+            par->locate_lanes, fmiSearch->sa_rate(), par->max_occ, seconds, rate / 1e6,
+            (unsigned long)checksum);
+    roi_result_str("locate_mode", mode[par->locate_mode]);
+    roi_result_num("locate_positions", located);
+    roi_result_num("locate_per_second", rate);
+}
+
+/**
+ * Streaming mode (FMI_STREAM): seed the reads of @fp chunk by chunk, while a
+ * reader thread reads and encodes the next ones, and print the SMEMs of every
+ * chunk once it is seeded.
+ */
+static int run_streaming(const char *ref_file, const char *query_file, gzFile fp,
+                         const seed_params_t *par, int64_t chunk_size, int32_t depth)
+{
+    printf("before reading sequences\n");
+    std::chrono::steady_clock::time_point begin_reading = std::chrono::steady_clock::now();
+    FMI_search *fmiSearch = load_fmi(ref_file);
+    std::chrono::steady_clock::time_point end_reading = std::chrono::steady_clock::now();
+
+    printf("streaming chunks of %ld bases, %d chunks in flight\n", (long)chunk_size, depth);
+
+    query_stream_t *qs = new query_stream_t();
+    qs->ks = kseq_init(fp);
+    qs->chunk_size = chunk_size;
+    qs->depth = depth;
+    qs->ring = (query_chunk_t *)calloc(depth, sizeof(query_chunk_t));
+    qs->head = qs->tail = 0;
+    qs->eof = false;
+    qs->io_seconds = 0;
+    std::thread reader(stream_reader, qs);
+
+    start_threads(fmiSearch, par->numthreads);
+
+    seed_buffers_t *buffers = (seed_buffers_t *)_mm_malloc(par->numthreads * sizeof(seed_buffers_t), 64);
+    memset(buffers, 0, par->numthreads * sizeof(seed_buffers_t));
+    int64_t max_batches = 0;
+    int64_t *numTotalSmem = NULL;
+    SMEM **batchStart = NULL;
+
+    roi_phase_t roi_kernel = roi_phase("computing");
+    roi_phase_t roi_wait = roi_phase("wait_input");
+    roi_phase_t roi_output = roi_phase("output");
+    roi_begin(roi_kernel);
+
+    std::chrono::steady_clock::time_point begin_computing = std::chrono::steady_clock::now();
+
+#ifdef PRINT_OUTPUT
+    smem_writer_t *writer = smem_writer_open();
 #endif
-#if VTUNE_ANALYSIS
-    __itt_pause();
+
+    int64_t numReads = 0;
+    int64_t totalSmem = 0;
+    while(true)
+    {
+        roi_begin(roi_wait);
+        query_chunk_t *chunk = stream_next(qs);
+        roi_end(roi_wait);
+        if(chunk == NULL)
+            break;
+
+        int64_t num_batches = (chunk->numReads + par->batch_size - 1) / par->batch_size;
+        if(num_batches > max_batches)
+        {
+            max_batches = num_batches;
+            numTotalSmem = (int64_t *)realloc(numTotalSmem, num_batches * sizeof(int64_t));
+            batchStart = (SMEM **)realloc(batchStart, num_batches * sizeof(SMEM *));
+        }
+        memset(numTotalSmem, 0, num_batches * sizeof(int64_t));
+
+        seed_reads(fmiSearch, buffers, par, chunk->enc_qdb, chunk->seqs, chunk->query_offset,
+                   chunk->numReads, chunk->first_rid,
+                   numTotalSmem, batchStart);
+        numReads += chunk->numReads;
+        stream_release(qs, chunk);
+
+        int64_t batch_id;
+        for(batch_id = 0; batch_id < num_batches; batch_id++)
+        {
+            totalSmem += numTotalSmem[batch_id];
+        }
+#ifdef PRINT_OUTPUT
+        roi_begin(roi_output);
+        print_smems(writer, numTotalSmem, batchStart, num_batches);
+        roi_end(roi_output);
 #endif
-#if FAPP_ANALYSIS
-    fapp_stop("computing", 1, 0);
+    }
+
+    std::chrono::steady_clock::time_point end_computing = std::chrono::steady_clock::now();
+
+    roi_end(roi_kernel);
+
+#ifdef PRINT_OUTPUT
+    smem_writer_close(writer);
 #endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
+    reader.join();
+    double io_seconds = std::chrono::duration<double>(end_reading - begin_reading).count() + qs->io_seconds;
+    printf("numReads = %ld\n", (long)numReads);
+    std::cout << "totalSmems = " << totalSmem << "\n";
+    std::cout << "Reading time: " << io_seconds << " s\n";
+    std::cout << "Computing time: " <<
+        std::chrono::duration<double>(end_computing - begin_computing).count()
+        << " s\n";
+
+    roi_result_str("kernel", "fmi");
+    roi_result_str("input", query_file);
+    roi_result_num("threads", par->numthreads);
+    roi_result_num("io_seconds", io_seconds);
+    roi_result_throughput("SMEMs", totalSmem);
+    int64_t arena_bytes = 0;
+    for(int tid = 0; tid < par->numthreads; tid++)
+        arena_bytes += smem_arena_bytes(&buffers[tid].arena);
+    roi_result_num("smem_arena_mb", arena_bytes / 1048576.0);
+    report_locate(fmiSearch, buffers, par);
+
+    for(int c = 0; c < depth; c++)
+    {
+        free(qs->ring[c].enc_qdb);
+        free(qs->ring[c].query_offset);
+    }
+    free(qs->ring);
+    kseq_destroy(qs->ks);
+    gzclose(fp);
+    delete qs;
+    for(int tid = 0; tid < par->numthreads; tid++)
+    {
+        smem_arena_free(&buffers[tid].arena);
+        free(buffers[tid].min_intv_array);
+        free(buffers[tid].query_pos_array);
+        free(buffers[tid].rid_array);
+        free(buffers[tid].query_cum_len_ar);
+        _mm_free(buffers[tid].scratch);
+        _mm_free(buffers[tid].sortKeys);
+        free(buffers[tid].sa_pos);
+        free(buffers[tid].ref_pos);
+    }
+    _mm_free(buffers);
+    free(numTotalSmem);
+    free(batchStart);
+    delete fmiSearch;
+    roi_finalize();
+    return 0;
+}
+
+/**
+ * Seed the reads of the request @req of a client (see seed_server.h) and
+ * write their SMEMs to a new shared memory segment, returned in @resp.
+ */
+static void serve_request(FMI_search *fmiSearch, seed_buffers_t *buffers, int numthreads,
+                          const fmi_request_t *req, fmi_response_t *resp)
+{
+    memset(resp, 0, sizeof(fmi_response_t));
+    resp->magic = FMI_SERVER_MAGIC;
+    resp->numthreads = numthreads;
+    if(req->numReads <= 0 || req->batch_size <= 0 || req->batch_size > req->numReads ||
+       req->batch_size > FMI_MAX_BATCH_SIZE || req->minSeedLen <= 0 ||
+       req->num_bases < 0 || memchr(req->shm_name, '\0', FMI_SHM_NAME_LEN) == NULL)
+    {
+        resp->status = EINVAL;
+        return;
+    }
+    int32_t numReads = req->numReads;
+    size_t query_size = fmi_query_size(numReads, req->num_bases);
+    int64_t *query_offset = (int64_t *)fmi_shm_map(req->shm_name, query_size, 0);
+    if(query_offset == NULL)
+    {
+        resp->status = errno != 0 ? errno : EINVAL;
+        return;
+    }
+    uint8_t *enc_qdb = (uint8_t *)(query_offset + numReads + 1);
+
+    // The seeding only needs the lengths of the reads.
+    bseq1_t *seqs = (bseq1_t *)calloc(numReads, sizeof(bseq1_t));
+    int32_t i;
+    for(i = 0; i < numReads; i++)
+    {
+        int64_t len = query_offset[i + 1] - query_offset[i];
+        if(query_offset[i] < 0 || len < 0 || query_offset[i + 1] > req->num_bases)
+        {
+            resp->status = EINVAL;
+            break;
+        }
+        seqs[i].l_seq = len;
+    }
+
+    if(resp->status == 0)
+    {
+        seed_params_t par;
+        init_seed_params(&par, req->batch_size, req->minSeedLen, numthreads);
+        int64_t num_batches = (numReads + par.batch_size - 1) / par.batch_size;
+        int64_t *numTotalSmem = (int64_t *)calloc(num_batches, sizeof(int64_t));
+        SMEM **batchStart = (SMEM **)calloc(num_batches, sizeof(SMEM *));
+
+        roi_phase_t roi_kernel = roi_phase("computing");
+        roi_begin(roi_kernel);
+        double begin = roi_wtime();
+        seed_reads(fmiSearch, buffers, &par, enc_qdb, seqs, query_offset, numReads,
+                   0, numTotalSmem, batchStart);
+        resp->seconds = roi_wtime() - begin;
+        roi_end(roi_kernel);
+
+        int64_t batch_id;
+        for(batch_id = 0; batch_id < num_batches; batch_id++)
+            resp->numSmems += numTotalSmem[batch_id];
+        SMEM *smems = (SMEM *)fmi_shm_create(resp->shm_name, resp->numSmems * sizeof(SMEM));
+        if(smems == NULL)
+        {
+            resp->status = errno != 0 ? errno : ENOMEM;
+        }
+        else
+        {
+            int64_t n = 0;
+            for(batch_id = 0; batch_id < num_batches; batch_id++)
+            {
+                memcpy(smems + n, batchStart[batch_id], numTotalSmem[batch_id] * sizeof(SMEM));
+                n += numTotalSmem[batch_id];
+            }
+            fmi_shm_unmap(smems, resp->numSmems * sizeof(SMEM));
+        }
+        free(numTotalSmem);
+        free(batchStart);
+    }
+    free(seqs);
+    fmi_shm_unmap(query_offset, query_size);
+}
+
+/**
+ * Server mode (FMI_SERVER): load the index once and seed the reads of the
+ * clients that connect to the socket @path, one client at a time, until one
+ * of them asks for a shutdown.
+ */
+static int run_server(const char *ref_file, const char *path, int numthreads)
+{
+    FMI_search *fmiSearch = load_fmi(ref_file);
+    start_threads(fmiSearch, numthreads);
+    seed_buffers_t *buffers = (seed_buffers_t *)_mm_malloc(numthreads * sizeof(seed_buffers_t), 64);
+    memset(buffers, 0, numthreads * sizeof(seed_buffers_t));
+
+    int listen_fd = fmi_server_listen(path);
+    fprintf(stderr, "[M::%s] serving %s on %s\n", __func__, ref_file, path);
+
+    int64_t requests = 0, totalSmem = 0;
+    bool running = true;
+    while(running)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            perror("[E::run_server] accept");
+            break;
+        }
+        fmi_request_t req;
+        while(fmi_recv(fd, &req, sizeof(req)) == 0 && req.magic == FMI_SERVER_MAGIC)
+        {
+            if(req.type == FMI_REQUEST_SHUTDOWN)
+            {
+                running = false;
+                break;
+            }
+            fmi_response_t resp;
+            serve_request(fmiSearch, buffers, numthreads, &req, &resp);
+            if(resp.status != 0)
+                fprintf(stderr, "[W::%s] request failed: %s\n", __func__, strerror(resp.status));
+            int sent = fmi_send(fd, &resp, sizeof(resp));
+            if(resp.status == 0)
+            {
+                // The client has mapped the SMEMs once it acknowledges.
+                char ack;
+                if(sent == 0)
+                    fmi_recv(fd, &ack, 1);
+                fmi_shm_unlink(resp.shm_name);
+                requests++;
+                totalSmem += resp.numSmems;
+            }
+            if(sent != 0)
+                break;
+        }
+        close(fd);
+    }
+    close(listen_fd);
+    unlink(path);
+    fprintf(stderr, "[M::%s] %ld requests, %ld SMEMs\n", __func__, (long)requests, (long)totalSmem);
+
+    roi_result_str("kernel", "fmi");
+    roi_result_str("input", "server");
+    roi_result_num("threads", numthreads);
+    roi_result_num("requests", requests);
+    roi_result_throughput("SMEMs", totalSmem);
+    for(int tid = 0; tid < numthreads; tid++)
+    {
+        smem_arena_free(&buffers[tid].arena);
+        free(buffers[tid].min_intv_array);
+        free(buffers[tid].query_pos_array);
+        free(buffers[tid].rid_array);
+        free(buffers[tid].query_cum_len_ar);
+        _mm_free(buffers[tid].scratch);
+        _mm_free(buffers[tid].sortKeys);
+        free(buffers[tid].sa_pos);
+        free(buffers[tid].ref_pos);
+    }
+    _mm_free(buffers);
+    delete fmiSearch;
+    roi_finalize();
+    return 0;
+}
+
+/**
+ * Ask the server at @path to stop (FMI_CLIENT=<path>,shutdown).
+ */
+static int shutdown_server(const char *path)
+{
+    int fd = fmi_client_connect(path);
+    if(fd < 0)
+        return 1;
+    fmi_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.magic = FMI_SERVER_MAGIC;
+    req.type = FMI_REQUEST_SHUTDOWN;
+    int status = fmi_send(fd, &req, sizeof(req));
+    close(fd);
+    return status == 0 ? 0 : 1;
+}
+
+/**
+ * Client mode (FMI_CLIENT): read the reads of @fp into a shared memory
+ * segment, have the server at @path seed them, and print their SMEMs as in
+ * the default mode.
+ */
+static int run_client(const char *path, const char *query_file, gzFile fp, const seed_params_t *par)
+{
+    printf("before reading sequences\n");
+    double begin_reading = roi_wtime();
+    int32_t numReads = 0;
+    int64_t total_size = 0;
+    bseq1_t *seqs = bseq_read_one_fasta_file(QUERY_DB_SIZE, &numReads, fp, &total_size);
+    if(seqs == NULL || numReads == 0)
+    {
+        printf("ERROR! seqs = NULL\n");
+        exit(EXIT_FAILURE);
+    }
+    int max_readlength = seqs[0].l_seq;
+    int min_readlength = seqs[0].l_seq;
+    int64_t num_bases = 0;
+    for(int i = 0; i < numReads; i++)
+    {
+        if(max_readlength < seqs[i].l_seq)
+            max_readlength = seqs[i].l_seq;
+        if(min_readlength > seqs[i].l_seq)
+            min_readlength = seqs[i].l_seq;
+        num_bases += seqs[i].l_seq;
+    }
+    printf("numReads = %d, max_readlength = %d, min_readlength = %d\n", numReads, max_readlength, min_readlength);
+
+    // The reads are encoded in place in the segment read by the server.
+    fmi_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.magic = FMI_SERVER_MAGIC;
+    req.type = FMI_REQUEST_SEED;
+    req.numReads = numReads;
+    // A single batch holds all the reads, the server rejects larger ones.
+    req.batch_size = par->batch_size < numReads ? par->batch_size : numReads;
+    req.minSeedLen = par->minSeedLen;
+    req.num_bases = num_bases;
+    size_t query_size = fmi_query_size(numReads, num_bases);
+    int64_t *query_offset = (int64_t *)fmi_shm_create(req.shm_name, query_size);
+    if(query_offset == NULL)
+    {
+        fprintf(stderr, "[E::%s] failed to create the shared memory of the reads: %s\n",
+                __func__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    query_offsets(seqs, numReads, query_offset);
+    encode_reads(seqs, numReads, query_offset, (uint8_t *)(query_offset + numReads + 1));
+    double end_reading = roi_wtime();
+
+    roi_phase_t roi_kernel = roi_phase("computing");
+    roi_begin(roi_kernel);
+    double begin_computing = roi_wtime();
+    int fd = fmi_client_connect(path);
+    if(fd < 0)
+    {
+        fmi_shm_unlink(req.shm_name);
+        exit(EXIT_FAILURE);
+    }
+    fmi_response_t resp;
+    int status = fmi_send(fd, &req, sizeof(req));
+    if(status == 0)
+        status = fmi_recv(fd, &resp, sizeof(resp));
+    fmi_shm_unlink(req.shm_name);
+    fmi_shm_unmap(query_offset, query_size);
+    if(status != 0 || resp.magic != FMI_SERVER_MAGIC || resp.status != 0)
+    {
+        fprintf(stderr, "[E::%s] the server failed to seed the reads: %s\n", __func__,
+                status != 0 || resp.magic != FMI_SERVER_MAGIC ? "connection lost" : strerror(resp.status));
+        exit(EXIT_FAILURE);
+    }
+    SMEM *smems = (SMEM *)fmi_shm_map(resp.shm_name, resp.numSmems * sizeof(SMEM), 0);
+    char ack = 0;
+    fmi_send(fd, &ack, 1);
+    close(fd);
+    if(smems == NULL)
+    {
+        fprintf(stderr, "[E::%s] failed to map the SMEMs: %s\n", __func__, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    double end_computing = roi_wtime();
+    roi_end(roi_kernel);
+
+    printf("Running %d threads\n", resp.numthreads);
+    std::cout << "totalSmems = " << resp.numSmems << "\n";
+    std::cout << "Reading time: " << end_reading - begin_reading << " s\n";
+    std::cout << "Computing time: " << end_computing - begin_computing << " s\n";
+    fprintf(stderr, "[M::%s] seeding time in the server: %.4f s\n", __func__, resp.seconds);
+
+    roi_result_str("kernel", "fmi");
+    roi_result_str("input", query_file);
+    roi_result_num("threads", resp.numthreads);
+    roi_result_num("io_seconds", end_reading - begin_reading);
+    roi_result_num("server_seconds", resp.seconds);
+    roi_result_throughput("SMEMs", resp.numSmems);
+
+#ifdef PRINT_OUTPUT
+    smem_writer_t *writer = smem_writer_open();
+    smem_writer_write(writer, smems, resp.numSmems);
+    smem_writer_close(writer);
 #endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
+    fmi_shm_unmap(smems, resp.numSmems * sizeof(SMEM));
+    for(int i = 0; i < numReads; i++)
+    {
+        free(seqs[i].name);
+        free(seqs[i].comment);
+        free(seqs[i].seq);
+        free(seqs[i].qual);
+    }
+    free(seqs);
+    gzclose(fp);
+    roi_finalize();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if(argc!=6)
+    {
+        printf("Need five arguments : ref_file query_set batch_size minSeedLen n_threads\n");
+        return 1;
+    }
+
+    // FMI_SERVER=<socket> loads the index and seeds the reads sent by the
+    // clients (FMI_CLIENT=<socket>) until FMI_CLIENT=<socket>,shutdown, see
+    // seed_server.h. The server ignores query_set, batch_size and minSeedLen.
+    const char *server = getenv("FMI_SERVER");
+    if (server != NULL && server[0] != '\0') {
+        int numthreads = atoi(argv[5]);
+        assert(numthreads > 0 && numthreads <= omp_get_max_threads());
+        return run_server(argv[1], server, numthreads);
+    }
+    const char *client = getenv("FMI_CLIENT");
+    std::string client_path;
+    if (client != NULL && client[0] != '\0') {
+        client_path = client;
+        size_t comma = client_path.find(',');
+        if (comma != std::string::npos) {
+            bool shutdown = client_path.compare(comma + 1, std::string::npos, "shutdown") == 0;
+            client_path.resize(comma);
+            if (shutdown)
+                return shutdown_server(client_path.c_str());
+        }
+    }
 
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
+    int32_t numReads = 0;
+    int64_t total_size = 0;
+    gzFile fp = gzopen(argv[2], "r");
+	if (fp == 0)
+	{
+		fprintf(stderr, "[E::%s] fail to open file `%s'.\n", __func__, argv[2]);
+        exit(EXIT_FAILURE);
 	}
 
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
+    int batch_size=0;
+    batch_size=atoi(argv[3]);
+    assert(batch_size > 0);
+
+    int32_t minSeedLen = atoi(argv[4]);
+    int numthreads=atoi(argv[5]);
+
+    assert(numthreads > 0);
+    assert(numthreads <= omp_get_max_threads());
+
+    seed_params_t par;
+    init_seed_params(&par, batch_size, minSeedLen, numthreads);
+
+    // FMI_LOCATE=1|scalar|check[,<lanes>[,<max occurrences>]] also finds the
+    // reference positions of the SMEMs of every batch, with the batched
+    // locate (1), one position at a time (scalar), or both to compare them
+    // (check), and reports the throughput of the locate.
+    const char *locate = getenv("FMI_LOCATE");
+    if (locate != NULL && locate[0] != '\0' && strcmp(locate, "0") != 0) {
+        if (strncmp(locate, "scalar", 6) == 0) par.locate_mode = LOCATE_SCALAR;
+        else if (strncmp(locate, "check", 5) == 0) par.locate_mode = LOCATE_CHECK;
+        else par.locate_mode = LOCATE_BATCH;
+        const char *arg = strchr(locate, ',');
+        if (arg != NULL) {
+            par.locate_lanes = atoi(arg + 1);
+            arg = strchr(arg + 1, ',');
+            if (arg != NULL) par.max_occ = atoi(arg + 1);
+        }
+        assert(par.locate_lanes > 0 && par.locate_lanes <= LOCATE_MAX_LANES);
+        assert(par.max_occ > 0);
+    }
+
+    if (!client_path.empty())
+        return run_client(client_path.c_str(), argv[2], fp, &par);
+
+    // FMI_STREAM=1[,<bases per chunk>[,<chunks in flight>]] reads the input in
+    // chunks on a separate thread while the previous chunks are seeded.
+    const char *stream = getenv("FMI_STREAM");
+    if (stream != NULL && stream[0] != '\0' && strcmp(stream, "0") != 0) {
+        int64_t chunk_size = STREAM_CHUNK_SIZE * numthreads;
+        int32_t depth = STREAM_DEPTH;
+        const char *arg = strchr(stream, ',');
+        if (arg != NULL) {
+            chunk_size = atol(arg + 1);
+            arg = strchr(arg + 1, ',');
+            if (arg != NULL) depth = atoi(arg + 1);
+        }
+        assert(chunk_size > 0);
+        assert(depth > 0);
+        return run_streaming(argv[1], argv[2], fp, &par, chunk_size, depth);
+    }
+    
+    printf("before reading sequences\n");
+    std::chrono::steady_clock::time_point begin_reading = std::chrono::steady_clock::now();
+
+    bseq1_t *seqs = bseq_read_one_fasta_file(QUERY_DB_SIZE, &numReads, fp, &total_size);
+
+    if(seqs == NULL)
+    {
+        printf("ERROR! seqs = NULL\n");
+        exit(EXIT_FAILURE);
+    }
+    int64_t *query_offset = (int64_t *)_mm_malloc((numReads + 1) * sizeof(int64_t), 64);
+
+    FMI_search *fmiSearch = load_fmi(argv[1]);
+    
+    std::chrono::steady_clock::time_point end_reading = std::chrono::steady_clock::now();
+
+    int max_readlength = seqs[0].l_seq;
+    int min_readlength = seqs[0].l_seq;
+    for(int i = 1; i < numReads; i++)
+    {
+        if(max_readlength < seqs[i].l_seq)
+            max_readlength = seqs[i].l_seq;
+        if(min_readlength > seqs[i].l_seq)
+            min_readlength = seqs[i].l_seq;
+    }
+    assert(max_readlength > 0);
+    assert(numReads > 0);
+    printf("numReads = %d, max_readlength = %d, min_readlength = %d\n", numReads, max_readlength, min_readlength);
+    int64_t num_bases = query_offsets(seqs, numReads, query_offset);
+    uint8_t *enc_qdb=(uint8_t *)malloc(num_bases * sizeof(uint8_t));
+
+    encode_reads(seqs, numReads, query_offset, enc_qdb);
+
+    assert(batch_size <= numReads);
+
+    int64_t num_batches = (numReads + batch_size - 1 ) / batch_size;
+    int64_t *numTotalSmem = (int64_t *)_mm_malloc(num_batches * sizeof(int64_t), 64);;
+    SMEM **batchStart = (SMEM **)_mm_malloc(num_batches * sizeof(SMEM *), 64);
+    seed_buffers_t *buffers = (seed_buffers_t *)_mm_malloc(numthreads * sizeof(seed_buffers_t), 64);
+    memset(buffers, 0, numthreads * sizeof(seed_buffers_t));
+    
+    uint64_t tim = __rdtsc();
+    sleep(1);
+    uint64_t proc_freq = __rdtsc() - tim;
+
+    start_threads(fmiSearch, numthreads);
+
+    roi_phase_t roi_kernel = roi_phase("computing");
+    roi_begin(roi_kernel);
+
+    int64_t startTick, endTick;
+    startTick = __rdtsc();
+
+    std::chrono::steady_clock::time_point begin_computing = std::chrono::steady_clock::now();
+
+    memset(numTotalSmem, 0, num_batches * sizeof(int64_t));
+    memset(batchStart, 0, num_batches * sizeof(SMEM *));
 
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
+#ifdef ENABLE_PARSEC_HOOKS
+    __parsec_roi_begin();
 #endif
 
-    //int64_t sumTicks = 0;
-    //int64_t maxTicks = 0;
-    //for(i = 0; i < numthreads; i++)
-    //{
-    //    sumTicks += workTicks[CLMUL * i];
-    //    if(workTicks[CLMUL * i] > maxTicks) maxTicks = workTicks[CLMUL * i];
-    //}
-    //double avgTicks = (sumTicks * 1.0) / numthreads;
-    //printf("avgTicks = %lf, maxTicks = %ld, load imbalance = %lf\n", avgTicks, maxTicks, maxTicks/avgTicks);
+    seed_reads(fmiSearch, buffers, &par, enc_qdb, seqs, query_offset, numReads,
+               0, numTotalSmem, batchStart);
+
+#ifdef ENABLE_PARSEC_HOOKS
+    __parsec_roi_end();
+#endif
+
+    std::chrono::steady_clock::time_point end_computing = std::chrono::steady_clock::now();
+
+    endTick = __rdtsc();
+
+    roi_end(roi_kernel);
 
     //printf("Consumed: %ld cycles, %0.4lf sec\n", endTick - startTick, (endTick - startTick) * 1.0 / proc_freq);
 
@@ -426,51 +1331,41 @@ int main(int argc, char **argv) {
         std::chrono::duration<double>(end_computing - begin_computing).count()
         << " s\n";
 
+    roi_result_str("kernel", "fmi");
+    roi_result_str("input", argv[2]);
+    roi_result_num("threads", numthreads);
+    roi_result_num("io_seconds",
+        std::chrono::duration<double>(end_reading - begin_reading).count());
+    roi_result_throughput("SMEMs", totalSmem);
+    int64_t arena_bytes = 0;
+    for(int tid = 0; tid < numthreads; tid++)
+        arena_bytes += smem_arena_bytes(&buffers[tid].arena);
+    roi_result_num("smem_arena_mb", arena_bytes / 1048576.0);
+    report_locate(fmiSearch, buffers, &par);
+
 #ifdef PRINT_OUTPUT
-    int32_t prevRid = -1;
-    for(batch_id = 0; batch_id < num_batches; batch_id++)
-    {
-        SMEM *myMatchArray = batchStart[batch_id];
-        int64_t i;
-        for(i = 0; i < numTotalSmem[batch_id]; i++)
-        {
-            SMEM smem = myMatchArray[i];
-            if(smem.rid != prevRid)
-            {
-                int32_t j;
-                for(j = prevRid + 1; j <= smem.rid; j++)
-                    printf("%u:\n", j);
-            }
-            prevRid = smem.rid;
-            printf("[%u,%u]", smem.m, smem.n + 1);
-            // printf("%u, %u]", smem.k, smem.s);
-#if 0
-            printf(" ["); 
-            int64_t u1, u2, u3;
-            u1 = smem.k;
-            u2 = smem.k + smem.s;
-            for(u3 = u1; u3 < u2; u3++)
-            {
-                printf("%ld,", fmiSearch->get_sa_entry(u3));
-            }
-            printf("]"); 
-#endif
-            printf("\n");
-        }
-    }
+    smem_writer_t *writer = smem_writer_open();
+    print_smems(writer, numTotalSmem, batchStart, num_batches);
+    smem_writer_close(writer);
 #endif
-    _mm_free(query_cum_len_ar);
+    _mm_free(query_offset);
     free(enc_qdb);
     for(int tid = 0; tid < numthreads; tid++)
     {
-        free(matchArray[CLMUL * tid]);
-        free(min_intv_array[CLMUL * tid]);
-        free(query_pos_array[CLMUL * tid]);
-        free(rid_array[CLMUL * tid]);
+        smem_arena_free(&buffers[tid].arena);
+        free(buffers[tid].min_intv_array);
+        free(buffers[tid].query_pos_array);
+        free(buffers[tid].rid_array);
+        free(buffers[tid].query_cum_len_ar);
+        _mm_free(buffers[tid].scratch);
+        _mm_free(buffers[tid].sortKeys);
+        free(buffers[tid].sa_pos);
+        free(buffers[tid].ref_pos);
     }
+    _mm_free(buffers);
     _mm_free(numTotalSmem);
     _mm_free(batchStart);
     delete fmiSearch;
+    roi_finalize();
     return 0;
 }
-
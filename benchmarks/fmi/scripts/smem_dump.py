@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Print the SMEMs written by fmi with FMI_OUTPUT (see smem_writer.h) in the
+text format of fmi.
+
+Usage: smem_dump.py [--intervals] SMEMS.bin
+
+With --intervals, every line also has the SA interval of the SMEM (k and s).
+"""
+
+import argparse
+import struct
+import sys
+
+SMEM_FILE_MAGIC = 0x314d454d53494d46
+SMEM_FILE_VERSION = 1
+SMEM_FILE_VARINT = 0x1
+COLUMNS = 5
+
+
+def varints(data, count):
+    values = []
+    value = shift = 0
+    for byte in data:
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if byte < 0x80:
+            values.append(value)
+            value = shift = 0
+    if len(values) != count:
+        raise ValueError(f'expected {count} varints, found {len(values)}')
+    return values
+
+
+def read_blocks(f, flags):
+    while True:
+        header = f.read(8 * (1 + COLUMNS))
+        if not header:
+            return
+        if len(header) != 8 * (1 + COLUMNS):
+            raise ValueError('truncated block header')
+        count, *sizes = struct.unpack(f'<{1 + COLUMNS}Q', header)
+        columns = [f.read(size) for size in sizes]
+        if any(len(c) != size for c, size in zip(columns, sizes)):
+            raise ValueError('truncated block')
+
+        if flags & SMEM_FILE_VARINT:
+            rid_d, m_d, length, k, s = (varints(c, count) for c in columns)
+            rid, m, n = [], [], []
+            prev_rid = prev_m = 0
+            for i in range(count):
+                r = (prev_rid + rid_d[i]) & 0xffffffff
+                if r != prev_rid:
+                    prev_m = 0
+                prev_m = (prev_m + m_d[i]) & 0xffffffff
+                prev_rid = r
+                rid.append(r)
+                m.append(prev_m)
+                n.append(prev_m + length[i])
+        else:
+            rid, m, n = (struct.unpack(f'<{count}I', c) for c in columns[:3])
+            k, s = (struct.unpack(f'<{count}q', c) for c in columns[3:])
+        yield from zip(rid, m, n, k, s)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('smems', help='file written with FMI_OUTPUT')
+    parser.add_argument('--intervals', action='store_true',
+                        help='print the SA interval of every SMEM')
+    args = parser.parse_args()
+
+    out = sys.stdout
+    with open(args.smems, 'rb') as f:
+        magic, version, flags = struct.unpack('<QII', f.read(16))
+        if magic != SMEM_FILE_MAGIC or version != SMEM_FILE_VERSION:
+            sys.exit(f'{args.smems}: not an SMEM file of version '
+                     f'{SMEM_FILE_VERSION}')
+        prev_rid = -1
+        for rid, m, n, k, s in read_blocks(f, flags):
+            for r in range(prev_rid + 1, rid + 1):
+                out.write(f'{r}:\n')
+            prev_rid = rid
+            if args.intervals:
+                out.write(f'[{m},{n}] {k} {s}\n')
+            else:
+                out.write(f'[{m},{n}]\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "seed_server.h"
+
+void *fmi_shm_create(char name[FMI_SHM_NAME_LEN], size_t size)
+{
+    static int64_t seq = 0;
+    int fd = -1;
+    // The name is unique among the processes (pid) and the calls (seq).
+    while(fd < 0)
+    {
+        snprintf(name, FMI_SHM_NAME_LEN, "/fmi-%ld-%ld", (long)getpid(),
+                 (long)__sync_fetch_and_add(&seq, 1));
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd < 0 && errno != EEXIST)
+            return NULL;
+    }
+    if(ftruncate(fd, size > 0 ? size : 1) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void *ptr = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+    return ptr;
+}
+
+void *fmi_shm_map(const char *name, size_t size, int writable)
+{
+    int fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if(fd < 0)
+        return NULL;
+    void *ptr = mmap(NULL, size > 0 ? size : 1, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void fmi_shm_unmap(void *ptr, size_t size)
+{
+    munmap(ptr, size > 0 ? size : 1);
+}
+
+void fmi_shm_unlink(const char *name)
+{
+    shm_unlink(name);
+}
+
+static void socket_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "[E::%s] socket path too long: %s\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr->sun_path, path);
+}
+
+int fmi_server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    socket_address(path, &addr);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        perror("[E::fmi_server_listen] socket");
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+        fprintf(stderr, "[E::%s] cannot listen on %s: %s\n", __func__, path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+int fmi_client_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    socket_address(path, &addr);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "[E::%s] cannot connect to %s: %s\n", __func__, path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int fmi_send(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while(len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int fmi_recv(int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    while(len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
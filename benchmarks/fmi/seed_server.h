@@ -0,0 +1,99 @@
+/**
+ * Transport of the seeding server of fmi (FMI_SERVER) and of its clients
+ * (FMI_CLIENT).
+ *
+ * The server loads the index once and then seeds the reads of one client
+ * at a time with all its threads. A client connects to the Unix-domain
+ * socket of the server and, for every request:
+ *
+ *   1. Writes its encoded reads to a new POSIX shared memory segment (see
+ *      fmi_query_size()) and sends an fmi_request_t with its name.
+ *   2. Receives an fmi_response_t with the name of the segment where the
+ *      server wrote the SMEMs, sorted by read, and removes its own segment.
+ *   3. Maps the SMEMs, then sends one byte to let the server remove their
+ *      segment.
+ *
+ * Only the requests and the responses go through the socket. A request of
+ * type FMI_REQUEST_SHUTDOWN stops the server.
+ */
+
+#ifndef SEED_SERVER_H
+#define SEED_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FMI_SERVER_MAGIC 0x31525653494d46L // "FMISRV1"
+#define FMI_SHM_NAME_LEN 64
+#define FMI_MAX_BATCH_SIZE (1 << 20)
+
+#define FMI_REQUEST_SEED 0
+#define FMI_REQUEST_SHUTDOWN 1
+
+typedef struct {
+    uint64_t magic;
+    int32_t type;
+    int32_t numReads;
+    int32_t batch_size; // At most numReads and FMI_MAX_BATCH_SIZE.
+    int32_t minSeedLen;
+    int64_t num_bases;
+    char shm_name[FMI_SHM_NAME_LEN]; // Segment with the reads.
+} fmi_request_t;
+
+typedef struct {
+    uint64_t magic;
+    int32_t status;     // 0, or an errno value.
+    int32_t numthreads; // Threads of the server.
+    int64_t numSmems;
+    double seconds;     // Seeding time in the server.
+    char shm_name[FMI_SHM_NAME_LEN]; // Segment with the SMEMs.
+} fmi_response_t;
+
+/**
+ * Size of the segment of @numReads reads of @num_bases bases: the int64_t
+ * offsets of the reads (numReads + 1, see query_offsets() in fmi.cpp)
+ * followed by the bases, one byte each.
+ */
+static inline size_t fmi_query_size(int32_t numReads, int64_t num_bases)
+{
+    return (numReads + 1) * sizeof(int64_t) + num_bases;
+}
+
+/**
+ * Create a shared memory segment of @size bytes with a new name, written to
+ * @name, and map it. Return NULL on failure.
+ */
+void *fmi_shm_create(char name[FMI_SHM_NAME_LEN], size_t size);
+
+/**
+ * Map the shared memory segment @name of @size bytes, read-only unless
+ * @writable. Return NULL on failure.
+ */
+void *fmi_shm_map(const char *name, size_t size, int writable);
+
+void fmi_shm_unmap(void *ptr, size_t size);
+
+/**
+ * Remove the name of a segment, it is freed once it is unmapped.
+ */
+void fmi_shm_unlink(const char *name);
+
+/**
+ * Listening socket at @path, replacing a stale socket file. Exit on failure.
+ */
+int fmi_server_listen(const char *path);
+
+/**
+ * Socket connected to the server at @path, or -1 on failure (the error is
+ * printed), so that the caller can remove its segments before exiting.
+ */
+int fmi_client_connect(const char *path);
+
+/**
+ * Send or receive exactly @len bytes. Return 0, or -1 on failure or if the
+ * peer closed the connection.
+ */
+int fmi_send(int fd, const void *buf, size_t len);
+int fmi_recv(int fd, void *buf, size_t len);
+
+#endif // SEED_SERVER_H
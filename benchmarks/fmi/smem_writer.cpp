@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "smem_writer.h"
+
+#define SMEM_TEXT_BUF_SIZE (1 << 16)
+#define SMEM_COLUMNS 5
+
+struct smem_writer {
+    FILE *fp;
+    int binary;
+    uint32_t flags;
+    int64_t prev_rid;
+    // Text: formatted output, flushed when almost full.
+    char *text;
+    int64_t text_len;
+    // Binary: one buffer per column, SMEM_COLUMNS of them.
+    uint8_t *column[SMEM_COLUMNS];
+    int64_t column_alloc;
+};
+
+static void write_or_die(const void *ptr, size_t size, FILE *fp)
+{
+    if(size > 0 && fwrite(ptr, size, 1, fp) != 1)
+    {
+        fprintf(stderr, "[E::%s] failed to write the SMEMs.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+}
+
+smem_writer_t *smem_writer_open(void)
+{
+    smem_writer_t *w = (smem_writer_t *)calloc(1, sizeof(smem_writer_t));
+    w->prev_rid = -1;
+
+    const char *output = getenv("FMI_OUTPUT");
+    if(output == NULL || output[0] == '\0')
+    {
+        w->fp = stdout;
+        w->text = (char *)malloc(SMEM_TEXT_BUF_SIZE);
+        return w;
+    }
+
+    char *path = strdup(output);
+    char *opts = strchr(path, ',');
+    if(opts != NULL)
+    {
+        *opts++ = '\0';
+        if(strstr(opts, "varint") != NULL) w->flags |= SMEM_FILE_VARINT;
+    }
+    w->fp = fopen(path, "wb");
+    if(w->fp == NULL)
+    {
+        fprintf(stderr, "[E::%s] fail to open file `%s'.\n", __func__, path);
+        exit(EXIT_FAILURE);
+    }
+    free(path);
+    w->binary = 1;
+
+    uint64_t magic = SMEM_FILE_MAGIC;
+    uint32_t version = SMEM_FILE_VERSION;
+    write_or_die(&magic, sizeof(magic), w->fp);
+    write_or_die(&version, sizeof(version), w->fp);
+    write_or_die(&w->flags, sizeof(w->flags), w->fp);
+    return w;
+}
+
+// Decimal digits of @x at @p, return the end.
+static inline char *put_uint(char *p, uint64_t x)
+{
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = '0' + x % 10;
+        x /= 10;
+    } while(x != 0);
+    while(len > 0)
+        *p++ = digits[--len];
+    return p;
+}
+
+static void flush_text(smem_writer_t *w)
+{
+    write_or_die(w->text, w->text_len, w->fp);
+    w->text_len = 0;
+}
+
+// Longest line: "[4294967295,4294967296]\n".
+#define SMEM_TEXT_LINE_MAX 32
+
+static void write_text(smem_writer_t *w, const SMEM *smems, int64_t n)
+{
+    int64_t i;
+    for(i = 0; i < n; i++)
+    {
+        const SMEM *smem = &smems[i];
+        if(smem->rid != w->prev_rid)
+        {
+            int64_t j;
+            for(j = w->prev_rid + 1; j <= smem->rid; j++)
+            {
+                if(w->text_len + SMEM_TEXT_LINE_MAX > SMEM_TEXT_BUF_SIZE) flush_text(w);
+                char *p = put_uint(w->text + w->text_len, j);
+                *p++ = ':';
+                *p++ = '\n';
+                w->text_len = p - w->text;
+            }
+        }
+        w->prev_rid = smem->rid;
+        if(w->text_len + SMEM_TEXT_LINE_MAX > SMEM_TEXT_BUF_SIZE) flush_text(w);
+        char *p = w->text + w->text_len;
+        *p++ = '[';
+        p = put_uint(p, smem->m);
+        *p++ = ',';
+        p = put_uint(p, (uint64_t)smem->n + 1);
+        *p++ = ']';
+        *p++ = '\n';
+        w->text_len = p - w->text;
+    }
+    // The rest of the output of fmi uses printf, keep the order.
+    flush_text(w);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t x)
+{
+    while(x >= 0x80)
+    {
+        *p++ = (uint8_t)(x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (uint8_t)x;
+    return p;
+}
+
+static void write_binary(smem_writer_t *w, const SMEM *smems, int64_t n)
+{
+    // A varint of a 64-bit value takes at most 10 bytes.
+    int64_t alloc = n * 10;
+    if(w->column_alloc < alloc)
+    {
+        w->column_alloc = alloc;
+        for(int c = 0; c < SMEM_COLUMNS; c++)
+            w->column[c] = (uint8_t *)realloc(w->column[c], alloc);
+    }
+
+    uint8_t *end[SMEM_COLUMNS];
+    for(int c = 0; c < SMEM_COLUMNS; c++)
+        end[c] = w->column[c];
+
+    int64_t i;
+    if(w->flags & SMEM_FILE_VARINT)
+    {
+        // The deltas are modulo 2^32, like the columns without varints.
+        uint32_t prev_rid = 0, prev_m = 0;
+        for(i = 0; i < n; i++)
+        {
+            const SMEM *smem = &smems[i];
+            if(smem->rid != prev_rid) prev_m = 0;
+            end[0] = put_varint(end[0], (uint32_t)(smem->rid - prev_rid));
+            end[1] = put_varint(end[1], (uint32_t)(smem->m - prev_m));
+            end[2] = put_varint(end[2], smem->n + 1 - smem->m);
+            end[3] = put_varint(end[3], smem->k);
+            end[4] = put_varint(end[4], smem->s);
+            prev_rid = smem->rid;
+            prev_m = smem->m;
+        }
+    }
+    else
+    {
+        uint32_t *rid = (uint32_t *)w->column[0];
+        uint32_t *m = (uint32_t *)w->column[1];
+        uint32_t *end_pos = (uint32_t *)w->column[2];
+        int64_t *k = (int64_t *)w->column[3];
+        int64_t *s = (int64_t *)w->column[4];
+        for(i = 0; i < n; i++)
+        {
+            rid[i] = smems[i].rid;
+            m[i] = smems[i].m;
+            end_pos[i] = smems[i].n + 1;
+            k[i] = smems[i].k;
+            s[i] = smems[i].s;
+        }
+        end[0] += n * sizeof(uint32_t);
+        end[1] += n * sizeof(uint32_t);
+        end[2] += n * sizeof(uint32_t);
+        end[3] += n * sizeof(int64_t);
+        end[4] += n * sizeof(int64_t);
+    }
+
+    uint64_t header[1 + SMEM_COLUMNS];
+    header[0] = n;
+    for(int c = 0; c < SMEM_COLUMNS; c++)
+        header[1 + c] = end[c] - w->column[c];
+    write_or_die(header, sizeof(header), w->fp);
+    for(int c = 0; c < SMEM_COLUMNS; c++)
+        write_or_die(w->column[c], header[1 + c], w->fp);
+}
+
+void smem_writer_write(smem_writer_t *w, const SMEM *smems, int64_t n)
+{
+    if(n == 0)
+        return;
+    if(w->binary)
+        write_binary(w, smems, n);
+    else
+        write_text(w, smems, n);
+}
+
+void smem_writer_close(smem_writer_t *w)
+{
+    if(w->binary)
+    {
+        if(fclose(w->fp) != 0)
+        {
+            fprintf(stderr, "[E::%s] failed to write the SMEMs.\n", __func__);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        fflush(w->fp);
+    }
+    for(int c = 0; c < SMEM_COLUMNS; c++)
+        free(w->column[c]);
+    free(w->text);
+    free(w);
+}
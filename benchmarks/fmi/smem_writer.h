@@ -0,0 +1,54 @@
+/**
+ * Output of the SMEMs found by fmi.
+ *
+ * By default, the SMEMs are printed to stdout as text, a "<rid>:" line for
+ * every read followed by one "[m,n]" line per SMEM. The text is formatted
+ * by hand in a buffer instead of one printf per SMEM.
+ *
+ * FMI_OUTPUT=<file>[,varint] writes them to <file> in a binary columnar
+ * format instead:
+ *
+ *   header  uint64 magic (SMEM_FILE_MAGIC), uint32 version, uint32 flags
+ *   block   uint64 count, uint64 bytes[5] (size of every column), then the
+ *           columns rid, m, n, k and s of count SMEMs
+ *
+ * There is one block per batch. The columns are little-endian uint32 (rid,
+ * m and n) and int64 (k and s), with n the end of the SMEM (exclusive, as in
+ * the text output). With the "varint" flag (SMEM_FILE_VARINT), every value
+ * is a LEB128 varint instead: rid is the delta with the previous SMEM of the
+ * block, m the delta with the previous SMEM of the same read, and n the
+ * length of the SMEM. scripts/smem_dump.py prints a file as text.
+ */
+
+#ifndef FMI_SMEM_WRITER_H
+#define FMI_SMEM_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "FMI_search.h"
+
+#define SMEM_FILE_MAGIC 0x314d454d53494d46L // "FMISMEM1"
+#define SMEM_FILE_VERSION 1
+#define SMEM_FILE_VARINT 0x1
+
+typedef struct smem_writer smem_writer_t;
+
+/**
+ * Open the output selected by FMI_OUTPUT (text on stdout if not set).
+ */
+smem_writer_t *smem_writer_open(void);
+
+/**
+ * Write @n SMEMs sorted by read. Reads are numbered from 0 across calls: in
+ * text mode, a "<rid>:" line is printed for every read up to the last one
+ * with SMEMs.
+ */
+void smem_writer_write(smem_writer_t *w, const SMEM *smems, int64_t n);
+
+/**
+ * Flush and close the output.
+ */
+void smem_writer_close(smem_writer_t *w);
+
+#endif // FMI_SMEM_WRITER_H
@@ -23,26 +23,7 @@
 
 // #define VTUNE_ANALYSIS 1
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
 
 bool parseArgs(int argc, char** argv, std::string& readsFasta, 
 			   std::string& logFile,
@@ -197,6 +178,7 @@ int main(int argc, char** argv)
 	SequenceContainer readsContainer;
 	std::vector<std::string> readsList = splitString(readsFasta, ',');
 	Logger::get().info() << "Reading sequences";
+	double ioStart = roi_wtime();
 	try
 	{
 		//only use reads that are longer than minOverlap,
@@ -212,6 +194,7 @@ int main(int argc, char** argv)
 		Logger::get().error() << e.what();
 		return 1;
 	}
+	double ioSeconds = roi_wtime() - ioStart;
 	readsContainer.buildPositionIndex();
 	VertexIndex vertexIndex(readsContainer, 
 							(int)Config::get("assemble_kmer_sample"));
@@ -236,48 +219,8 @@ int main(int argc, char** argv)
 	const char *roi_q;
 	int roi_i, roi_j;
 	char roi_s[20] = "chr22:0-5";
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-    }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-    __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-    fapp_start("computing", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-    __DR_START_TRACE();
-#endif
+    roi_phase_t roi_kernel = roi_phase("computing");
+    roi_begin(roi_kernel);
 	roi_q = __parsec_roi_begin(roi_s, &roi_i, &roi_j);
 	bool useMinimizers = Config::get("use_minimizers");
 	if (useMinimizers)
@@ -292,46 +235,24 @@ int main(int argc, char** argv)
 		//									 TANDEM_FREQ);
 	}
 	roi_q = __parsec_roi_end(roi_s, &roi_i, &roi_j);
-#if DYNAMORIO_ANALYSIS
-    __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-    __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-    fapp_stop("computing", 1, 0);
-#endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
-
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-	}
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
-#endif
+    roi_end(roi_kernel);
 	gettimeofday(&end_time, NULL);
 	runtime += (end_time.tv_sec - start_time.tv_sec)*1e6 + end_time.tv_usec - start_time.tv_usec;
 	Logger::get().debug() << "Peak RAM usage: " 
 		<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
 	fprintf(stderr, "Kernel time: %.3f sec\n", runtime * 1e-6);
+
+	// Both strands of every read are indexed.
+	size_t numBases = 0;
+	for (auto& seq : readsContainer.iterSeqs())
+	{
+		numBases += seq.sequence.length();
+	}
+	roi_result_str("kernel", "kmer-cnt");
+	roi_result_str("input", readsFasta.c_str());
+	roi_result_num("threads", numThreads);
+	roi_result_num("io_seconds", ioSeconds);
+	roi_result_throughput("bases", numBases);
+	roi_finalize();
 	return 0;
 }
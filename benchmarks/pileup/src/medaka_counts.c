@@ -1,25 +1,6 @@
 #define _GNU_SOURCE
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { __asm__ volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { __asm__ volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
 
 #include "omp.h"
 #include "time.h"
@@ -565,100 +546,32 @@ int main(int argc, char *argv[]) {
     struct timeval start_time, end_time;
     double runtime = 0;
     gettimeofday(&start_time, NULL);
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-    }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-    __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-    fapp_start("calculate_pileup", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-    __DR_START_TRACE();
-#endif
+    roi_phase_t roi_kernel = roi_phase("calculate_pileup");
+    roi_phase_t roi_batches = roi_phase("batches");
+    roi_begin(roi_kernel);
     // process batches in parallel
     #pragma omp parallel num_threads(numThreads)
     {
+        roi_thread_begin(roi_batches);
         #pragma omp for schedule(dynamic, 1)
             for (i = 0; i < batches.n; i++) {
+                roi_task_begin(roi_batches);
                 batches.a[i].pileup = calculate_pileup(
                                         batches.a[i].region_string, bam_file, num_dtypes, dtypes,
                                         num_homop, tag_name, tag_value, keep_missing,
                                         weibull_summation, read_group);
+                roi_task_end(roi_batches, batches.a[i].pileup->n_cols);
             }
+        roi_thread_end(roi_batches);
     }
-#if DYNAMORIO_ANALYSIS
-    __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-    __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-    fapp_stop("calculate_pileup", 1, 0);
-#endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
-
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-	}
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
-#endif
+    roi_end(roi_kernel);
     gettimeofday(&end_time, NULL);
     runtime += (end_time.tv_sec - start_time.tv_sec)*1e6 + end_time.tv_usec - start_time.tv_usec;
 
     // print pileup and clean up
+    size_t num_cols = 0;
     for (i = 0; i < batches.n; i++) {
+        num_cols += batches.a[i].pileup->n_cols;
 #ifdef PRINT_OUTPUT
         print_pileup_data(batches.a[i].pileup, num_dtypes, dtypes, num_homop);
         fprintf(stdout, "pileup is length %zu, with buffer of %zu columns\n", batches.a[i].pileup->n_cols, batches.a[i].pileup->buffer_cols);
@@ -667,5 +580,13 @@ int main(int argc, char *argv[]) {
     }
     kv_destroy(batches);
     fprintf(stderr, "Kernel runtime: %.2f s\n", runtime*1e-6);
+
+    // The BAM file is read inside the kernel.
+    roi_result_str("kernel", "pileup");
+    roi_result_str("input", bam_file);
+    roi_result_num("threads", numThreads);
+    roi_result_num("io_seconds", 0.0);
+    roi_result_throughput("columns", num_cols);
+    roi_finalize();
     return 0;
 }
@@ -29,26 +29,7 @@
 
 // #define ENABLE_SORT 1
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-    #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-    #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-    #if defined(__x86_64__) || defined(_M_X64)
-        #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-        #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-    #else
-        #error invalid TARGET
-    #endif
-#endif
+#include "roi.h"
 
 using namespace std;
 using Alignment = std::vector<std::pair<std::int32_t, std::int32_t>>;
@@ -234,53 +215,14 @@ int main(int argc, char** argv) {
     }
 }
 
+    double io_start = roi_wtime();
     readFile(fp_seq, batches);
+    double io_seconds = roi_wtime() - io_start;
     fprintf(stderr, "Number of batches: %lu, Size of batch struct %d\n", batches.size(), sizeof(Batch));
-    // int64_t workTicks[CLMUL * numThreads];
-    // std::memset(workTicks, 0, CLMUL * numThreads * sizeof(int64_t));
     gettimeofday(&start_time, NULL); real_start = get_realtime();
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-
-	rapl_stopwatch_play(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-	// 3. Get electric energy at the start.
-	double energy0 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if PERF_ANALYSIS
-	const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd = open(perf_pipe, O_WRONLY);
-    if (perf_pipe_fd == -1) {
-        fprintf(stderr, "ERROR opening the Perf pipe\n");
-    }
-    write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-    __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-    fapp_start("alignment", 1, 0);
-#endif
-#if DYNAMORIO_ANALYSIS
-    __DR_START_TRACE();
-#endif
+    roi_phase_t roi_kernel = roi_phase("alignment");
+    roi_phase_t roi_batches = roi_phase("batches");
+    roi_begin(roi_kernel);
 
 #ifdef ENABLE_SORT
     std::sort(batches.begin(), batches.end(), SortBySize());
@@ -289,9 +231,10 @@ int main(int argc, char** argv) {
 #pragma omp parallel num_threads(numThreads)
 {
     int tid = omp_get_thread_num();
+    roi_thread_begin(roi_batches);
     #pragma omp for schedule(dynamic, 1)
         for (int i = 0; i < batches.size(); i++) {
-            // int64_t st1 = __rdtsc();
+            roi_task_begin(roi_batches);
             // gettimeofday(&t_start, NULL);
             auto graph = spoa::createGraph();
             // gettimeofday(&t_end, NULL);
@@ -311,66 +254,21 @@ int main(int argc, char** argv) {
             batches[i].consensus_seq = graph->generate_consensus();
             // gettimeofday(&t_end, NULL);
             // generateConsensusTime += (t_end.tv_sec - t_start.tv_sec)*1e6 + t_end.tv_usec - t_start.tv_usec;
-            // int64_t et1 = __rdtsc();
-            // workTicks[CLMUL * tid] += (et1 - st1);
+            roi_task_end(roi_batches, batches[i].seqs.size());
         }
-    // printf("%d] workTicks = %ld\n", tid, workTicks[CLMUL * tid]);
+    roi_thread_end(roi_batches);
 
 }
 #ifdef ENABLE_SORT
     std::sort(batches.begin(), batches.end(), SortById());
 #endif
 
-#if DYNAMORIO_ANALYSIS
-    __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-    write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-    close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-    __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-    fapp_stop("alignment", 1, 0);
-#endif
-#if PWR
-	// 3. Get electric energy at the end.
-	double energy1 = 0.0;
-	PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-	// 4. Terminate processing of Power API
-	PWR_CntxtDestroy(pwr_cntxt);
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-	rapl_stopwatch_pause(&rapl_sw);
-
-	uint64_t count = 0;
-	err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-	if (err) {
-		fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-	}
-
-	fprintf(stderr, "Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-	rapl_stopwatch_destroy(&rapl_sw);
-	rapl_stopwatch_api_destroy();
-#endif
+    roi_end(roi_kernel);
 
     gettimeofday(&end_time, NULL); real_end = get_realtime();
     runtime += (end_time.tv_sec - start_time.tv_sec)*1e6 + end_time.tv_usec - start_time.tv_usec;
     realtime += (real_end-real_start);
 
-    int64_t sumTicks = 0;
-    int64_t maxTicks = 0;
-    for(int i = 0; i < numThreads; i++)
-    {
-        // sumTicks += workTicks[CLMUL * i];
-        // if(workTicks[CLMUL * i] > maxTicks) maxTicks = workTicks[CLMUL * i];
-    }
-    double avgTicks = (sumTicks * 1.0) / numThreads;
-    // printf("avgTicks = %lf, maxTicks = %ld, load imbalance = %lf\n", avgTicks, maxTicks, maxTicks/avgTicks);
 #ifdef PRINT_OUTPUT
     for (int i = 0; i < batches.size(); i++) {
         cout << ">Consensus_sequence" << endl;
@@ -381,5 +279,12 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Runtime: %.2f, GraphCreate: %.2f, Align: %.2f, AddSeqGraph: %.2f, Consensus %.2f %.2f %.3f \n", runtime*1e-6, graphCreationTime*1e-6, alignTime*1e-6, addToGraphTime*1e-6, generateConsensusTime*1e-6, realtime*1e-6, peakrss()/1024.0/1024.0);
 
     fp_seq.close();
+
+    roi_result_str("kernel", "poa");
+    roi_result_str("input", seq_file.c_str());
+    roi_result_num("threads", numThreads);
+    roi_result_num("io_seconds", io_seconds);
+    roi_result_throughput("consensus", batches.size());
+    roi_finalize();
     return 0;
 }
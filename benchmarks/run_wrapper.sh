@@ -242,6 +242,10 @@ for command in "${commands[@]}"; do
 
         jobscript+="export MPI_RANKS=$mpi\n"
         jobscript+="export OMP_NUM_THREADS=$omp\n"
+        if [[ -n "$GENARCH_ROI_JSON" ]]; then
+            # Jobs run in their stage folder, keep a single results file.
+            jobscript+="export GENARCH_ROI_JSON=\"$(realpath -m "$GENARCH_ROI_JSON")\"\n"
+        fi
 
         jobscript+="$before_command $command $command_opts $after_command"
 
@@ -97,7 +97,7 @@ after_run() (
         return 1 # Failure
     fi
 
-    cat "$job_name.out" | grep "Energy consumption:"
+    cat "$job_name.err" | grep "Energy consumption:"
 
     return 0 # OK
 )
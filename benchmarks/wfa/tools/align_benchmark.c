@@ -29,26 +29,7 @@
  * DESCRIPTION: Wavefront Alignment benchmarking tool
  */
 
-#if RAPL_STOPWATCH
-	#include <rapl_stopwatch.h>
-#endif
-#if PWR
-	#include <pwr.h>
-#endif
-#if VTUNE_ANALYSIS
-  #include <ittnotify.h>
-#endif
-#if FAPP_ANALYSIS
-  #include <fj_tool/fapp.h>
-#endif
-#if DYNAMORIO_ANALYSIS
-  #if defined(__x86_64__) || defined(_M_X64)
-    #define __DR_START_TRACE() { asm volatile ("nopw 0x24"); }
-    #define __DR_STOP_TRACE() { asm volatile ("nopw 0x42"); }
-  #else
-    #error invalid TARGET
-  #endif
-#endif
+#include "roi.h"
 
 #include "utils/commons.h"
 #include "gap_affine/affine_wavefront.h"
@@ -321,32 +302,17 @@ int main(int argc,char* argv[]) {
   gettimeofday(&benchmark_start, NULL);
 
   // Parse input file
+  double io_start = roi_wtime();
   int *total_sequences;
   input_pair_sequences_t** const input_buffers =
       parse_input_sequences(input_file, &total_sequences);
+  double io_seconds = roi_wtime() - io_start;
 
   struct timeval alignment_start;
   struct timeval alignment_end;
 
-#if RAPL_STOPWATCH
-	int err = rapl_stopwatch_api_init();
-	if (err) {
-		fprintf(stderr, "Error initializing the RAPL-stopwatch API\n");
-	}
-
-	rapl_stopwatch_t rapl_sw;
-	rapl_stopwatch_init(&rapl_sw);
-#endif
-#if PWR
-	// 1. Initialize Power API
-	PWR_Cntxt pwr_cntxt = NULL;
-	PWR_CntxtInit(PWR_CNTXT_FX1000, PWR_ROLE_APP, "app", &pwr_cntxt);
-	// 2. Get Object (In this step, get an Object that indicates the entire compute node.)
-	PWR_Obj pwr_obj = NULL;
-	PWR_CntxtGetObjByName(pwr_cntxt, "plat.node", &pwr_obj);
-
-	double energy0 = 0.0;
-#endif
+  roi_phase_t roi_kernel = roi_phase("align");
+  roi_phase_t roi_align_pairs = roi_phase("align_pairs");
 
   int progress_mod = 0;
   #pragma omp parallel num_threads(parameters.nthreads)
@@ -367,42 +333,14 @@ int main(int argc,char* argv[]) {
           parameters.max_distance_threshold,mm_allocator);
     }
 
-#if PERF_ANALYSIS
-	  const char *perf_pipe = "perf_ctl.fifo";
-    const char *perf_enable = "enable";
-    const char *perf_disable = "disable";
-
-    int perf_pipe_fd;
-#endif
-
     #pragma omp barrier
     #pragma omp master
     {
-#if DYNAMORIO_ANALYSIS
-      __DR_START_TRACE();
-#endif
-#if PERF_ANALYSIS
-      perf_pipe_fd = open(perf_pipe, O_WRONLY);
-      if (perf_pipe_fd == -1) {
-          fprintf(stderr, "ERROR opening the Perf pipe\n");
-      }
-      write(perf_pipe_fd, perf_enable, strlen(perf_enable));
-#endif
-#if VTUNE_ANALYSIS
-      __itt_resume();
-#endif
-#if FAPP_ANALYSIS
-      fapp_start("align", 1, 0);
-#endif
-#if PWR
-      // 3. Get electric energy at the start.
-      PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy0, NULL);
-#endif
-#if RAPL_STOPWATCH
-      rapl_stopwatch_play(&rapl_sw);
-#endif
+      roi_begin(roi_kernel);
       gettimeofday(&alignment_start, NULL);
     }
+    // Open the ROI before any thread starts aligning.
+    #pragma omp barrier
 
     // Pointer to thread private data.
     int thread_id = omp_get_thread_num();
@@ -412,6 +350,7 @@ int main(int argc,char* argv[]) {
     edit_cigar_t *edit_cigars = malloc(thread_total_sequences * sizeof(edit_cigars[0])); 
 
     // Read-align loop
+    roi_thread_begin(roi_align_pairs);
     for (int i = 0; i < thread_total_sequences; ++i) {
       // Align
       affine_wavefronts_clear(affine_wavefronts);
@@ -447,47 +386,13 @@ int main(int argc,char* argv[]) {
         }
       }
     }
+    roi_thread_end(roi_align_pairs);
 
     #pragma omp barrier
     #pragma omp master
     {
       gettimeofday(&alignment_end, NULL);
-#if DYNAMORIO_ANALYSIS
-      __DR_STOP_TRACE();
-#endif
-#if PERF_ANALYSIS
-      write(perf_pipe_fd, perf_disable, strlen(perf_disable));
-      close(perf_pipe_fd);
-#endif
-#if VTUNE_ANALYSIS
-      __itt_pause();
-#endif
-#if FAPP_ANALYSIS
-      fapp_stop("align", 1, 0);
-#endif
-#if PWR
-      // 3. Get electric energy at the end.
-      double energy1 = 0.0;
-      PWR_ObjAttrGetValue(pwr_obj, PWR_ATTR_MEASURED_ENERGY, &energy1, NULL);
-      // 4. Terminate processing of Power API
-      PWR_CntxtDestroy(pwr_cntxt);
-
-      printf("Energy consumption: %0.4lf J\n", energy1 - energy0);
-#endif
-#if RAPL_STOPWATCH
-      rapl_stopwatch_pause(&rapl_sw);
-
-      uint64_t count = 0;
-      err = rapl_stopwatch_get_mj(&rapl_sw, RAPL_NODE, &count);
-      if (err) {
-        fprintf(stderr, "Error reading the RAPL-stopwatch counter\n");
-      }
-
-      printf("Energy consumption: %0.4lf J\n", (double)count / 1E3);
-
-      rapl_stopwatch_destroy(&rapl_sw);
-      rapl_stopwatch_api_destroy();
-#endif
+      roi_end(roi_kernel);
     }
 
     // Print the output.
@@ -531,4 +436,11 @@ int main(int argc,char* argv[]) {
       (benchmark_end.tv_usec - benchmark_start.tv_usec) * 1E-6);
   printf("Time.Alignment: %f s\n", (alignment_end.tv_sec - alignment_start.tv_sec) + 
       (alignment_end.tv_usec - alignment_start.tv_usec) * 1E-6);
+
+  roi_result_str("kernel", "wfa");
+  roi_result_str("input", parameters.input);
+  roi_result_num("threads", parameters.nthreads);
+  roi_result_num("io_seconds", io_seconds);
+  roi_result_throughput("pairs", progress_mod);
+  roi_finalize();
 }